@@ -0,0 +1,472 @@
+/* dbxbench: reproducible benchmark of the dbx module.
+ *
+ * It connects to a redis-server having dbx.so loaded, generates a
+ * phonebook-like table of the given rows, width and value distribution, runs
+ * a fixed matrix of workloads and prints their throughput and latency
+ * percentiles as JSON. The rows are generated from a seed, so two runs of the
+ * same options load the same table and issue the same statements.
+ *
+ *   dbxbench [-h host] [-p port] [-r rows] [-w width] [-l value length]
+ *            [-d uniform|zipf] [-n point ops] [-s scan ops] [-S seed]
+ *            [-t dir] [-o output]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define TABLE        "bench"
+#define IMPORT_TABLE "bench_import"
+#define LOAD_BATCH   500
+#define TOP_N        10
+
+typedef struct Options {
+  const char *host;
+  int port;
+  long rows;
+  int width;      // columns of the table, the phonebook columns first
+  int valueLen;   // length of the values of the extra columns
+  int zipf;       // skewed values of pos and gender instead of uniform
+  long pointOps;  // iterations of the workloads touching a row
+  long scanOps;   // iterations of the workloads scanning the table
+  uint64_t seed;
+  const char *dir;
+  const char *output;
+} Options;
+
+/* Deterministic generator, xorshift64* */
+static uint64_t rngState;
+
+uint64_t rngNext(void) {
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+double rngDouble(void) {
+  return (rngNext() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* A value in [0, n), uniform or zipf with exponent 1 by inverting its
+ * continuous approximation */
+long rngPick(long n, int zipf) {
+  if (!zipf) return rngNext() % n;
+  double x = exp(rngDouble() * log((double)n + 1)) - 1;
+  long v = (long)x;
+  return v < n? v: n - 1;
+}
+
+/* Minimal RESP client */
+typedef struct Conn {
+  int fd;
+  char *buf;
+  size_t len, pos, cap;
+  char *out;
+  size_t outLen, outCap;
+} Conn;
+
+int connOpen(Conn *c, const char *host, int port) {
+  struct addrinfo hints, *res;
+  char service[16];
+  memset(c, 0, sizeof(Conn));
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  sprintf(service, "%d", port);
+  if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+  c->fd = -1;
+  for (struct addrinfo *a = res; a != NULL && c->fd < 0; a = a->ai_next) {
+    c->fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (c->fd >= 0 && connect(c->fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(c->fd);
+      c->fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  if (c->fd < 0) return -1;
+  int one = 1;
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  c->cap = c->outCap = 65536;
+  c->buf = malloc(c->cap);
+  c->out = malloc(c->outCap);
+  return 0;
+}
+
+void connPut(Conn *c, const char *s, size_t len) {
+  if (c->outLen + len > c->outCap) {
+    while (c->outLen + len > c->outCap) c->outCap *= 2;
+    c->out = realloc(c->out, c->outCap);
+  }
+  memcpy(c->out + c->outLen, s, len);
+  c->outLen += len;
+}
+
+/* Queue a command of argc arguments */
+void connCommand(Conn *c, int argc, const char **argv) {
+  char head[32];
+  connPut(c, head, sprintf(head, "*%d\r\n", argc));
+  for (int i = 0; i < argc; i++) {
+    size_t len = strlen(argv[i]);
+    connPut(c, head, sprintf(head, "$%zu\r\n", len));
+    connPut(c, argv[i], len);
+    connPut(c, "\r\n", 2);
+  }
+}
+
+int connFlush(Conn *c) {
+  for (size_t sent = 0; sent < c->outLen; ) {
+    ssize_t n = write(c->fd, c->out + sent, c->outLen - sent);
+    if (n <= 0) return -1;
+    sent += n;
+  }
+  c->outLen = 0;
+  return 0;
+}
+
+/* The next line of the reply, without its CRLF */
+char *connLine(Conn *c) {
+  for (;;) {
+    char *nl = c->pos < c->len? memchr(c->buf + c->pos, '\n', c->len - c->pos): NULL;
+    if (nl != NULL) {
+      char *line = c->buf + c->pos;
+      *nl = 0;
+      if (nl > line && nl[-1] == '\r') nl[-1] = 0;
+      c->pos = nl - c->buf + 1;
+      return line;
+    }
+    if (c->pos > 0) {
+      memmove(c->buf, c->buf + c->pos, c->len - c->pos);
+      c->len -= c->pos;
+      c->pos = 0;
+    }
+    if (c->len == c->cap) {
+      c->cap *= 2;
+      c->buf = realloc(c->buf, c->cap);
+    }
+    ssize_t n = read(c->fd, c->buf + c->len, c->cap - c->len);
+    if (n <= 0) return NULL;
+    c->len += n;
+  }
+}
+
+/* Read a whole reply and drop it. The length of the top array, or the
+ * integer, is returned in *n. An error reply is copied into err and -1 is
+ * returned, -2 if the connection is lost. */
+int connReply(Conn *c, long long *n, char *err, size_t errLen) {
+  char *line = connLine(c);
+  if (line == NULL) {
+    snprintf(err, errLen, "connection lost");
+    return -2;
+  }
+  long long v = strtoll(line + 1, NULL, 10);
+  if (n != NULL) *n = v;
+  switch (line[0]) {
+    case '-':
+      snprintf(err, errLen, "%s", line + 1);
+      return -1;
+    case '$':
+      // a bulk string spans its length and CRLF, which may hold newlines
+      while (v >= 0) {
+        line = connLine(c);
+        if (line == NULL) return -2;
+        v -= strlen(line) + 2;
+      }
+      return 0;
+    case '*':
+      // errors nested in the array, i.e. the rows of a cluster, are skipped
+      for (long long i = 0; i < v; i++)
+        if (connReply(c, NULL, err, errLen) == -2) return -2;
+      return 0;
+  }
+  return 0;
+}
+
+/* Run a command, its reply is dropped. The error is reported unless quiet. */
+int command(Conn *c, int argc, const char **argv, long long *n, int quiet) {
+  char err[256] = "connection lost";
+  connCommand(c, argc, argv);
+  if (connFlush(c) < 0 || connReply(c, n, err, sizeof(err)) < 0) {
+    if (!quiet) fprintf(stderr, "dbxbench: %s: %s\n", argv[argc - 1], err);
+    return -1;
+  }
+  return 0;
+}
+
+/* Run a dbx statement */
+int dbx(Conn *c, const char *stm, long long *n) {
+  const char *argv[] = {"dbx", stm};
+  return command(c, 2, argv, n, 0);
+}
+
+long long nowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Table generator. The phonebook columns come first: id, name, tel, birth,
+ * pos and gender, then c6, c7... up to the width. pos is zero padded, so its
+ * alphabetical order is its numeric order. */
+static const char *firstNames[] = {"Peter", "Betty", "Mary", "Mattias", "Kevin", "Kenneth", "Joan", "Louis",
+  "Anna", "David", "Sarah", "Tom", "Laura", "Paul", "Emma", "Chris"};
+static const char *lastNames[] = {"Nelson", "Joan", "Swensson", "Louis", "Cheng", "Smith", "Brown", "Jones",
+  "Miller", "Davis", "Wilson", "Taylor", "Clark", "Hall", "Young", "King"};
+
+typedef struct Row {
+  char name[64], tel[24], birth[16], pos[16], gender[2];
+} Row;
+
+void genRow(Options *o, Row *r) {
+  sprintf(r->name, "%s %s", firstNames[rngNext() % 16], lastNames[rngPick(16, o->zipf)]);
+  sprintf(r->tel, "1-%03d-%04d-%04d", (int)(rngNext() % 1000), (int)(rngNext() % 10000), (int)(rngNext() % 10000));
+  sprintf(r->birth, "%04d-%02d-%02d", 1950 + (int)(rngNext() % 70), 1 + (int)(rngNext() % 12), 1 + (int)(rngNext() % 28));
+  sprintf(r->pos, "%08ld", rngPick(o->rows, o->zipf));
+  strcpy(r->gender, rngPick(2, o->zipf)? "F": "M");
+}
+
+void genExtra(Options *o, char *v) {
+  for (int i = 0; i < o->valueLen; i++) v[i] = 'a' + rngNext() % 26;
+  v[o->valueLen] = 0;
+}
+
+char *columnList(Options *o, int withId) {
+  static char cols[4096];
+  strcpy(cols, withId? "id, name, tel, birth, pos, gender": "name, tel, birth, pos, gender");
+  for (int c = 6; c < o->width; c++) sprintf(cols + strlen(cols), ", c%d", c + 1);
+  return cols;
+}
+
+/* Load the table by multi-row inserts of LOAD_BATCH rows */
+int loadTable(Conn *c, Options *o, double *seconds) {
+  char *stm = malloc(LOAD_BATCH * (256 + o->width * (o->valueLen + 4)) + 4096);
+  char extra[o->valueLen + 1];
+  Row r;
+
+  // the rows and the definitions of a previous run are dropped, the id is
+  // the primary key so the point workloads are lookups
+  const char *deletes[][2] = {{"dbx", "delete from " TABLE}, {"dbx", "delete from " IMPORT_TABLE}};
+  const char *drop[] = {"DEL", "__dbx_table:" TABLE, "__dbx_table:" IMPORT_TABLE};
+  command(c, 2, deletes[0], NULL, 1);
+  command(c, 2, deletes[1], NULL, 1);
+  if (command(c, 3, drop, NULL, 0) < 0) return -1;
+  char create[4096];
+  sprintf(create, "create table " TABLE " (id key, %s)", columnList(o, 0));
+  if (dbx(c, create, NULL) < 0) return -1;
+
+  long long start = nowUs();
+  for (long id = 0; id < o->rows; ) {
+    char *p = stm + sprintf(stm, "insert into " TABLE " (%s) values ", columnList(o, 1));
+    for (long k = 0; k < LOAD_BATCH && id < o->rows; k++, id++) {
+      genRow(o, &r);
+      p += sprintf(p, "%s(%ld, '%s', '%s', '%s', '%s', '%s'", k? ", ": "", id, r.name, r.tel, r.birth, r.pos, r.gender);
+      for (int col = 6; col < o->width; col++) {
+        genExtra(o, extra);
+        p += sprintf(p, ", '%s'", extra);
+      }
+      *p++ = ')';
+      *p = 0;
+    }
+    if (dbx(c, stm, NULL) < 0) {
+      free(stm);
+      return -1;
+    }
+  }
+  *seconds = (nowUs() - start) / 1e6;
+  free(stm);
+  return 0;
+}
+
+/* The CSV file imported by the csv import workload */
+int writeImportFile(Options *o, const char *path, long rows) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) return -1;
+  char extra[o->valueLen + 1];
+  Row r;
+  for (long i = 0; i < rows; i++) {
+    genRow(o, &r);
+    fprintf(fp, "\"%s\",\"%s\",\"%s\",\"%s\",\"%s\"", r.name, r.tel, r.birth, r.pos, r.gender);
+    for (int col = 6; col < o->width; col++) {
+      genExtra(o, extra);
+      fprintf(fp, ",\"%s\"", extra);
+    }
+    fputc('\n', fp);
+  }
+  fclose(fp);
+  return 0;
+}
+
+/* Workloads. A workload makes the statement of each iteration, before and
+ * after hooks are not timed. */
+typedef struct Workload {
+  const char *name;
+  int scan;  // iterations of scanOps rather than pointOps
+  void (*statement)(Options *o, long i, char *stm);
+  void (*before)(Conn *c, Options *o, long i);
+} Workload;
+
+static char exportPath[512], importPath[512];
+
+void pointSelect(Options *o, long i, char *stm) {
+  sprintf(stm, "select name, tel from " TABLE " where id = %ld", (long)(rngNext() % o->rows));
+}
+
+void rangeSelect(Options *o, long i, char *stm) {
+  // about 1% of the values of pos
+  long span = o->rows / 100 + 1;
+  long from = rngNext() % o->rows;
+  sprintf(stm, "select name, pos from " TABLE " where pos >= %08ld and pos < %08ld", from, from + span);
+}
+
+void likeSelect(Options *o, long i, char *stm) {
+  sprintf(stm, "select name from " TABLE " where name like %s", lastNames[rngNext() % 16]);
+}
+
+void orderTop(Options *o, long i, char *stm) {
+  sprintf(stm, "select top %d name, pos from " TABLE " order by pos desc", TOP_N);
+}
+
+void fullExport(Options *o, long i, char *stm) {
+  sprintf(stm, "select * into csv \"%s\" from " TABLE, exportPath);
+}
+
+void beforeExport(Conn *c, Options *o, long i) {
+  unlink(exportPath);
+}
+
+void csvImport(Options *o, long i, char *stm) {
+  sprintf(stm, "insert into " IMPORT_TABLE " (%s) from \"%s\"", columnList(o, 0), importPath);
+}
+
+void beforeImport(Conn *c, Options *o, long i) {
+  const char *argv[] = {"dbx", "delete from " IMPORT_TABLE};
+  command(c, 2, argv, NULL, 1);
+}
+
+void pointDelete(Options *o, long i, char *stm) {
+  // each id once, the table shrinks by the number of iterations
+  sprintf(stm, "delete from " TABLE " where id = %ld", (long)((i * 7919) % o->rows));
+}
+
+static Workload workloads[] = {
+  {"point_select", 0, pointSelect, NULL},
+  {"range_select", 1, rangeSelect, NULL},
+  {"like", 1, likeSelect, NULL},
+  {"order_by_top", 1, orderTop, NULL},
+  {"full_export", 1, fullExport, beforeExport},
+  {"csv_import", 1, csvImport, beforeImport},
+  {"delete", 0, pointDelete, NULL},
+};
+
+int compareLongLong(const void *x, const void *y) {
+  long long a = *(const long long*)x, b = *(const long long*)y;
+  return a < b? -1: a > b;
+}
+
+long long percentile(long long *sorted, long n, double p) {
+  long rank = (long)ceil(p * n) - 1;
+  return sorted[rank < 0? 0: rank];
+}
+
+int runWorkload(Conn *c, Options *o, Workload *w, FILE *out, int first) {
+  long ops = w->scan? o->scanOps: o->pointOps;
+  if (w->statement == pointDelete && ops > o->rows) ops = o->rows;
+  long long *lat = malloc((ops + 1) * sizeof(long long));
+  char *stm = malloc(8192);
+  long long total = 0, rows = 0;
+
+  for (long i = 0; i < ops; i++) {
+    if (w->before) w->before(c, o, i);
+    w->statement(o, i, stm);
+    long long start = nowUs();
+    if (dbx(c, stm, &rows) < 0) {
+      free(lat);
+      free(stm);
+      return -1;
+    }
+    lat[i] = nowUs() - start;
+    total += lat[i];
+  }
+  qsort(lat, ops, sizeof(long long), compareLongLong);
+  fprintf(out, "%s    {\"name\": \"%s\", \"ops\": %ld, \"ops_per_sec\": %.1f, \"p50_us\": %lld, "
+    "\"p99_us\": %lld, \"max_us\": %lld, \"reply_len\": %lld}", first? "": ",\n", w->name, ops,
+    total > 0? ops * 1e6 / total: 0, ops? percentile(lat, ops, 0.5): 0, ops? percentile(lat, ops, 0.99): 0,
+    ops? lat[ops - 1]: 0, rows);
+  fflush(out);
+  free(lat);
+  free(stm);
+  return 0;
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: dbxbench [-h host] [-p port] [-r rows] [-w width] [-l value length] "
+    "[-d uniform|zipf] [-n point ops] [-s scan ops] [-S seed] [-t dir] [-o output]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  Options o = {"127.0.0.1", 6399, 100000, 6, 8, 0, 10000, 20, 1, "/tmp", NULL};
+  int opt;
+  while ((opt = getopt(argc, argv, "h:p:r:w:l:d:n:s:S:t:o:")) != -1) {
+    switch (opt) {
+      case 'h': o.host = optarg; break;
+      case 'p': o.port = atoi(optarg); break;
+      case 'r': o.rows = atol(optarg); break;
+      case 'w': o.width = atoi(optarg); break;
+      case 'l': o.valueLen = atoi(optarg); break;
+      case 'd':
+        if (strcmp(optarg, "zipf") == 0) o.zipf = 1;
+        else if (strcmp(optarg, "uniform") != 0) usage();
+        break;
+      case 'n': o.pointOps = atol(optarg); break;
+      case 's': o.scanOps = atol(optarg); break;
+      case 'S': o.seed = strtoull(optarg, NULL, 10); break;
+      case 't': o.dir = optarg; break;
+      case 'o': o.output = optarg; break;
+      default: usage();
+    }
+  }
+  if (o.rows < 1 || o.width < 6 || o.width > 256 || o.valueLen < 1 || o.valueLen > 1024) usage();
+  rngState = o.seed? o.seed: 1;
+  snprintf(exportPath, sizeof(exportPath), "%s/dbxbench_export.csv", o.dir);
+  snprintf(importPath, sizeof(importPath), "%s/dbxbench_import.csv", o.dir);
+
+  Conn c;
+  if (connOpen(&c, o.host, o.port) < 0) {
+    fprintf(stderr, "dbxbench: cannot connect to %s:%d\n", o.host, o.port);
+    return 1;
+  }
+  FILE *out = o.output? fopen(o.output, "w"): stdout;
+  if (out == NULL) {
+    fprintf(stderr, "dbxbench: cannot write %s: %s\n", o.output, strerror(errno));
+    return 1;
+  }
+
+  double loadSeconds;
+  long importRows = o.rows / 10 + 1;
+  if (loadTable(&c, &o, &loadSeconds) < 0 || writeImportFile(&o, importPath, importRows) < 0) return 1;
+
+  fprintf(out, "{\n  \"rows\": %ld,\n  \"width\": %d,\n  \"value_len\": %d,\n  \"distribution\": \"%s\",\n"
+    "  \"seed\": %llu,\n  \"load\": {\"rows\": %ld, \"seconds\": %.3f, \"rows_per_sec\": %.1f},\n"
+    "  \"import_rows\": %ld,\n  \"workloads\": [\n", o.rows, o.width, o.valueLen, o.zipf? "zipf": "uniform",
+    (unsigned long long)o.seed, o.rows, loadSeconds, loadSeconds > 0? o.rows / loadSeconds: 0, importRows);
+  int rc = 0;
+  for (size_t w = 0; w < sizeof(workloads) / sizeof(Workload) && rc == 0; w++)
+    rc = runWorkload(&c, &o, &workloads[w], out, w == 0);
+  fprintf(out, "\n  ]\n}\n");
+
+  unlink(exportPath);
+  unlink(importPath);
+  if (out != stdout) fclose(out);
+  close(c.fd);
+  return rc == 0? 0: 1;
+}
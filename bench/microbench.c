@@ -0,0 +1,316 @@
+/* microbench: the parser, predicate evaluator, CSV codec and whole statements
+ * of dbx timed in process, against the mock module API of mockredis.c. No
+ * server is needed, so it runs as is under perf or valgrind.
+ *
+ *   microbench [-r rows] [-n iterations] [bench...]
+ *
+ * The benches named on the command line are run, or all of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mockredis.h"
+#include "rmutil/vector.h"
+
+/* Functions of the engine in src/dbx.c, and its arena in the same layout */
+typedef struct Arena {
+  void *head;
+  size_t total;
+  RedisModuleCtx *pool;
+} Arena;
+typedef struct LikePattern LikePattern;
+Vector* splitWhereString(Arena *a, char *s);
+void arenaFree(Arena *a);
+LikePattern *likeCompile(Arena *a, const char *pattern);
+int likeMatch(const LikePattern *p, const char *s, size_t len);
+char *parseValues(char *p, Vector *vValue, size_t *nRow, const char **err);
+void normalizeStatement(int type, RedisModuleString **argv, int argc, char *out, size_t cap);
+int compareValue(const char *s, int op, const char *w);
+void csvAppend(char **line, size_t *len, size_t *cap, const char *v, size_t vlen);
+size_t csvSplit(char *line, char **values, size_t max);
+int RedisModule_OnLoad(RedisModuleCtx *ctx);
+
+#define TABLE   "bench"
+#define VALUES  1024
+
+static long rows = 10000;
+static long iterations = 1000000;
+static char *names[VALUES], *positions[VALUES];
+static volatile long long sink;
+
+static const char *firstNames[] = {"Peter", "Betty", "Mary", "Mattias", "Kevin", "Kenneth", "Joan", "Louis"};
+static const char *lastNames[] = {"Nelson", "Joan", "Swensson", "Louis", "Cheng", "Smith", "Brown", "Jones"};
+
+long long nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void genValues(void) {
+  srand(1);
+  for (int i = 0; i < VALUES; i++) {
+    names[i] = malloc(32);
+    positions[i] = malloc(16);
+    sprintf(names[i], "%s %s", firstNames[rand() % 8], lastNames[rand() % 8]);
+    sprintf(positions[i], "%08ld", rand() % rows);
+  }
+}
+
+/* Run a dbx statement through the mock, the number of rows or the integer it
+ * replied is returned */
+long long dbx(const char *stm) {
+  const char *argv[] = {"dbx", stm};
+  MockResult r;
+  mockCommand(&r, 2, argv);
+  if (r.error[0]) {
+    fprintf(stderr, "microbench: %s: %s\n", stm, r.error);
+    exit(1);
+  }
+  return r.len;
+}
+
+/* The values tuples of n rows */
+char *valuesClause(long from, long n) {
+  char *s = malloc(n * 96 + 1), *p = s;
+  for (long i = 0; i < n; i++)
+    p += sprintf(p, "%s(%ld, '%s', '1-456-1246-%04ld', '2019-10-01', '%s', '%c')", i? ", ": "",
+      from + i, names[(from + i) % VALUES], (from + i) % 10000, positions[(from + i) % VALUES], i % 2? 'F': 'M');
+  return s;
+}
+
+/* Benches. Each runs its work n times and returns the number of operations,
+ * i.e. rows for the statements. */
+long long benchParseWhere(long n) {
+  const char *where = "pos>=00001000&&pos<00002000&&name~son";
+  char buf[128];
+  Arena a = {NULL, 0, NULL};
+  for (long i = 0; i < n; i++) {
+    strcpy(buf, where);
+    Vector *v = splitWhereString(&a, buf);
+    sink += Vector_Size(v);
+    // a block of the arena takes many statements
+    if (i % 64 == 63) arenaFree(&a);
+  }
+  arenaFree(&a);
+  return n;
+}
+
+long long benchParseValues(long n) {
+  long tuples = 100;
+  char *values = valuesClause(0, tuples);
+  size_t len = strlen(values);
+  char *buf = malloc(len + 1);
+  long i;
+  for (i = 0; i < n; i += tuples) {
+    memcpy(buf, values, len + 1);
+    Vector *v = NewVector(char *, 6 * tuples);
+    size_t nRow;
+    const char *err;
+    parseValues(buf, v, &nRow, &err);
+    sink += nRow;
+    Vector_Free(v);
+  }
+  free(buf);
+  free(values);
+  return i;
+}
+
+long long benchNormalize(long n) {
+  RedisModuleCtx *ctx = mockCtx();
+  RedisModuleString *argv[2] = {
+    RedisModule_CreateString(ctx, "dbx", 3),
+    RedisModule_CreateString(ctx, "select name, tel from phonebook where id = 1234 and name like 'Peter%' and pos >= 10", 84)
+  };
+  char out[256];
+  for (long i = 0; i < n; i++) {
+    normalizeStatement(0, argv, 2, out, sizeof(out));
+    sink += out[0];
+  }
+  RedisModule_FreeString(ctx, argv[0]);
+  RedisModule_FreeString(ctx, argv[1]);
+  mockReleaseCtx(ctx);
+  return n;
+}
+
+long long benchCompare(long n) {
+  // >=, <, = on the zero padded positions
+  static const int ops[] = {0, 5, 6};
+  long long matched = 0;
+  for (long i = 0; i < n; i++)
+    matched += compareValue(positions[i % VALUES], ops[i % 3], "00005000");
+  sink += matched;
+  return n;
+}
+
+/* The shapes of like pattern: infix, prefix, suffix and general */
+long long benchLike(long n) {
+  static const char *patterns[] = {"son", "pet%", "%SON", "m_tt%s%n"};
+  LikePattern *like[4];
+  size_t len[VALUES];
+  for (int k = 0; k < 4; k++) like[k] = likeCompile(NULL, patterns[k]);
+  for (int i = 0; i < VALUES; i++) len[i] = strlen(names[i]);
+  long long matched = 0;
+  for (long i = 0; i < n; i++)
+    matched += likeMatch(like[i & 3], names[i % VALUES], len[i % VALUES]);
+  sink += matched;
+  for (int k = 0; k < 4; k++) RedisModule_Free(like[k]);
+  return n;
+}
+
+long long benchCsvEncode(long n) {
+  size_t len, cap = 64;
+  char *line = malloc(cap);
+  for (long i = 0; i < n; i++) {
+    const char *v[] = {names[i % VALUES], "1-456-1246-3421", "2019-10-01", positions[i % VALUES], "M"};
+    len = 0;
+    for (int c = 0; c < 5; c++) csvAppend(&line, &len, &cap, v[c], strlen(v[c]));
+    sink += len;
+  }
+  free(line);
+  return n;
+}
+
+long long benchCsvDecode(long n) {
+  const char *csv = "\"Kenneth Cheng\",\"123-12134-123\",\"2000-12-31\",\"00000005\",\"M\"\n";
+  char line[128];
+  char *values[16];
+  for (long i = 0; i < n; i++) {
+    strcpy(line, csv);
+    sink += csvSplit(line, values, 16);
+  }
+  return n;
+}
+
+/* The table of the statement benches, rows keyed by id */
+void loadBench(void) {
+  mockFlush();
+  dbx("create table " TABLE " (id key, name, tel, birth, pos, gender)");
+  for (long from = 0; from < rows; from += 500) {
+    char *values = valuesClause(from, from + 500 <= rows? 500: rows - from);
+    char *stm = malloc(strlen(values) + 128);
+    sprintf(stm, "insert into " TABLE " (id, name, tel, birth, pos, gender) values %s", values);
+    dbx(stm);
+    free(stm);
+    free(values);
+  }
+}
+
+long long benchInsert(long n) {
+  long tuples = 100;
+  char *values = valuesClause(0, tuples);
+  char *stm = malloc(strlen(values) + 128);
+  sprintf(stm, "insert into mb_insert (id, name, tel, birth, pos, gender) values %s", values);
+  long i;
+  for (i = 0; i < n; i += tuples) dbx(stm);
+  free(stm);
+  free(values);
+  return i;
+}
+
+long long benchPointSelect(long n) {
+  char stm[128];
+  for (long i = 0; i < n; i++) {
+    sprintf(stm, "select name, tel from " TABLE " where id = %ld", (i * 7919) % rows);
+    sink += dbx(stm);
+  }
+  return n;
+}
+
+long long benchScanFilter(long n) {
+  long i;
+  for (i = 0; i < n; i += rows)
+    sink += dbx("select name, pos from " TABLE " where pos >= 00001000 and pos < 00002000");
+  return i;
+}
+
+long long benchScanOr(long n) {
+  long i;
+  for (i = 0; i < n; i += rows)
+    sink += dbx("select name, pos from " TABLE " where pos between 00001000 and 00001999 or gender in (F)");
+  return i;
+}
+
+/* in on the primary key, a union of direct lookups */
+long long benchKeyIn(long n) {
+  char stm[1024];
+  long i;
+  for (i = 0; i < n; i += 64) {
+    char *p = stm + sprintf(stm, "select name from " TABLE " where id in (");
+    for (int k = 0; k < 64; k++) p += sprintf(p, "%s%ld", k? ",": "", (i + k * 7919) % rows);
+    strcpy(p, ")");
+    sink += dbx(stm);
+  }
+  return i;
+}
+
+long long benchGroupSort(long n) {
+  long i;
+  for (i = 0; i < n; i += rows)
+    sink += dbx("select name, count(*) from " TABLE " group by name order by count(*) desc");
+  return i;
+}
+
+typedef struct Bench {
+  const char *name;
+  long long (*run)(long n);
+  int scale;    // iterations divided by scale
+  int table;    // needs the table loaded
+} Bench;
+
+static Bench benches[] = {
+  {"parse_where", benchParseWhere, 1, 0},
+  {"parse_values", benchParseValues, 1, 0},
+  {"normalize", benchNormalize, 1, 0},
+  {"compare", benchCompare, 1, 0},
+  {"like", benchLike, 1, 0},
+  {"csv_encode", benchCsvEncode, 1, 0},
+  {"csv_decode", benchCsvDecode, 1, 0},
+  {"insert_values", benchInsert, 10, 0},
+  {"point_select", benchPointSelect, 10, 1},
+  {"scan_filter", benchScanFilter, 10, 1},
+  {"scan_or", benchScanOr, 10, 1},
+  {"key_in", benchKeyIn, 10, 1},
+  {"group_sort", benchGroupSort, 10, 1},
+};
+
+void usage(void) {
+  fprintf(stderr, "usage: microbench [-r rows] [-n iterations] [bench...]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+    switch (opt) {
+      case 'r': rows = atol(optarg); break;
+      case 'n': iterations = atol(optarg); break;
+      default: usage();
+    }
+  }
+  if (rows < 1 || iterations < 1) usage();
+  if (mockLoad(RedisModule_OnLoad) != REDISMODULE_OK) {
+    fprintf(stderr, "microbench: the module failed to load\n");
+    return 1;
+  }
+  genValues();
+
+  int loaded = 0;
+  printf("%-16s %12s %14s %10s\n", "bench", "ops", "ops/sec", "ns/op");
+  for (size_t b = 0; b < sizeof(benches) / sizeof(Bench); b++) {
+    int selected = optind == argc;
+    for (int i = optind; i < argc; i++) selected |= strcmp(argv[i], benches[b].name) == 0;
+    if (!selected) continue;
+    if (benches[b].table && !loaded) {
+      loadBench();
+      loaded = 1;
+    }
+    long long start = nowNs();
+    long long ops = benches[b].run(iterations / benches[b].scale);
+    long long ns = nowNs() - start;
+    printf("%-16s %12lld %14.0f %10.1f\n", benches[b].name, ops, ns > 0? ops * 1e9 / ns: 0, ops? (double)ns / ops: 0);
+  }
+  return 0;
+}
@@ -0,0 +1,1106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include "mockredis.h"
+
+/* Objects of a context in auto memory mode, released when the command
+ * returns unless the module freed them before */
+#define AUTO_STRING 0
+#define AUTO_REPLY  1
+#define AUTO_KEY    2
+typedef struct AutoObject {
+  int type;
+  void *ptr;
+} AutoObject;
+
+struct RedisModuleCtx {
+  void *getapifuncptr;  // read by RedisModule_Init, it must come first
+  int autoMemory;
+  AutoObject *autos;
+  size_t nAuto, capAuto;
+  void **pool;          // blocks of PoolAlloc
+  size_t nPool, capPool;
+  MockResult *result;
+  MockResult scratch;
+  int open;             // postponed arrays not yet closed
+  int topPostponed;
+};
+
+struct RedisModuleString {
+  char *ptr;
+  size_t len;
+  RedisModuleCtx *ctx;
+  long slot;            // in the auto objects of ctx, -1 if not tracked
+};
+
+struct RedisModuleCallReply {
+  int type;
+  char *str;
+  size_t len;
+  long long integer;
+  struct RedisModuleCallReply *elements;
+  size_t n;
+  RedisModuleCtx *ctx;
+  long slot;
+};
+
+struct RedisModuleKey {
+  RedisModuleCtx *ctx;
+  char *name;
+  size_t len;
+  int mode;
+  long slot;
+};
+
+struct RedisModuleType {
+  char name[16];
+  RedisModuleTypeMethods methods;
+};
+
+/* Keyspace. The entries are kept in their order of creation, which is the
+ * order of SCAN, and located by an open addressing index of entry + 1. A
+ * deleted entry keeps its place until the index is rebuilt, so cursors stay
+ * valid as long as no key is added. */
+typedef struct MockField {
+  char *name, *value;
+  size_t nlen, vlen;
+} MockField;
+
+typedef struct MockEntry {
+  char *key;            // NULL once deleted
+  size_t klen;
+  int type;             // REDISMODULE_KEYTYPE_HASH or REDISMODULE_KEYTYPE_MODULE
+  MockField *fields;
+  size_t n, cap;
+  RedisModuleType *mt;
+  void *module;
+} MockEntry;
+
+static MockEntry *db;
+static size_t dbLen, dbCap, dbLive;
+static size_t *dbIndex;
+static size_t dbIndexCap;
+
+static uint64_t hashKey(const char *p, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+  return h;
+}
+
+static char *copyBytes(const char *p, size_t len) {
+  char *s = malloc(len + 1);
+  memcpy(s, p, len);
+  s[len] = 0;
+  return s;
+}
+
+static MockEntry *dbFind(const char *key, size_t len) {
+  if (dbIndexCap == 0) return NULL;
+  for (size_t i = hashKey(key, len) & (dbIndexCap - 1); dbIndex[i]; i = (i + 1) & (dbIndexCap - 1)) {
+    MockEntry *e = &db[dbIndex[i] - 1];
+    if (e->key && e->klen == len && memcmp(e->key, key, len) == 0) return e;
+  }
+  return NULL;
+}
+
+static void dbIndexPut(size_t entry) {
+  MockEntry *e = &db[entry];
+  size_t i = hashKey(e->key, e->klen) & (dbIndexCap - 1);
+  while (dbIndex[i]) i = (i + 1) & (dbIndexCap - 1);
+  dbIndex[i] = entry + 1;
+}
+
+/* Drop the deleted entries and size the index for twice the live keys */
+static void dbRebuild(void) {
+  size_t live = 0;
+  for (size_t i = 0; i < dbLen; i++)
+    if (db[i].key) db[live++] = db[i];
+  dbLen = live;
+  size_t cap = 1024;
+  while (cap < 4 * (live + 1)) cap *= 2;
+  free(dbIndex);
+  dbIndex = calloc(cap, sizeof(size_t));
+  dbIndexCap = cap;
+  for (size_t i = 0; i < dbLen; i++) dbIndexPut(i);
+}
+
+static MockEntry *dbAdd(const char *key, size_t len, int type) {
+  if (2 * (dbLen + 1) > dbIndexCap) dbRebuild();
+  if (dbLen == dbCap) {
+    dbCap = dbCap? 2 * dbCap: 1024;
+    db = realloc(db, dbCap * sizeof(MockEntry));
+  }
+  MockEntry *e = &db[dbLen];
+  memset(e, 0, sizeof(MockEntry));
+  e->key = copyBytes(key, len);
+  e->klen = len;
+  e->type = type;
+  dbIndexPut(dbLen++);
+  dbLive++;
+  return e;
+}
+
+static void dbDelete(MockEntry *e) {
+  for (size_t i = 0; i < e->n; i++) {
+    free(e->fields[i].name);
+    free(e->fields[i].value);
+  }
+  free(e->fields);
+  if (e->module && e->mt->methods.free) e->mt->methods.free(e->module);
+  free(e->key);
+  e->key = NULL;
+  e->fields = NULL;
+  e->module = NULL;
+  e->n = e->cap = 0;
+  dbLive--;
+}
+
+static MockField *hashFind(MockEntry *e, const char *f, size_t len) {
+  for (size_t i = 0; i < e->n; i++)
+    if (e->fields[i].nlen == len && memcmp(e->fields[i].name, f, len) == 0) return &e->fields[i];
+  return NULL;
+}
+
+/* Set a field, 1 is returned if it is new */
+static int hashSet(MockEntry *e, const char *f, size_t flen, const char *v, size_t vlen) {
+  MockField *field = hashFind(e, f, flen);
+  if (field != NULL) {
+    free(field->value);
+    field->value = copyBytes(v, vlen);
+    field->vlen = vlen;
+    return 0;
+  }
+  if (e->n == e->cap) {
+    e->cap = e->cap? 2 * e->cap: 8;
+    e->fields = realloc(e->fields, e->cap * sizeof(MockField));
+  }
+  field = &e->fields[e->n++];
+  field->name = copyBytes(f, flen);
+  field->nlen = flen;
+  field->value = copyBytes(v, vlen);
+  field->vlen = vlen;
+  return 1;
+}
+
+static int hashDel(MockEntry *e, const char *f, size_t flen) {
+  MockField *field = hashFind(e, f, flen);
+  if (field == NULL) return 0;
+  free(field->name);
+  free(field->value);
+  *field = e->fields[--e->n];
+  return 1;
+}
+
+size_t mockDbSize(void) {
+  return dbLive;
+}
+
+void mockFlush(void) {
+  for (size_t i = 0; i < dbLen; i++)
+    if (db[i].key) dbDelete(&db[i]);
+  dbLen = 0;
+  dbRebuild();
+}
+
+/* Auto memory */
+static long autoTrack(RedisModuleCtx *ctx, int type, void *ptr) {
+  if (ctx == NULL || !ctx->autoMemory) return -1;
+  if (ctx->nAuto == ctx->capAuto) {
+    ctx->capAuto = ctx->capAuto? 2 * ctx->capAuto: 64;
+    ctx->autos = realloc(ctx->autos, ctx->capAuto * sizeof(AutoObject));
+  }
+  ctx->autos[ctx->nAuto] = (AutoObject){type, ptr};
+  return ctx->nAuto++;
+}
+
+static void autoUntrack(RedisModuleCtx *ctx, long slot) {
+  if (ctx != NULL && slot >= 0) ctx->autos[slot].ptr = NULL;
+}
+
+/* Memory */
+static void *mockAlloc(size_t bytes) {
+  return malloc(bytes);
+}
+
+static void *mockCalloc(size_t nmemb, size_t size) {
+  return calloc(nmemb, size);
+}
+
+static void *mockRealloc(void *ptr, size_t bytes) {
+  return realloc(ptr, bytes);
+}
+
+static void mockFree(void *ptr) {
+  free(ptr);
+}
+
+static char *mockStrdup(const char *s) {
+  return strdup(s);
+}
+
+static void *mockPoolAlloc(RedisModuleCtx *ctx, size_t bytes) {
+  if (ctx->nPool == ctx->capPool) {
+    ctx->capPool = ctx->capPool? 2 * ctx->capPool: 64;
+    ctx->pool = realloc(ctx->pool, ctx->capPool * sizeof(void*));
+  }
+  return ctx->pool[ctx->nPool++] = malloc(bytes);
+}
+
+/* Strings */
+static RedisModuleString *newString(RedisModuleCtx *ctx, const char *p, size_t len) {
+  RedisModuleString *s = malloc(sizeof(RedisModuleString));
+  s->ptr = copyBytes(p, len);
+  s->len = len;
+  s->ctx = ctx;
+  s->slot = autoTrack(ctx, AUTO_STRING, s);
+  return s;
+}
+
+static void freeString(RedisModuleString *s) {
+  free(s->ptr);
+  free(s);
+}
+
+static RedisModuleString *mockCreateString(RedisModuleCtx *ctx, const char *ptr, size_t len) {
+  return newString(ctx, ptr, len);
+}
+
+static RedisModuleString *mockCreateStringFromLongLong(RedisModuleCtx *ctx, long long ll) {
+  char buf[32];
+  return newString(ctx, buf, sprintf(buf, "%lld", ll));
+}
+
+static RedisModuleString *mockCreateStringFromString(RedisModuleCtx *ctx, const RedisModuleString *str) {
+  return newString(ctx, str->ptr, str->len);
+}
+
+static RedisModuleString *mockCreateStringPrintf(RedisModuleCtx *ctx, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  char *buf = malloc(len + 1);
+  va_start(ap, fmt);
+  vsnprintf(buf, len + 1, fmt, ap);
+  va_end(ap);
+  RedisModuleString *s = newString(ctx, buf, len);
+  free(buf);
+  return s;
+}
+
+static void mockFreeString(RedisModuleCtx *ctx, RedisModuleString *str) {
+  autoUntrack(str->ctx, str->slot);
+  freeString(str);
+}
+
+static const char *mockStringPtrLen(const RedisModuleString *str, size_t *len) {
+  if (len) *len = str->len;
+  return str->ptr;
+}
+
+static int mockStringToLongLong(const RedisModuleString *str, long long *ll) {
+  char *end;
+  errno = 0;
+  *ll = strtoll(str->ptr, &end, 10);
+  return str->len > 0 && *end == 0 && errno == 0? REDISMODULE_OK: REDISMODULE_ERR;
+}
+
+static int mockStringToDouble(const RedisModuleString *str, double *d) {
+  char *end;
+  *d = strtod(str->ptr, &end);
+  return str->len > 0 && *end == 0? REDISMODULE_OK: REDISMODULE_ERR;
+}
+
+/* Call replies */
+static RedisModuleCallReply *newReply(RedisModuleCtx *ctx, int type) {
+  RedisModuleCallReply *r = calloc(1, sizeof(RedisModuleCallReply));
+  r->type = type;
+  r->ctx = ctx;
+  r->slot = autoTrack(ctx, AUTO_REPLY, r);
+  return r;
+}
+
+static void setReplyString(RedisModuleCallReply *r, const char *p, size_t len) {
+  r->type = REDISMODULE_REPLY_STRING;
+  r->str = copyBytes(p, len);
+  r->len = len;
+}
+
+static RedisModuleCallReply *replyString(RedisModuleCtx *ctx, const char *p, size_t len) {
+  RedisModuleCallReply *r = newReply(ctx, REDISMODULE_REPLY_STRING);
+  setReplyString(r, p, len);
+  return r;
+}
+
+static RedisModuleCallReply *replyInteger(RedisModuleCtx *ctx, long long ll) {
+  RedisModuleCallReply *r = newReply(ctx, REDISMODULE_REPLY_INTEGER);
+  r->integer = ll;
+  return r;
+}
+
+static RedisModuleCallReply *replyError(RedisModuleCtx *ctx, const char *fmt, const char *arg) {
+  char buf[256];
+  RedisModuleCallReply *r = newReply(ctx, REDISMODULE_REPLY_ERROR);
+  r->len = snprintf(buf, sizeof(buf), fmt, arg);
+  r->str = copyBytes(buf, r->len);
+  return r;
+}
+
+static RedisModuleCallReply *replyArray(RedisModuleCtx *ctx, size_t n) {
+  RedisModuleCallReply *r = newReply(ctx, REDISMODULE_REPLY_ARRAY);
+  r->elements = calloc(n + 1, sizeof(RedisModuleCallReply));
+  r->n = n;
+  for (size_t i = 0; i < n; i++) r->elements[i].type = REDISMODULE_REPLY_NULL;
+  return r;
+}
+
+static void freeReplyContent(RedisModuleCallReply *r) {
+  free(r->str);
+  for (size_t i = 0; i < r->n; i++) freeReplyContent(&r->elements[i]);
+  free(r->elements);
+}
+
+static void mockFreeCallReply(RedisModuleCallReply *reply) {
+  if (reply == NULL) return;
+  autoUntrack(reply->ctx, reply->slot);
+  freeReplyContent(reply);
+  free(reply);
+}
+
+static int mockCallReplyType(RedisModuleCallReply *reply) {
+  return reply? reply->type: REDISMODULE_REPLY_UNKNOWN;
+}
+
+static size_t mockCallReplyLength(RedisModuleCallReply *reply) {
+  if (reply == NULL) return 0;
+  switch (reply->type) {
+    case REDISMODULE_REPLY_STRING:
+    case REDISMODULE_REPLY_ERROR: return reply->len;
+    case REDISMODULE_REPLY_ARRAY: return reply->n;
+  }
+  return 0;
+}
+
+static long long mockCallReplyInteger(RedisModuleCallReply *reply) {
+  return reply && reply->type == REDISMODULE_REPLY_INTEGER? reply->integer: LLONG_MIN;
+}
+
+static RedisModuleCallReply *mockCallReplyArrayElement(RedisModuleCallReply *reply, size_t idx) {
+  if (reply == NULL || reply->type != REDISMODULE_REPLY_ARRAY || idx >= reply->n) return NULL;
+  return &reply->elements[idx];
+}
+
+static const char *mockCallReplyStringPtr(RedisModuleCallReply *reply, size_t *len) {
+  if (reply == NULL || (reply->type != REDISMODULE_REPLY_STRING && reply->type != REDISMODULE_REPLY_ERROR))
+    return NULL;
+  if (len) *len = reply->len;
+  return reply->str;
+}
+
+static RedisModuleString *mockCreateStringFromCallReply(RedisModuleCallReply *reply) {
+  if (reply == NULL) return NULL;
+  switch (reply->type) {
+    case REDISMODULE_REPLY_STRING:
+    case REDISMODULE_REPLY_ERROR: return newString(reply->ctx, reply->str, reply->len);
+    case REDISMODULE_REPLY_INTEGER: return mockCreateStringFromLongLong(reply->ctx, reply->integer);
+  }
+  return NULL;
+}
+
+/* RedisModule_Call of the commands issued by dbx on hashes and the keyspace.
+ * The arguments are collected as byte strings first. */
+typedef struct Arg {
+  const char *p;
+  size_t len;
+} Arg;
+
+static int argIs(Arg *a, const char *s) {
+  return a->len == strlen(s) && strncasecmp(a->p, s, a->len) == 0;
+}
+
+static long long argInteger(Arg *a) {
+  char buf[32];
+  size_t len = a->len < sizeof(buf) - 1? a->len: sizeof(buf) - 1;
+  memcpy(buf, a->p, len);
+  buf[len] = 0;
+  return strtoll(buf, NULL, 10);
+}
+
+static RedisModuleCallReply *runCommand(RedisModuleCtx *ctx, Arg *a, size_t n) {
+  static const char *wrongType = "WRONGTYPE Operation against a key holding the wrong kind of value%s";
+  MockEntry *e = n > 1? dbFind(a[1].p, a[1].len): NULL;
+  int hashCommand = a[0].p[0] == 'H' || a[0].p[0] == 'h';
+  if (e != NULL && e->type != REDISMODULE_KEYTYPE_HASH && hashCommand)
+    return replyError(ctx, wrongType, "");
+
+  if (argIs(&a[0], "HGET") && n == 3) {
+    MockField *f = e? hashFind(e, a[2].p, a[2].len): NULL;
+    return f? replyString(ctx, f->value, f->vlen): newReply(ctx, REDISMODULE_REPLY_NULL);
+  }
+  if (argIs(&a[0], "HGETALL") && n == 2) {
+    RedisModuleCallReply *r = replyArray(ctx, e? 2 * e->n: 0);
+    for (size_t i = 0; e && i < e->n; i++) {
+      setReplyString(&r->elements[2*i], e->fields[i].name, e->fields[i].nlen);
+      setReplyString(&r->elements[2*i+1], e->fields[i].value, e->fields[i].vlen);
+    }
+    return r;
+  }
+  if ((argIs(&a[0], "HSET") || argIs(&a[0], "HMSET")) && n >= 4 && n % 2 == 0) {
+    if (e == NULL) e = dbAdd(a[1].p, a[1].len, REDISMODULE_KEYTYPE_HASH);
+    long long added = 0;
+    for (size_t i = 2; i < n; i += 2) added += hashSet(e, a[i].p, a[i].len, a[i+1].p, a[i+1].len);
+    return argIs(&a[0], "HSET")? replyInteger(ctx, added): replyString(ctx, "OK", 2);
+  }
+  if (argIs(&a[0], "HINCRBY") && n == 4) {
+    if (e == NULL) e = dbAdd(a[1].p, a[1].len, REDISMODULE_KEYTYPE_HASH);
+    MockField *f = hashFind(e, a[2].p, a[2].len);
+    char buf[32];
+    long long v = (f? strtoll(f->value, NULL, 10): 0) + argInteger(&a[3]);
+    hashSet(e, a[2].p, a[2].len, buf, sprintf(buf, "%lld", v));
+    return replyInteger(ctx, v);
+  }
+  if (argIs(&a[0], "HEXISTS") && n == 3)
+    return replyInteger(ctx, e && hashFind(e, a[2].p, a[2].len));
+  if (argIs(&a[0], "HDEL") && n >= 3) {
+    long long removed = 0;
+    for (size_t i = 2; e && i < n; i++) removed += hashDel(e, a[i].p, a[i].len);
+    if (e && e->n == 0) dbDelete(e);
+    return replyInteger(ctx, removed);
+  }
+  if ((argIs(&a[0], "EXISTS") || argIs(&a[0], "DEL") || argIs(&a[0], "UNLINK")) && n >= 2) {
+    long long count = 0;
+    for (size_t i = 1; i < n; i++) {
+      MockEntry *k = dbFind(a[i].p, a[i].len);
+      if (k == NULL) continue;
+      count++;
+      if (!argIs(&a[0], "EXISTS")) dbDelete(k);
+    }
+    return replyInteger(ctx, count);
+  }
+  if (argIs(&a[0], "SCAN") && n >= 2) {
+    size_t cursor = argInteger(&a[1]), count = 10;
+    char *match = NULL;
+    for (size_t i = 2; i + 1 < n; i += 2) {
+      if (argIs(&a[i], "MATCH")) match = copyBytes(a[i+1].p, a[i+1].len);
+      else if (argIs(&a[i], "COUNT")) count = argInteger(&a[i+1]);
+    }
+    size_t found = 0, end = cursor;
+    size_t *keys = malloc(count * sizeof(size_t));
+    for (; end < dbLen && found < count; end++)
+      if (db[end].key && (match == NULL || fnmatch(match, db[end].key, 0) == 0)) keys[found++] = end;
+    RedisModuleCallReply *r = replyArray(ctx, 2);
+    char buf[32];
+    setReplyString(&r->elements[0], buf, sprintf(buf, "%zu", end < dbLen? end: 0));
+    RedisModuleCallReply *list = &r->elements[1];
+    list->type = REDISMODULE_REPLY_ARRAY;
+    list->elements = calloc(found + 1, sizeof(RedisModuleCallReply));
+    list->n = found;
+    for (size_t i = 0; i < found; i++) setReplyString(&list->elements[i], db[keys[i]].key, db[keys[i]].klen);
+    free(keys);
+    free(match);
+    return r;
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "%.*s", (int)a[0].len, a[0].p);
+  return replyError(ctx, "ERR unknown command '%s' of the mock", name);
+}
+
+static RedisModuleCallReply *mockCall(RedisModuleCtx *ctx, const char *cmdname, const char *fmt, ...) {
+  size_t n = 1, cap = 16;
+  Arg *a = malloc(cap * sizeof(Arg));
+  char nums[16][32];
+  size_t nNum = 0;
+  a[0] = (Arg){cmdname, strlen(cmdname)};
+
+  va_list ap;
+  va_start(ap, fmt);
+  for (const char *f = fmt; *f; f++) {
+    RedisModuleString **v = NULL;
+    size_t vn = 1;
+    Arg arg;
+    switch (*f) {
+      case 'c':
+        arg.p = va_arg(ap, const char*);
+        arg.len = strlen(arg.p);
+        break;
+      case 's': {
+        RedisModuleString *s = va_arg(ap, RedisModuleString*);
+        arg = (Arg){s->ptr, s->len};
+        break;
+      }
+      case 'b':
+        arg.p = va_arg(ap, const char*);
+        arg.len = va_arg(ap, size_t);
+        break;
+      case 'l':
+        if (nNum == 16) continue;
+        arg.len = sprintf(nums[nNum], "%lld", va_arg(ap, long long));
+        arg.p = nums[nNum++];
+        break;
+      case 'v':
+        v = va_arg(ap, RedisModuleString**);
+        vn = va_arg(ap, size_t);
+        break;
+      default:
+        // flags as "!" of replication
+        continue;
+    }
+    if (n + vn > cap) {
+      while (n + vn > cap) cap *= 2;
+      a = realloc(a, cap * sizeof(Arg));
+    }
+    if (v == NULL) a[n++] = arg;
+    else
+      for (size_t i = 0; i < vn; i++) a[n++] = (Arg){v[i]->ptr, v[i]->len};
+  }
+  va_end(ap);
+
+  RedisModuleCallReply *r = runCommand(ctx, a, n);
+  free(a);
+  return r;
+}
+
+/* Keys */
+static void *mockOpenKey(RedisModuleCtx *ctx, RedisModuleString *keyname, int mode) {
+  // like Redis, a missing key opened for reading is NULL
+  if (!(mode & REDISMODULE_WRITE) && dbFind(keyname->ptr, keyname->len) == NULL) return NULL;
+  RedisModuleKey *key = malloc(sizeof(RedisModuleKey));
+  key->ctx = ctx;
+  key->name = copyBytes(keyname->ptr, keyname->len);
+  key->len = keyname->len;
+  key->mode = mode;
+  key->slot = autoTrack(ctx, AUTO_KEY, key);
+  return key;
+}
+
+static void mockCloseKey(RedisModuleKey *key) {
+  if (key == NULL) return;
+  autoUntrack(key->ctx, key->slot);
+  free(key->name);
+  free(key);
+}
+
+static int mockKeyType(RedisModuleKey *key) {
+  MockEntry *e = key? dbFind(key->name, key->len): NULL;
+  return e? e->type: REDISMODULE_KEYTYPE_EMPTY;
+}
+
+static size_t mockValueLength(RedisModuleKey *key) {
+  MockEntry *e = key? dbFind(key->name, key->len): NULL;
+  return e && e->type == REDISMODULE_KEYTYPE_HASH? e->n: 0;
+}
+
+static int mockHashSet(RedisModuleKey *key, int flags, ...) {
+  if (key == NULL || !(key->mode & REDISMODULE_WRITE)) return 0;
+  MockEntry *e = dbFind(key->name, key->len);
+  if (e != NULL && e->type != REDISMODULE_KEYTYPE_HASH) return 0;
+  int updated = 0;
+  va_list ap;
+  va_start(ap, flags);
+  for (;;) {
+    const char *f;
+    size_t flen;
+    if (flags & REDISMODULE_HASH_CFIELDS) {
+      f = va_arg(ap, const char*);
+      if (f == NULL) break;
+      flen = strlen(f);
+    }
+    else {
+      RedisModuleString *s = va_arg(ap, RedisModuleString*);
+      if (s == NULL) break;
+      f = s->ptr;
+      flen = s->len;
+    }
+    RedisModuleString *v = va_arg(ap, RedisModuleString*);
+    int exists = e && hashFind(e, f, flen);
+    if (v == REDISMODULE_HASH_DELETE) {
+      updated += e && hashDel(e, f, flen);
+      continue;
+    }
+    if ((flags & REDISMODULE_HASH_NX) && exists) continue;
+    if ((flags & REDISMODULE_HASH_XX) && !exists) continue;
+    if (e == NULL) e = dbAdd(key->name, key->len, REDISMODULE_KEYTYPE_HASH);
+    hashSet(e, f, flen, v->ptr, v->len);
+    updated++;
+  }
+  va_end(ap);
+  if (e && e->n == 0) dbDelete(e);
+  return updated;
+}
+
+static int mockHashGet(RedisModuleKey *key, int flags, ...) {
+  MockEntry *e = key? dbFind(key->name, key->len): NULL;
+  if (e != NULL && e->type != REDISMODULE_KEYTYPE_HASH) return REDISMODULE_ERR;
+  va_list ap;
+  va_start(ap, flags);
+  for (;;) {
+    const char *f;
+    size_t flen;
+    if (flags & REDISMODULE_HASH_CFIELDS) {
+      f = va_arg(ap, const char*);
+      if (f == NULL) break;
+      flen = strlen(f);
+    }
+    else {
+      RedisModuleString *s = va_arg(ap, RedisModuleString*);
+      if (s == NULL) break;
+      f = s->ptr;
+      flen = s->len;
+    }
+    void *out = va_arg(ap, void*);
+    MockField *field = e? hashFind(e, f, flen): NULL;
+    if (flags & REDISMODULE_HASH_EXISTS) *(int*)out = field != NULL;
+    else *(RedisModuleString**)out = field? newString(key->ctx, field->value, field->vlen): NULL;
+  }
+  va_end(ap);
+  return REDISMODULE_OK;
+}
+
+/* Module types */
+static RedisModuleType *mockCreateDataType(RedisModuleCtx *ctx, const char *name, int encver, RedisModuleTypeMethods *typemethods) {
+  RedisModuleType *mt = calloc(1, sizeof(RedisModuleType));
+  snprintf(mt->name, sizeof(mt->name), "%s", name);
+  mt->methods = *typemethods;
+  return mt;
+}
+
+static int mockModuleTypeSetValue(RedisModuleKey *key, RedisModuleType *mt, void *value) {
+  if (key == NULL || !(key->mode & REDISMODULE_WRITE)) return REDISMODULE_ERR;
+  MockEntry *e = dbFind(key->name, key->len);
+  if (e != NULL) dbDelete(e);
+  e = dbAdd(key->name, key->len, REDISMODULE_KEYTYPE_MODULE);
+  e->mt = mt;
+  e->module = value;
+  return REDISMODULE_OK;
+}
+
+static RedisModuleType *mockModuleTypeGetType(RedisModuleKey *key) {
+  MockEntry *e = key? dbFind(key->name, key->len): NULL;
+  return e && e->type == REDISMODULE_KEYTYPE_MODULE? e->mt: NULL;
+}
+
+static void *mockModuleTypeGetValue(RedisModuleKey *key) {
+  MockEntry *e = key? dbFind(key->name, key->len): NULL;
+  return e && e->type == REDISMODULE_KEYTYPE_MODULE? e->module: NULL;
+}
+
+/* Dictionaries, chained hash tables. An iterator takes the keys sorted as a
+ * rax would, from the first one or from the key sought by ^, >= or >. */
+typedef struct DictNode {
+  struct DictNode *next;
+  char *key;
+  size_t len;
+  void *val;
+} DictNode;
+
+struct RedisModuleDict {
+  DictNode **buckets;
+  size_t cap, n;
+};
+
+struct RedisModuleDictIter {
+  DictNode **nodes;
+  size_t n, next;
+};
+
+static RedisModuleDict *mockCreateDict(RedisModuleCtx *ctx) {
+  RedisModuleDict *d = calloc(1, sizeof(RedisModuleDict));
+  d->cap = 16;
+  d->buckets = calloc(d->cap, sizeof(DictNode*));
+  return d;
+}
+
+static void mockFreeDict(RedisModuleCtx *ctx, RedisModuleDict *d) {
+  for (size_t b = 0; b < d->cap; b++)
+    for (DictNode *node = d->buckets[b], *next; node != NULL; node = next) {
+      next = node->next;
+      free(node->key);
+      free(node);
+    }
+  free(d->buckets);
+  free(d);
+}
+
+static uint64_t mockDictSize(RedisModuleDict *d) {
+  return d->n;
+}
+
+static DictNode **dictFind(RedisModuleDict *d, const char *key, size_t len) {
+  DictNode **p = &d->buckets[hashKey(key, len) & (d->cap - 1)];
+  while (*p && ((*p)->len != len || memcmp((*p)->key, key, len) != 0)) p = &(*p)->next;
+  return p;
+}
+
+static int dictPut(RedisModuleDict *d, const char *key, size_t len, void *val, int replace) {
+  DictNode **p = dictFind(d, key, len);
+  if (*p != NULL) {
+    if (!replace) return REDISMODULE_ERR;
+    (*p)->val = val;
+    return REDISMODULE_OK;
+  }
+  DictNode *node = malloc(sizeof(DictNode));
+  node->key = copyBytes(key, len);
+  node->len = len;
+  node->val = val;
+  node->next = *p;
+  *p = node;
+  if (++d->n > d->cap) {
+    size_t cap = 2 * d->cap;
+    DictNode **buckets = calloc(cap, sizeof(DictNode*));
+    for (size_t b = 0; b < d->cap; b++)
+      for (DictNode *n = d->buckets[b], *next; n != NULL; n = next) {
+        next = n->next;
+        size_t i = hashKey(n->key, n->len) & (cap - 1);
+        n->next = buckets[i];
+        buckets[i] = n;
+      }
+    free(d->buckets);
+    d->buckets = buckets;
+    d->cap = cap;
+  }
+  return REDISMODULE_OK;
+}
+
+static int mockDictSetC(RedisModuleDict *d, void *key, size_t keylen, void *ptr) {
+  return dictPut(d, key, keylen, ptr, 0);
+}
+
+static int mockDictReplaceC(RedisModuleDict *d, void *key, size_t keylen, void *ptr) {
+  return dictPut(d, key, keylen, ptr, 1);
+}
+
+static int mockDictSet(RedisModuleDict *d, RedisModuleString *key, void *ptr) {
+  return dictPut(d, key->ptr, key->len, ptr, 0);
+}
+
+static int mockDictReplace(RedisModuleDict *d, RedisModuleString *key, void *ptr) {
+  return dictPut(d, key->ptr, key->len, ptr, 1);
+}
+
+static void *mockDictGetC(RedisModuleDict *d, void *key, size_t keylen, int *nokey) {
+  DictNode *node = *dictFind(d, key, keylen);
+  if (nokey) *nokey = node == NULL;
+  return node? node->val: NULL;
+}
+
+static void *mockDictGet(RedisModuleDict *d, RedisModuleString *key, int *nokey) {
+  return mockDictGetC(d, key->ptr, key->len, nokey);
+}
+
+static int mockDictDelC(RedisModuleDict *d, void *key, size_t keylen, void *oldval) {
+  DictNode **p = dictFind(d, key, keylen);
+  if (*p == NULL) return REDISMODULE_ERR;
+  DictNode *node = *p;
+  if (oldval) *(void**)oldval = node->val;
+  *p = node->next;
+  free(node->key);
+  free(node);
+  d->n--;
+  return REDISMODULE_OK;
+}
+
+static int mockDictDel(RedisModuleDict *d, RedisModuleString *key, void *oldval) {
+  return mockDictDelC(d, key->ptr, key->len, oldval);
+}
+
+static int dictKeyCmp(const char *a, size_t alen, const char *b, size_t blen) {
+  int c = memcmp(a, b, alen < blen? alen: blen);
+  return c != 0? c: alen < blen? -1: alen > blen;
+}
+
+static int dictNodeCmp(const void *a, const void *b) {
+  const DictNode *x = *(DictNode* const*)a, *y = *(DictNode* const*)b;
+  return dictKeyCmp(x->key, x->len, y->key, y->len);
+}
+
+static RedisModuleDictIter *mockDictIteratorStartC(RedisModuleDict *d, const char *op, void *key, size_t keylen) {
+  RedisModuleDictIter *di = calloc(1, sizeof(RedisModuleDictIter));
+  di->nodes = malloc((d->n + 1) * sizeof(DictNode*));
+  for (size_t b = 0; b < d->cap; b++)
+    for (DictNode *node = d->buckets[b]; node != NULL; node = node->next) di->nodes[di->n++] = node;
+  qsort(di->nodes, di->n, sizeof(DictNode*), dictNodeCmp);
+  int strict = strcmp(op, ">") == 0;
+  if (strict || strcmp(op, ">=") == 0) {
+    while (di->next < di->n) {
+      int c = dictKeyCmp(di->nodes[di->next]->key, di->nodes[di->next]->len, key, keylen);
+      if (c > 0 || (c == 0 && !strict)) break;
+      di->next++;
+    }
+  }
+  return di;
+}
+
+static void *mockDictNextC(RedisModuleDictIter *di, size_t *keylen, void **dataptr) {
+  if (di->next >= di->n) return NULL;
+  DictNode *node = di->nodes[di->next++];
+  if (keylen) *keylen = node->len;
+  if (dataptr) *dataptr = node->val;
+  return node->key;
+}
+
+static void mockDictIteratorStop(RedisModuleDictIter *di) {
+  free(di->nodes);
+  free(di);
+}
+
+/* Replies of the command, counted into its result */
+static int replied(RedisModuleCtx *ctx) {
+  ctx->result->calls++;
+  return REDISMODULE_OK;
+}
+
+/* An element of the reply appended to the text of the result */
+static void replyText(RedisModuleCtx *ctx, const char *p, size_t len) {
+  MockResult *r = ctx->result;
+  size_t room = sizeof(r->text) - 1 - r->textLen;
+  if (r->textLen > 0 && r->text[r->textLen - 1] != '\n' && room > 0) {
+    r->text[r->textLen++] = ' ';
+    room--;
+  }
+  if (len > room) len = room;
+  memcpy(r->text + r->textLen, p, len);
+  r->textLen += len;
+  r->text[r->textLen] = 0;
+}
+
+static void replyTextNumber(RedisModuleCtx *ctx, const char *fmt, ...) {
+  char buf[64];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  replyText(ctx, buf, len);
+}
+
+static int mockReplyWithLongLong(RedisModuleCtx *ctx, long long ll) {
+  if (ctx->result->calls == 0) ctx->result->len = ll;
+  replyTextNumber(ctx, "%lld", ll);
+  return replied(ctx);
+}
+
+static int mockReplyWithError(RedisModuleCtx *ctx, const char *err) {
+  if (ctx->result->error[0] == 0) snprintf(ctx->result->error, sizeof(ctx->result->error), "%s", err);
+  return replied(ctx);
+}
+
+static int mockReplyWithSimpleString(RedisModuleCtx *ctx, const char *msg) {
+  replyText(ctx, msg, strlen(msg));
+  return replied(ctx);
+}
+
+static int mockReplyWithArray(RedisModuleCtx *ctx, long len) {
+  MockResult *r = ctx->result;
+  if (len == REDISMODULE_POSTPONED_ARRAY_LEN) {
+    if (r->calls == 0) ctx->topPostponed = 1;
+    ctx->open++;
+  }
+  else if (r->calls == 0)
+    r->len = len;
+  // a nested array starts a line
+  if (r->calls > 0 && r->textLen > 0 && r->text[r->textLen - 1] != '\n' && r->textLen < sizeof(r->text) - 1) {
+    r->text[r->textLen++] = '\n';
+    r->text[r->textLen] = 0;
+  }
+  return replied(ctx);
+}
+
+static void mockReplySetArrayLength(RedisModuleCtx *ctx, long len) {
+  if (--ctx->open == 0 && ctx->topPostponed) {
+    ctx->result->len = len;
+    ctx->topPostponed = 0;
+  }
+}
+
+static int mockReplyWithStringBuffer(RedisModuleCtx *ctx, const char *buf, size_t len) {
+  replyText(ctx, buf, len);
+  return replied(ctx);
+}
+
+static int mockReplyWithString(RedisModuleCtx *ctx, RedisModuleString *str) {
+  replyText(ctx, str->ptr, str->len);
+  return replied(ctx);
+}
+
+static int mockReplyWithNull(RedisModuleCtx *ctx) {
+  replyText(ctx, "(nil)", 5);
+  return replied(ctx);
+}
+
+static int mockReplyWithDouble(RedisModuleCtx *ctx, double d) {
+  replyTextNumber(ctx, "%.17g", d);
+  return replied(ctx);
+}
+
+static void replyTextCallReply(RedisModuleCtx *ctx, RedisModuleCallReply *reply) {
+  switch (reply->type) {
+    case REDISMODULE_REPLY_STRING: replyText(ctx, reply->str, reply->len); break;
+    case REDISMODULE_REPLY_INTEGER: replyTextNumber(ctx, "%lld", reply->integer); break;
+    case REDISMODULE_REPLY_NULL: replyText(ctx, "(nil)", 5); break;
+    case REDISMODULE_REPLY_ARRAY:
+      for (size_t i = 0; i < reply->n; i++) replyTextCallReply(ctx, &reply->elements[i]);
+      break;
+  }
+}
+
+static int mockReplyWithCallReply(RedisModuleCtx *ctx, RedisModuleCallReply *reply) {
+  replyTextCallReply(ctx, reply);
+  return replied(ctx);
+}
+
+static int mockWrongArity(RedisModuleCtx *ctx) {
+  return mockReplyWithError(ctx, "ERR wrong number of arguments");
+}
+
+/* Contexts */
+static RedisModuleCtx *newCtx(MockResult *r);
+
+static void mockAutoMemory(RedisModuleCtx *ctx) {
+  ctx->autoMemory = 1;
+}
+
+static int mockGetContextFlags(RedisModuleCtx *ctx) {
+  return 0;
+}
+
+static int mockReplicateVerbatim(RedisModuleCtx *ctx) {
+  return REDISMODULE_OK;
+}
+
+static int mockReplicate(RedisModuleCtx *ctx, const char *cmdname, const char *fmt, ...) {
+  return REDISMODULE_OK;
+}
+
+static RedisModuleCtx *mockGetThreadSafeContext(RedisModuleBlockedClient *bc) {
+  return newCtx(NULL);
+}
+
+static void mockFreeThreadSafeContext(RedisModuleCtx *ctx) {
+  mockReleaseCtx(ctx);
+}
+
+/* Module registration */
+typedef struct MockCommand {
+  char name[64];
+  RedisModuleCmdFunc fn;
+} MockCommand;
+
+#define MAX_COMMANDS 64
+static MockCommand commands[MAX_COMMANDS];
+static int nCommands;
+
+static int mockCreateCommand(RedisModuleCtx *ctx, const char *name, RedisModuleCmdFunc cmdfunc, const char *strflags, int firstkey, int lastkey, int keystep) {
+  if (nCommands == MAX_COMMANDS) return REDISMODULE_ERR;
+  snprintf(commands[nCommands].name, sizeof(commands[nCommands].name), "%s", name);
+  commands[nCommands++].fn = cmdfunc;
+  return REDISMODULE_OK;
+}
+
+static void mockSetModuleAttribs(RedisModuleCtx *ctx, const char *name, int ver, int apiver) {
+}
+
+static int mockSubscribeToKeyspaceEvents(RedisModuleCtx *ctx, int types, RedisModuleNotificationFunc cb) {
+  return REDISMODULE_OK;
+}
+
+static void mockRegisterClusterMessageReceiver(RedisModuleCtx *ctx, uint8_t type, RedisModuleClusterMessageReceiver callback) {
+}
+
+/* The functions given to RedisModule_Init, the others are left NULL */
+#define API(name) {"RedisModule_" #name, (void*)mock##name}
+static struct {
+  const char *name;
+  void *func;
+} api[] = {
+  API(Alloc), API(Calloc), API(Realloc), API(Free), API(Strdup), API(PoolAlloc),
+  API(CreateCommand), API(SetModuleAttribs), API(WrongArity),
+  API(ReplyWithLongLong), API(ReplyWithError), API(ReplyWithSimpleString), API(ReplyWithArray),
+  API(ReplySetArrayLength), API(ReplyWithStringBuffer), API(ReplyWithString), API(ReplyWithNull),
+  API(ReplyWithDouble), API(ReplyWithCallReply),
+  API(OpenKey), API(CloseKey), API(KeyType), API(ValueLength), API(HashSet), API(HashGet),
+  API(StringToLongLong), API(StringToDouble),
+  API(Call), API(FreeCallReply), API(CallReplyInteger), API(CallReplyType), API(CallReplyLength),
+  API(CallReplyArrayElement), API(CallReplyStringPtr), API(CreateStringFromCallReply),
+  API(CreateString), API(CreateStringFromLongLong), API(CreateStringFromString), API(CreateStringPrintf),
+  API(FreeString), API(StringPtrLen), API(AutoMemory), API(ReplicateVerbatim), API(Replicate), API(GetContextFlags),
+  API(CreateDataType), API(ModuleTypeSetValue), API(ModuleTypeGetType), API(ModuleTypeGetValue),
+  API(CreateDict), API(FreeDict), API(DictSize), API(DictSetC), API(DictReplaceC), API(DictSet),
+  API(DictReplace), API(DictGetC), API(DictGet), API(DictDelC), API(DictDel),
+  API(DictIteratorStartC), API(DictNextC), API(DictIteratorStop),
+  API(GetThreadSafeContext), API(FreeThreadSafeContext),
+  API(SubscribeToKeyspaceEvents), API(RegisterClusterMessageReceiver),
+};
+
+static int mockGetApi(const char *name, void *pp) {
+  for (size_t i = 0; i < sizeof(api) / sizeof(api[0]); i++)
+    if (strcmp(api[i].name, name) == 0) {
+      *(void**)pp = api[i].func;
+      return REDISMODULE_OK;
+    }
+  return REDISMODULE_ERR;
+}
+
+static RedisModuleCtx *newCtx(MockResult *r) {
+  RedisModuleCtx *ctx = calloc(1, sizeof(RedisModuleCtx));
+  ctx->getapifuncptr = (void*)mockGetApi;
+  ctx->result = r? r: &ctx->scratch;
+  memset(ctx->result, 0, sizeof(MockResult));
+  return ctx;
+}
+
+RedisModuleCtx *mockCtx(void) {
+  return newCtx(NULL);
+}
+
+void mockReleaseCtx(RedisModuleCtx *ctx) {
+  for (size_t i = 0; i < ctx->nAuto; i++) {
+    void *p = ctx->autos[i].ptr;
+    if (p == NULL) continue;
+    switch (ctx->autos[i].type) {
+      case AUTO_STRING: freeString(p); break;
+      case AUTO_REPLY:
+        freeReplyContent(p);
+        free(p);
+        break;
+      case AUTO_KEY:
+        free(((RedisModuleKey*)p)->name);
+        free(p);
+        break;
+    }
+  }
+  for (size_t i = 0; i < ctx->nPool; i++) free(ctx->pool[i]);
+  free(ctx->autos);
+  free(ctx->pool);
+  free(ctx);
+}
+
+int mockLoad(int (*onLoad)(RedisModuleCtx *ctx)) {
+  if (dbIndexCap == 0) dbRebuild();
+  RedisModuleCtx *ctx = newCtx(NULL);
+  int rc = onLoad(ctx);
+  mockReleaseCtx(ctx);
+  return rc;
+}
+
+int mockCommand(MockResult *r, int argc, const char **argv) {
+  MockCommand *cmd = NULL;
+  for (int i = 0; i < nCommands && cmd == NULL; i++)
+    if (strcasecmp(commands[i].name, argv[0]) == 0) cmd = &commands[i];
+  if (cmd == NULL) {
+    memset(r, 0, sizeof(MockResult));
+    snprintf(r->error, sizeof(r->error), "ERR unknown command '%s'", argv[0]);
+    return r->status = REDISMODULE_ERR;
+  }
+
+  RedisModuleCtx *ctx = newCtx(r);
+  RedisModuleString *args[argc];
+  for (int i = 0; i < argc; i++) args[i] = newString(NULL, argv[i], strlen(argv[i]));
+  r->status = cmd->fn(ctx, args, argc);
+  mockReleaseCtx(ctx);
+  for (int i = 0; i < argc; i++) freeString(args[i]);
+  return r->status;
+}
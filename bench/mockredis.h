@@ -0,0 +1,39 @@
+#ifndef __MOCKREDIS_H__
+#define __MOCKREDIS_H__
+
+/* In-process implementation of the part of the module API used by dbx, so
+ * that the engine runs without a server, i.e. under perf or valgrind. The
+ * keyspace holds hashes and module values in memory, RedisModule_Call knows
+ * the commands dbx issues on them, and the replies of a command are counted
+ * and kept as text rather than encoded. */
+#include "redismodule.h"
+
+/* What a command replied */
+typedef struct MockResult {
+  int status;        // returned by the command function
+  long long len;     // elements of the top array, or the integer replied
+  long long calls;   // reply calls, i.e. all the elements of the reply
+  char error[128];   // the first error replied, empty if none
+  // The elements replied separated by spaces, every array nested in the top
+  // one, i.e. a row of a select, on a line of its own. Null is (nil), and
+  // the text is cut at its size.
+  char text[4096];
+  size_t textLen;
+} MockResult;
+
+/* Load the module by its OnLoad function, REDISMODULE_ERR if it fails */
+int mockLoad(int (*onLoad)(RedisModuleCtx *ctx));
+
+/* Run a command registered by the module, argv[0] is its name */
+int mockCommand(MockResult *r, int argc, const char **argv);
+
+/* A context for calling the functions of the module directly, its objects
+ * of auto memory are released by mockReleaseCtx */
+RedisModuleCtx *mockCtx(void);
+void mockReleaseCtx(RedisModuleCtx *ctx);
+
+/* Number of keys, and removing all of them */
+size_t mockDbSize(void);
+void mockFlush(void);
+
+#endif
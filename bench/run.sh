@@ -0,0 +1,29 @@
+#!/bin/sh
+# Start a throwaway redis-server with dbx loaded, run dbxbench against it and
+# stop the server. The arguments are passed to dbxbench, i.e.
+#
+#   ./run.sh -r 100000 -w 6 -d zipf -o results.json
+#
+# REDIS_SERVER, PORT and MODULE select the server binary, its port and the
+# module to load.
+set -e
+cd "$(dirname "$0")"
+
+REDIS_SERVER=${REDIS_SERVER:-redis-server}
+PORT=${PORT:-6399}
+MODULE=${MODULE:-$(pwd)/../src/dbx.so}
+DIR=$(mktemp -d)
+
+"$REDIS_SERVER" --port "$PORT" --loadmodule "$MODULE" --dir "$DIR" --save "" --appendonly no \
+  --daemonize yes --pidfile "$DIR/redis.pid" --logfile "$DIR/redis.log"
+trap 'kill "$(cat "$DIR/redis.pid")" 2>/dev/null; rm -rf "$DIR"' EXIT
+
+# wait for the server to accept connections
+i=0
+while [ ! -f "$DIR/redis.pid" ] && [ $i -lt 50 ]; do
+  sleep 0.1
+  i=$((i + 1))
+done
+sleep 0.2
+
+./dbxbench -p "$PORT" -t "$DIR" "$@"
@@ -0,0 +1,304 @@
+/* test_dbx: statements of dbx run against the mock module API of mockredis.c,
+ * and their replies checked. No server is needed.
+ *
+ *   test_dbx
+ *
+ * The rows of a reply are compared sorted, since the order of a scan is the
+ * one of the keyspace. Each row is its elements separated by spaces, and the
+ * rows are joined by "|".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mockredis.h"
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx);
+
+static int tests, failures;
+
+static int lineCmp(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Run a command of dbx through the mock, its rows, sorted unless the order
+ * is checked, or its error are written to out */
+void runArgs(int argc, const char **argv, int sorted, char *out, size_t cap) {
+  MockResult r;
+  mockCommand(&r, argc, argv);
+  if (r.error[0]) {
+    snprintf(out, cap, "%s", r.error);
+    return;
+  }
+  char *lines[256];
+  size_t n = 0;
+  for (char *s = strtok(r.text, "\n"); s != NULL && n < 256; s = strtok(NULL, "\n")) lines[n++] = s;
+  if (sorted) qsort(lines, n, sizeof(char*), lineCmp);
+  size_t len = 0;
+  out[0] = 0;
+  for (size_t i = 0; i < n && len < cap; i++)
+    len += snprintf(out + len, cap - len, "%s%s", i? "|": "", lines[i]);
+}
+
+void run(const char *cmd, const char *stm, int sorted, char *out, size_t cap) {
+  const char *argv[] = {cmd, stm};
+  runArgs(2, argv, sorted, out, cap);
+}
+
+void dbx(const char *stm, char *out, size_t cap) {
+  run("dbx", stm, 1, out, cap);
+}
+
+/* The reply of stm is expected */
+void check(const char *stm, const char *expected) {
+  char got[4096];
+  dbx(stm, got, sizeof(got));
+  tests++;
+  if (strcmp(got, expected) != 0) {
+    fprintf(stderr, "FAIL %s\n  expected: %s\n  got:      %s\n", stm, expected, got);
+    failures++;
+  }
+}
+
+/* The rows of a select on the cluster are expected in their order */
+void checkCluster(const char *stm, const char *expected) {
+  char got[4096];
+  run("dbx.cluster", stm, 0, got, sizeof(got));
+  tests++;
+  if (strcmp(got, expected) != 0) {
+    fprintf(stderr, "FAIL dbx.cluster %s\n  expected: %s\n  got:      %s\n", stm, expected, got);
+    failures++;
+  }
+}
+
+/* Both statements reply the same rows */
+void same(const char *a, const char *b) {
+  char ra[4096], rb[4096];
+  dbx(a, ra, sizeof(ra));
+  dbx(b, rb, sizeof(rb));
+  tests++;
+  if (strcmp(ra, rb) != 0) {
+    fprintf(stderr, "FAIL %s\n  %s\n  differs from %s\n  %s\n", a, ra, b, rb);
+    failures++;
+  }
+}
+
+/* The rows of the phonebook, both in a hash table and in a columnar one */
+void createPhonebook(void) {
+  const char *values = "values (1, 'Peter Nelson', 3, 'M', 1-456-1246-3421), (2, 'Betty Joan', 1, 'F', 1-123-1234-5678), "
+    "(3, 'Mary Smith', 2, 'F', 1-456-2222-1111), (4, 'Mattias Swensson', 10, 'M', 1-789-3333-2222), (5, 'Kevin Louis', 7, 'M', 1-456-4444-3333)";
+  char stm[1024];
+  check("create table pb (id key, name, pos, gender, tel)", "OK");
+  check("create table col (id key, name, pos, gender, tel) using columnar", "OK");
+  snprintf(stm, sizeof(stm), "insert into pb (id, name, pos, gender, tel) %s", values);
+  check(stm, "5 pb:1 pb:5");
+  snprintf(stm, sizeof(stm), "insert into col (id, name, pos, gender, tel) %s", values);
+  check(stm, "5 col:1 col:5");
+}
+
+void testWhere(void) {
+  check("select name from pb where pos = 3", "name Peter Nelson");
+  check("select name from pb where pos > 3", "name Kevin Louis|name Mattias Swensson");
+  check("select name from pb where pos <= 2", "name Betty Joan|name Mary Smith");
+  check("select name from pb where gender <> M", "name Betty Joan|name Mary Smith");
+  check("select name from pb where gender != F and pos < 5", "name Peter Nelson");
+  // integers compare by value, 10 > 7
+  check("select name from pb where pos >= 7", "name Kevin Louis|name Mattias Swensson");
+  check("select count(*) from pb where pos < 10", "count(*) 4");
+}
+
+void testOrInBetween(void) {
+  check("select name from pb where pos = 1 or pos = 10", "name Betty Joan|name Mattias Swensson");
+  check("select name from pb where gender = F or tel like 1-789%", "name Betty Joan|name Mary Smith|name Mattias Swensson");
+  check("select name from pb where pos in (1, 2, 7)", "name Betty Joan|name Kevin Louis|name Mary Smith");
+  check("select name from pb where tel in (1-456-1246-3421, 1-000)", "name Peter Nelson");
+  check("select name from pb where pos between 2 and 7", "name Kevin Louis|name Mary Smith|name Peter Nelson");
+  check("select name from pb where pos between 2 and 10", "name Kevin Louis|name Mary Smith|name Mattias Swensson|name Peter Nelson");
+  // and binds tighter than or
+  check("select name from pb where gender = M and pos < 5 or pos = 1", "name Betty Joan|name Peter Nelson");
+  check("select name from pb where gender = M and (pos < 5 or pos = 10)", "name Mattias Swensson|name Peter Nelson");
+  check("select name from pb where pos between 2 and 3 and (gender = F or tel like 1-456%)", "name Mary Smith|name Peter Nelson");
+  // primary key pinned by in and by or
+  check("select name from pb where id in (2, 4, 9)", "name Betty Joan|name Mattias Swensson");
+  check("select name from pb where id = 1 or id = 3", "name Mary Smith|name Peter Nelson");
+}
+
+void testLike(void) {
+  check("select name from pb where name like son", "name Mattias Swensson|name Peter Nelson");
+  check("select name from pb where name like %son", "name Mattias Swensson|name Peter Nelson");
+  check("select name from pb where name like pet%", "name Peter Nelson");
+  check("select name from pb where name like PET%", "name Peter Nelson");
+  check("select name from pb where name like %", "name Betty Joan|name Kevin Louis|name Mary Smith|name Mattias Swensson|name Peter Nelson");
+  check("select name from pb where name like m_tt%", "name Mattias Swensson");
+  check("select name from pb where name like %e_t%", "name Betty Joan");
+  check("select name from pb where name like b%n", "name Betty Joan");
+  check("select name from pb where name like x%", "");
+  check("select name from pb where name like %n%s%n%", "name Mattias Swensson|name Peter Nelson");
+  check("select name from pb where name like 'mary smith'", "name Mary Smith");
+  check("select name from pb where name like _", "");
+  check("select name from pb where name like %ou%", "name Kevin Louis");
+}
+
+/* Quoted values holding the syntax of the where clause */
+void testQuotes(void) {
+  check("create table q (id key, name, pos)", "OK");
+  check("insert into q (id, name, pos) values (1, 'x) y', 1), (2, 'p || q', 2), (3, 'a,b c', 3), (4, 'z z', 4)", "4 q:1 q:4");
+  check("select name from q where name = 'x) y' and pos > 0", "name x) y");
+  check("select name from q where name = 'x) y' && pos > 0", "name x) y");
+  check("select name from q where name = 'p || q' && pos > 0", "name p || q");
+  check("select name from q where name = 'x) y' or name = 'p || q'", "name p || q|name x) y");
+  check("select name from q where (name = 'x) y' or pos = 4) and pos < 3", "name x) y");
+  check("select name from q where name in ('a,b c', 'z z')", "name a,b c|name z z");
+  check("select name from q where name between 'a,b c' and 'p || q'", "name a,b c|name p || q");
+  check("select name from q where name like 'x) %'", "name x) y");
+  check("select name from q where name = 'Nobody'", "");
+  check("update q set name = 'c, d', pos = 9 where id = 3", "1");
+  check("select name, pos from q where id = 3", "name c, d pos 9");
+  check("update q set name = 'e=f, g' where name = 'c, d'", "1");
+  check("select name from q where pos = 9", "name e=f, g");
+  check("delete from q where name = 'p || q'", "1");
+  check("select count(*) from q", "count(*) 3");
+}
+
+/* The same statements on the hash table and on the columnar table */
+void testColumnar(void) {
+  const char *wheres[] = {
+    "pos = 3", "pos > 3", "pos >= 7", "pos < 10", "pos != 2", "pos between 2 and 10", "pos in (1, 10)",
+    "gender = F", "gender <> F", "gender in (M)", "name > L", "name like %son", "name like m%",
+    "tel like 1-456%", "pos = 1 or name like k%", "gender = M and pos < 5 or pos = 1", "id = 4", "id in (1, 5)",
+    "id between 2 and 4", NULL
+  };
+  char a[256], b[256];
+  for (int i = 0; wheres[i]; i++) {
+    snprintf(a, sizeof(a), "select name, pos from pb where %s", wheres[i]);
+    snprintf(b, sizeof(b), "select name, pos from col where %s", wheres[i]);
+    same(a, b);
+  }
+  same("select gender, count(*), sum(pos) from pb group by gender", "select gender, count(*), sum(pos) from col group by gender");
+  same("select count(*), min(pos), max(pos) from pb", "select count(*), min(pos), max(pos) from col");
+
+  // an integer column turning into strings compares the same
+  check("insert into pb (id, name, pos, gender, tel) values (6, 'Joan Cheng', 'n/a', 'F', 1-000-0000-0000)", "pb:6");
+  check("insert into col (id, name, pos, gender, tel) values (6, 'Joan Cheng', 'n/a', 'F', 1-000-0000-0000)", "col:6");
+  same("select name from pb where pos > 3", "select name from col where pos > 3");
+  same("select name from pb where pos < 3", "select name from col where pos < 3");
+  same("select name from pb where pos = n/a", "select name from col where pos = n/a");
+  check("delete from pb where id = 6", "1");
+  check("delete from col where id = 6", "1");
+}
+
+void testUpdateDelete(void) {
+  check("update pb set pos = 8 where name like %son", "2");
+  check("select name from pb where pos = 8", "name Mattias Swensson|name Peter Nelson");
+  check("update pb set id = 9 where id = 1", "primary key cannot be updated");
+  // delete ... like deletes the matching rows only
+  check("delete from pb where name like m%", "2");
+  check("select name from pb", "name Betty Joan|name Kevin Louis|name Peter Nelson");
+  check("select count(*) from pb", "count(*) 3");
+  check("delete from col where name like m%", "2");
+  check("select name from col", "name Betty Joan|name Kevin Louis|name Peter Nelson");
+  // a failing row writes none of the statement
+  check("insert into pb (id, name) values (20, 'Ann Larson'), (2, 'Betty Joan')", "duplicate key at row 2");
+  check("select count(*) from pb", "count(*) 3");
+  check("select name from pb where id = 20", "");
+  check("insert into col (id, name) values (20, 'Ann Larson'), (2, 'Betty Joan')", "duplicate key at row 2");
+  check("insert into col (id, name, nick) values (20, 'Ann Larson', 'Ann')", "unknown column at row 1");
+  check("insert into pb (name) values ('Ann Larson')", "primary key value is expected at row 1");
+  check("select count(*) from col", "count(*) 3");
+}
+
+void testJoin(void) {
+  check("create table customer (id key, name, city)", "OK");
+  check("insert into customer (id, name, city) values (1001, 'Peter Nelson', Oslo), (1002, 'Betty Joan', Rome), (1003, 'Mary Smith', Oslo)",
+    "3 customer:1001 customer:1003");
+  check("create table orders (id key, cust, amount)", "OK");
+  check("insert into orders (id, cust, amount) values (A001, 1001, 250), (A002, 1002, 80), (A003, 1001, 120), (A004, 1009, 300)",
+    "4 orders:A001 orders:A004");
+  // by the primary key of customer
+  check("select orders.id, customer.name from orders join customer on orders.cust = customer.id where orders.amount > 100",
+    "orders.id A001 customer.name Peter Nelson|orders.id A003 customer.name Peter Nelson");
+  check("select orders.id, customer.name from orders join customer on orders.cust = customer.id",
+    "orders.id A001 customer.name Peter Nelson|orders.id A002 customer.name Betty Joan|orders.id A003 customer.name Peter Nelson");
+  // by a hash table of the join values
+  check("create table visit (id key, city, day)", "OK");
+  check("insert into visit (id, city, day) values (1, Oslo, mon), (2, Paris, tue), (3, Rome, wed)", "3 visit:1 visit:3");
+  check("select customer.name, visit.day from customer join visit on customer.city = visit.city where visit.day != wed",
+    "customer.name Mary Smith visit.day mon|customer.name Peter Nelson visit.day mon");
+}
+
+void testView(void) {
+  check("create view genders as select gender, count(*), sum(pos) from pb group by gender", "OK");
+  check("select * from genders", "gender F count(*) 1 sum(pos) 1|gender M count(*) 2 sum(pos) 15");
+  check("insert into pb (id, name, pos, gender) values (30, 'Ann Larson', 4, 'F')", "pb:30");
+  check("select * from genders", "gender F count(*) 2 sum(pos) 5|gender M count(*) 2 sum(pos) 15");
+  // count(field) counts the values that are not numbers, they add nothing to a sum
+  check("create view names as select gender, count(name), avg(pos) from pb group by gender", "OK");
+  check("select * from names", "gender F count(name) 2 avg(pos) 2.5|gender M count(name) 2 avg(pos) 7.5");
+  check("update pb set name = 'Ann Lee' where id = 30", "1");
+  check("select * from names", "gender F count(name) 2 avg(pos) 2.5|gender M count(name) 2 avg(pos) 7.5");
+  check("update pb set name = 'Ann Larson' where id = 30", "1");
+}
+
+/* The csv import into a columnar table, and the dbx.restore commands it
+ * replicates its rows by */
+void testCsv(void) {
+  const char *file = "/tmp/test_dbx.csv";
+  FILE *fp = fopen(file, "w");
+  fputs("id,name,pos\n1,Ann,5\n2,Bob,6\n3,Cy\n4,Dan,8\n", fp);
+  fclose(fp);
+  check("create table csvc (id key, name, pos) using columnar", "OK");
+  // a short line stops the import, the rows before it are written
+  check("insert into csvc from \"/tmp/test_dbx.csv\"", "Number of values does not match");
+  check("select name, pos from csvc", "name Ann pos 5|name Bob pos 6");
+  check("select count(*) from csvc", "count(*) 2");
+
+  // a restored row replaces the row of its primary key
+  const char *restore[] = {"dbx.restore", "__dbx_data:csvc", "id,name,pos", "id", "10", "1", "=1", "=Ann", "", "7", "=7", "=Eve", "=3"};
+  char got[4096];
+  runArgs(13, restore, 1, got, sizeof(got));
+  tests++;
+  if (strcmp(got, "OK") != 0) {
+    fprintf(stderr, "FAIL dbx.restore\n  got: %s\n", got);
+    failures++;
+  }
+  check("select id, name, pos from csvc", "id 1 name Ann pos (nil)|id 2 name Bob pos 6|id 7 name Eve pos 3");
+  remove(file);
+}
+
+/* Outside of a cluster the node replies alone, through the partial results
+ * the coordinator merges */
+void testCluster(void) {
+  checkCluster("select name from pb order by pos", "name Betty Joan|name Ann Larson|name Kevin Louis|name Peter Nelson");
+  checkCluster("select name from pb order by pos desc", "name Peter Nelson|name Kevin Louis|name Ann Larson|name Betty Joan");
+  checkCluster("select top 2 name, pos from pb order by pos desc", "name Peter Nelson pos 8|name Kevin Louis pos 7");
+  checkCluster("select name from pb where gender = F order by name", "name Ann Larson|name Betty Joan");
+  checkCluster("select name from col order by pos desc", "name Kevin Louis|name Peter Nelson|name Betty Joan");
+  checkCluster("select gender, count(*) from pb group by gender order by gender", "gender F count(*) 2|gender M count(*) 2");
+  // with top clause only the first groups are kept for the sort
+  checkCluster("select top 3 name, count(*) from pb group by name order by name desc",
+    "name Peter Nelson count(*) 1|name Kevin Louis count(*) 1|name Betty Joan count(*) 1");
+  checkCluster("select top 1 gender, sum(pos) from pb group by gender order by gender desc", "gender M sum(pos) 15");
+}
+
+int main(int argc, char **argv) {
+  if (mockLoad(RedisModule_OnLoad) != REDISMODULE_OK) {
+    fprintf(stderr, "test_dbx: the module failed to load\n");
+    return 1;
+  }
+  createPhonebook();
+  testWhere();
+  testOrInBetween();
+  testLike();
+  testQuotes();
+  testColumnar();
+  testUpdateDelete();
+  testJoin();
+  testView();
+  testCluster();
+  testCsv();
+  if (failures) {
+    fprintf(stderr, "%d of %d tests failed\n", failures, tests);
+    return 1;
+  }
+  printf("PASS! %d tests\n", tests);
+  return 0;
+}
@@ -0,0 +1,163 @@
+#include "sketch.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t Sketch_Hash64(const void *key, size_t len, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+  const uint8_t *data = key;
+  const uint8_t *end = data + (len - (len & 7));
+
+  for (; data != end; data += 8) {
+    uint64_t k;
+    memcpy(&k, data, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  switch (len & 7) {
+    case 7: h ^= (uint64_t)data[6] << 48;
+    case 6: h ^= (uint64_t)data[5] << 40;
+    case 5: h ^= (uint64_t)data[4] << 32;
+    case 4: h ^= (uint64_t)data[3] << 24;
+    case 3: h ^= (uint64_t)data[2] << 16;
+    case 2: h ^= (uint64_t)data[1] << 8;
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+void HLL_Init(HLL *h) {
+  memset(h->registers, 0, sizeof(h->registers));
+}
+
+void HLL_Add(HLL *h, const void *data, size_t len) {
+  uint64_t hash = Sketch_Hash64(data, len, 0xadc83b19ULL);
+  size_t index = hash >> (64 - HLL_P);
+  // the rank is the position of the first 1 bit after the index bits, a
+  // guard bit keeps it within 64 - HLL_P + 1
+  uint64_t rest = (hash << HLL_P) | ((uint64_t)1 << (HLL_P - 1));
+  uint8_t rank = __builtin_clzll(rest) + 1;
+  if (rank > h->registers[index]) h->registers[index] = rank;
+}
+
+void HLL_Merge(HLL *dst, const HLL *src) {
+  for (size_t i = 0; i < HLL_REGISTERS; i++)
+    if (src->registers[i] > dst->registers[i]) dst->registers[i] = src->registers[i];
+}
+
+uint64_t HLL_Count(const HLL *h) {
+  double m = HLL_REGISTERS;
+  double sum = 0;
+  size_t zeros = 0;
+  for (size_t i = 0; i < HLL_REGISTERS; i++) {
+    sum += ldexp(1.0, -h->registers[i]);
+    if (h->registers[i] == 0) zeros++;
+  }
+  double estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+  // linear counting is more accurate for small cardinalities
+  if (estimate <= 2.5 * m && zeros > 0) estimate = m * log(m / zeros);
+  return (uint64_t)(estimate + 0.5);
+}
+
+void TDigest_Init(TDigest *t) {
+  memset(t, 0, sizeof(TDigest));
+  t->min = INFINITY;
+  t->max = -INFINITY;
+}
+
+static int compareCentroids(const void *a, const void *b) {
+  double x = ((const TDigestCentroid*)a)->mean, y = ((const TDigestCentroid*)b)->mean;
+  return (x > y) - (x < y);
+}
+
+/* k1 scale function, a merged centroid spans at most 1 of k */
+static double scale(double q) {
+  return TDIGEST_COMPRESSION / (2 * M_PI) * asin(2 * q - 1);
+}
+
+static void compress(TDigest *t) {
+  if (t->unmerged == 0) return;
+  size_t n = t->merged + t->unmerged;
+  TDigestCentroid *c = t->centroids;
+  qsort(c, n, sizeof(TDigestCentroid), compareCentroids);
+
+  double total = 0;
+  for (size_t i = 0; i < n; i++) total += c[i].weight;
+
+  size_t out = 0;
+  double before = 0;
+  TDigestCentroid cur = c[0];
+  double kLeft = scale(0);
+  for (size_t i = 1; i < n; i++) {
+    double weight = cur.weight + c[i].weight;
+    if (scale((before + weight) / total) - kLeft <= 1) {
+      cur.mean += (c[i].mean - cur.mean) * c[i].weight / weight;
+      cur.weight = weight;
+    }
+    else {
+      c[out++] = cur;
+      before += cur.weight;
+      kLeft = scale(before / total);
+      cur = c[i];
+    }
+  }
+  c[out++] = cur;
+  t->merged = out;
+  t->unmerged = 0;
+  t->total = total;
+}
+
+void TDigest_Add(TDigest *t, double value, double weight) {
+  if (isnan(value) || weight <= 0) return;
+  if (t->merged + t->unmerged == TDIGEST_SIZE) compress(t);
+  t->centroids[t->merged + t->unmerged].mean = value;
+  t->centroids[t->merged + t->unmerged].weight = weight;
+  t->unmerged++;
+  if (value < t->min) t->min = value;
+  if (value > t->max) t->max = value;
+}
+
+void TDigest_Merge(TDigest *dst, TDigest *src) {
+  double min = src->min, max = src->max;
+  compress(src);
+  for (size_t i = 0; i < src->merged; i++)
+    TDigest_Add(dst, src->centroids[i].mean, src->centroids[i].weight);
+  // the extremes are kept exactly
+  if (min < dst->min) dst->min = min;
+  if (max > dst->max) dst->max = max;
+}
+
+double TDigest_Quantile(TDigest *t, double q) {
+  compress(t);
+  if (t->merged == 0) return NAN;
+  if (q <= 0) return t->min;
+  if (q >= 1) return t->max;
+
+  TDigestCentroid *c = t->centroids;
+  double target = q * t->total;
+  // each centroid is centered at the middle of its weight, the values
+  // between two centers are interpolated linearly
+  double left = 0, center = c[0].weight / 2;
+  if (target < center)
+    return t->min + (c[0].mean - t->min) * target / center;
+  for (size_t i = 0; i + 1 < t->merged; i++) {
+    double next = left + c[i].weight + c[i+1].weight / 2;
+    if (target < next)
+      return c[i].mean + (c[i+1].mean - c[i].mean) * (target - center) / (next - center);
+    left += c[i].weight;
+    center = next;
+  }
+  double last = c[t->merged - 1].mean;
+  return last + (t->max - last) * (target - center) / (t->total - center);
+}
@@ -0,0 +1,54 @@
+#ifndef __RMUTIL_SKETCH_H__
+#define __RMUTIL_SKETCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** sketch.h - Fixed size mergeable sketches for approximate aggregates.
+ *
+ * The sketches are plain structs without pointers, so they can be copied,
+ * serialized or sent as they are, and the states built over separate parts of
+ * the data can be merged into the state of the whole.
+ */
+
+/* 64 bit MurmurHash2 (MurmurHash64A) */
+uint64_t Sketch_Hash64(const void *key, size_t len, uint64_t seed);
+
+/* HyperLogLog of 2^12 registers, i.e. 4KB and about 1.6% standard error */
+#define HLL_P 12
+#define HLL_REGISTERS (1 << HLL_P)
+
+typedef struct {
+  uint8_t registers[HLL_REGISTERS];
+} HLL;
+
+void HLL_Init(HLL *h);
+void HLL_Add(HLL *h, const void *data, size_t len);
+void HLL_Merge(HLL *dst, const HLL *src);
+uint64_t HLL_Count(const HLL *h);
+
+/* Merging t-digest of compression 100 in 256 centroids, i.e. 4KB. The
+ * quantiles near 0 and 1 are the most accurate. */
+#define TDIGEST_COMPRESSION 100
+#define TDIGEST_SIZE 256
+
+typedef struct {
+  double mean;
+  double weight;
+} TDigestCentroid;
+
+typedef struct {
+  size_t merged;     // centroids compressed
+  size_t unmerged;   // values appended after the merged centroids
+  double total;      // weight of all the centroids
+  double min, max;
+  TDigestCentroid centroids[TDIGEST_SIZE];
+} TDigest;
+
+void TDigest_Init(TDigest *t);
+void TDigest_Add(TDigest *t, double value, double weight);
+void TDigest_Merge(TDigest *dst, TDigest *src);
+/* The value at quantile q of [0, 1], NAN if the digest is empty */
+double TDigest_Quantile(TDigest *t, double q);
+
+#endif
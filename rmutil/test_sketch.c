@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <math.h>
+#include "sketch.h"
+#include "test.h"
+
+int testHLL() {
+  static HLL h, a, b;
+  HLL_Init(&h);
+  ASSERT_EQUAL(0, HLL_Count(&h));
+
+  char buf[32];
+  for (int i = 0; i < 100000; i++) {
+    int len = sprintf(buf, "value-%d", i % 50000);
+    HLL_Add(&h, buf, len);
+  }
+  uint64_t n = HLL_Count(&h);
+  ASSERT(n > 50000 * 0.95 && n < 50000 * 1.05);
+
+  // merging the halves is the same as adding them all
+  HLL_Init(&a);
+  HLL_Init(&b);
+  for (int i = 0; i < 50000; i++) {
+    int len = sprintf(buf, "value-%d", i);
+    HLL_Add(i % 2? &a: &b, buf, len);
+  }
+  HLL_Merge(&a, &b);
+  ASSERT_EQUAL(n, HLL_Count(&a));
+
+  HLL_Init(&a);
+  for (int i = 0; i < 10; i++) {
+    int len = sprintf(buf, "%d", i);
+    HLL_Add(&a, buf, len);
+  }
+  ASSERT_EQUAL(10, HLL_Count(&a));
+  return 0;
+}
+
+int testTDigest() {
+  static TDigest t, a, b;
+  TDigest_Init(&t);
+  ASSERT(isnan(TDigest_Quantile(&t, 0.5)));
+
+  // a shuffled sequence 0 .. 99999
+  for (int i = 0; i < 100000; i++)
+    TDigest_Add(&t, (i * 7919) % 100000, 1);
+  ASSERT_EQUAL(0, TDigest_Quantile(&t, 0));
+  ASSERT_EQUAL(99999, TDigest_Quantile(&t, 1));
+  ASSERT(fabs(TDigest_Quantile(&t, 0.5) - 50000) < 1000);
+  ASSERT(fabs(TDigest_Quantile(&t, 0.99) - 99000) < 200);
+  ASSERT(fabs(TDigest_Quantile(&t, 0.001) - 100) < 50);
+
+  TDigest_Init(&a);
+  TDigest_Init(&b);
+  for (int i = 0; i < 100000; i++)
+    TDigest_Add(i < 50000? &a: &b, i, 1);
+  TDigest_Merge(&a, &b);
+  ASSERT_EQUAL(0, TDigest_Quantile(&a, 0));
+  ASSERT_EQUAL(99999, TDigest_Quantile(&a, 1));
+  ASSERT(fabs(TDigest_Quantile(&a, 0.5) - 50000) < 1000);
+  ASSERT(fabs(TDigest_Quantile(&a, 0.9) - 90000) < 500);
+
+  TDigest_Init(&a);
+  TDigest_Add(&a, 42, 1);
+  ASSERT_EQUAL(42, TDigest_Quantile(&a, 0.5));
+  return 0;
+}
+
+TEST_MAIN({
+  TESTFUNC(testHLL);
+  TESTFUNC(testTDigest);
+});
@@ -1,15 +1,248 @@
+#define REDISMODULE_EXPERIMENTAL_API
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <stdint.h>
 #include <regex.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
+#include <math.h>
 #include "../redismodule.h"
 #include "../rmutil/util.h"
 #include "../rmutil/strings.h"
 #include "../rmutil/vector.h"
+#include "../rmutil/sketch.h"
+#include "../rmutil/periodic.h"
 #include "../rmutil/test_util.h"
 
 static int rn;
 
+/* Statement statistics. Each statement type counts its calls, the keys it
+ * scanned, the rows matching its where clause, the fields it fetched and the
+ * rows it returned, sorted and exported, with its latency in a log-linear
+ * histogram of 4 buckets per power of two microseconds. The counters of the
+ * running statement are reached by curStats, so the scan adds to them once
+ * per key or per batch. */
+#define STAT_SELECT  0
+#define STAT_INSERT  1
+#define STAT_UPDATE  2
+#define STAT_DELETE  3
+#define STAT_CREATE  4
+#define STAT_CLUSTER 5
+#define STAT_TYPES   6
+#define LATENCY_BUCKETS 160
+
+typedef struct StmtStats {
+  long long calls, errors, usec, maxUsec;
+  long long scanned, matched, fetched, returned, sorted, exported;
+  long long latency[LATENCY_BUCKETS];
+} StmtStats;
+
+static StmtStats stats[STAT_TYPES];
+static StmtStats noStats;  // the work done outside of a statement
+static StmtStats *curStats = &noStats;
+#define STAT(counter, n) (curStats->counter += (n))
+
+/* Stage timings of the running statement for the slow log and explain
+ * analyze. The time since the previous lap is added to the stage which just
+ * ended, so a stage costs a clock read where it ends, once per batch on the
+ * scan. The stages are the operators of the plan, each counting the rows
+ * going in and out of it and the most memory it held. Nothing is traced when
+ * the slow log is off, unless the statement is explained. */
+#define STAGE_PARSE   0
+#define STAGE_SCAN    1
+#define STAGE_PROBE   2
+#define STAGE_FETCH   3
+#define STAGE_FILTER  4
+#define STAGE_SORT    5
+#define STAGE_TOP     6
+#define STAGE_PROJECT 7
+#define STAGE_SINK    8
+#define STAGE_WRITE   9
+#define STAGES        10
+
+typedef struct StmtTrace {
+  long long lap;
+  long long stages[STAGES];
+  long long rowsIn[STAGES], rowsOut[STAGES];
+  size_t mem[STAGES];
+  const char *path;  // the access path of the rows
+} StmtTrace;
+
+static const char *stageNames[STAGES] = {"parse", "scan", "probe", "fetch", "filter", "sort", "top",
+  "project", "sink", "write"};
+
+static StmtTrace *curTrace;
+
+/* Monotonic clock in microseconds */
+long long monotonicUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void stageLap(int stage) {
+  long long now = monotonicUs();
+  curTrace->stages[stage] += now - curTrace->lap;
+  curTrace->lap = now;
+}
+
+#define STAGE(stage) do { if (curTrace != NULL) stageLap(stage); } while (0)
+#define TRACE_PATH(p) do { if (curTrace != NULL && curTrace->path == NULL) curTrace->path = (p); } while (0)
+#define TRACE_ROWS(stage, in, out) do { \
+    if (curTrace != NULL) { curTrace->rowsIn[stage] += (in); curTrace->rowsOut[stage] += (out); } \
+  } while (0)
+#define TRACE_MEM(stage, bytes) do { \
+    if (curTrace != NULL && (size_t)(bytes) > curTrace->mem[stage]) curTrace->mem[stage] = (bytes); \
+  } while (0)
+
+/* Replies of the select path. They go to the client, unless replyCapture is
+ * set by a caller running the statement for its own use, the cluster or
+ * explain, in which case they are encoded as encodeReply does. The lengths
+ * of postponed arrays are patched when they are set. */
+#define CAPTURE_DEPTH 8
+
+typedef struct PartialBuf {
+  char *p;
+  size_t len, cap;
+} PartialBuf;
+
+void partialPut(PartialBuf *b, const void *v, size_t len) {
+  if (b->len + len > b->cap) {
+    b->cap = b->cap? 2 * b->cap: 256;
+    if (b->cap < b->len + len) b->cap = b->len + len;
+    b->p = RedisModule_Realloc(b->p, b->cap);
+  }
+  memcpy(b->p + b->len, v, len);
+  b->len += len;
+}
+
+/* Encode a reply as a type byte followed by its length and bytes, its
+ * integer, or its length and elements */
+void encodeReply(PartialBuf *b, RedisModuleCallReply *rep) {
+  int8_t type = rep? RedisModule_CallReplyType(rep): REDISMODULE_REPLY_NULL;
+  partialPut(b, &type, sizeof(type));
+  if (type == REDISMODULE_REPLY_STRING || type == REDISMODULE_REPLY_ERROR) {
+    size_t len;
+    const char *s = RedisModule_CallReplyStringPtr(rep, &len);
+    uint32_t len32 = len;
+    partialPut(b, &len32, sizeof(len32));
+    partialPut(b, s, len32);
+  }
+  else if (type == REDISMODULE_REPLY_INTEGER) {
+    long long ll = RedisModule_CallReplyInteger(rep);
+    partialPut(b, &ll, sizeof(ll));
+  }
+  else if (type == REDISMODULE_REPLY_ARRAY) {
+    uint32_t n = RedisModule_CallReplyLength(rep);
+    partialPut(b, &n, sizeof(n));
+    for (uint32_t i = 0; i < n; i++)
+      encodeReply(b, RedisModule_CallReplyArrayElement(rep, i));
+  }
+}
+
+void encodeError(PartialBuf *b, const char *err) {
+  int8_t type = REDISMODULE_REPLY_ERROR;
+  uint32_t len32 = strlen(err);
+  partialPut(b, &type, sizeof(type));
+  partialPut(b, &len32, sizeof(len32));
+  partialPut(b, err, len32);
+}
+
+typedef struct ReplyCapture {
+  PartialBuf buf;
+  size_t open[CAPTURE_DEPTH];  // offsets of the lengths of postponed arrays
+  int depth;
+} ReplyCapture;
+
+static ReplyCapture *replyCapture;
+
+void capturePut(int type, const void *v, size_t len) {
+  int8_t t = type;
+  partialPut(&replyCapture->buf, &t, sizeof(t));
+  if (type == REDISMODULE_REPLY_STRING || type == REDISMODULE_REPLY_ERROR) {
+    uint32_t len32 = len;
+    partialPut(&replyCapture->buf, &len32, sizeof(len32));
+  }
+  if (v != NULL) partialPut(&replyCapture->buf, v, len);
+}
+
+void replyArray(RedisModuleCtx *ctx, long len) {
+  if (replyCapture == NULL) {
+    RedisModule_ReplyWithArray(ctx, len);
+    return;
+  }
+  uint32_t n = len == REDISMODULE_POSTPONED_ARRAY_LEN? 0: len;
+  capturePut(REDISMODULE_REPLY_ARRAY, NULL, 0);
+  if (len == REDISMODULE_POSTPONED_ARRAY_LEN && replyCapture->depth < CAPTURE_DEPTH)
+    replyCapture->open[replyCapture->depth++] = replyCapture->buf.len;
+  partialPut(&replyCapture->buf, &n, sizeof(n));
+}
+
+void replySetArrayLength(RedisModuleCtx *ctx, long len) {
+  if (replyCapture == NULL) {
+    RedisModule_ReplySetArrayLength(ctx, len);
+    return;
+  }
+  if (replyCapture->depth == 0) return;
+  uint32_t n = len;
+  memcpy(replyCapture->buf.p + replyCapture->open[--replyCapture->depth], &n, sizeof(n));
+}
+
+void replyStringBuffer(RedisModuleCtx *ctx, const char *buf, size_t len) {
+  if (replyCapture == NULL) RedisModule_ReplyWithStringBuffer(ctx, buf, len);
+  else capturePut(REDISMODULE_REPLY_STRING, buf, len);
+}
+
+void replyString(RedisModuleCtx *ctx, RedisModuleString *str) {
+  if (replyCapture == NULL) {
+    RedisModule_ReplyWithString(ctx, str);
+    return;
+  }
+  size_t len;
+  const char *buf = RedisModule_StringPtrLen(str, &len);
+  capturePut(REDISMODULE_REPLY_STRING, buf, len);
+}
+
+void replySimpleString(RedisModuleCtx *ctx, const char *msg) {
+  if (replyCapture == NULL) RedisModule_ReplyWithSimpleString(ctx, msg);
+  else capturePut(REDISMODULE_REPLY_STRING, msg, strlen(msg));
+}
+
+void replyLongLong(RedisModuleCtx *ctx, long long ll) {
+  if (replyCapture == NULL) RedisModule_ReplyWithLongLong(ctx, ll);
+  else capturePut(REDISMODULE_REPLY_INTEGER, &ll, sizeof(ll));
+}
+
+// A double is replied as a bulk string, as Redis does
+void replyDouble(RedisModuleCtx *ctx, double d) {
+  if (replyCapture == NULL) {
+    RedisModule_ReplyWithDouble(ctx, d);
+    return;
+  }
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), "%.17g", d);
+  capturePut(REDISMODULE_REPLY_STRING, buf, len);
+}
+
+void replyNull(RedisModuleCtx *ctx) {
+  if (replyCapture == NULL) RedisModule_ReplyWithNull(ctx);
+  else capturePut(REDISMODULE_REPLY_NULL, NULL, 0);
+}
+
+void replyError(RedisModuleCtx *ctx, const char *err) {
+  if (replyCapture == NULL) RedisModule_ReplyWithError(ctx, err);
+  else capturePut(REDISMODULE_REPLY_ERROR, err, strlen(err));
+}
+
+void replyCallReply(RedisModuleCtx *ctx, RedisModuleCallReply *reply) {
+  if (replyCapture == NULL) RedisModule_ReplyWithCallReply(ctx, reply);
+  else encodeReply(&replyCapture->buf, reply);
+}
+
+void viewsRowChanged(RedisModuleCtx *ctx, RedisModuleString *key);
+
 /* Helper function: compiles a regex, or dies complaining. */
 int regexCompile(RedisModuleCtx *ctx, regex_t *r, const char *t) {
   int status = regcomp(r, t, REG_EXTENDED | REG_NOSUB | REG_NEWLINE);
@@ -19,7 +252,7 @@ int regexCompile(RedisModuleCtx *ctx, regex_t *r, const char *t) {
     char err[256];
     regerror(status, r, rerr, 128);
     sprintf(err, "ERR regex compilation failed: %s", rerr);
-    RedisModule_ReplyWithError(ctx, err);
+    replyError(ctx, err);
     return status;
   }
 
@@ -28,6 +261,7 @@ int regexCompile(RedisModuleCtx *ctx, regex_t *r, const char *t) {
 
 char* trim(char* s, char t) {
   char* p = s;
+  if (*p == 0) return p;
   if (p[strlen(s)-1] == t) p[strlen(s)-1] = 0;
   if (p[0] == t) p++;
   return p;
@@ -54,64 +288,521 @@ char* VectorGetString(Vector *v, size_t i) {
   return value;
 }
 
-int whereRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vWhere) {
-  //char *field;
-  char *w;
-  int condition;
-  int match = 1;
+/* Table catalog. A table created by the create statement is described by the
+ * hash __dbx_table:<name>, so the definition is kept in RDB and AOF together
+ * with the rows. Tables which are not in catalog are still accessible as the
+ * plain hashes of the key prefix. */
+#define CATALOG_PREFIX "__dbx_table:"
 
-  // If where statement is defined, get the specified hash content and do comparison
+/* Hash tagged row keys. The rows of a table created with "buckets 1" are
+ * named {<name>}:<id>, so the whole table is in one cluster slot. With
+ * "buckets <n>" they are spread over n tags {<name>:<bucket>}, the bucket
+ * being a hash of the id or primary key, so the table is in n slots. */
+#define MAX_BUCKETS 16384
+
+typedef struct {
+  char name[128];
+  char key[128];      // primary key column, empty if rows are named by row id
+  char pattern[160];  // regex of the row keys, a defined table owns <name>:*
+  int buckets;        // the row keys are hash tagged by bucket if > 0
+  int defined;        // 1 if the table is created by the create statement
+  int counted;        // 1 if the number of rows is maintained in catalog
+  int columnar;       // 1 if the rows are kept by the native column store
+  long long rows;
+} Table;
+
+int loadTable(RedisModuleCtx *ctx, const char *name, Table *t) {
+  memset(t, 0, sizeof(Table));
+  if (strlen(name) >= sizeof(t->name)) return 0;
+  strcpy(t->name, name);
+
+  RedisModuleString *catalog = RedisModule_CreateStringPrintf(ctx, CATALOG_PREFIX "%s", name);
+  RedisModuleKey *ckey = RedisModule_OpenKey(ctx, catalog, REDISMODULE_READ);
+  if (RedisModule_KeyType(ckey) == REDISMODULE_KEYTYPE_HASH) {
+    RedisModuleString *columns = NULL, *key = NULL, *rows = NULL, *storage = NULL, *buckets = NULL;
+    RedisModule_HashGet(ckey, REDISMODULE_HASH_CFIELDS, "columns", &columns, "key", &key, "rows", &rows,
+      "storage", &storage, "buckets", &buckets, NULL);
+    if (key) {
+      size_t len;
+      const char *k = RedisModule_StringPtrLen(key, &len);
+      if (len < sizeof(t->key)) strcpy(t->key, k);
+      RedisModule_FreeString(ctx, key);
+    }
+    if (rows) {
+      t->counted = RedisModule_StringToLongLong(rows, &t->rows) == REDISMODULE_OK;
+      RedisModule_FreeString(ctx, rows);
+    }
+    if (storage) {
+      t->columnar = strcmp(RedisModule_StringToChar(storage), "columnar") == 0;
+      RedisModule_FreeString(ctx, storage);
+    }
+    if (buckets) {
+      long long n;
+      if (RedisModule_StringToLongLong(buckets, &n) == REDISMODULE_OK && n > 0 && n <= MAX_BUCKETS)
+        t->buckets = n;
+      RedisModule_FreeString(ctx, buckets);
+    }
+    if (columns) {
+      t->defined = 1;
+      RedisModule_FreeString(ctx, columns);
+    }
+  }
+  RedisModule_CloseKey(ckey);
+  RedisModule_FreeString(ctx, catalog);
+
+  // the hash tag of a table with buckets is {<name>} or {<name>:<bucket>}
+  if (t->buckets == 1)
+    sprintf(t->pattern, "^\\{%s\\}:", name);
+  else if (t->buckets > 1)
+    sprintf(t->pattern, "^\\{%s:[0-9]+\\}:", name);
+  else if (t->defined)
+    sprintf(t->pattern, "^%s:", name);
+  else
+    strcpy(t->pattern, name);
+  return t->defined;
+}
+
+/* Maintain the number of rows of a defined table after a statement. The
+ * count of a columnar table is not propagated, as its statements are
+ * replicated verbatim and count the rows again on the replica. */
+void updateRowCount(RedisModuleCtx *ctx, Table *t, long long delta) {
+  if (!t->counted || delta == 0) return;
+  RedisModuleString *catalog = RedisModule_CreateStringPrintf(ctx, CATALOG_PREFIX "%s", t->name);
+  RedisModuleCallReply *rep = RedisModule_Call(ctx, "HINCRBY", "scl", catalog, "rows", delta);
+  t->rows = RedisModule_CallReplyInteger(rep);
+  RedisModule_FreeCallReply(rep);
+  if (!t->columnar) RedisModule_Replicate(ctx, "HINCRBY", "scl", catalog, "rows", delta);
+  RedisModule_FreeString(ctx, catalog);
+}
+
+/* Count the existing rows of a table by scanning the keys matching glob */
+long long countRows(RedisModuleCtx *ctx, const char *glob) {
+  RedisModuleString *match = RedisModule_CreateString(ctx, glob, strlen(glob));
+  RedisModuleString *scursor = RedisModule_CreateStringFromLongLong(ctx, 0);
+  long long lcursor, rows = 0;
+  do {
+    RedisModuleCallReply *rep = RedisModule_Call(ctx, "SCAN", "scsl", scursor, "MATCH", match, "COUNT", 1000LL);
+    RedisModule_FreeString(ctx, scursor);
+    scursor = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(rep, 0));
+    RedisModule_StringToLongLong(scursor, &lcursor);
+    rows += RedisModule_CallReplyLength(RedisModule_CallReplyArrayElement(rep, 1));
+    RedisModule_FreeCallReply(rep);
+  } while (lcursor);
+  RedisModule_FreeString(ctx, scursor);
+  RedisModule_FreeString(ctx, match);
+  return rows;
+}
+
+/* Check if the key belongs to the table pattern. The internal keys of the
+ * module (catalog and temporary sets) are never part of a table. */
+int matchKey(regex_t *r, const char *s) {
+  return strncmp(s, "__db", 4) != 0 && !regexec(r, s, 1, NULL, 0);
+}
+
+/* The hash tag of a bucket of the table */
+void bucketTag(Table *t, unsigned bucket, char *tag /*160*/) {
+  if (t->buckets == 1) sprintf(tag, "{%s}", t->name);
+  else sprintf(tag, "{%s:%u}", t->name, bucket);
+}
+
+/* The key of a row by its row id or primary key value */
+RedisModuleString *rowKey(RedisModuleCtx *ctx, Table *t, const char *id) {
+  if (t->buckets == 0)
+    return RedisModule_CreateStringPrintf(ctx, "%s:%s", t->name, id);
+  char tag[160];
+  bucketTag(t, Sketch_Hash64(id, strlen(id), 0) % t->buckets, tag);
+  return RedisModule_CreateStringPrintf(ctx, "%s:%s", tag, id);
+}
+
+/* The keys of a table matching its pattern. The key space is walked by SCAN,
+ * except for a table with buckets in a cluster: a bucket is a single slot, so
+ * its keys are listed by CLUSTER GETKEYSINSLOT, and the slots held by other
+ * nodes cost a single call. */
+typedef struct KeyScan {
+  Table *table;
+  regex_t *regex;
+  int bySlot;
+  long long cursor;  // SCAN cursor, or the next bucket
+  int done;
+  RedisModuleCallReply *rep, *keys;
+  size_t i, n;
+} KeyScan;
+
+void keyScanInit(RedisModuleCtx *ctx, KeyScan *s, Table *t, regex_t *r) {
+  memset(s, 0, sizeof(KeyScan));
+  s->table = t;
+  s->regex = r;
+  s->bySlot = t->buckets > 0 && (RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_CLUSTER);
+}
+
+/* The next key of the table, or NULL at the end. The key is freed by the
+ * caller. */
+RedisModuleString *keyScanNext(RedisModuleCtx *ctx, KeyScan *s) {
+  while (1) {
+    while (s->i < s->n) {
+      RedisModuleString *key = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(s->keys, s->i++));
+      STAT(scanned, 1);
+      if (matchKey(s->regex, RedisModule_StringToChar(key))) {
+        TRACE_ROWS(STAGE_SCAN, 1, 1);
+        return key;
+      }
+      TRACE_ROWS(STAGE_SCAN, 1, 0);
+      RedisModule_FreeString(ctx, key);
+    }
+    if (s->rep != NULL) RedisModule_FreeCallReply(s->rep);
+    s->rep = s->keys = NULL;
+    s->i = s->n = 0;
+    if (s->done) return NULL;
+
+    if (s->bySlot) {
+      char tag[160];
+      bucketTag(s->table, s->cursor, tag);
+      if (++s->cursor >= s->table->buckets) s->done = 1;
+      RedisModuleCallReply *rep = RedisModule_Call(ctx, "CLUSTER", "cc", "KEYSLOT", tag);
+      long long slot = RedisModule_CallReplyInteger(rep);
+      RedisModule_FreeCallReply(rep);
+      rep = RedisModule_Call(ctx, "CLUSTER", "cl", "COUNTKEYSINSLOT", slot);
+      long long count = RedisModule_CallReplyInteger(rep);
+      RedisModule_FreeCallReply(rep);
+      if (count <= 0) continue;
+      s->rep = s->keys = RedisModule_Call(ctx, "CLUSTER", "cll", "GETKEYSINSLOT", slot, count);
+    }
+    else {
+      s->rep = RedisModule_Call(ctx, "SCAN", "l", s->cursor);
+      size_t len;
+      const char *cursor = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(s->rep, 0), &len);
+      s->cursor = cursor? strtoll(cursor, NULL, 10): 0;
+      if (s->cursor == 0) s->done = 1;
+      s->keys = RedisModule_CallReplyArrayElement(s->rep, 1);
+    }
+    if (s->keys != NULL && RedisModule_CallReplyType(s->keys) == REDISMODULE_REPLY_ARRAY)
+      s->n = RedisModule_CallReplyLength(s->keys);
+  }
+}
+
+void keyScanFree(KeyScan *s) {
+  if (s->rep != NULL) RedisModule_FreeCallReply(s->rep);
+  s->rep = NULL;
+}
+
+/* Row id allocator. Each table owns a 64-bit counter "rowid" in its catalog
+ * hash. A statement reserves a block of ids by a single HINCRBY, which is
+ * propagated with the rows named by the ids, so the counter survives
+ * restarts, and then hands them out by increment.
+ * The ids are encoded in base-62 to keep the row keys short. */
+#define ROWID_BLOCK 1024
+
+typedef struct {
+  char name[128];
+  long long next;   // next id to hand out
+  long long end;    // end of the reserved block (exclusive)
+  long long block;  // number of ids of the next reservation
+} RowIdBlock;
+
+void initRowIds(RowIdBlock *ids, const char *name, long long block) {
+  memset(ids, 0, sizeof(RowIdBlock));
+  if (strlen(name) < sizeof(ids->name)) strcpy(ids->name, name);
+  ids->block = block > 0? block: 1;
+}
+
+long long nextRowId(RedisModuleCtx *ctx, RowIdBlock *ids) {
+  if (ids->next == ids->end) {
+    RedisModuleString *catalog = RedisModule_CreateStringPrintf(ctx, CATALOG_PREFIX "%s", ids->name);
+    RedisModuleCallReply *rep = RedisModule_Call(ctx, "HINCRBY", "scl", catalog, "rowid", ids->block);
+    ids->end = RedisModule_CallReplyInteger(rep) + 1;
+    ids->next = ids->end - ids->block;
+    RedisModule_FreeCallReply(rep);
+    RedisModule_Replicate(ctx, "HINCRBY", "scl", catalog, "rowid", ids->block);
+    RedisModule_FreeString(ctx, catalog);
+  }
+  return ids->next++;
+}
+
+/* Encode the row id in base-62 at the end of buf of 12 bytes */
+const char *encodeRowId(char *buf, unsigned long long id) {
+  static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  char *p = &buf[11];
+  *p = 0;
+  do {
+    *--p = digits[id % 62];
+    id /= 62;
+  } while (id);
+  return p;
+}
+
+RedisModuleString *nextRowKey(RedisModuleCtx *ctx, Table *t, RowIdBlock *ids) {
+  char buf[12];
+  return rowKey(ctx, t, encodeRowId(buf, nextRowId(ctx, ids)));
+}
+
+/* Write n field/value pairs into an opened hash key. RedisModule_HashSet is
+ * variadic and stops at the first NULL field, so the pairs are passed in
+ * fixed size batches padded by NULL. A row of up to HASHSET_BATCH fields costs
+ * a single call. */
+#define HASHSET_BATCH 8
+void hashSetFields(RedisModuleKey *key, char **fields, RedisModuleString **values, size_t n) {
+  for (size_t i = 0; i < n; i += HASHSET_BATCH) {
+    void *p[2 * HASHSET_BATCH] = {NULL};
+    for (size_t j = 0; j < HASHSET_BATCH && i + j < n; j++) {
+      p[2*j] = fields[i+j];
+      p[2*j+1] = values[i+j];
+    }
+    RedisModule_HashSet(key, REDISMODULE_HASH_CFIELDS,
+      p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7],
+      p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15], NULL);
+  }
+}
+
+/* Replication of the statements. A statement on hash tables replicates its
+ * effects: each row written through the key API is propagated as HSET, and
+ * each command it runs on the rows or the catalog by RedisModule_Replicate
+ * too, so they reach the replicas and AOF together and in order, and a
+ * replica needs neither the rows nor the file the statement read. A
+ * statement on a columnar table is replicated verbatim instead, since the
+ * column store is not written by commands, and none of its writes is
+ * propagated on its own. The two are never mixed in a statement. */
+void replicateRow(RedisModuleCtx *ctx, RedisModuleString *key, char **fields, RedisModuleString **values, size_t n) {
+  if (n == 0) return;
+  RedisModuleString *args[2 * n];
+  for (size_t i = 0; i < n; i++) {
+    args[2*i] = RedisModule_CreateString(ctx, fields[i], strlen(fields[i]));
+    args[2*i+1] = values[i];
+  }
+  RedisModule_Replicate(ctx, "HSET", "sv", key, args, 2 * n);
+  for (size_t i = 0; i < n; i++)
+    RedisModule_FreeString(ctx, args[2*i]);
+}
+
+/* Read n fields of an opened hash key in the same batches as hashSetFields.
+ * The missing fields are returned as NULL. */
+void hashGetFields(RedisModuleKey *key, char **fields, RedisModuleString **values, size_t n) {
+  for (size_t i = 0; i < n; i += HASHSET_BATCH) {
+    void *p[2 * HASHSET_BATCH] = {NULL};
+    for (size_t j = 0; j < HASHSET_BATCH && i + j < n; j++) {
+      p[2*j] = fields[i+j];
+      p[2*j+1] = &values[i+j];
+    }
+    RedisModule_HashGet(key, REDISMODULE_HASH_CFIELDS,
+      p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7],
+      p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15], NULL);
+  }
+}
+
+/* Pattern of like, compiled once per statement. % matches any run of bytes
+ * and _ a single byte, case insensitively. A pattern without wildcards
+ * matches anywhere in the value as %pattern%. The common shapes compare a
+ * literal: pat% is a prefix, %pat a suffix and %pat% a search skipping by
+ * the last byte of the window (Horspool), the others are matched by
+ * backtracking to the last %. */
+#define LIKE_ANY      0  // %
+#define LIKE_PREFIX   1
+#define LIKE_SUFFIX   2
+#define LIKE_INFIX    3
+#define LIKE_GENERAL  4
+
+typedef struct LikePattern {
+  int kind;
+  const char *lit;     // the literal of prefix, suffix and infix
+  size_t len;
+  uint8_t skip[256];   // shift of infix by the last byte of the window
+  char text[];         // the folded pattern
+} LikePattern;
+
+/* Case folding of the bytes, so that matching neither lowercases the value
+ * nor depends on the locale */
+static unsigned char foldTable[256];
+
+void foldInit(void) {
+  for (int c = 0; c < 256; c++)
+    foldTable[c] = c >= 'A' && c <= 'Z'? c - 'A' + 'a': c;
+}
+
+static inline int foldEqual(const char *s, const char *lit, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    if (foldTable[(unsigned char)s[i]] != (unsigned char)lit[i]) return 0;
+  return 1;
+}
+
+int likeGeneral(const char *s, size_t len, const char *p) {
+  const char *star = NULL;
+  size_t i = 0, mark = 0;
+  while (i < len) {
+    if (*p == '%') {
+      star = ++p;
+      mark = i;
+    }
+    else if (*p && (*p == '_' || (unsigned char)*p == foldTable[(unsigned char)s[i]])) {
+      p++;
+      i++;
+    }
+    else if (star) {
+      p = star;
+      i = ++mark;
+    }
+    else return 0;
+  }
+  while (*p == '%') p++;
+  return *p == 0;
+}
+
+int likeMatch(const LikePattern *p, const char *s, size_t len) {
+  size_t m = p->len;
+  switch (p->kind) {
+    case LIKE_ANY: return 1;
+    case LIKE_PREFIX: return len >= m && foldEqual(s, p->lit, m);
+    case LIKE_SUFFIX: return len >= m && foldEqual(s + len - m, p->lit, m);
+    case LIKE_INFIX: {
+      if (len < m) return 0;
+      unsigned char last = p->lit[m - 1];
+      for (size_t i = 0; i <= len - m; ) {
+        unsigned char c = foldTable[(unsigned char)s[i + m - 1]];
+        if (c == last && foldEqual(s + i, p->lit, m - 1)) return 1;
+        i += p->skip[c];
+      }
+      return 0;
+    }
+  }
+  return likeGeneral(s, len, p->text);
+}
+
+/* Operators of where clause beyond the comparisons 0 to 6 and like 7. The
+ * value of in is the vector of its values, and a group of or takes the
+ * place of a condition with the vector of its alternatives as value, each a
+ * conjunction of conditions itself. Between is parsed into >= and <=. */
+#define WHERE_IN       8
+#define WHERE_BETWEEN  9
+#define WHERE_OR       10
+
+/* The operator of a condition, which is kept as a pointer sized element */
+int whereOp(Vector *vWhere, size_t i) {
+  void *op = NULL;
+  Vector_Get(vWhere, i, &op);
+  return (int)(intptr_t)op;
+}
+
+/* The value of a condition, a like keeps its compiled pattern instead */
+LikePattern *whereLike(Vector *vWhere, size_t i) {
+  LikePattern *p = NULL;
+  if (whereOp(vWhere, i+1) == 7) Vector_Get(vWhere, i+2, &p);
+  return p;
+}
+
+/* The values of in, or the alternatives of or */
+Vector *whereList(Vector *vWhere, size_t i) {
+  Vector *list = NULL;
+  int op = whereOp(vWhere, i+1);
+  if (op == WHERE_IN || op == WHERE_OR) Vector_Get(vWhere, i+2, &list);
+  return list;
+}
+
+char *whereValue(Vector *vWhere, size_t i) {
+  LikePattern *p = whereLike(vWhere, i);
+  return p? p->text: whereList(vWhere, i)? "": VectorGetString(vWhere, i+2);
+}
+
+/* Parse a value which is an integer written in its canonical form, so that
+ * it is written back the same: no sign but a minus, no leading zero */
+int parseInt64(const char *s, long long *ll) {
+  const char *p = s + (*s == '-');
+  size_t len = strlen(p);
+  if (len == 0 || len > 19 || (p[0] == '0' && (len > 1 || p != s))) return 0;
+  for (size_t i = 0; i < len; i++)
+    if (p[i] < '0' || p[i] > '9') return 0;
+  errno = 0;
+  *ll = strtoll(s, NULL, 10);
+  return errno == 0;
+}
+
+/* Order a value against the literal of a comparison. A value and a literal
+ * which are both integers compare as numbers, anything else as text, so the
+ * result does not depend on how a table keeps its values. */
+int whereCompare(const char *s, const char *w) {
+  long long a, b;
+  if (parseInt64(w, &b) && parseInt64(s, &a)) return (a > b) - (a < b);
+  return strcmp(s, w);
+}
+
+/* Evaluate a comparison of where clause on a value, like is evaluated by
+ * likeMatch. Equal integers are equal text, so only the ranges need the
+ * order of whereCompare. */
+int compareValue(const char *s, int op, const char *w) {
+  switch (op) {
+    case 0: return whereCompare(s, w) >= 0;
+    case 1: return whereCompare(s, w) <= 0;
+    case 2:
+    case 3: return strcmp(s, w) != 0;
+    case 4: return whereCompare(s, w) > 0;
+    case 5: return whereCompare(s, w) < 0;
+    case 6: return strcmp(s, w) == 0;
+  }
+  return 0;
+}
+
+int inList(Vector *list, const char *s) {
+  for (int i = 0; i < Vector_Size(list); i++)
+    if (strcmp(s, VectorGetString(list, i)) == 0) return 1;
+  return 0;
+}
+
+/* Evaluate the condition i of a conjunction on a value of its field. The
+ * value of a comparison or like must not be empty. */
+int whereValueMatch(Vector *vWhere, size_t i, const char *s, size_t len) {
+  int op = whereOp(vWhere, i+1);
+  if (op == WHERE_IN) return inList(whereList(vWhere, i), s);
+  if (op == 7) return likeMatch(whereLike(vWhere, i), s, len);
+  const char *w = VectorGetString(vWhere, i+2);
+  return strlen(w) > 0 && compareValue(s, op, w);
+}
+
+/* Evaluate the conjunction on the row, a condition at a time until one is
+ * false. A group of or is true by its first true alternative, and in by its
+ * first equal value. */
+int whereMatch(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vWhere) {
   size_t n = Vector_Size(vWhere);
-  if (n == 0) return 1;
   if (n % 3 != 0) return 0;
   for (size_t i = 0; i < n; i += 3) {
-    // Vector_Get(vWhere, i, &field);
-    Vector_Get(vWhere, i+1, &condition);
-    Vector_Get(vWhere, i+2, &w);
-    if (condition == 7)
-      toLower(w);
-    if (strlen(w) == 0) return 0;
+    int match = 0;
+    if (whereOp(vWhere, i+1) == WHERE_OR) {
+      Vector *alts = whereList(vWhere, i);
+      Vector *alt;
+      for (int k = 0; k < Vector_Size(alts) && !match; k++)
+        if (Vector_Get(alts, k, &alt)) match = whereMatch(ctx, key, alt);
+      if (match == 0) return 0;
+      continue;
+    }
 
     RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGET", "sc", key, VectorGetString(vWhere, i));
+    STAT(fetched, 1);
     if (RedisModule_CallReplyLength(tags) == 0) {
       RedisModule_FreeCallReply(tags);
       return 0;
     }
     RedisModuleString *rms = RedisModule_CreateStringFromCallReply(tags);
-    const char *s = RedisModule_StringToChar(rms);
-    switch(condition) {
-      case 0:
-        match = strcmp(s, w) >= 0? 1: 0;
-        break;
-      case 1:
-        match = strcmp(s, w) <= 0? 1: 0;
-        break;
-      case 2:
-      case 3:
-        match = strcmp(s, w) != 0? 1: 0;
-        break;
-      case 4:
-        match = strcmp(s, w) > 0? 1: 0;
-        break;
-      case 5:
-        match = strcmp(s, w) < 0? 1: 0;
-        break;
-      case 6:
-        match = strcmp(s, w) == 0? 1: 0;
-        break;
-      case 7:
-        match = strstr(toLower((char*)s), w)? 1: 0;
-        break;
-    }
+    size_t len;
+    const char *s = RedisModule_StringPtrLen(rms, &len);
+    match = whereValueMatch(vWhere, i, s, len);
     RedisModule_FreeString(ctx, rms);
     RedisModule_FreeCallReply(tags);
     if (match == 0) return 0;
   }
+  return 1;
+}
+
+int whereRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vWhere) {
+  // If where statement is defined, get the specified hash content and do comparison
+  if (Vector_Size(vWhere) == 0) {
+    STAT(matched, 1);
+    return 1;
+  }
+  TRACE_ROWS(STAGE_FILTER, 1, 0);
+  int match = whereMatch(ctx, key, vWhere);
+  STAT(matched, match);
+  TRACE_ROWS(STAGE_FILTER, 0, match);
   return match;
 }
 
 void showRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect) {
-  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  replyArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
 
   char* field;
   size_t nSelected = Vector_Size(vSelect);
@@ -123,10 +814,11 @@ void showRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect) {
     if (strcmp(field, "*") == 0) {
       RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGETALL", "s", key);
       size_t tf = RedisModule_CallReplyLength(tags);
+      STAT(fetched, tf / 2);
       if (tf > 0) {
         for(size_t j=0; j<tf; j++) {
           RedisModuleString *rms = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(tags, j));
-          RedisModule_ReplyWithString(ctx, rms);
+          replyString(ctx, rms);
           n++;
           RedisModule_FreeString(ctx, rms);
         }
@@ -134,87 +826,97 @@ void showRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect) {
       RedisModule_FreeCallReply(tags);
     }
     else if (strcmp(field, "rowid()") == 0) {
-      RedisModule_ReplyWithSimpleString(ctx, field);
-      RedisModule_ReplyWithString(ctx, key);
+      replySimpleString(ctx, field);
+      replyString(ctx, key);
       n += 2;
     }
     else {
       // Display the hash name and content
-      RedisModule_ReplyWithSimpleString(ctx, field);
+      replySimpleString(ctx, field);
       RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGET", "sc", key, field);
+      STAT(fetched, 1);
       if (RedisModule_CallReplyLength(tags) > 0) {
         RedisModuleString *rms = RedisModule_CreateStringFromCallReply(tags);
-        RedisModule_ReplyWithString(ctx, rms);
+        replyString(ctx, rms);
         RedisModule_FreeString(ctx, rms);
       }
       else
-        RedisModule_ReplyWithNull(ctx); // If hash is undefined
+        replyNull(ctx); // If hash is undefined
       n += 2;
       RedisModule_FreeCallReply(tags);
     }
   }
-  RedisModule_ReplySetArrayLength(ctx, n);
+  replySetArrayLength(ctx, n);
 }
 
-void intoRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect, char *intoKey) {
-  char* field;
-  size_t nSelected = Vector_Size(vSelect);
-  char newkey[64];
-
-  sprintf(newkey, "%s:%u-%i", intoKey, (unsigned)time(NULL), rn++);
-  for(size_t i = 0; i < nSelected; i++) {
-    Vector_Get(vSelect, i, &field);
+/* CSV codec of export and import. A line is the values joined by commas as
+ * they are, it is grown in *line as needed. */
+void csvAppend(char **line, size_t *len, size_t *cap, const char *v, size_t vlen) {
+  if (*len + vlen + 2 > *cap) {
+    *cap = 2 * (*len + vlen + 2);
+    *line = RedisModule_Realloc(*line, *cap);
+  }
+  if (*len > 0) (*line)[(*len)++] = ',';
+  memcpy(*line + *len, v, vlen);
+  *len += vlen;
+  (*line)[*len] = 0;
+}
 
-    // If '*' is specified in selected hash list, display all hashes then
-    if (strcmp(field, "*") == 0) {
-      RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGETALL", "s", key);
-      size_t tf = RedisModule_CallReplyLength(tags);
-      if (tf > 0) {
-        for(size_t j=0; j<tf; j+=2) {
-          RedisModuleString *rms1 = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(tags, j));
-          RedisModuleString *rms2 = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(tags, j+1));
-          RedisModule_Call(ctx, "HSET", "css", newkey, rms1, rms2);
-          RedisModule_FreeString(ctx, rms1);
-          RedisModule_FreeString(ctx, rms2);
-        }
-      }
-      RedisModule_FreeCallReply(tags);
-    }
-    else {
-      // Display the hash name and content
-      RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGET", "sc", key, field);
-      if (RedisModule_CallReplyLength(tags) > 0) {
-        RedisModuleString *rms = RedisModule_CreateStringFromCallReply(tags);
-        RedisModule_Call(ctx, "HSET", "ccs", newkey, field, rms);
-        RedisModule_FreeString(ctx, rms);
-      }
-      else
-        RedisModule_Call(ctx, "HSET", "ccc", newkey, field, "");
-      RedisModule_FreeCallReply(tags);
-    }
+/* Read a line of a file whatever its length, the buffer is grown as needed.
+ * NULL is returned at the end of the file. */
+char *csvReadLine(FILE *fp, char **line, size_t *cap) {
+  size_t len = 0;
+  if (*line == NULL) *line = RedisModule_Alloc(*cap = 1024);
+  while (fgets(*line + len, *cap - len, fp) != NULL) {
+    len += strlen(*line + len);
+    if ((*line)[len-1] == '\n' || len + 1 < *cap) break;
+    *line = RedisModule_Realloc(*line, *cap *= 2);
   }
-  RedisModule_ReplyWithSimpleString(ctx, newkey);
+  return len > 0? *line: NULL;
+}
+
+/* Split an imported line in place at its commas into at most max values,
+ * without the end of line and the double quotes around each value. The
+ * number of values is returned. */
+#define CSV_MAX_VALUES 512
+size_t csvSplit(char *line, char **values, size_t max) {
+  size_t len = strlen(line);
+  if (len > 0 && line[len-1] == '\n') line[--len] = 0;
+  if (len > 0 && line[len-1] == '\r') line[--len] = 0;
+  size_t n = 0;
+  char *save;
+  for (char *v = strtok_r(line, ",", &save); v != NULL && n < max; v = strtok_r(NULL, ",", &save))
+    values[n++] = trim(v, '"');
+  return n;
 }
 
 void intoCSV(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect, char *filename) {
   char* field;
   size_t nSelected = Vector_Size(vSelect);
-  char line[1024];
+  size_t len = 0, cap = 256;
+  char *line = RedisModule_Alloc(cap);
+  line[0] = 0;
 
   FILE *fp = fopen(filename, "a");
-  strcpy(line, "");
+  if (fp == NULL) {
+    replyError(ctx, "csv file cannot be written");
+    RedisModule_Free(line);
+    return;
+  }
   for(size_t i = 0; i < nSelected; i++) {
     Vector_Get(vSelect, i, &field);
     // If '*' is specified in selected hash list, display all hashes then
     if (strcmp(field, "*") == 0) {
       RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGETALL", "s", key);
       size_t tf = RedisModule_CallReplyLength(tags);
+      STAT(fetched, tf / 2);
       if (tf > 0) {
         for(size_t j=0; j<tf; j+=2) {
           // RedisModuleString *rms1 = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(tags, j));
           RedisModuleString *rms2 = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(tags, j+1));
-          if (strlen(line) > 0) strcat(line, ",");
-          strcat(line, RedisModule_StringToChar(rms2));
+          size_t vlen;
+          const char *v = RedisModule_StringPtrLen(rms2, &vlen);
+          csvAppend(&line, &len, &cap, v, vlen);
           // RedisModule_FreeString(ctx, rms1);
           RedisModule_FreeString(ctx, rms2);
         }
@@ -222,132 +924,5289 @@ void intoCSV(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect, char
       RedisModule_FreeCallReply(tags);
     }
     else {
-      if (strlen(line) > 0) strcat(line, ",");
       RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGET", "sc", key, field);
-      if (RedisModule_CallReplyLength(tags) > 0) {
-        RedisModuleString *rms = RedisModule_CreateStringFromCallReply(tags);
-        strcat(line, RedisModule_StringToChar(rms));
-        RedisModule_FreeString(ctx, rms);
-      }
+      STAT(fetched, 1);
+      size_t vlen = 0;
+      const char *v = RedisModule_CallReplyLength(tags) > 0? RedisModule_CallReplyStringPtr(tags, &vlen): "";
+      // a missing value at the start of the line leaves no separator
+      if (len > 0 || vlen > 0) csvAppend(&line, &len, &cap, v? v: "", vlen);
       RedisModule_FreeCallReply(tags);
     }
   }
-  RedisModule_ReplyWithSimpleString(ctx, line);
+  replySimpleString(ctx, line);
   fprintf(fp, "%s\n", line);
+  STAT(exported, len + 1);
   fclose(fp);
+  RedisModule_Free(line);
 }
 
-/* Split the string by specified delimilator */
-Vector* splitStringByChar(char *s, char* d) {
-  size_t cap;
-  char *p = s;
-  for (cap=1; p[cap]; p[cap]==d[0] ? cap++ : *p++);
+/* Per-query arena. Memory of a query is bump allocated from chained blocks
+ * and released at once, so the many small objects of a query need neither
+ * their own malloc nor their own free. The arena of a statement takes its
+ * memory from the pool of the command context instead, which Redis releases
+ * when the command returns. */
+#define ARENA_BLOCK 65536
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t used, size;
+  char data[];
+} ArenaBlock;
 
-  Vector *v = NewVector(void *, cap);
-  if (strlen(s) > 0) {
-    char *token = strtok(s, d);
-    for(int i=0; i<cap; i++) {
-      if (token != NULL) Vector_Push(v, token);
-      token = strtok(NULL, d);
-    }
+typedef struct Arena {
+  ArenaBlock *head;
+  size_t total;          // bytes of all the blocks
+  RedisModuleCtx *pool;  // if set, the memory comes from the pool of this context
+} Arena;
+
+void *arenaAlloc(Arena *a, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  if (a->pool != NULL) {
+    a->total += size;
+    return RedisModule_PoolAlloc(a->pool, size? size: 8);
   }
+  ArenaBlock *b = a->head;
+  if (b == NULL || b->used + size > b->size) {
+    size_t bsize = size > ARENA_BLOCK? size: ARENA_BLOCK;
+    b = RedisModule_Alloc(sizeof(ArenaBlock) + bsize);
+    b->used = 0;
+    b->size = bsize;
+    b->next = a->head;
+    a->head = b;
+    a->total += bsize;
+  }
+  void *p = b->data + b->used;
+  b->used += size;
+  return p;
+}
+
+/* Zeroed memory of n elements in the arena */
+void *arenaCalloc(Arena *a, size_t n, size_t size) {
+  void *p = arenaAlloc(a, n * size);
+  memset(p, 0, n * size);
+  return p;
+}
+
+/* A vector of at most cap pointers in the arena. It is released with the
+ * arena rather than by Vector_Free, and cannot grow past cap. */
+Vector *arenaVector(Arena *a, size_t cap) {
+  Vector *v = arenaAlloc(a, sizeof(Vector));
+  v->data = arenaAlloc(a, (cap + 1) * sizeof(void*));
+  v->elemSize = sizeof(void*);
+  v->cap = cap + 1;
+  v->top = 0;
   return v;
 }
 
-Vector* splitWhereString(char *s) {
-  Vector *v = NewVector(void *, 16);
-  char *token = strtok(s, "&&");
-  while (token != NULL) {
-    static char chk[8][3] = {">=", "<=", "!=", "<>", ">", "<", "=", "~"};
-    char *p = token;
-    while(*p++) {
-      for(int i=0; i<8; i++) {
-        char *c = chk[i];
-        if (strncmp(c, p, strlen(c)) == 0) {
-          *p = 0;
-          p += strlen(c);
-          Vector_Push(v, token);
-          Vector_Push(v, i);
-          Vector_Push(v, p);
-          break;
-        }
-      }
-    }
-    token = strtok(NULL, "&&");
+/* A terminated copy of len bytes in the arena */
+char *arenaStrndup(Arena *a, const char *s, size_t len) {
+  char *p = arenaAlloc(a, len + 1);
+  memcpy(p, s, len);
+  p[len] = 0;
+  return p;
+}
+
+void arenaFree(Arena *a) {
+  while (a->head) {
+    ArenaBlock *b = a->head;
+    a->head = b->next;
+    RedisModule_Free(b);
   }
-  return v;
+  a->total = 0;
 }
 
-size_t processRecords(RedisModuleCtx *ctx, RedisModuleCallReply *keys, regex_t *r, Vector *vSelect, Vector *vWhere, long *top, char *intoKey, char *csvFile) {
-  size_t nKeys = RedisModule_CallReplyLength(keys);
+/* Split the string by specified delimilator, except the delimilators inside
+ * parentheses, e.g. approx_percentile(pos,0.9). The vector is taken from the
+ * arena if one is given. */
+Vector* splitStringByChar(Arena *a, char *s, char* d) {
+  size_t cap;
+  char *p = s;
+  for (cap=1; *s && p[cap]; p[cap]==d[0] ? cap++ : *p++);
+
+  Vector *v = a? arenaVector(a, cap): NewVector(void *, cap);
+  char *token = s;
+  int depth = 0;
+  for (p = s; ; p++) {
+    if (*p == '(')
+      depth++;
+    else if (*p == ')' && depth > 0)
+      depth--;
+    else if (*p == 0 || (*p == d[0] && depth == 0)) {
+      int end = *p == 0;
+      *p = 0;
+      if (p > token) Vector_Push(v, token);
+      if (end) break;
+      token = p + 1;
+    }
+  }
+  return v;
+}
+
+/* Cut the string at its first delimiter outside of quotes. The text after it
+ * is returned, or NULL if there is none. */
+char *cutUnquoted(char *s, char d) {
+  char quote = 0;
+  for (char *p = s; *p; p++) {
+    if (quote) {
+      if (*p == quote) quote = 0;
+    }
+    else if (*p == '\'' || *p == '"')
+      quote = *p;
+    else if (*p == d) {
+      *p = 0;
+      return p + 1;
+    }
+  }
+  return NULL;
+}
+
+/* Join a token of a statement split by strtok on spaces with the following
+ * ones, up to the quote closing a quoted string it opens. The quotes are
+ * kept. The joined token is written to temp, which takes the statement, and
+ * is valid until the next join. */
+char *joinQuoted(char *token, char *temp) {
+  size_t quotes = 0;
+  for (char *p = token; *p; p++) quotes += *p == 39;
+  if (quotes % 2 == 0) return token;
+  char *rest = strtok(NULL, "'");
+  if (rest == NULL) return token;
+  sprintf(temp, "%s %s'", token, rest);
+  return temp;
+}
+
+/* Compile the pattern of like into the arena, or RedisModule_Alloc memory if
+ * no arena is given */
+LikePattern *likeCompile(Arena *a, const char *pattern) {
+  size_t n = strlen(pattern);
+  LikePattern *p = a? arenaAlloc(a, sizeof(LikePattern) + n + 1): RedisModule_Alloc(sizeof(LikePattern) + n + 1);
+  for (size_t i = 0; i <= n; i++)
+    p->text[i] = foldTable[(unsigned char)pattern[i]];
+
+  // the literal between a leading and a trailing %
+  const char *lit = p->text, *end = p->text + n;
+  int lead = 0, trail = 0;
+  while (*lit == '%') lit++, lead = 1;
+  while (end > lit && end[-1] == '%') end--, trail = 1;
+  p->lit = lit;
+  p->len = end - lit;
+  if (memchr(lit, '%', p->len) || memchr(lit, '_', p->len)) p->kind = LIKE_GENERAL;
+  else if (p->len == 0) p->kind = LIKE_ANY;
+  else if (!lead && trail) p->kind = LIKE_PREFIX;
+  else if (lead && !trail) p->kind = LIKE_SUFFIX;
+  else p->kind = LIKE_INFIX;
+
+  if (p->kind == LIKE_INFIX) {
+    uint8_t shift = p->len < 255? p->len: 255;
+    memset(p->skip, shift, sizeof(p->skip));
+    for (size_t j = 0; j + 1 < p->len; j++) {
+      size_t d = p->len - 1 - j;
+      p->skip[(unsigned char)lit[j]] = d < 255? d: 255;
+    }
+  }
+  return p;
+}
+
+/* Append a word of where clause to its internal form, 1 is returned for the
+ * words other than keywords. Conditions are joined by && and alternatives by
+ * ||, like is ~, in is @ before its list in parentheses and between is #
+ * before its bounds, which the and following it joins by a comma. between
+ * is set while that and is expected. Quoted values keep their quotes. */
+int whereAppend(char *stmWhere, char *token, int *between) {
+  if (strcmp("and", token) == 0) {
+    strcat(stmWhere, *between? ",": "&&");
+    *between = 0;
+  }
+  else if (strcmp("or", token) == 0)
+    strcat(stmWhere, "||");
+  else if (strcmp("like", token) == 0)
+    strcat(stmWhere, "~");
+  else if (strcmp("in", token) == 0)
+    strcat(stmWhere, "@");
+  else if (strcmp("between", token) == 0) {
+    strcat(stmWhere, "#");
+    *between = 1;
+  }
+  else {
+    // an argument holding spaces is a single value, as if it were quoted
+    int quote = token[0] != 39 && strchr(token, 7) != NULL;
+    char *p = token;
+    while (*p++) *p = *p == 7? 32: *p;
+    if (quote) strcat(stmWhere, "'");
+    strcat(stmWhere, token);
+    if (quote) strcat(stmWhere, "'");
+    return 1;
+  }
+  return 0;
+}
+
+/* A vector of the arena grows into a copy of twice its capacity */
+void wherePush(Arena *a, Vector *v, void *elem) {
+  if (a != NULL && (size_t)Vector_Size(v) + 1 >= v->cap) {
+    char *data = arenaAlloc(a, 2 * v->cap * sizeof(void*));
+    memcpy(data, v->data, v->top * sizeof(void*));
+    v->data = data;
+    v->cap *= 2;
+  }
+  Vector_Push(v, elem);
+}
+
+/* Estimated cost of evaluating a condition per row, for the cheapest and
+ * most selective first: equality, in, ranges, the likes comparing a literal,
+ * other likes, inequality and last the groups of or */
+int whereCost(Vector *vWhere, size_t i) {
+  switch (whereOp(vWhere, i+1)) {
+    case 6: return 0;
+    case WHERE_IN: return 1;
+    case 2:
+    case 3: return 5;
+    case 7: return whereLike(vWhere, i)->kind == LIKE_GENERAL? 4: 3;
+    case WHERE_OR: return 6;
+  }
+  return 2;
+}
+
+/* Order the conditions of a conjunction by cost, the evaluation stops at the
+ * first false one */
+void whereSort(Vector *vWhere) {
+  void **c = (void**)vWhere->data;
+  size_t n = Vector_Size(vWhere) / 3;
+  for (size_t i = 1; i < n; i++) {
+    int cost = whereCost(vWhere, 3 * i);
+    void *cond[3] = {c[3 * i], c[3 * i + 1], c[3 * i + 2]};
+    size_t j = i;
+    for (; j > 0 && whereCost(vWhere, 3 * (j - 1)) > cost; j--)
+      memcpy(&c[3 * j], &c[3 * (j - 1)], 3 * sizeof(void*));
+    memcpy(&c[3 * j], cond, sizeof(cond));
+  }
+}
+
+/* The where clause is parsed by recursive descent over its tokens, the
+ * conditions and the separators below, which are told by their address */
+static char whereOpen[] = "(", whereClose[] = ")", whereAnd[] = "&&", whereOr[] = "||";
+
+typedef struct WhereParser {
+  Arena *a;
+  char **tokens;
+  size_t n, next;
+} WhereParser;
+
+Vector *whereVector(WhereParser *w) {
+  return w->a? arenaVector(w->a, 5): NewVector(void *, 6);
+}
+
+char *whereToken(WhereParser *w) {
+  return w->next < w->n? w->tokens[w->next]: NULL;
+}
+
+/* Split the where string into its tokens in place. A condition ends at &&, ||
+ * or the parenthesis closing the group it is in, the parentheses of in are
+ * part of it. Quoted strings are skipped. */
+void whereTokenize(WhereParser *w, char *s) {
+  int depth = 0;
+  char *cond = NULL;
+  for (char *p = s; *p; p++) {
+    char *sep = NULL;
+    if (*p == 39 && cond != NULL) {
+      char *q = strchr(p + 1, 39);
+      if (q != NULL) p = q;
+      continue;
+    }
+    if (strncmp(p, "&&", 2) == 0) sep = whereAnd;
+    else if (strncmp(p, "||", 2) == 0) sep = whereOr;
+    else if (*p == '(' && cond == NULL) sep = whereOpen;
+    else if (*p == '(') depth++;
+    else if (*p == ')' && depth > 0) depth--;
+    else if (*p == ')') sep = whereClose;
+    else if (cond == NULL && *p != ' ') w->tokens[w->n++] = cond = p;
+    if (sep == NULL) continue;
+    w->tokens[w->n++] = sep;
+    *p = 0;
+    if (sep == whereAnd || sep == whereOr) p++;
+    cond = NULL;
+    depth = 0;
+  }
+}
+
+/* Parse a condition into the conjunction, 0 is returned if it has no
+ * operator or between has no bounds */
+int whereCondition(WhereParser *w, Vector *v, char *token) {
+  static char chk[10][3] = {">=", "<=", "!=", "<>", ">", "<", "=", "~", "@", "#"};
+  // the field takes at least a character
+  for (char *p = token + 1; *p; p++) {
+    if (strchr("<>!=~@#", *p) == NULL) continue;
+    for (int i = 0; i < 10; i++) {
+      char *c = chk[i];
+      if (strncmp(c, p, strlen(c)) != 0) continue;
+      *p = 0;
+      p += strlen(c);
+      if (i == WHERE_BETWEEN) {
+        char *hi = cutUnquoted(p, ',');
+        if (hi == NULL) return 0;
+        wherePush(w->a, v, token);
+        wherePush(w->a, v, (void*)(intptr_t)0);
+        wherePush(w->a, v, trim(p, 39));
+        wherePush(w->a, v, token);
+        wherePush(w->a, v, (void*)(intptr_t)1);
+        wherePush(w->a, v, trim(hi, 39));
+        return 1;
+      }
+      wherePush(w->a, v, token);
+      wherePush(w->a, v, (void*)(intptr_t)i);
+      if (i == 7) wherePush(w->a, v, likeCompile(w->a, trim(p, 39)));
+      else if (i == WHERE_IN) {
+        // the values in parentheses, optionally quoted
+        Vector *list = whereVector(w);
+        char *end = p + strlen(p);
+        if (*p == '(' && end[-1] == ')') *--end = 0, p++;
+        for (char *item = p, *next; item != NULL; item = next) {
+          next = cutUnquoted(item, ',');
+          while (*item == ' ') item++;
+          for (end = item + strlen(item); end > item && end[-1] == ' '; ) *--end = 0;
+          if (*item) wherePush(w->a, list, trim(item, 39));
+        }
+        wherePush(w->a, v, list);
+      }
+      else wherePush(w->a, v, trim(p, 39));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+Vector *whereParseOr(WhereParser *w);
+
+/* Parse the conditions and groups joined by && into the conjunction, the
+ * conditions of a group in parentheses without || are merged into it */
+int whereParseAnd(WhereParser *w, Vector *v) {
+  for (;;) {
+    char *token = whereToken(w);
+    if (token == whereOpen) {
+      w->next++;
+      Vector *sub = whereParseOr(w);
+      if (sub == NULL || whereToken(w) != whereClose) return 0;
+      w->next++;
+      void *elem;
+      for (int i = 0; i < Vector_Size(sub); i++)
+        if (Vector_Get(sub, i, &elem)) wherePush(w->a, v, elem);
+      if (w->a == NULL) Vector_Free(sub);
+    }
+    else if (token == NULL || token == whereClose || token == whereAnd || token == whereOr)
+      return 0;
+    else if (!whereCondition(w, v, token))
+      return 0;
+    else w->next++;
+
+    if (whereToken(w) != whereAnd) break;
+    w->next++;
+  }
+  whereSort(v);
+  return 1;
+}
+
+/* Parse the alternatives joined by ||. A single one is returned as is, more
+ * become a group of or. NULL is returned on a syntax error. */
+Vector *whereParseOr(WhereParser *w) {
+  Vector *v = whereVector(w);
+  if (!whereParseAnd(w, v)) return NULL;
+  if (whereToken(w) != whereOr) return v;
+
+  Vector *alts = whereVector(w);
+  wherePush(w->a, alts, v);
+  while (whereToken(w) == whereOr) {
+    w->next++;
+    v = whereVector(w);
+    if (!whereParseAnd(w, v)) return NULL;
+    wherePush(w->a, alts, v);
+  }
+  v = whereVector(w);
+  wherePush(w->a, v, "");
+  wherePush(w->a, v, (void*)(intptr_t)WHERE_OR);
+  wherePush(w->a, v, alts);
+  return v;
+}
+
+/* Parse the where string into a conjunction of conditions, which may be
+ * groups of or. The vectors are taken from the arena if one is given. NULL
+ * is returned if the clause cannot be parsed. */
+Vector* splitWhereString(Arena *a, char *s) {
+  char *tokens[strlen(s) + 1];
+  WhereParser w = {a, tokens, 0, 0};
+  whereTokenize(&w, s);
+  if (w.n == 0) return whereVector(&w);
+  Vector *v = whereParseOr(&w);
+  return v != NULL && w.next == w.n? v: NULL;
+}
+
+/* The value pinning the primary key by equality in a conjunction, or NULL */
+char *whereKeyValue(Vector *vWhere, const char *key) {
+  for (int i = 0; i + 2 < Vector_Size(vWhere); i += 3)
+    if (whereOp(vWhere, i+1) == 6 && strcmp(VectorGetString(vWhere, i), key) == 0)
+      return VectorGetString(vWhere, i+2);
+  return NULL;
+}
+
+/* If the table has a primary key and the where clause pins it by equality,
+ * return the only row which can match. Otherwise NULL and a scan is needed. */
+RedisModuleString *primaryKeyLookup(RedisModuleCtx *ctx, Table *t, Vector *vWhere) {
+  if (strlen(t->key) == 0) return NULL;
+
+  char *value = whereKeyValue(vWhere, t->key);
+  return value? rowKey(ctx, t, value): NULL;
+}
+
+/* If the table has a primary key and a condition of the where clause pins it
+ * to a list of values, by in or by a group of or each alternative of which
+ * pins it by equality, return the distinct values. Their rows are looked up
+ * directly and the union of them is the only rows which can match. */
+Vector *primaryKeyValues(Arena *a, const char *key, Vector *vWhere) {
+  if (strlen(key) == 0) return NULL;
+
+  for (int i = 0; i + 2 < Vector_Size(vWhere); i += 3) {
+    int op = whereOp(vWhere, i+1);
+    Vector *list = whereList(vWhere, i);
+    if (op == WHERE_IN && strcmp(VectorGetString(vWhere, i), key) != 0) continue;
+    if (op != WHERE_IN && op != WHERE_OR) continue;
+
+    Vector *values = arenaVector(a, Vector_Size(list));
+    for (int k = 0; values != NULL && k < Vector_Size(list); k++) {
+      char *value;
+      if (op == WHERE_IN) value = VectorGetString(list, k);
+      else {
+        Vector *alt;
+        Vector_Get(list, k, &alt);
+        value = whereKeyValue(alt, key);
+      }
+      if (value == NULL) values = NULL;
+      else if (!inList(values, value)) Vector_Push(values, value);
+    }
+    if (values != NULL) return values;
+  }
+  return NULL;
+}
+
+/* Name a new row of the table. The rows of a table with primary key are named
+ * by the key column, others by the next row id. NULL is returned if the
+ * primary key value is not provided. */
+RedisModuleString *newRowKey(RedisModuleCtx *ctx, Table *t, RowIdBlock *ids, char **fields, char **values, size_t n) {
+  if (strlen(t->key) == 0)
+    return nextRowKey(ctx, t, ids);
+
+  for (size_t i = 0; i < n; i++)
+    if (strcmp(fields[i], t->key) == 0 && strlen(values[i]) > 0)
+      return rowKey(ctx, t, values[i]);
+  return NULL;
+}
+
+/* Open the key of a new row for writing. An existing row is opened only if
+ * upsert is specified, otherwise NULL is returned. created tells whether the
+ * row is new. */
+RedisModuleKey *openNewRow(RedisModuleCtx *ctx, RedisModuleString *key, int upsert, int *created) {
+  RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ|REDISMODULE_WRITE);
+  int type = RedisModule_KeyType(hkey);
+  if (type != REDISMODULE_KEYTYPE_EMPTY && (!upsert || type != REDISMODULE_KEYTYPE_HASH)) {
+    RedisModule_CloseKey(hkey);
+    return NULL;
+  }
+  *created = type == REDISMODULE_KEYTYPE_EMPTY;
+  return hkey;
+}
+
+/* Write a row by a single multi-field HashSet. REDISMODULE_ERR is returned if
+ * the row exists and upsert is not specified. */
+int writeRow(RedisModuleCtx *ctx, RedisModuleString *key, char **fields, char **values, size_t n, int upsert, int *created) {
+  RedisModuleKey *hkey = openNewRow(ctx, key, upsert, created);
+  if (hkey == NULL) return REDISMODULE_ERR;
+
+  RedisModuleString *rms[n];
+  for (size_t i = 0; i < n; i++)
+    rms[i] = RedisModule_CreateString(ctx, values[i], strlen(values[i]));
+  hashSetFields(hkey, fields, rms, n);
+  RedisModule_CloseKey(hkey);
+  replicateRow(ctx, key, fields, rms, n);
+  for (size_t i = 0; i < n; i++)
+    RedisModule_FreeString(ctx, rms[i]);
+  viewsRowChanged(ctx, key);
+  return REDISMODULE_OK;
+}
+
+/* Apply the assignments of update statement to the row in place */
+int updateRecord(RedisModuleCtx *ctx, RedisModuleString *key, char **fields, RedisModuleString **values, size_t n) {
+  RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ|REDISMODULE_WRITE);
+  int updated = RedisModule_KeyType(hkey) == REDISMODULE_KEYTYPE_HASH;
+  if (updated) hashSetFields(hkey, fields, values, n);
+  RedisModule_CloseKey(hkey);
+  if (updated) {
+    replicateRow(ctx, key, fields, values, n);
+    viewsRowChanged(ctx, key);
+  }
+  return updated;
+}
+
+/* Remove a row of delete statement, the DEL is propagated like the writes */
+void deleteRecord(RedisModuleCtx *ctx, RedisModuleString *key) {
+  RedisModuleCallReply *rep = RedisModule_Call(ctx, "DEL", "s", key);
+  if (rep != NULL && RedisModule_CallReplyInteger(rep) > 0)
+    RedisModule_Replicate(ctx, "DEL", "s", key);
+  if (rep != NULL) RedisModule_FreeCallReply(rep);
+}
+
+/* Remove the trailing "on duplicate [key] update" of insert ... select, which
+ * is not a part of the select statement. It returns 1 if it is removed. */
+int stripUpsertClause(char *s) {
+  char *on = NULL;
+  for (char *p = strstr(s, " on "); p != NULL; p = strstr(p + 1, " on "))
+    on = p;
+  if (on == NULL) return 0;
+
+  char w[4][16];
+  int n = sscanf(on + 4, "%15s %15s %15s %15s", w[0], w[1], w[2], w[3]);
+  if ((n == 2 && strcmp(w[0], "duplicate") == 0 && strcmp(w[1], "update") == 0) ||
+      (n == 3 && strcmp(w[0], "duplicate") == 0 && strcmp(w[1], "key") == 0 && strcmp(w[2], "update") == 0)) {
+    *on = 0;
+    return 1;
+  }
+  return 0;
+}
+
+/* Parse the tuples of values clause, i.e. "(v1, 'v 2'), (v3, v4)", in a single
+ * pass. The values are terminated in place and pushed to vValue. Quotes are
+ * removed and the spaces around unquoted values are trimmed. The rest of the
+ * statement is returned, or NULL with err set if the clause is malformed. */
+char *parseValues(char *p, Vector *vValue, size_t *nRow, const char **err) {
+  size_t nTuple = 0;
+  *nRow = 0;
+  *err = "parse error in values clause";
+  for (;;) {
+    while (*p == ' ' || *p == 7) p++;
+    if (*p++ != '(') return NULL;
+
+    size_t n = 0;
+    char c;
+    do {
+      while (*p == ' ' || *p == 7) p++;
+      char *value = p;
+      if (*p == '\'' || *p == '"') {
+        char quote = *p++;
+        value = p;
+        while (*p && *p != quote) {
+          if (*p == 7) *p = ' ';
+          p++;
+        }
+        if (*p == 0) return NULL;
+        *p++ = 0;
+        while (*p == ' ' || *p == 7) p++;
+        c = *p;
+      }
+      else {
+        while (*p && *p != ',' && *p != ')') {
+          if (*p == 7) *p = ' ';
+          p++;
+        }
+        char *e = p;
+        while (e > value && e[-1] == ' ') e--;
+        c = *p;
+        *e = 0;
+      }
+      if (c != ',' && c != ')') return NULL;
+      *p++ = 0;
+      Vector_Push(vValue, value);
+      n++;
+    } while (c == ',');
+
+    // All the tuples should have the same number of values
+    if (*nRow == 0) nTuple = n;
+    else if (n != nTuple) {
+      *err = "Number of values does not match";
+      return NULL;
+    }
+    (*nRow)++;
+
+    while (*p == ' ' || *p == 7) p++;
+    if (*p != ',') return p;
+    p++;
+  }
+}
+
+/* Destination of select ... into and insert ... select */
+typedef struct {
+  Table table;
+  RowIdBlock ids;
+  Vector *vField;   // destination fields of insert ... select, NULL keeps the source names
+  int upsert;
+  int compact;      // reply count, first and last key instead of every new key
+  long long added;  // number of new rows
+  RedisModuleString *first;
+  RedisModuleString *last;
+} IntoTarget;
+
+void initIntoTarget(RedisModuleCtx *ctx, IntoTarget *into, const char *name, Vector *vField, int upsert, int compact) {
+  memset(into, 0, sizeof(IntoTarget));
+  loadTable(ctx, name, &into->table);
+  initRowIds(&into->ids, name, ROWID_BLOCK);
+  into->vField = vField;
+  into->upsert = upsert;
+  into->compact = compact;
+}
+
+/* Copy the whole hash by its serialized form, i.e. DUMP and RESTORE, so no
+ * field is decoded or encoded again */
+RedisModuleString *copyRecord(RedisModuleCtx *ctx, RedisModuleString *key, IntoTarget *into) {
+  RedisModuleString *newkey;
+  if (strlen(into->table.key) > 0) {
+    RedisModuleString *pk = NULL;
+    RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+    if (RedisModule_KeyType(hkey) == REDISMODULE_KEYTYPE_HASH)
+      RedisModule_HashGet(hkey, REDISMODULE_HASH_CFIELDS, into->table.key, &pk, NULL);
+    RedisModule_CloseKey(hkey);
+    if (pk == NULL) return NULL;
+    newkey = rowKey(ctx, &into->table, RedisModule_StringToChar(pk));
+    RedisModule_FreeString(ctx, pk);
+  }
+  else
+    newkey = nextRowKey(ctx, &into->table, &into->ids);
+
+  // A replaced row is not a new row
+  int created = 1;
+  if (into->upsert) {
+    RedisModuleKey *hkey = RedisModule_OpenKey(ctx, newkey, REDISMODULE_READ);
+    created = RedisModule_KeyType(hkey) == REDISMODULE_KEYTYPE_EMPTY;
+    RedisModule_CloseKey(hkey);
+  }
+
+  RedisModuleCallReply *rep = RedisModule_Call(ctx, "DUMP", "s", key);
+  if (RedisModule_CallReplyType(rep) != REDISMODULE_REPLY_STRING) {
+    RedisModule_FreeCallReply(rep);
+    RedisModule_FreeString(ctx, newkey);
+    return NULL;
+  }
+  RedisModuleString *payload = RedisModule_CreateStringFromCallReply(rep);
+  RedisModule_FreeCallReply(rep);
+
+  if (into->upsert)
+    rep = RedisModule_Call(ctx, "RESTORE", "slsc", newkey, 0LL, payload, "REPLACE");
+  else
+    rep = RedisModule_Call(ctx, "RESTORE", "sls", newkey, 0LL, payload);
+  int type = RedisModule_CallReplyType(rep);
+  RedisModule_FreeCallReply(rep);
+  if (type != REDISMODULE_REPLY_ERROR && into->upsert)
+    RedisModule_Replicate(ctx, "RESTORE", "slsc", newkey, 0LL, payload, "REPLACE");
+  else if (type != REDISMODULE_REPLY_ERROR)
+    RedisModule_Replicate(ctx, "RESTORE", "sls", newkey, 0LL, payload);
+  RedisModule_FreeString(ctx, payload);
+  if (type == REDISMODULE_REPLY_ERROR) {
+    RedisModule_FreeString(ctx, newkey);
+    return NULL;
+  }
+  into->added += created;
+  return newkey;
+}
+
+/* Copy the projected fields of the row. The row is read once, the explicit
+ * fields by batched HashGet and "*" by HGETALL, and the new row is written by
+ * a single multi-field HashSet. */
+RedisModuleString *projectRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect, IntoTarget *into) {
+  size_t nSelected = Vector_Size(vSelect);
+  char *sel[nSelected];
+  RedisModuleString *selValue[nSelected];
+  size_t nSel = 0;
+  RedisModuleCallReply *all = NULL;
+
+  for (size_t i = 0; i < nSelected; i++) {
+    char *field = VectorGetString(vSelect, i);
+    if (strcmp(field, "*") == 0) {
+      if (all == NULL) all = RedisModule_Call(ctx, "HGETALL", "s", key);
+    }
+    else
+      sel[nSel++] = field;
+  }
+
+  RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+  if (RedisModule_KeyType(hkey) != REDISMODULE_KEYTYPE_HASH) {
+    RedisModule_CloseKey(hkey);
+    if (all) RedisModule_FreeCallReply(all);
+    return NULL;
+  }
+  hashGetFields(hkey, sel, selValue, nSel);
+  RedisModule_CloseKey(hkey);
+
+  size_t nAll = all? RedisModule_CallReplyLength(all) / 2: 0;
+  size_t n = nAll + nSel;
+  char *fields[n + 1];
+  char *values[n + 1];
+  RedisModuleString *rms[n + 1];
+  RedisModuleString *names[nAll + 1];
+  for (size_t j = 0; j < nAll; j++) {
+    // The strings of a call reply are not terminated, so they are copied
+    names[j] = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(all, 2*j));
+    rms[j] = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(all, 2*j+1));
+    fields[j] = (char*)RedisModule_StringToChar(names[j]);
+  }
+  for (size_t j = 0; j < nSel; j++) {
+    // The undefined fields are copied as empty string
+    rms[nAll+j] = selValue[j]? selValue[j]: RedisModule_CreateString(ctx, "", 0);
+    fields[nAll+j] = into->vField? VectorGetString(into->vField, j): sel[j];
+  }
+  for (size_t j = 0; j < n; j++)
+    values[j] = (char*)RedisModule_StringToChar(rms[j]);
+
+  int created = 0;
+  RedisModuleString *newkey = newRowKey(ctx, &into->table, &into->ids, fields, values, n);
+  hkey = newkey? openNewRow(ctx, newkey, into->upsert, &created): NULL;
+  if (hkey != NULL) {
+    hashSetFields(hkey, fields, rms, n);
+    RedisModule_CloseKey(hkey);
+    replicateRow(ctx, newkey, fields, rms, n);
+    viewsRowChanged(ctx, newkey);
+    into->added += created;
+  }
+  else if (newkey != NULL) {
+    RedisModule_FreeString(ctx, newkey);
+    newkey = NULL;
+  }
+
+  for (size_t j = 0; j < n; j++)
+    RedisModule_FreeString(ctx, rms[j]);
+  for (size_t j = 0; j < nAll; j++)
+    RedisModule_FreeString(ctx, names[j]);
+  if (all) RedisModule_FreeCallReply(all);
+  return newkey;
+}
+
+/* Reply the key of a row copied into the destination table, NULL if it is
+ * not written. It returns the number of the reply elements, or with compact
+ * reply the rows written. */
+int intoResult(RedisModuleCtx *ctx, IntoTarget *into, RedisModuleString *newkey) {
+  if (!into->compact) {
+    if (newkey != NULL) {
+      replyString(ctx, newkey);
+      RedisModule_FreeString(ctx, newkey);
+    }
+    else
+      replyError(ctx, "duplicate key");
+    return 1;
+  }
+
+  if (newkey == NULL) return 0;
+  if (into->first == NULL)
+    into->first = newkey;
+  else {
+    if (into->last) RedisModule_FreeString(ctx, into->last);
+    into->last = newkey;
+  }
+  return 1;
+}
+
+/* Copy a row into the destination table */
+int intoRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect, IntoTarget *into) {
+  RedisModuleString *newkey;
+  if (into->vField == NULL && Vector_Size(vSelect) == 1 && strcmp(VectorGetString(vSelect, 0), "*") == 0)
+    newkey = copyRecord(ctx, key, into);
+  else
+    newkey = projectRecord(ctx, key, vSelect, into);
+  return intoResult(ctx, into, newkey);
+}
+
+/* Aggregate functions of select list, e.g. count(*), sum(pos), avg(pos),
+ * min(name), max(name), approx_count_distinct(name) or
+ * approx_percentile(pos,0.9), optionally per group of group by clause. The rows
+ * are folded into the states of their group while scanning, so a group costs
+ * a single row of the result whatever the table size. */
+#define AGG_COUNT 0
+#define AGG_SUM   1
+#define AGG_AVG   2
+#define AGG_MIN   3
+#define AGG_MAX   4
+#define AGG_DISTINCT   5  // HyperLogLog
+#define AGG_PERCENTILE 6  // t-digest
+
+typedef struct AggFunc {
+  int func;
+  char *field;       // NULL for count(*)
+  double param;      // the percentile
+} AggFunc;
+
+typedef struct AggState {
+  long long count;   // rows (count) or values (sum, avg) seen
+  long long isum;    // exact sum while all the values are integers
+  double sum;
+  int integral;
+  char *value;       // current min or max, kept in the arena
+  size_t vlen, vcap;
+  double dvalue;
+  int numeric;
+  void *sketch;      // fixed size sketch of approximate functions
+} AggState;
+
+/* A group is identified by the encoded values of its group by columns, each
+ * value is a byte telling NULL or not followed by its length and bytes */
+typedef struct Group {
+  uint64_t hash;
+  char *key;
+  size_t klen;
+  long long rows;
+  AggState states[];
+} Group;
+
+/* Groups exceeding the memory budget are not kept, the keys of their rows
+ * are spilled to buffers by partition instead, and aggregated partition by
+ * partition after the scan. A key costs a few bytes where a group may hold
+ * sketches, and the statement writes nothing, so it runs on a replica. A
+ * partition over the budget again is split by the next 4 bits of the hash. */
+#define GROUPBY_MEMORY (64 * 1024 * 1024)
+#define SPILL_PARTITIONS 16
+#define SPILL_LEVELS 16
+
+typedef struct Aggregation {
+  size_t nFunc;
+  AggFunc *funcs;
+  size_t nGroup;     // group by columns, fetched before the aggregated fields
+  char **fields;
+  size_t nField;
+  size_t nItem;      // select list, an item is a function or a group column
+  int *items;        // function index, or -1-index of group column
+  char **labels;
+  size_t nOrder;     // order by on the select list
+  int *orders;
+  int *descs;
+  long limit;        // top clause
+
+  Arena arena;
+  Group **slots;     // open addressing by linear probing
+  size_t cap, n;
+  char *keybuf;
+  size_t keycap;
+
+  size_t budget;
+  int spill;         // partitions having spilled rows, by bit
+  int level;         // of the partition aggregated, 0 for the scan
+  PartialBuf spilled[SPILL_PARTITIONS];  // keys by length and bytes
+} Aggregation;
+
+static const char *aggNames[] = {"count", "sum", "avg", "min", "max",
+  "approx_count_distinct", "approx_percentile"};
+
+void freeAggregation(RedisModuleCtx *ctx, Aggregation *a) {
+  if (a == NULL) return;
+  for (size_t i = 0; i < a->nFunc; i++)
+    if (a->funcs[i].field) RedisModule_Free(a->funcs[i].field);
+  for (int p = 0; p < SPILL_PARTITIONS; p++)
+    RedisModule_Free(a->spilled[p].p);
+  arenaFree(&a->arena);
+  RedisModule_Free(a->slots);
+  RedisModule_Free(a->keybuf);
+  RedisModule_Free(a->funcs);
+  RedisModule_Free(a->fields);
+  RedisModule_Free(a->items);
+  RedisModule_Free(a->labels);
+  RedisModule_Free(a->orders);
+  RedisModule_Free(a->descs);
+  RedisModule_Free(a);
+}
+
+/* Parse the select list into aggregate functions and group columns. NULL is
+ * returned if there is neither aggregate function nor group by clause, err is
+ * set if the statement is not valid. */
+Aggregation *parseAggregation(RedisModuleCtx *ctx, Vector *vSelect, Vector *vGroup, Vector *vOrder, long top, const char **err) {
+  size_t n = Vector_Size(vSelect), nGroup = Vector_Size(vGroup), nFunc = 0;
+  *err = NULL;
+  for (size_t i = 0; i < n; i++) {
+    char *item = VectorGetString(vSelect, i);
+    if (strchr(item, '(') != NULL && item[strlen(item) - 1] == ')' && strcmp(item, "rowid()") != 0) nFunc++;
+  }
+  if (nFunc == 0 && nGroup == 0) return NULL;
+
+  Aggregation *a = RedisModule_Calloc(1, sizeof(Aggregation));
+  a->funcs = RedisModule_Calloc(n + 1, sizeof(AggFunc));
+  a->fields = RedisModule_Calloc(n + nGroup + 1, sizeof(char*));
+  a->items = RedisModule_Calloc(n + 1, sizeof(int));
+  a->labels = RedisModule_Calloc(n + 1, sizeof(char*));
+  a->orders = RedisModule_Calloc(Vector_Size(vOrder) + 1, sizeof(int));
+  a->descs = RedisModule_Calloc(Vector_Size(vOrder) + 1, sizeof(int));
+  a->nGroup = nGroup;
+  a->limit = top;
+  a->budget = GROUPBY_MEMORY;
+  a->keycap = 64;
+  a->keybuf = RedisModule_Alloc(a->keycap);
+  for (size_t g = 0; g < nGroup; g++)
+    a->fields[a->nField++] = VectorGetString(vGroup, g);
+
+  for (size_t i = 0; i < n; i++) {
+    char *item = VectorGetString(vSelect, i);
+    char *lp = strchr(item, '(');
+    a->labels[a->nItem] = item;
+    if (lp == NULL || item[strlen(item) - 1] != ')' || strcmp(item, "rowid()") == 0) {
+      // a plain field must be one of the group columns
+      int g = -1;
+      for (size_t j = 0; j < nGroup; j++)
+        if (strcmp(item, a->fields[j]) == 0) g = j;
+      if (g < 0) {
+        *err = "fields must be aggregated or listed in group by";
+        freeAggregation(ctx, a);
+        return NULL;
+      }
+      a->items[a->nItem++] = -1 - g;
+      continue;
+    }
+
+    AggFunc *f = &a->funcs[a->nFunc];
+    size_t len = lp - item;
+    f->func = -1;
+    for (int k = 0; k < 7; k++)
+      if (strlen(aggNames[k]) == len && strncasecmp(item, aggNames[k], len) == 0) f->func = k;
+    f->field = RedisModule_Strdup(&item[len + 1]);
+    f->field[strlen(f->field) - 1] = 0;
+    a->items[a->nItem++] = a->nFunc++;
+    // the percentile is the second argument
+    char *comma = strchr(f->field, ',');
+    if (comma != NULL) {
+      *comma++ = 0;
+      char *end;
+      f->param = strtod(comma, &end);
+      if (f->func != AGG_PERCENTILE || *end != 0 || f->param < 0 || f->param > 1) {
+        *err = "percentile between 0 and 1 is expected";
+        freeAggregation(ctx, a);
+        return NULL;
+      }
+    }
+    else if (f->func == AGG_PERCENTILE) {
+      *err = "percentile between 0 and 1 is expected";
+      freeAggregation(ctx, a);
+      return NULL;
+    }
+    if (f->func < 0 || strlen(f->field) == 0 ||
+        (strcmp(f->field, "*") == 0 && f->func != AGG_COUNT)) {
+      *err = "unknown aggregate function";
+      freeAggregation(ctx, a);
+      return NULL;
+    }
+    if (strcmp(f->field, "*") == 0) {
+      RedisModule_Free(f->field);
+      f->field = NULL;
+    }
+    else
+      a->fields[a->nField++] = f->field;
+  }
+
+  // order by refers to the select list, desc is marked by a trailing '-'
+  for (size_t i = 0; i < Vector_Size(vOrder); i++) {
+    char *o = VectorGetString(vOrder, i);
+    size_t len = strlen(o);
+    int desc = len > 0 && o[len - 1] == '-';
+    if (desc) len--;
+    int item = -1;
+    for (size_t j = 0; j < a->nItem; j++)
+      if (strlen(a->labels[j]) == len && strncasecmp(o, a->labels[j], len) == 0) item = j;
+    if (item < 0) {
+      *err = "order by must refer to the select list";
+      freeAggregation(ctx, a);
+      return NULL;
+    }
+    a->orders[a->nOrder] = item;
+    a->descs[a->nOrder++] = desc;
+  }
+  return a;
+}
+
+/* FNV-1a */
+uint64_t hashBytes(const char *p, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* Find the group of the key, a new group is added if create is set */
+Group *findGroup(Aggregation *a, const char *key, size_t klen, uint64_t hash, int create) {
+  if (a->cap > 0) {
+    for (size_t i = hash & (a->cap - 1); a->slots[i] != NULL; i = (i + 1) & (a->cap - 1)) {
+      Group *g = a->slots[i];
+      if (g->hash == hash && g->klen == klen && memcmp(g->key, key, klen) == 0) return g;
+    }
+  }
+  if (!create) return NULL;
+
+  // keep the load factor under a half
+  if (2 * (a->n + 1) > a->cap) {
+    size_t cap = a->cap? 2 * a->cap: 64;
+    Group **slots = RedisModule_Calloc(cap, sizeof(Group*));
+    for (size_t i = 0; i < a->cap; i++) {
+      Group *g = a->slots[i];
+      if (g == NULL) continue;
+      size_t j = g->hash & (cap - 1);
+      while (slots[j] != NULL) j = (j + 1) & (cap - 1);
+      slots[j] = g;
+    }
+    RedisModule_Free(a->slots);
+    a->slots = slots;
+    a->cap = cap;
+  }
+
+  Group *g = arenaAlloc(&a->arena, sizeof(Group) + a->nFunc * sizeof(AggState));
+  memset(g, 0, sizeof(Group) + a->nFunc * sizeof(AggState));
+  g->hash = hash;
+  g->klen = klen;
+  g->key = arenaAlloc(&a->arena, klen + 1);
+  memcpy(g->key, key, klen);
+  for (size_t f = 0; f < a->nFunc; f++) g->states[f].integral = 1;
+
+  size_t i = hash & (a->cap - 1);
+  while (a->slots[i] != NULL) i = (i + 1) & (a->cap - 1);
+  a->slots[i] = g;
+  a->n++;
+  return g;
+}
+
+/* Drop all the groups, e.g. between spilled partitions */
+void resetGroups(Aggregation *a) {
+  arenaFree(&a->arena);
+  if (a->slots) memset(a->slots, 0, a->cap * sizeof(Group*));
+  a->n = 0;
+}
+
+/* Keep the value if it is beyond the min or max of the state. Numbers are
+ * compared by value, otherwise alphabetically. */
+void updateExtreme(Aggregation *a, AggFunc *f, AggState *s, const char *v, size_t len, int isNum, double d) {
+  int cmp;
+  if (s->value == NULL)
+    cmp = f->func == AGG_MIN? -1: 1;
+  else if (isNum && s->numeric)
+    cmp = d < s->dvalue? -1: d > s->dvalue? 1: 0;
+  else {
+    cmp = memcmp(v, s->value, len < s->vlen? len: s->vlen);
+    if (cmp == 0) cmp = len < s->vlen? -1: len > s->vlen;
+  }
+  if ((f->func == AGG_MIN && cmp < 0) || (f->func == AGG_MAX && cmp > 0)) {
+    if (s->value == NULL || len > s->vcap) {
+      s->value = arenaAlloc(&a->arena, len + 1);
+      s->vcap = len;
+    }
+    memcpy(s->value, v, len);
+    s->vlen = len;
+    s->dvalue = d;
+    s->numeric = isNum;
+  }
+}
+
+void updateState(Aggregation *a, AggFunc *f, AggState *s, RedisModuleString *value) {
+  if (f->field == NULL) {
+    s->count++;
+    return;
+  }
+  if (value == NULL) return;
+
+  long long ll;
+  double d;
+  int isInt = RedisModule_StringToLongLong(value, &ll) == REDISMODULE_OK;
+  int isNum = isInt || RedisModule_StringToDouble(value, &d) == REDISMODULE_OK;
+  if (isInt) d = (double)ll;
+
+  switch (f->func) {
+    case AGG_COUNT:
+      s->count++;
+      break;
+    case AGG_SUM:
+    case AGG_AVG:
+      // the values which are not numbers are ignored like NULL
+      if (!isNum) break;
+      s->count++;
+      s->sum += d;
+      if (isInt && s->integral &&
+          !((ll > 0 && s->isum > LLONG_MAX - ll) || (ll < 0 && s->isum < LLONG_MIN - ll)))
+        s->isum += ll;
+      else
+        s->integral = 0;
+      break;
+    case AGG_DISTINCT: {
+      size_t len;
+      const char *v = RedisModule_StringPtrLen(value, &len);
+      if (s->sketch == NULL) {
+        s->sketch = arenaAlloc(&a->arena, sizeof(HLL));
+        HLL_Init(s->sketch);
+      }
+      HLL_Add(s->sketch, v, len);
+      s->count++;
+      break;
+    }
+    case AGG_PERCENTILE:
+      if (!isNum) break;
+      if (s->sketch == NULL) {
+        s->sketch = arenaAlloc(&a->arena, sizeof(TDigest));
+        TDigest_Init(s->sketch);
+      }
+      TDigest_Add(s->sketch, d, 1);
+      s->count++;
+      break;
+    case AGG_MIN:
+    case AGG_MAX: {
+      size_t len;
+      const char *v = RedisModule_StringPtrLen(value, &len);
+      updateExtreme(a, f, s, v, len, isNum, d);
+      break;
+    }
+  }
+}
+
+/* Encode the values of the group by columns into the key buffer, the length
+ * is returned */
+size_t groupKey(Aggregation *a, RedisModuleString **values) {
+  size_t klen = 0;
+  for (size_t i = 0; i < a->nGroup; i++) {
+    size_t len = 0;
+    if (values[i]) RedisModule_StringPtrLen(values[i], &len);
+    klen += 1 + sizeof(uint32_t) + len;
+  }
+  if (klen > a->keycap) {
+    a->keybuf = RedisModule_Realloc(a->keybuf, klen);
+    a->keycap = klen;
+  }
+  char *p = a->keybuf;
+  for (size_t i = 0; i < a->nGroup; i++) {
+    uint32_t len32 = 0;
+    const char *v = "";
+    if (values[i]) {
+      size_t len;
+      v = RedisModule_StringPtrLen(values[i], &len);
+      len32 = len;
+    }
+    *p++ = values[i] != NULL;
+    memcpy(p, &len32, sizeof(len32));
+    p += sizeof(len32);
+    memcpy(p, v, len32);
+    p += len32;
+  }
+  return klen;
+}
+
+/* Fold the aggregated values of a row into the states of its group */
+void aggregateInto(Aggregation *a, Group *g, RedisModuleString **values) {
+  g->rows++;
+  size_t v = 0;
+  for (size_t f = 0; f < a->nFunc; f++)
+    updateState(a, &a->funcs[f], &g->states[f], a->funcs[f].field? values[v++]: NULL);
+}
+
+/* Fold the values of a row, in the order of the fields of the aggregation,
+ * into the states of its group. A row of a new group is spilled if the groups
+ * are over the budget, unless spill is 0. */
+void aggregateValues(RedisModuleCtx *ctx, RedisModuleString *key, Aggregation *a, RedisModuleString **values, int spill) {
+  size_t klen = groupKey(a, values);
+  uint64_t hash = hashBytes(a->keybuf, klen);
+  Group *g = findGroup(a, a->keybuf, klen, hash, 0);
+  if (g == NULL && spill && a->arena.total > a->budget) {
+    int part = (hash >> (60 - 4 * a->level)) & (SPILL_PARTITIONS - 1);
+    size_t len;
+    const char *k = RedisModule_StringPtrLen(key, &len);
+    uint32_t len32 = len;
+    partialPut(&a->spilled[part], &len32, sizeof(len32));
+    partialPut(&a->spilled[part], k, len32);
+    a->spill |= 1 << part;
+  }
+  else {
+    if (g == NULL) g = findGroup(a, a->keybuf, klen, hash, 1);
+    aggregateInto(a, g, &values[a->nGroup]);
+  }
+}
+
+/* Fold a row into the states of its group. The group columns and the
+ * aggregated fields are read by one batch of HashGet. */
+void aggregateRecord(RedisModuleCtx *ctx, RedisModuleString *key, Aggregation *a, int spill) {
+  RedisModuleString *values[a->nField + 1];
+  memset(values, 0, sizeof(values));
+  if (a->nField > 0) {
+    RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+    if (RedisModule_KeyType(hkey) == REDISMODULE_KEYTYPE_HASH)
+      hashGetFields(hkey, a->fields, values, a->nField);
+    RedisModule_CloseKey(hkey);
+  }
+  aggregateValues(ctx, key, a, values, spill);
+  for (size_t i = 0; i < a->nField; i++)
+    if (values[i]) RedisModule_FreeString(ctx, values[i]);
+}
+
+/* The value of a select item of a group. It is NULL, a long long, a double
+ * or a string. */
+#define OUT_NULL   0
+#define OUT_INT    1
+#define OUT_DOUBLE 2
+#define OUT_STRING 3
+typedef struct OutValue {
+  int type;
+  long long ll;
+  double d;
+  const char *s;
+  size_t len;
+} OutValue;
+
+void outputValue(Aggregation *a, Group *g, int item, OutValue *o) {
+  memset(o, 0, sizeof(OutValue));
+  int i = a->items[item];
+  if (i < 0) {
+    // decode the group column from the key
+    const char *p = g->key;
+    for (int c = 0; ; c++) {
+      uint32_t len32;
+      memcpy(&len32, p + 1, sizeof(len32));
+      if (c == -1 - i) {
+        if (*p) {
+          o->type = OUT_STRING;
+          o->s = p + 1 + sizeof(len32);
+          o->len = len32;
+        }
+        return;
+      }
+      p += 1 + sizeof(len32) + len32;
+    }
+  }
+
+  AggState *s = &g->states[i];
+  switch (a->funcs[i].func) {
+    case AGG_COUNT:
+      o->type = OUT_INT;
+      o->ll = s->count;
+      break;
+    case AGG_MIN:
+    case AGG_MAX:
+      if (s->value) {
+        o->type = OUT_STRING;
+        o->s = s->value;
+        o->len = s->vlen;
+      }
+      break;
+    case AGG_DISTINCT:
+      o->type = OUT_INT;
+      o->ll = s->sketch? HLL_Count(s->sketch): 0;
+      break;
+    case AGG_PERCENTILE:
+      if (s->sketch == NULL) break;
+      o->type = OUT_DOUBLE;
+      o->d = TDigest_Quantile(s->sketch, a->funcs[i].param);
+      break;
+    default:
+      if (s->count == 0) break;
+      if (a->funcs[i].func == AGG_SUM && s->integral) {
+        o->type = OUT_INT;
+        o->ll = s->isum;
+      }
+      else {
+        o->type = OUT_DOUBLE;
+        o->d = a->funcs[i].func == AGG_SUM? s->sum: s->sum / s->count;
+      }
+  }
+}
+
+/* Partial aggregation. A node of a cluster select replies the states of its
+ * groups rather than their values, and the coordinator merges the states of
+ * all the nodes into the groups of the whole table. A group is a single
+ * string: the key of the group, its rows, then each state as it is kept,
+ * including the sketches. */
+static int partialReply;
+
+typedef struct PartialReader {
+  const char *p, *end;
+  int ok;            // 0 once the data is short
+} PartialReader;
+
+void partialGet(PartialReader *r, void *v, size_t len) {
+  if (!r->ok || (size_t)(r->end - r->p) < len) {
+    r->ok = 0;
+    memset(v, 0, len);
+    return;
+  }
+  memcpy(v, r->p, len);
+  r->p += len;
+}
+
+size_t sketchSize(AggFunc *f) {
+  return f->func == AGG_DISTINCT? sizeof(HLL): sizeof(TDigest);
+}
+
+void replyPartialGroup(RedisModuleCtx *ctx, Aggregation *a, Group *g) {
+  PartialBuf b = {NULL, 0, 0};
+  uint32_t klen = g->klen;
+  partialPut(&b, &klen, sizeof(klen));
+  partialPut(&b, g->key, klen);
+  partialPut(&b, &g->rows, sizeof(g->rows));
+  for (size_t f = 0; f < a->nFunc; f++) {
+    AggState *s = &g->states[f];
+    uint32_t vlen = s->value? s->vlen: UINT32_MAX;
+    uint8_t hasSketch = s->sketch != NULL;
+    partialPut(&b, &s->count, sizeof(s->count));
+    partialPut(&b, &s->isum, sizeof(s->isum));
+    partialPut(&b, &s->sum, sizeof(s->sum));
+    partialPut(&b, &s->integral, sizeof(s->integral));
+    partialPut(&b, &s->dvalue, sizeof(s->dvalue));
+    partialPut(&b, &s->numeric, sizeof(s->numeric));
+    partialPut(&b, &vlen, sizeof(vlen));
+    if (s->value) partialPut(&b, s->value, vlen);
+    partialPut(&b, &hasSketch, sizeof(hasSketch));
+    if (hasSketch) partialPut(&b, s->sketch, sketchSize(&a->funcs[f]));
+  }
+  replyStringBuffer(ctx, b.p, b.len);
+  RedisModule_Free(b.p);
+}
+
+/* Merge a group replied by a node into the aggregation, 0 is returned if the
+ * group is malformed */
+int mergePartialGroup(Aggregation *a, const char *p, size_t len) {
+  PartialReader r = {p, p + len, 1};
+  uint32_t klen;
+  partialGet(&r, &klen, sizeof(klen));
+  if (!r.ok || (size_t)(r.end - r.p) < klen) return 0;
+  const char *key = r.p;
+  r.p += klen;
+  long long rows;
+  partialGet(&r, &rows, sizeof(rows));
+  if (!r.ok) return 0;
+
+  Group *g = findGroup(a, key, klen, hashBytes(key, klen), 1);
+  g->rows += rows;
+  for (size_t f = 0; f < a->nFunc && r.ok; f++) {
+    AggFunc *fn = &a->funcs[f];
+    AggState *s = &g->states[f], o;
+    uint32_t vlen;
+    uint8_t hasSketch;
+    partialGet(&r, &o.count, sizeof(o.count));
+    partialGet(&r, &o.isum, sizeof(o.isum));
+    partialGet(&r, &o.sum, sizeof(o.sum));
+    partialGet(&r, &o.integral, sizeof(o.integral));
+    partialGet(&r, &o.dvalue, sizeof(o.dvalue));
+    partialGet(&r, &o.numeric, sizeof(o.numeric));
+    partialGet(&r, &vlen, sizeof(vlen));
+    if (vlen != UINT32_MAX) {
+      if (!r.ok || (size_t)(r.end - r.p) < vlen) return 0;
+      updateExtreme(a, fn, s, r.p, vlen, o.numeric, o.dvalue);
+      r.p += vlen;
+    }
+    s->count += o.count;
+    s->sum += o.sum;
+    if (s->integral && o.integral &&
+        !((o.isum > 0 && s->isum > LLONG_MAX - o.isum) || (o.isum < 0 && s->isum < LLONG_MIN - o.isum)))
+      s->isum += o.isum;
+    else
+      s->integral = 0;
+
+    partialGet(&r, &hasSketch, sizeof(hasSketch));
+    if (hasSketch) {
+      size_t size = sketchSize(fn);
+      if (!r.ok || (size_t)(r.end - r.p) < size) return 0;
+      void *sketch = arenaAlloc(&a->arena, size);
+      memcpy(sketch, r.p, size);
+      r.p += size;
+      if (s->sketch == NULL)
+        s->sketch = sketch;
+      else if (fn->func == AGG_DISTINCT)
+        HLL_Merge(s->sketch, sketch);
+      else
+        TDigest_Merge(s->sketch, sketch);
+    }
+  }
+  return r.ok;
+}
+
+/* Reply a group in the same form as showRecord */
+void replyGroup(RedisModuleCtx *ctx, Aggregation *a, Group *g) {
+  if (partialReply) {
+    replyPartialGroup(ctx, a, g);
+    return;
+  }
+  replyArray(ctx, 2 * a->nItem);
+  for (size_t i = 0; i < a->nItem; i++) {
+    OutValue o;
+    outputValue(a, g, i, &o);
+    replySimpleString(ctx, a->labels[i]);
+    switch (o.type) {
+      case OUT_NULL: replyNull(ctx); break;
+      case OUT_INT: replyLongLong(ctx, o.ll); break;
+      case OUT_DOUBLE: replyDouble(ctx, o.d); break;
+      default: replyStringBuffer(ctx, o.s, o.len);
+    }
+  }
+}
+
+/* Strings looking like numbers are ordered by value */
+int outputNumber(OutValue *o, double *d) {
+  if (o->type == OUT_INT) *d = o->ll;
+  else if (o->type == OUT_DOUBLE) *d = o->d;
+  else if (o->type == OUT_STRING && o->len > 0 && o->len < 64) {
+    char buf[64], *end;
+    memcpy(buf, o->s, o->len);
+    buf[o->len] = 0;
+    *d = strtod(buf, &end);
+    return *end == 0;
+  }
+  else
+    return 0;
+  return 1;
+}
+
+static Aggregation *sortAggregation;
+
+int compareGroups(const void *x, const void *y) {
+  Aggregation *a = sortAggregation;
+  Group *gx = *(Group**)x, *gy = *(Group**)y;
+  for (size_t i = 0; i < a->nOrder; i++) {
+    OutValue ox, oy;
+    double dx, dy;
+    outputValue(a, gx, a->orders[i], &ox);
+    outputValue(a, gy, a->orders[i], &oy);
+    int cmp;
+    if (ox.type == OUT_NULL || oy.type == OUT_NULL)
+      cmp = (ox.type != OUT_NULL) - (oy.type != OUT_NULL);
+    else if (ox.type == OUT_INT && oy.type == OUT_INT)
+      cmp = (ox.ll > oy.ll) - (ox.ll < oy.ll);
+    else if (outputNumber(&ox, &dx) && outputNumber(&oy, &dy))
+      cmp = (dx > dy) - (dx < dy);
+    else if (ox.type == OUT_STRING && oy.type == OUT_STRING) {
+      cmp = memcmp(ox.s, oy.s, ox.len < oy.len? ox.len: oy.len);
+      if (cmp == 0) cmp = (ox.len > oy.len) - (ox.len < oy.len);
+    }
+    else
+      cmp = ox.type == OUT_STRING? 1: -1;
+    if (cmp != 0) return a->descs[i]? -cmp: cmp;
+  }
+  return 0;
+}
+
+/* Copy a group out of the arena of the groups into one allocation, freed by
+ * RedisModule_Free */
+Group *copyGroup(Aggregation *a, Group *g) {
+  size_t head = sizeof(Group) + a->nFunc * sizeof(AggState);
+  size_t size = head + g->klen + 1;
+  for (size_t f = 0; f < a->nFunc; f++) {
+    if (g->states[f].sketch != NULL)
+      size += a->funcs[f].func == AGG_DISTINCT? sizeof(HLL): sizeof(TDigest);
+    if (g->states[f].value != NULL) size += g->states[f].vlen + 1;
+  }
+  Group *c = RedisModule_Alloc(size);
+  memcpy(c, g, head);
+  char *p = (char*)c + head;
+  // the sketches first, as they are aligned after the states
+  for (size_t f = 0; f < a->nFunc; f++) {
+    if (g->states[f].sketch == NULL) continue;
+    size_t len = a->funcs[f].func == AGG_DISTINCT? sizeof(HLL): sizeof(TDigest);
+    c->states[f].sketch = memcpy(p, g->states[f].sketch, len);
+    p += len;
+  }
+  for (size_t f = 0; f < a->nFunc; f++) {
+    if (g->states[f].value == NULL) continue;
+    c->states[f].value = memcpy(p, g->states[f].value, g->states[f].vlen);
+    p[g->states[f].vlen] = 0;
+    p += g->states[f].vlen + 1;
+  }
+  c->key = memcpy(p, g->key, g->klen);
+  p[g->klen] = 0;
+  return c;
+}
+
+/* The groups on their way to the reply. Without order by they are replied
+ * at once. With order by they are kept for the sort, copied if the groups in
+ * memory are dropped between spilled partitions. With top clause too only
+ * the first top groups are kept, in a heap whose root is the last of them. */
+typedef struct GroupSink {
+  Group **rows;
+  size_t nRow, capRow;
+  size_t offered;
+  int copy;
+  long limit;
+  size_t replied;
+} GroupSink;
+
+static void siftGroup(Group **rows, size_t n, size_t i) {
+  for (;;) {
+    size_t m = i, l = 2 * i + 1, r = l + 1;
+    if (l < n && compareGroups(&rows[l], &rows[m]) > 0) m = l;
+    if (r < n && compareGroups(&rows[r], &rows[m]) > 0) m = r;
+    if (m == i) return;
+    Group *t = rows[i];
+    rows[i] = rows[m];
+    rows[m] = t;
+    i = m;
+  }
+}
+
+void sinkGroups(RedisModuleCtx *ctx, Aggregation *a, GroupSink *s) {
+  for (size_t i = 0; i < a->cap; i++) {
+    // the groups of a view whose rows are all gone are left empty
+    Group *g = a->slots[i];
+    if (g == NULL || (g->rows == 0 && a->nGroup > 0)) continue;
+    if (a->nOrder == 0) {
+      if (s->limit == 0) break;
+      replyGroup(ctx, a, g);
+      s->replied++;
+      s->limit--;
+      continue;
+    }
+    s->offered++;
+    if (s->limit >= 0 && s->nRow == (size_t)s->limit) {
+      // a group after the last of the top groups is dropped
+      if (s->nRow == 0 || compareGroups(&g, &s->rows[0]) >= 0) continue;
+      if (s->copy) RedisModule_Free(s->rows[0]);
+      s->rows[0] = s->copy? copyGroup(a, g): g;
+      siftGroup(s->rows, s->nRow, 0);
+      continue;
+    }
+    if (s->nRow == s->capRow) {
+      s->capRow = s->capRow? 2 * s->capRow: 64;
+      s->rows = RedisModule_Realloc(s->rows, s->capRow * sizeof(Group*));
+    }
+    s->rows[s->nRow++] = s->copy? copyGroup(a, g): g;
+    if (s->limit >= 0 && s->nRow == (size_t)s->limit)
+      for (size_t j = s->nRow / 2; j-- > 0;) siftGroup(s->rows, s->nRow, j);
+  }
+}
+
+/* Aggregate the spilled partitions one by one. The keys of a partition over
+ * the budget spill again to the partitions of the next level, aggregated
+ * before the next partition of this level. */
+void aggregateSpilled(RedisModuleCtx *ctx, Aggregation *a, GroupSink *s, int level) {
+  PartialBuf spilled[SPILL_PARTITIONS];
+  int spill = a->spill;
+  memcpy(spilled, a->spilled, sizeof(spilled));
+  memset(a->spilled, 0, sizeof(a->spilled));
+  for (int p = 0; p < SPILL_PARTITIONS; p++) {
+    if (!(spill & (1 << p))) continue;
+    resetGroups(a);
+    a->spill = 0;
+    a->level = level;
+    PartialReader r = {spilled[p].p, spilled[p].p + spilled[p].len, 1};
+    uint32_t len;
+    while (r.p < r.end) {
+      partialGet(&r, &len, sizeof(len));
+      RedisModuleString *key = RedisModule_CreateString(ctx, r.p, len);
+      r.p += len;
+      aggregateRecord(ctx, key, a, level < SPILL_LEVELS);
+      RedisModule_FreeString(ctx, key);
+    }
+    RedisModule_Free(spilled[p].p);
+    spilled[p].p = NULL;
+    sinkGroups(ctx, a, s);
+    if (a->spill) aggregateSpilled(ctx, a, s, level + 1);
+  }
+}
+
+/* Reply the groups, the spilled partitions are aggregated one by one after
+ * the groups in memory. With order by, the groups are sorted at last, so
+ * without top clause all of them are kept until then, copied out of the
+ * budget of the groups. The number of rows replied is returned. */
+size_t replyAggregation(RedisModuleCtx *ctx, Aggregation *a) {
+  // Without group by, an empty table is still a row of count 0
+  if (a->nGroup == 0 && a->n == 0) findGroup(a, "", 0, hashBytes("", 0), 1);
+
+  GroupSink s = {0};
+  s.copy = a->spill != 0;
+  s.limit = a->limit;
+  sortAggregation = a;
+  sinkGroups(ctx, a, &s);
+  if (a->spill) aggregateSpilled(ctx, a, &s, 1);
+
+  if (a->nOrder > 0) {
+    STAGE(STAGE_SINK);
+    qsort(s.rows, s.nRow, sizeof(Group*), compareGroups);
+    STAT(sorted, s.offered);
+    TRACE_ROWS(STAGE_SORT, s.offered, s.nRow);
+    TRACE_MEM(STAGE_SORT, s.capRow * sizeof(Group*));
+    STAGE(STAGE_SORT);
+    for (size_t i = 0; i < s.nRow; i++) {
+      replyGroup(ctx, a, s.rows[i]);
+      s.replied++;
+    }
+  }
+  if (a->limit >= 0) TRACE_ROWS(STAGE_TOP, a->nOrder > 0? s.offered: s.replied, s.replied);
+  TRACE_MEM(STAGE_SINK, a->arena.total + a->cap * sizeof(Group*));
+  if (s.copy)
+    for (size_t i = 0; i < s.nRow; i++) RedisModule_Free(s.rows[i]);
+  RedisModule_Free(s.rows);
+  return s.replied;
+}
+
+/* Materialized views. A view keeps the groups of its aggregate query in the
+ * module and folds each change of a row of its table into them, so reading
+ * the view costs the number of groups instead of a scan. Only count, sum and
+ * avg can be maintained, as the share of a row can be taken back exactly. The
+ * definition is kept in the hash __dbx_view:<name>, the groups are built by a
+ * scan when the view is read the first time after a restart. */
+#define VIEW_PREFIX "__dbx_view:"
+
+/* The share of a row in its group, remembered to take it back when the row
+ * is changed or deleted */
+typedef struct RowShare {
+  Group *group;
+  struct {
+    int has;         // the value is counted
+    int isInt;
+    long long ll;
+    double d;
+  } values[];
+} RowShare;
+
+typedef struct View {
+  char name[128];
+  char *query;       // the select statement after "select"
+  char *select;      // the clauses owned by the view
+  char *where;
+  char *group;
+  Table table;
+  regex_t regex;
+  Vector *vWhere;
+  Arena arena;       // the conditions of the where clause
+  Aggregation *agg;
+  RedisModuleDict *rows;  // row key to RowShare
+  int built;
+  struct View *next;
+} View;
+
+static View *views;
+
+View *findView(RedisModuleCtx *ctx, const char *name);
+
+/* Fold the current content of a row into the view, after taking back its
+ * previous share. The row may be gone or no longer match the where clause. */
+void viewApplyRow(RedisModuleCtx *ctx, View *view, RedisModuleString *key) {
+  Aggregation *a = view->agg;
+  RowShare *old = RedisModule_DictGet(view->rows, key, NULL);
+  if (old != NULL) {
+    Group *g = old->group;
+    g->rows--;
+    for (size_t f = 0; f < a->nFunc; f++) {
+      AggState *s = &g->states[f];
+      if (a->funcs[f].field == NULL) s->count--;
+      else if (old->values[f].has) {
+        s->count--;
+        s->sum -= old->values[f].d;
+        if (old->values[f].isInt) s->isum -= old->values[f].ll;
+      }
+    }
+    RedisModule_DictDel(view->rows, key, NULL);
+    RedisModule_Free(old);
+  }
+
+  RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+  int isHash = RedisModule_KeyType(hkey) == REDISMODULE_KEYTYPE_HASH;
+  if (!isHash || !whereRecord(ctx, key, view->vWhere)) {
+    RedisModule_CloseKey(hkey);
+    return;
+  }
+  RedisModuleString *values[a->nField + 1];
+  memset(values, 0, sizeof(values));
+  hashGetFields(hkey, a->fields, values, a->nField);
+  RedisModule_CloseKey(hkey);
+
+  size_t klen = groupKey(a, values);
+  Group *g = findGroup(a, a->keybuf, klen, hashBytes(a->keybuf, klen), 1);
+  g->rows++;
+
+  RowShare *share = RedisModule_Calloc(1, sizeof(RowShare) + a->nFunc * sizeof(share->values[0]));
+  share->group = g;
+  size_t v = a->nGroup;
+  for (size_t f = 0; f < a->nFunc; f++) {
+    AggState *s = &g->states[f];
+    if (a->funcs[f].field == NULL) {
+      s->count++;
+      continue;
+    }
+    RedisModuleString *value = values[v++];
+    if (value == NULL) continue;
+    long long ll;
+    double d = 0;
+    int isInt = RedisModule_StringToLongLong(value, &ll) == REDISMODULE_OK;
+    int isNum = isInt || RedisModule_StringToDouble(value, &d) == REDISMODULE_OK;
+    if (isInt) d = (double)ll;
+    // count(field) counts any value, sum and avg only numbers
+    if (a->funcs[f].func != AGG_COUNT && !isNum) continue;
+    share->values[f].has = 1;
+    s->count++;
+    if (!isNum) continue;
+    share->values[f].d = d;
+    s->sum += d;
+    if (isInt && s->integral &&
+        !((ll > 0 && s->isum > LLONG_MAX - ll) || (ll < 0 && s->isum < LLONG_MIN - ll))) {
+      s->isum += ll;
+      share->values[f].isInt = 1;
+      share->values[f].ll = ll;
+    }
+    else
+      s->integral = 0;
+  }
+  RedisModule_DictSet(view->rows, key, share);
+
+  for (size_t i = 0; i < a->nField; i++)
+    if (values[i]) RedisModule_FreeString(ctx, values[i]);
+}
+
+/* Build the groups of a view by a scan of its table */
+void viewBuild(RedisModuleCtx *ctx, View *view) {
+  KeyScan ks;
+  RedisModuleString *key;
+  keyScanInit(ctx, &ks, &view->table, &view->regex);
+  while ((key = keyScanNext(ctx, &ks)) != NULL) {
+    viewApplyRow(ctx, view, key);
+    RedisModule_FreeString(ctx, key);
+  }
+  keyScanFree(&ks);
+  view->built = 1;
+}
+
+/* Apply a changed row to the built views of its table. It is called by the
+ * statements writing rows through the key API, which raises no keyspace
+ * event, and by the keyspace events of the other commands. Applying a row
+ * twice is harmless. */
+void viewsRowChanged(RedisModuleCtx *ctx, RedisModuleString *key) {
+  const char *k = NULL;
+  for (View *view = views; view != NULL; view = view->next) {
+    if (!view->built) continue;
+    if (k == NULL) k = RedisModule_StringToChar(key);
+    if (matchKey(&view->regex, k)) viewApplyRow(ctx, view, key);
+  }
+}
+
+/* Finish the reply of select statement with n rows, or with the rows of
+ * aggregate functions */
+void endReply(RedisModuleCtx *ctx, IntoTarget *into, Aggregation *agg, size_t n) {
+  if (agg != NULL) n = replyAggregation(ctx, agg);
+  STAT(returned, n);
+  TRACE_ROWS(STAGE_SINK, 0, n);
+  if (into != NULL) {
+    updateRowCount(ctx, &into->table, into->added);
+    into->added = 0;
+  }
+  if (into == NULL || !into->compact) {
+    replySetArrayLength(ctx, n);
+    return;
+  }
+
+  replyArray(ctx, 3);
+  replyLongLong(ctx, n);
+  if (into->first) replyString(ctx, into->first);
+  else replyNull(ctx);
+  if (into->last) replyString(ctx, into->last);
+  else if (into->first) replyString(ctx, into->first);
+  else replyNull(ctx);
+  if (into->first) RedisModule_FreeString(ctx, into->first);
+  if (into->last) RedisModule_FreeString(ctx, into->last);
+  into->first = into->last = NULL;
+}
+
+int processRecord(RedisModuleCtx *ctx, RedisModuleString *key, Vector *vSelect, Vector *vWhere, Aggregation *agg, IntoTarget *into, char *csvFile) {
+  if (vWhere == NULL || whereRecord(ctx, key, vWhere)) {
+    if (agg != NULL)
+      aggregateRecord(ctx, key, agg, 1);
+    else if (strlen(csvFile) > 0)
+      intoCSV(ctx, key, vSelect, csvFile);
+    else if (into != NULL)
+      return intoRecord(ctx, key, vSelect, into);
+    else
+      showRecord(ctx, key, vSelect);
+    return 1;
+  }
+  return 0;
+}
+
+/* Count the rows of the last stages of a select: the rows offered to top
+ * clause and the rows kept, which are projected if they are replied, and go
+ * into the sink. The time since the last lap went to the projection or to the
+ * sink. */
+void traceEmit(int replied, long top, size_t offered, size_t kept) {
+  if (curTrace == NULL) return;
+  if (top >= 0) TRACE_ROWS(STAGE_TOP, offered, kept);
+  if (replied) TRACE_ROWS(STAGE_PROJECT, kept, kept);
+  TRACE_ROWS(STAGE_SINK, kept, 0);
+  stageLap(replied? STAGE_PROJECT: STAGE_SINK);
+}
+
+size_t processRecords(RedisModuleCtx *ctx, RedisModuleCallReply *keys, regex_t *r, Vector *vSelect, Vector *vWhere, Aggregation *agg, long *top, IntoTarget *into, char *csvFile) {
+  size_t nKeys = RedisModule_CallReplyLength(keys);
+  size_t affected = 0, i;
+  long limit = *top;
+  for (i = 0; i < nKeys && *top != 0; i++) {
+    RedisModuleString *key = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(keys, i));
+    const char *s = RedisModule_StringToChar(key);
+    if (matchKey(r, s) && processRecord(ctx, key, vSelect, vWhere, agg, into, csvFile)) {
+      affected++;
+      (*top)--;
+    }
+    RedisModule_FreeString(ctx, key);
+  }
+  traceEmit(agg == NULL && into == NULL && strlen(csvFile) == 0, limit, i, affected);
+  return affected;
+}
+
+/* Batch executor of the scan. The matching keys of up to BATCH_SIZE rows are
+ * collected, the fields used by the statement are fetched once per row into
+ * column vectors, and the where conditions are evaluated column by column on
+ * a selection vector of the rows still qualifying. The projection and the
+ * aggregation read the same vectors, so a row costs a single open and a few
+ * HashGet calls whatever the number of conditions and selected fields. */
+#define BATCH_SIZE 1024
+
+typedef struct Batch {
+  size_t n;
+  RedisModuleString *keys[BATCH_SIZE];
+  size_t nCol;
+  char **cols;
+  RedisModuleString **values;  // column major, BATCH_SIZE values per column
+  size_t nSel;
+  uint16_t sel[BATCH_SIZE];    // the qualifying rows
+  size_t nCond;
+  int *condCols;
+  int *condOps;
+  char **condValues;
+  LikePattern **condLikes;
+  Vector **condLists;          // values of in, alternatives of or
+  int valid;                   // 0 if no row can match the where clause
+  int project;                 // the rows are replied from the columns
+  int *selCols;                // column of each select item, -1 for rowid()
+  int *aggCols;                // column of each field of the aggregation
+} Batch;
+
+int batchColumn(Batch *b, char *field) {
+  for (size_t c = 0; c < b->nCol; c++)
+    if (strcmp(b->cols[c], field) == 0) return c;
+  b->cols[b->nCol] = field;
+  return b->nCol++;
+}
+
+/* Conditions in the groups of or, whose fields are fetched too */
+size_t whereFields(Vector *vWhere) {
+  size_t n = 0;
+  for (int i = 0; i + 2 < Vector_Size(vWhere); i += 3) {
+    Vector *alts = whereList(vWhere, i), *alt;
+    if (whereOp(vWhere, i+1) != WHERE_OR) n++;
+    else for (int k = 0; k < Vector_Size(alts); k++)
+      if (Vector_Get(alts, k, &alt)) n += whereFields(alt);
+  }
+  return n;
+}
+
+void batchOrColumns(Batch *b, Vector *alts) {
+  Vector *alt;
+  for (int k = 0; k < Vector_Size(alts); k++) {
+    Vector_Get(alts, k, &alt);
+    for (int i = 0; i + 2 < Vector_Size(alt); i += 3) {
+      if (whereOp(alt, i+1) == WHERE_OR) batchOrColumns(b, whereList(alt, i));
+      else batchColumn(b, VectorGetString(alt, i));
+    }
+  }
+}
+
+/* Evaluate a conjunction on a row of the batch, as whereMatch on its key */
+int batchRowMatch(Batch *b, uint16_t r, Vector *vWhere) {
+  if (Vector_Size(vWhere) % 3 != 0) return 0;
+  for (int i = 0; i < Vector_Size(vWhere); i += 3) {
+    int match = 0;
+    if (whereOp(vWhere, i+1) == WHERE_OR) {
+      Vector *alts = whereList(vWhere, i), *alt;
+      for (int k = 0; k < Vector_Size(alts) && !match; k++)
+        if (Vector_Get(alts, k, &alt)) match = batchRowMatch(b, r, alt);
+    }
+    else {
+      RedisModuleString *value = b->values[batchColumn(b, VectorGetString(vWhere, i)) * BATCH_SIZE + r];
+      size_t len;
+      const char *s = value? RedisModule_StringPtrLen(value, &len): NULL;
+      match = s != NULL && whereValueMatch(vWhere, i, s, len);
+    }
+    if (match == 0) return 0;
+  }
+  return 1;
+}
+
+/* The batch lives in the arena of the statement */
+Batch *newBatch(Arena *a, Vector *vSelect, Vector *vWhere, Aggregation *agg) {
+  size_t nSelect = Vector_Size(vSelect), nWhere = Vector_Size(vWhere) / 3;
+  size_t maxCol = nSelect + whereFields(vWhere) + (agg? agg->nField: 0) + 1;
+  Batch *b = arenaCalloc(a, 1, sizeof(Batch));
+  b->cols = arenaCalloc(a, maxCol, sizeof(char*));
+  b->condCols = arenaCalloc(a, nWhere + 1, sizeof(int));
+  b->condOps = arenaCalloc(a, nWhere + 1, sizeof(int));
+  b->condValues = arenaCalloc(a, nWhere + 1, sizeof(char*));
+  b->condLikes = arenaCalloc(a, nWhere + 1, sizeof(LikePattern*));
+  b->condLists = arenaCalloc(a, nWhere + 1, sizeof(Vector*));
+  b->selCols = arenaCalloc(a, nSelect + 1, sizeof(int));
+  b->aggCols = arenaCalloc(a, (agg? agg->nField: 0) + 1, sizeof(int));
+
+  b->valid = Vector_Size(vWhere) % 3 == 0;
+  for (size_t i = 0; i < nWhere; i++) {
+    b->condOps[i] = whereOp(vWhere, 3 * i + 1);
+    b->condValues[i] = whereValue(vWhere, 3 * i);
+    b->condLikes[i] = whereLike(vWhere, 3 * i);
+    b->condLists[i] = whereList(vWhere, 3 * i);
+    if (b->condOps[i] == WHERE_OR) batchOrColumns(b, b->condLists[i]);
+    else b->condCols[i] = batchColumn(b, VectorGetString(vWhere, 3 * i));
+    if (b->condLists[i] == NULL && strlen(b->condValues[i]) == 0) b->valid = 0;
+  }
+  b->nCond = nWhere;
+
+  if (agg != NULL) {
+    for (size_t i = 0; i < agg->nField; i++)
+      b->aggCols[i] = batchColumn(b, agg->fields[i]);
+  }
+  else {
+    b->project = 1;
+    for (size_t i = 0; i < nSelect; i++) {
+      char *item = VectorGetString(vSelect, i);
+      if (strcmp(item, "*") == 0) b->project = 0;
+      else b->selCols[i] = strcmp(item, "rowid()") == 0? -1: batchColumn(b, item);
+    }
+  }
+  b->values = arenaCalloc(a, b->nCol * BATCH_SIZE + 1, sizeof(RedisModuleString*));
+  TRACE_MEM(STAGE_FETCH, sizeof(Batch) + (b->nCol * BATCH_SIZE + 1) * sizeof(RedisModuleString*));
+  return b;
+}
+
+/* Fetch the columns of all the rows, a row by one open of its key */
+void batchFetch(RedisModuleCtx *ctx, Batch *b) {
+  if (b->nCol == 0) return;
+  RedisModuleString *row[b->nCol];
+  for (size_t r = 0; r < b->n; r++) {
+    memset(row, 0, sizeof(row));
+    RedisModuleKey *hkey = RedisModule_OpenKey(ctx, b->keys[r], REDISMODULE_READ);
+    if (RedisModule_KeyType(hkey) == REDISMODULE_KEYTYPE_HASH)
+      hashGetFields(hkey, b->cols, row, b->nCol);
+    RedisModule_CloseKey(hkey);
+    for (size_t c = 0; c < b->nCol; c++)
+      b->values[c * BATCH_SIZE + r] = row[c];
+  }
+  STAT(fetched, b->n * b->nCol);
+  TRACE_ROWS(STAGE_FETCH, b->n, b->n);
+}
+
+/* Keep the selected rows whose value of column c satisfies cond, a missing
+ * value never does */
+#define FILTER_KERNEL(cond) \
+  for (size_t i = 0; i < b->nSel; i++) { \
+    uint16_t r = b->sel[i]; \
+    if (col[r] == NULL) continue; \
+    const char *s = RedisModule_StringPtrLen(col[r], &len); \
+    if (cond) b->sel[out++] = r; \
+  }
+
+void batchFilter(Batch *b) {
+  b->nSel = b->valid? b->n: 0;
+  for (size_t r = 0; r < b->nSel; r++) b->sel[r] = r;
+  for (size_t k = 0; k < b->nCond && b->nSel > 0; k++) {
+    RedisModuleString **col = &b->values[b->condCols[k] * BATCH_SIZE];
+    const char *w = b->condValues[k];
+    size_t out = 0, len;
+    if (b->condOps[k] == WHERE_OR) {
+      for (size_t i = 0; i < b->nSel; i++) {
+        Vector *alt;
+        uint16_t r = b->sel[i];
+        for (int a = 0; a < Vector_Size(b->condLists[k]); a++)
+          if (Vector_Get(b->condLists[k], a, &alt) && batchRowMatch(b, r, alt)) {
+            b->sel[out++] = r;
+            break;
+          }
+      }
+      b->nSel = out;
+      continue;
+    }
+    switch (b->condOps[k]) {
+      case 0: FILTER_KERNEL(whereCompare(s, w) >= 0) break;
+      case 1: FILTER_KERNEL(whereCompare(s, w) <= 0) break;
+      case 2:
+      case 3: FILTER_KERNEL(strcmp(s, w) != 0) break;
+      case 4: FILTER_KERNEL(whereCompare(s, w) > 0) break;
+      case 5: FILTER_KERNEL(whereCompare(s, w) < 0) break;
+      case 6: FILTER_KERNEL(strcmp(s, w) == 0) break;
+      case 7: FILTER_KERNEL(likeMatch(b->condLikes[k], s, len)) break;
+      case WHERE_IN: FILTER_KERNEL(inList(b->condLists[k], s)) break;
+    }
+    b->nSel = out;
+  }
+  STAT(matched, b->nSel);
+  TRACE_ROWS(STAGE_FILTER, b->n, b->nSel);
+}
+
+/* Reply a selected row from the columns in the same form as showRecord */
+void batchShowRow(RedisModuleCtx *ctx, Batch *b, Vector *vSelect, uint16_t r) {
+  size_t nSelect = Vector_Size(vSelect);
+  replyArray(ctx, 2 * nSelect);
+  for (size_t i = 0; i < nSelect; i++) {
+    replySimpleString(ctx, VectorGetString(vSelect, i));
+    RedisModuleString *value = b->selCols[i] < 0? b->keys[r]: b->values[b->selCols[i] * BATCH_SIZE + r];
+    if (value) replyString(ctx, value);
+    else replyNull(ctx);
+  }
+}
+
+/* Fetch, filter and emit the rows of the batch, then empty it. The number of
+ * rows emitted is returned. */
+size_t batchRun(RedisModuleCtx *ctx, Batch *b, Vector *vSelect, Aggregation *agg, long *top, IntoTarget *into, char *csvFile) {
+  STAGE(STAGE_SCAN);
+  batchFetch(ctx, b);
+  STAGE(STAGE_FETCH);
+  batchFilter(b);
+  STAGE(STAGE_FILTER);
+
+  size_t affected = 0, i;
+  long limit = *top;
+  RedisModuleString *values[agg? agg->nField + 1: 1];
+  for (i = 0; i < b->nSel && *top != 0; i++) {
+    uint16_t r = b->sel[i];
+    if (agg != NULL) {
+      for (size_t f = 0; f < agg->nField; f++)
+        values[f] = b->values[b->aggCols[f] * BATCH_SIZE + r];
+      aggregateValues(ctx, b->keys[r], agg, values, 1);
+      affected++;
+    }
+    else if (b->project && into == NULL && strlen(csvFile) == 0) {
+      batchShowRow(ctx, b, vSelect, r);
+      affected++;
+    }
+    else if (processRecord(ctx, b->keys[r], vSelect, NULL, NULL, into, csvFile))
+      affected++;
+    else
+      continue;
+    (*top)--;
+  }
+
+  for (size_t r = 0; r < b->n; r++) {
+    for (size_t c = 0; c < b->nCol; c++) {
+      RedisModuleString **v = &b->values[c * BATCH_SIZE + r];
+      if (*v) RedisModule_FreeString(ctx, *v);
+      *v = NULL;
+    }
+    RedisModule_FreeString(ctx, b->keys[r]);
+  }
+  b->n = 0;
+  traceEmit(agg == NULL && into == NULL && strlen(csvFile) == 0, limit, i, affected);
+  return affected;
+}
+
+/* Native column store. A table created "using columnar" keeps all its rows in
+ * the single module key __dbx_data:<name> instead of a hash per row. Each
+ * column is a vector of its values: a column holding only integers is kept
+ * as int64, any other as strings, with a byte per row telling a missing
+ * value. The rows of a table with primary key are indexed by the key value.
+ * Rows have no order, a deleted row is replaced by the last row. */
+#define COLUMN_PREFIX "__dbx_data:"
+#define COL_INT    0
+#define COL_STRING 1
+#define COL_DICT   2
+
+/* A string column of few distinct values is dictionary encoded, each value is
+ * kept once in the dictionary of the column and the rows hold its 16-bit code.
+ * The dictionary may grow to DICT_MIN_CODES values whatever the rows, then as
+ * long as it stays under a quarter of the rows. A column outgrowing it is
+ * turned into plain strings. */
+#define DICT_MIN_CODES 256
+#define DICT_MAX_CODES 65535
+
+typedef struct Column {
+  char *name;
+  int type;
+  long long *ints;        // COL_INT
+  char **strs;            // COL_STRING
+  uint16_t *codes;        // COL_DICT
+  char **entries;         // values of the codes
+  size_t nDict, capDict;
+  RedisModuleDict *dict;  // value to code + 1
+  uint8_t *nulls;         // 1 if the row has no value
+} Column;
+
+typedef struct ColTable {
+  size_t nCol;
+  Column *cols;
+  int keyCol;               // primary key column, -1 if rows are named by row id
+  size_t nRow, cap;
+  long long *ids;           // row id of each row
+  long long nextId;
+  RedisModuleDict *index;   // primary key value to row + 1
+} ColTable;
+
+static RedisModuleType *ColumnType;
+
+ColTable *colCreate(const char *columns, const char *key) {
+  ColTable *t = RedisModule_Calloc(1, sizeof(ColTable));
+  char *names = RedisModule_Strdup(columns);
+  Vector *v = splitStringByChar(NULL, names, ",");
+  t->nCol = Vector_Size(v);
+  t->cols = RedisModule_Calloc(t->nCol + 1, sizeof(Column));
+  t->keyCol = -1;
+  for (size_t c = 0; c < t->nCol; c++) {
+    t->cols[c].name = RedisModule_Strdup(VectorGetString(v, c));
+    if (key != NULL && strcmp(t->cols[c].name, key) == 0) t->keyCol = c;
+  }
+  Vector_Free(v);
+  RedisModule_Free(names);
+  t->nextId = 1;
+  t->index = RedisModule_CreateDict(NULL);
+  return t;
+}
+
+/* Drop the dictionary of a column */
+void colFreeDict(Column *col) {
+  for (size_t i = 0; i < col->nDict; i++) RedisModule_Free(col->entries[i]);
+  RedisModule_Free(col->entries);
+  RedisModule_Free(col->codes);
+  if (col->dict) RedisModule_FreeDict(NULL, col->dict);
+  col->entries = NULL;
+  col->codes = NULL;
+  col->dict = NULL;
+  col->nDict = col->capDict = 0;
+}
+
+void colFree(void *value) {
+  ColTable *t = value;
+  for (size_t c = 0; c < t->nCol; c++) {
+    Column *col = &t->cols[c];
+    if (col->strs)
+      for (size_t r = 0; r < t->nRow; r++) RedisModule_Free(col->strs[r]);
+    RedisModule_Free(col->strs);
+    RedisModule_Free(col->ints);
+    colFreeDict(col);
+    RedisModule_Free(col->nulls);
+    RedisModule_Free(col->name);
+  }
+  RedisModule_Free(t->cols);
+  RedisModule_Free(t->ids);
+  RedisModule_FreeDict(NULL, t->index);
+  RedisModule_Free(t);
+}
+
+int colFindColumn(ColTable *t, const char *name) {
+  for (size_t c = 0; c < t->nCol; c++)
+    if (strcmp(t->cols[c].name, name) == 0) return c;
+  return -1;
+}
+
+/* The value of a row as string, integers are formatted into buf of 32 bytes.
+ * NULL is returned for a missing value. */
+const char *colGetValue(ColTable *t, size_t row, int c, char *buf) {
+  Column *col = &t->cols[c];
+  if (col->nulls[row]) return NULL;
+  if (col->type == COL_STRING) return col->strs[row];
+  if (col->type == COL_DICT) return col->entries[col->codes[row]];
+  snprintf(buf, 32, "%lld", col->ints[row]);
+  return buf;
+}
+
+/* The code of a value in the dictionary of the column. A new value is added
+ * if add is set and the dictionary is not full. -1 is returned if the value
+ * has no code. */
+long colDictCode(ColTable *t, Column *col, const char *value, int add) {
+  int nokey;
+  size_t len = strlen(value);
+  void *code = RedisModule_DictGetC(col->dict, (void*)value, len, &nokey);
+  if (!nokey) return (long)(intptr_t)code - 1;
+  if (!add || col->nDict >= DICT_MAX_CODES || (col->nDict >= DICT_MIN_CODES && col->nDict >= t->nRow / 4))
+    return -1;
+
+  if (col->nDict == col->capDict) {
+    col->capDict = col->capDict? 2 * col->capDict: 16;
+    col->entries = RedisModule_Realloc(col->entries, col->capDict * sizeof(char*));
+  }
+  col->entries[col->nDict] = RedisModule_Strdup(value);
+  RedisModule_DictSetC(col->dict, (void*)value, len, (void*)(intptr_t)(col->nDict + 1));
+  return col->nDict++;
+}
+
+/* Turn a column into plain strings, when its dictionary is full or an
+ * integer column gets another value of too many distinct values */
+void colToString(ColTable *t, Column *col) {
+  char buf[32];
+  char **strs = RedisModule_Calloc(t->cap, sizeof(char*));
+  for (size_t r = 0; r < t->nRow; r++) {
+    const char *v = colGetValue(t, r, col - t->cols, buf);
+    if (v != NULL) strs[r] = RedisModule_Strdup(v);
+  }
+  RedisModule_Free(col->ints);
+  col->ints = NULL;
+  colFreeDict(col);
+  col->strs = strs;
+  col->type = COL_STRING;
+}
+
+/* An integer column turns into a dictionary encoded column at its first
+ * other value, or into plain strings if its values do not fit a dictionary */
+void colToDict(ColTable *t, Column *col) {
+  char buf[32];
+  col->codes = RedisModule_Calloc(t->cap, sizeof(uint16_t));
+  col->dict = RedisModule_CreateDict(NULL);
+  for (size_t r = 0; r < t->nRow; r++) {
+    if (col->nulls[r]) continue;
+    snprintf(buf, sizeof(buf), "%lld", col->ints[r]);
+    long code = colDictCode(t, col, buf, 1);
+    if (code < 0) {
+      colFreeDict(col);
+      colToString(t, col);
+      return;
+    }
+    col->codes[r] = code;
+  }
+  RedisModule_Free(col->ints);
+  col->ints = NULL;
+  col->type = COL_DICT;
+}
+
+void colSetValue(ColTable *t, size_t row, int c, const char *value) {
+  Column *col = &t->cols[c];
+  long long ll = 0;
+  if (col->type == COL_INT && value != NULL && !parseInt64(value, &ll))
+    colToDict(t, col);
+  if (col->type == COL_DICT && value != NULL) {
+    long code = colDictCode(t, col, value, 1);
+    if (code < 0) colToString(t, col);
+    else col->codes[row] = code;
+  }
+  if (col->type == COL_STRING) {
+    RedisModule_Free(col->strs[row]);
+    col->strs[row] = value? RedisModule_Strdup(value): NULL;
+  }
+  else if (col->type == COL_INT)
+    col->ints[row] = ll;
+  col->nulls[row] = value == NULL;
+}
+
+/* Append an empty row, its index is returned */
+size_t colAppendRow(ColTable *t) {
+  if (t->nRow == t->cap) {
+    t->cap = t->cap? 2 * t->cap: 64;
+    t->ids = RedisModule_Realloc(t->ids, t->cap * sizeof(long long));
+    for (size_t c = 0; c < t->nCol; c++) {
+      Column *col = &t->cols[c];
+      col->nulls = RedisModule_Realloc(col->nulls, t->cap);
+      if (col->type == COL_STRING)
+        col->strs = RedisModule_Realloc(col->strs, t->cap * sizeof(char*));
+      else if (col->type == COL_DICT)
+        col->codes = RedisModule_Realloc(col->codes, t->cap * sizeof(uint16_t));
+      else
+        col->ints = RedisModule_Realloc(col->ints, t->cap * sizeof(long long));
+    }
+  }
+  size_t row = t->nRow++;
+  t->ids[row] = t->nextId++;
+  for (size_t c = 0; c < t->nCol; c++) {
+    Column *col = &t->cols[c];
+    col->nulls[row] = 1;
+    if (col->type == COL_STRING) col->strs[row] = NULL;
+    else if (col->type == COL_DICT) col->codes[row] = 0;
+    else col->ints[row] = 0;
+  }
+  return row;
+}
+
+/* The row of the primary key value, -1 if there is none */
+long colLookup(ColTable *t, const char *key) {
+  int nokey;
+  void *row = RedisModule_DictGetC(t->index, (void*)key, strlen(key), &nokey);
+  return nokey? -1: (long)(intptr_t)row - 1;
+}
+
+void colIndexRow(ColTable *t, size_t row) {
+  char buf[32];
+  const char *key = t->keyCol >= 0? colGetValue(t, row, t->keyCol, buf): NULL;
+  if (key != NULL) RedisModule_DictReplaceC(t->index, (void*)key, strlen(key), (void*)(intptr_t)(row + 1));
+}
+
+/* Remove a row, the last row takes its place */
+void colDeleteRow(ColTable *t, size_t row) {
+  char buf[32];
+  const char *key = t->keyCol >= 0? colGetValue(t, row, t->keyCol, buf): NULL;
+  if (key != NULL) RedisModule_DictDelC(t->index, (void*)key, strlen(key), NULL);
+
+  size_t last = --t->nRow;
+  for (size_t c = 0; c < t->nCol; c++) {
+    Column *col = &t->cols[c];
+    if (col->type == COL_STRING) {
+      RedisModule_Free(col->strs[row]);
+      col->strs[row] = col->strs[last];
+    }
+    else if (col->type == COL_DICT)
+      col->codes[row] = col->codes[last];
+    else
+      col->ints[row] = col->ints[last];
+    col->nulls[row] = col->nulls[last];
+  }
+  t->ids[row] = t->ids[last];
+  if (row != last) colIndexRow(t, row);
+}
+
+/* The key of a row as replied by rowid(), the same as a hash table would
+ * name it */
+RedisModuleString *colRowKey(RedisModuleCtx *ctx, Table *table, ColTable *t, size_t row) {
+  char buf[32];
+  const char *v = t->keyCol >= 0? colGetValue(t, row, t->keyCol, buf): encodeRowId(buf, t->ids[row]);
+  return rowKey(ctx, table, v? v: "");
+}
+
+/* Open the column store of a table. A missing store is created from the
+ * catalog if the key is opened for writing, otherwise NULL is returned as
+ * for a key of another type. The key is closed by the caller. */
+ColTable *openColTable(RedisModuleCtx *ctx, Table *table, int mode, RedisModuleKey **key) {
+  RedisModuleString *name = RedisModule_CreateStringPrintf(ctx, COLUMN_PREFIX "%s", table->name);
+  *key = RedisModule_OpenKey(ctx, name, mode);
+  RedisModule_FreeString(ctx, name);
+  int type = RedisModule_KeyType(*key);
+  if (type == REDISMODULE_KEYTYPE_MODULE && RedisModule_ModuleTypeGetType(*key) == ColumnType)
+    return RedisModule_ModuleTypeGetValue(*key);
+  if (type != REDISMODULE_KEYTYPE_EMPTY || !(mode & REDISMODULE_WRITE))
+    return NULL;
+
+  RedisModuleString *catalog = RedisModule_CreateStringPrintf(ctx, CATALOG_PREFIX "%s", table->name);
+  RedisModuleKey *ckey = RedisModule_OpenKey(ctx, catalog, REDISMODULE_READ);
+  RedisModuleString *columns = NULL;
+  if (RedisModule_KeyType(ckey) == REDISMODULE_KEYTYPE_HASH)
+    RedisModule_HashGet(ckey, REDISMODULE_HASH_CFIELDS, "columns", &columns, NULL);
+  RedisModule_CloseKey(ckey);
+  RedisModule_FreeString(ctx, catalog);
+  if (columns == NULL) return NULL;
+
+  ColTable *t = colCreate(RedisModule_StringToChar(columns), strlen(table->key) > 0? table->key: NULL);
+  RedisModule_FreeString(ctx, columns);
+  RedisModule_ModuleTypeSetValue(*key, ColumnType, t);
+  return t;
+}
+
+/* Insert a row, or update it by upsert if its primary key exists. The key of
+ * the row is returned, or NULL with err set. */
+RedisModuleString *colInsertRow(RedisModuleCtx *ctx, Table *table, ColTable *t, char **fields, char **values, size_t n, int upsert, int *created, const char **err) {
+  int cols[n + 1];
+  const char *pk = NULL;
+  for (size_t i = 0; i < n; i++) {
+    cols[i] = colFindColumn(t, fields[i]);
+    if (cols[i] < 0) {
+      *err = "unknown column";
+      return NULL;
+    }
+    if (cols[i] == t->keyCol && strlen(values[i]) > 0) pk = values[i];
+  }
+
+  long row = -1;
+  if (t->keyCol >= 0) {
+    if (pk == NULL) {
+      *err = "primary key value is expected";
+      return NULL;
+    }
+    row = colLookup(t, pk);
+    if (row >= 0 && !upsert) {
+      *err = "duplicate key";
+      return NULL;
+    }
+  }
+  *created = row < 0;
+  if (row < 0) row = colAppendRow(t);
+  for (size_t i = 0; i < n; i++)
+    colSetValue(t, row, cols[i], values[i]);
+  if (*created) colIndexRow(t, row);
+  return colRowKey(ctx, table, t, row);
+}
+
+/* The row written by colInsertRow, appended or found by its primary key */
+long colWrittenRow(ColTable *t, int created, char **fields, char **values, size_t n) {
+  if (created) return t->nRow - 1;
+  for (size_t i = 0; t->keyCol >= 0 && i < n; i++)
+    if (colFindColumn(t, fields[i]) == t->keyCol) return colLookup(t, values[i]);
+  return -1;
+}
+
+/* A condition of the where clause on a column */
+typedef struct ColCond {
+  int col;         // -1 if the table has no such column
+  int op;
+  const char *w;
+  LikePattern *like;
+  Vector *list;    // values of in, alternatives of or
+  long long ll;
+  int isInt;       // the literal is an integer, compared by value with an integer column
+  int coded;       // evaluated on the codes of a dictionary encoded column
+  long code;       // code of the literal for = and !=, -1 if it is not in the dictionary
+  uint8_t *match;  // result of the other operators by code
+} ColCond;
+
+/* The rows qualifying the where clause, batch by batch. A primary key pinned
+ * by equality narrows the rows to the one of the index, and pinned to a list
+ * of values or to a range, to the rows probed in the index. */
+typedef struct ColScan {
+  ColTable *t;
+  size_t nCond;
+  ColCond *conds;
+  int valid;       // 0 if no row can match
+  int reverse;     // the batches are taken from the last row
+  size_t from, to; // the rows still to scan, or the positions in rows
+  uint32_t *rows;  // the rows probed in the index, in order
+  size_t nSel;
+  uint32_t sel[BATCH_SIZE];
+} ColScan;
+
+int compareInt(long long v, int op, long long w) {
+  switch (op) {
+    case 0: return v >= w;
+    case 1: return v <= w;
+    case 2:
+    case 3: return v != w;
+    case 4: return v > w;
+    case 5: return v < w;
+    case 6: return v == w;
+  }
+  return 0;
+}
+
+/* Evaluate a conjunction on a row, as whereMatch. An integer column is
+ * compared by value with an integer literal, as by the filter kernels. */
+int colRowMatch(ColTable *t, uint32_t r, Vector *vWhere) {
+  if (Vector_Size(vWhere) % 3 != 0) return 0;
+  for (int i = 0; i < Vector_Size(vWhere); i += 3) {
+    int op = whereOp(vWhere, i+1), match = 0;
+    if (op == WHERE_OR) {
+      Vector *alts = whereList(vWhere, i), *alt;
+      for (int k = 0; k < Vector_Size(alts) && !match; k++)
+        if (Vector_Get(alts, k, &alt)) match = colRowMatch(t, r, alt);
+    }
+    else {
+      int c = colFindColumn(t, VectorGetString(vWhere, i));
+      char buf[32];
+      const char *v = c >= 0? colGetValue(t, r, c, buf): NULL;
+      long long ll;
+      if (v == NULL) match = 0;
+      else if (op <= 6 && t->cols[c].type == COL_INT && parseInt64(VectorGetString(vWhere, i+2), &ll))
+        match = compareInt(t->cols[c].ints[r], op, ll);
+      else match = whereValueMatch(vWhere, i, v, strlen(v));
+    }
+    if (match == 0) return 0;
+  }
+  return 1;
+}
+
+static int rowCmp(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return x < y? -1: x > y;
+}
+
+/* Probe the index of the primary key for the rows of a list of values, or
+ * of the range between the bounds of >= or > and <= or <. The range is taken
+ * in the order of the index, so only if the key column is compared as text,
+ * that is neither kept as integers nor bounded by an integer. The rows are
+ * scanned in table order and still filtered by all the conditions. */
+void colScanProbe(ColScan *s, Vector *vWhere) {
+  ColTable *t = s->t;
+  Arena a = {NULL, 0, NULL};
+  Vector *values = primaryKeyValues(&a, t->cols[t->keyCol].name, vWhere);
+  const char *lo = NULL, *hi = NULL;
+  int loOp = 0, hiOp = 0;
+  for (size_t k = 0; values == NULL && k < s->nCond; k++) {
+    ColCond *c = &s->conds[k];
+    if (c->col != t->keyCol || t->cols[c->col].type == COL_INT || c->isInt) continue;
+    if (c->op == 0 || c->op == 4) lo = c->w, loOp = c->op;
+    if (c->op == 1 || c->op == 5) hi = c->w, hiOp = c->op;
+  }
+  if (values == NULL && (lo == NULL || hi == NULL)) {
+    arenaFree(&a);
+    return;
+  }
+
+  size_t n = 0, cap = values? Vector_Size(values) + 1: 64;
+  s->rows = RedisModule_Alloc(cap * sizeof(uint32_t));
+  if (values != NULL) {
+    for (int k = 0; k < Vector_Size(values); k++) {
+      long row = colLookup(t, VectorGetString(values, k));
+      if (row >= 0) s->rows[n++] = row;
+    }
+  }
+  else {
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(t->index, loOp == 0? ">=": ">", (void*)lo, strlen(lo));
+    size_t len, hlen = strlen(hi);
+    char *key;
+    void *row;
+    while ((key = RedisModule_DictNextC(iter, &len, &row)) != NULL) {
+      int cmp = memcmp(key, hi, len < hlen? len: hlen);
+      if (cmp > 0 || (cmp == 0 && len > hlen) || (cmp == 0 && len == hlen && hiOp == 5)) break;
+      if (n == cap) s->rows = RedisModule_Realloc(s->rows, (cap *= 2) * sizeof(uint32_t));
+      s->rows[n++] = (intptr_t)row - 1;
+    }
+    RedisModule_DictIteratorStop(iter);
+  }
+  qsort(s->rows, n, sizeof(uint32_t), rowCmp);
+  s->from = 0;
+  s->to = n;
+  arenaFree(&a);
+  TRACE_ROWS(STAGE_PROBE, n, n);
+}
+
+void colScanInit(ColScan *s, ColTable *t, Vector *vWhere, int reverse) {
+  size_t nWhere = Vector_Size(vWhere) / 3;
+  memset(s, 0, offsetof(ColScan, sel));
+  s->t = t;
+  s->reverse = reverse;
+  s->conds = RedisModule_Calloc(nWhere + 1, sizeof(ColCond));
+  s->valid = t != NULL && Vector_Size(vWhere) % 3 == 0;
+  s->to = t? t->nRow: 0;
+  for (size_t i = 0; s->valid && i < nWhere; i++) {
+    ColCond *c = &s->conds[s->nCond++];
+    c->col = colFindColumn(t, VectorGetString(vWhere, 3 * i));
+    c->op = whereOp(vWhere, 3 * i + 1);
+    c->w = whereValue(vWhere, 3 * i);
+    c->like = whereLike(vWhere, 3 * i);
+    c->list = whereList(vWhere, 3 * i);
+    if (c->op == WHERE_OR) continue;
+    c->isInt = c->op <= 6 && parseInt64(c->w, &c->ll);
+    if (c->col < 0 || (c->list == NULL && strlen(c->w) == 0)) s->valid = 0;
+
+    // The condition on a dictionary encoded column is evaluated once per
+    // value of its dictionary, the rows only compare codes
+    Column *col = s->valid? &t->cols[c->col]: NULL;
+    if (col != NULL && col->type == COL_DICT) {
+      c->coded = 1;
+      if (c->op == 2 || c->op == 3 || c->op == 6)
+        c->code = colDictCode(t, col, c->w, 0);
+      else {
+        c->match = RedisModule_Calloc(col->nDict + 1, 1);
+        for (size_t k = 0; k < col->nDict; k++)
+          c->match[k] = whereValueMatch(vWhere, 3 * i, col->entries[k], strlen(col->entries[k]));
+      }
+    }
+
+    if (s->valid && c->col == t->keyCol && c->op == 6) {
+      long row = colLookup(t, c->w);
+      if (row < 0) s->valid = 0;
+      else if (s->to > (size_t)row) {
+        s->from = row;
+        s->to = row + 1;
+      }
+    }
+  }
+  if (s->valid && t->keyCol >= 0 && s->to - s->from > 1) colScanProbe(s, vWhere);
+}
+
+void colScanFree(ColScan *s) {
+  for (size_t k = 0; k < s->nCond; k++)
+    RedisModule_Free(s->conds[k].match);
+  RedisModule_Free(s->conds);
+  RedisModule_Free(s->rows);
+}
+
+/* Filter kernels of the integer columns. A kernel compares a run of values
+ * with a literal and sets the bit of each qualifying value in a bitmap, without
+ * a branch per value. The widest kernel the CPU supports is chosen at load. */
+typedef void (*IntFilter)(const long long *v, size_t n, int op, long long ll, uint64_t *bits);
+
+/* The operators are reduced to > or = on swapped operands, possibly negated:
+ * a >= b is !(b > a), a <= b is !(a > b), a < b is b > a and a != b is !(a = b) */
+#define INT_OP_SWAP(op) ((op) == 0 || (op) == 5)
+#define INT_OP_NOT(op) ((op) == 0 || (op) == 1 || (op) == 2 || (op) == 3)
+#define INT_OP_EQ(op) ((op) == 2 || (op) == 3 || (op) == 6)
+
+void intFilterScalar(const long long *v, size_t n, int op, long long ll, uint64_t *bits) {
+  int swap = INT_OP_SWAP(op), eq = INT_OP_EQ(op);
+  uint64_t neg = INT_OP_NOT(op);
+  memset(bits, 0, (n + 63) / 64 * sizeof(uint64_t));
+  for (size_t i = 0; i < n; i++) {
+    uint64_t b = eq? v[i] == ll: swap? ll > v[i]: v[i] > ll;
+    bits[i >> 6] |= (b ^ neg) << (i & 63);
+  }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+void intFilterAVX2(const long long *v, size_t n, int op, long long ll, uint64_t *bits) {
+  int swap = INT_OP_SWAP(op), eq = INT_OP_EQ(op);
+  uint64_t neg = INT_OP_NOT(op)? 0xf: 0;
+  __m256i w = _mm256_set1_epi64x(ll);
+  size_t i = 0;
+  memset(bits, 0, (n + 63) / 64 * sizeof(uint64_t));
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(v + i));
+    __m256i m = eq? _mm256_cmpeq_epi64(x, w): swap? _mm256_cmpgt_epi64(w, x): _mm256_cmpgt_epi64(x, w);
+    uint64_t b = (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(m)) ^ neg;
+    bits[i >> 6] |= b << (i & 63);
+  }
+  if (i < n) {
+    uint64_t tail[1];
+    intFilterScalar(v + i, n - i, op, ll, tail);
+    bits[i >> 6] |= tail[0] << (i & 63);
+  }
+}
+
+__attribute__((target("sse4.2")))
+void intFilterSSE42(const long long *v, size_t n, int op, long long ll, uint64_t *bits) {
+  int swap = INT_OP_SWAP(op), eq = INT_OP_EQ(op);
+  uint64_t neg = INT_OP_NOT(op)? 0x3: 0;
+  __m128i w = _mm_set1_epi64x(ll);
+  size_t i = 0;
+  memset(bits, 0, (n + 63) / 64 * sizeof(uint64_t));
+  for (; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(v + i));
+    __m128i m = eq? _mm_cmpeq_epi64(x, w): swap? _mm_cmpgt_epi64(w, x): _mm_cmpgt_epi64(x, w);
+    uint64_t b = (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(m)) ^ neg;
+    bits[i >> 6] |= b << (i & 63);
+  }
+  if (i < n) {
+    uint64_t tail[1];
+    intFilterScalar(v + i, n - i, op, ll, tail);
+    bits[i >> 6] |= tail[0] << (i & 63);
+  }
+}
+#endif
+
+static IntFilter intFilter = intFilterScalar;
+
+/* Choose the filter kernel of the CPU */
+void intFilterInit(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) intFilter = intFilterAVX2;
+  else if (__builtin_cpu_supports("sse4.2")) intFilter = intFilterSSE42;
+#endif
+}
+
+#define COL_INT_KERNEL(cond) \
+  for (size_t i = 0; i < s->nSel; i++) { \
+    uint32_t r = s->sel[i]; \
+    if (!nulls[r] && (cond)) s->sel[out++] = r; \
+  }
+#define COL_STR_KERNEL(cond) \
+  for (size_t i = 0; i < s->nSel; i++) { \
+    uint32_t r = s->sel[i]; \
+    const char *v = colGetValue(s->t, r, c->col, buf); \
+    if (v != NULL && (cond)) s->sel[out++] = r; \
+  }
+
+/* Select the qualifying rows of the next batch. 0 is returned when all the
+ * rows are scanned. The conditions on integer columns are evaluated first
+ * over the whole batch into a bitmap, the others on the rows it selects. */
+size_t colScanNext(ColScan *s) {
+  s->nSel = 0;
+  while (s->valid && s->nSel == 0 && s->from < s->to) {
+    size_t from = s->from, to = s->to;
+    if (to - from > BATCH_SIZE) {
+      if (s->reverse) from = to - BATCH_SIZE;
+      else to = from + BATCH_SIZE;
+    }
+    if (s->reverse) s->to = from;
+    else s->from = to;
+
+    size_t n = to - from;
+    STAT(scanned, n);
+    TRACE_ROWS(STAGE_SCAN, n, n);
+    uint64_t bits[BATCH_SIZE / 64], more[BATCH_SIZE / 64];
+    int filtered = 0;
+    for (size_t k = 0; s->rows == NULL && k < s->nCond; k++) {
+      ColCond *c = &s->conds[k];
+      if (c->op == WHERE_OR) continue;
+      Column *col = &s->t->cols[c->col];
+      if (col->type != COL_INT || !c->isInt) continue;
+      intFilter(col->ints + from, n, c->op, c->ll, filtered? more: bits);
+      for (size_t i = 0; filtered && i < (n + 63) / 64; i++) bits[i] &= more[i];
+      for (size_t i = 0; i < n; i++)
+        bits[i >> 6] &= ~((uint64_t)col->nulls[from + i] << (i & 63));
+      filtered = 1;
+    }
+    if (s->rows != NULL)
+      for (size_t i = from; i < to; i++) s->sel[s->nSel++] = s->rows[i];
+    else if (!filtered)
+      for (size_t r = from; r < to; r++) s->sel[s->nSel++] = r;
+    else
+      for (size_t i = 0; i < (n + 63) / 64; i++)
+        for (uint64_t b = bits[i]; b != 0; b &= b - 1)
+          s->sel[s->nSel++] = from + i * 64 + __builtin_ctzll(b);
+
+    for (size_t k = 0; k < s->nCond && s->nSel > 0; k++) {
+      ColCond *c = &s->conds[k];
+      size_t out = 0;
+      if (c->op == WHERE_OR) {
+        Vector *alt;
+        for (size_t i = 0; i < s->nSel; i++) {
+          uint32_t r = s->sel[i];
+          for (int a = 0; a < Vector_Size(c->list); a++)
+            if (Vector_Get(c->list, a, &alt) && colRowMatch(s->t, r, alt)) {
+              s->sel[out++] = r;
+              break;
+            }
+        }
+        s->nSel = out;
+        continue;
+      }
+      Column *col = &s->t->cols[c->col];
+      const uint8_t *nulls = col->nulls;
+      const char *w = c->w;
+      char buf[32];
+      if (col->type == COL_INT && c->isInt) {
+        // the rows probed in the index are not contiguous for the kernels
+        if (s->rows == NULL) continue;
+        const long long *v = col->ints;
+        long long ll = c->ll;
+        COL_INT_KERNEL(compareInt(v[r], c->op, ll))
+      }
+      else if (col->type == COL_DICT && c->coded) {
+        const uint16_t *v = col->codes;
+        long code = c->code;
+        const uint8_t *match = c->match;
+        switch (c->op) {
+          case 2:
+          case 3: COL_INT_KERNEL(code < 0 || v[r] != code) break;
+          case 6: if (code >= 0) COL_INT_KERNEL(v[r] == code) break;
+          default: COL_INT_KERNEL(match[v[r]])
+        }
+      }
+      else {
+        switch (c->op) {
+          case 0: COL_STR_KERNEL(whereCompare(v, w) >= 0) break;
+          case 1: COL_STR_KERNEL(whereCompare(v, w) <= 0) break;
+          case 2:
+          case 3: COL_STR_KERNEL(strcmp(v, w) != 0) break;
+          case 4: COL_STR_KERNEL(whereCompare(v, w) > 0) break;
+          case 5: COL_STR_KERNEL(whereCompare(v, w) < 0) break;
+          case 6: COL_STR_KERNEL(strcmp(v, w) == 0) break;
+          case 7: COL_STR_KERNEL(likeMatch(c->like, v, strlen(v))) break;
+          case WHERE_IN: COL_STR_KERNEL(inList(c->list, v)) break;
+        }
+      }
+      s->nSel = out;
+    }
+    TRACE_ROWS(STAGE_FILTER, n, s->nSel);
+  }
+  STAT(matched, s->nSel);
+  return s->nSel;
+}
+
+/* The columns of the select items, -1 for "*", -2 for rowid() and -3 for an
+ * unknown column */
+void colSelectColumns(ColTable *t, Vector *vSelect, int *cols) {
+  for (size_t i = 0; i < Vector_Size(vSelect); i++) {
+    char *item = VectorGetString(vSelect, i);
+    if (strcmp(item, "*") == 0) cols[i] = -1;
+    else if (strcmp(item, "rowid()") == 0) cols[i] = -2;
+    else {
+      cols[i] = colFindColumn(t, item);
+      if (cols[i] < 0) cols[i] = -3;
+    }
+  }
+}
+
+/* Reply a row in the same form as showRecord, "*" leaves out the missing
+ * values like HGETALL */
+void colShowRow(RedisModuleCtx *ctx, Table *table, ColTable *t, size_t row, Vector *vSelect, int *cols) {
+  char buf[32];
+  size_t n = 0;
+  replyArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  for (size_t i = 0; i < Vector_Size(vSelect); i++) {
+    if (cols[i] == -1) {
+      for (size_t c = 0; c < t->nCol; c++) {
+        const char *v = colGetValue(t, row, c, buf);
+        if (v == NULL) continue;
+        replySimpleString(ctx, t->cols[c].name);
+        replyStringBuffer(ctx, v, strlen(v));
+        n += 2;
+      }
+      continue;
+    }
+    replySimpleString(ctx, VectorGetString(vSelect, i));
+    if (cols[i] == -2) {
+      RedisModuleString *key = colRowKey(ctx, table, t, row);
+      replyString(ctx, key);
+      RedisModule_FreeString(ctx, key);
+    }
+    else {
+      const char *v = cols[i] >= 0? colGetValue(t, row, cols[i], buf): NULL;
+      if (v) replyStringBuffer(ctx, v, strlen(v));
+      else replyNull(ctx);
+    }
+    n += 2;
+  }
+  replySetArrayLength(ctx, n);
+}
+
+/* Write a row to the csv file in the same form as intoCSV */
+void colCSVRow(RedisModuleCtx *ctx, ColTable *t, size_t row, Vector *vSelect, int *cols, FILE *fp) {
+  char buf[32];
+  size_t len = 0, cap = 256;
+  char *line = RedisModule_Alloc(cap);
+  line[0] = 0;
+  for (size_t i = 0; i < Vector_Size(vSelect); i++) {
+    for (size_t c = 0; c < t->nCol; c++) {
+      if (cols[i] != -1 && (size_t)cols[i] != c) continue;
+      const char *v = colGetValue(t, row, c, buf);
+      if (v == NULL && cols[i] == -1) continue;
+      csvAppend(&line, &len, &cap, v? v: "", v? strlen(v): 0);
+    }
+  }
+  replySimpleString(ctx, line);
+  if (fp != NULL) fprintf(fp, "%s\n", line);
+  STAT(exported, len + 1);
+  RedisModule_Free(line);
+}
+
+/* Copy a row into a hash table by a single multi-field HashSet, the missing
+ * values are copied as empty string like projectRecord */
+int colIntoRow(RedisModuleCtx *ctx, ColTable *t, size_t row, Vector *vSelect, int *cols, IntoTarget *into) {
+  size_t nSelect = Vector_Size(vSelect), cap = nSelect * (t->nCol + 1);
+  char bufs[cap][32];
+  char *fields[cap];
+  char *values[cap];
+  size_t n = 0;
+  for (size_t i = 0; i < nSelect; i++) {
+    if (cols[i] == -1) {
+      for (size_t c = 0; c < t->nCol; c++) {
+        const char *v = colGetValue(t, row, c, bufs[n]);
+        if (v == NULL) continue;
+        fields[n] = t->cols[c].name;
+        values[n++] = (char*)v;
+      }
+      continue;
+    }
+    const char *v = cols[i] >= 0? colGetValue(t, row, cols[i], bufs[n]): NULL;
+    fields[n] = into->vField? VectorGetString(into->vField, i): VectorGetString(vSelect, i);
+    values[n++] = v? (char*)v: "";
+  }
+
+  int created = 0;
+  RedisModuleString *newkey = newRowKey(ctx, &into->table, &into->ids, fields, values, n);
+  if (newkey != NULL && writeRow(ctx, newkey, fields, values, n, into->upsert, &created) == REDISMODULE_ERR) {
+    RedisModule_FreeString(ctx, newkey);
+    newkey = NULL;
+  }
+  into->added += created;
+  return intoResult(ctx, into, newkey);
+}
+
+/* Groups by the codes of dictionary encoded columns. If all the group by
+ * columns are dictionary encoded, a row finds its group by the combination of
+ * its codes, a missing value being the code after the dictionary, without
+ * encoding or hashing its values. */
+#define GROUP_CODES_MAX 65536
+
+typedef struct CodeGroups {
+  size_t n;
+  Group **groups;
+} CodeGroups;
+
+void initCodeGroups(CodeGroups *cg, ColTable *t, Aggregation *agg, int *aggCols) {
+  cg->n = 1;
+  cg->groups = NULL;
+  for (size_t g = 0; g < agg->nGroup && cg->n > 0; g++) {
+    if (aggCols[g] < 0 || t->cols[aggCols[g]].type != COL_DICT) cg->n = 0;
+    else cg->n *= t->cols[aggCols[g]].nDict + 1;
+    if (cg->n > GROUP_CODES_MAX) cg->n = 0;
+  }
+  if (agg->nGroup > 0 && cg->n > 0)
+    cg->groups = RedisModule_Calloc(cg->n, sizeof(Group*));
+}
+
+/* Fold a row into the aggregation. The rows are never spilled, as spilled
+ * rows are read back by key. */
+void colAggregateRow(RedisModuleCtx *ctx, ColTable *t, size_t row, Aggregation *agg, int *aggCols, CodeGroups *cg) {
+  char buf[32];
+  RedisModuleString *values[agg->nField + 1];
+  Group **slot = NULL;
+  if (cg->groups != NULL) {
+    size_t i = 0;
+    for (size_t g = agg->nGroup; g > 0; g--) {
+      Column *col = &t->cols[aggCols[g - 1]];
+      i = i * (col->nDict + 1) + (col->nulls[row]? col->nDict: col->codes[row]);
+    }
+    slot = &cg->groups[i];
+  }
+
+  size_t from = slot != NULL && *slot != NULL? agg->nGroup: 0;
+  for (size_t f = from; f < agg->nField; f++) {
+    const char *v = aggCols[f] >= 0? colGetValue(t, row, aggCols[f], buf): NULL;
+    values[f] = v? RedisModule_CreateString(ctx, v, strlen(v)): NULL;
+  }
+  if (slot == NULL)
+    aggregateValues(ctx, NULL, agg, values, 0);
+  else {
+    if (*slot == NULL) {
+      size_t klen = groupKey(agg, values);
+      *slot = findGroup(agg, agg->keybuf, klen, hashBytes(agg->keybuf, klen), 1);
+    }
+    aggregateInto(agg, *slot, &values[agg->nGroup]);
+  }
+  for (size_t f = from; f < agg->nField; f++)
+    if (values[f]) RedisModule_FreeString(ctx, values[f]);
+}
+
+/* order by of a columnar table, integer columns are ordered by value */
+typedef struct ColOrder {
+  ColTable *t;
+  size_t n;
+  int *cols;
+  int *descs;
+} ColOrder;
+
+static ColOrder *sortColOrder;
+
+int compareColRows(const void *x, const void *y) {
+  ColOrder *o = sortColOrder;
+  size_t rx = *(uint32_t*)x, ry = *(uint32_t*)y;
+  for (size_t i = 0; i < o->n; i++) {
+    if (o->cols[i] < 0) continue;
+    Column *col = &o->t->cols[o->cols[i]];
+    int cmp;
+    if (col->nulls[rx] || col->nulls[ry])
+      cmp = !col->nulls[rx] - !col->nulls[ry];
+    else if (col->type == COL_INT)
+      cmp = (col->ints[rx] > col->ints[ry]) - (col->ints[rx] < col->ints[ry]);
+    else if (col->type == COL_DICT)
+      cmp = col->codes[rx] == col->codes[ry]? 0: strcmp(col->entries[col->codes[rx]], col->entries[col->codes[ry]]);
+    else
+      cmp = strcmp(col->strs[rx], col->strs[ry]);
+    if (cmp != 0) return o->descs[i]? -cmp: cmp;
+  }
+  return 0;
+}
+
+/* Execute select on a columnar table. The where clause is evaluated by batch
+ * over the column vectors, no row is fetched from the key space. The number
+ * of rows emitted is returned. */
+size_t colSelect(RedisModuleCtx *ctx, Table *table, Vector *vSelect, Vector *vWhere, Vector *vOrder, Aggregation *agg, long top, IntoTarget *into, char *csvFile) {
+  RedisModuleKey *key;
+  ColTable *t = openColTable(ctx, table, REDISMODULE_READ, &key);
+  ColScan scan;
+  colScanInit(&scan, t, vWhere, 0);
+
+  size_t nSelect = Vector_Size(vSelect);
+  int cols[nSelect + 1];
+  int aggCols[(agg? agg->nField: 0) + 1];
+  CodeGroups cg = {0, NULL};
+  if (t != NULL) {
+    colSelectColumns(t, vSelect, cols);
+    for (size_t f = 0; agg != NULL && f < agg->nField; f++)
+      aggCols[f] = colFindColumn(t, agg->fields[f]);
+    if (agg != NULL) initCodeGroups(&cg, t, agg, aggCols);
+  }
+  FILE *fp = strlen(csvFile) > 0? fopen(csvFile, "a"): NULL;
+
+  // order by collects the qualifying rows first, then emits them sorted
+  uint32_t *rows = NULL;
+  size_t nRows = 0, capRows = 0;
+  size_t nOrder = agg == NULL? Vector_Size(vOrder): 0;
+
+  size_t n = 0;
+  int replied = agg == NULL && fp == NULL && into == NULL;
+  while (top != 0 && colScanNext(&scan) > 0) {
+    STAGE(STAGE_FILTER);
+    size_t i, kept = n;
+    long limit = nOrder > 0? -1: top;
+    for (i = 0; i < scan.nSel && top != 0; i++) {
+      uint32_t r = scan.sel[i];
+      if (nOrder > 0) {
+        if (nRows == capRows) {
+          capRows = capRows? 2 * capRows: 1024;
+          rows = RedisModule_Realloc(rows, capRows * sizeof(uint32_t));
+        }
+        rows[nRows++] = r;
+        continue;
+      }
+      if (agg != NULL)
+        colAggregateRow(ctx, t, r, agg, aggCols, &cg);
+      else if (fp != NULL)
+        colCSVRow(ctx, t, r, vSelect, cols, fp);
+      else if (into != NULL) {
+        if (!colIntoRow(ctx, t, r, vSelect, cols, into)) continue;
+      }
+      else
+        colShowRow(ctx, table, t, r, vSelect, cols);
+      n++;
+      top--;
+    }
+    if (nOrder == 0) traceEmit(replied, limit, i, n - kept);
+  }
+
+  if (nOrder > 0 && t != NULL) {
+    ColOrder order = {t, nOrder, NULL, NULL};
+    int orderCols[nOrder], descs[nOrder];
+    for (size_t i = 0; i < nOrder; i++) {
+      char *field = VectorGetString(vOrder, i);
+      descs[i] = field[strlen(field) - 1] == '-';
+      if (descs[i]) field[strlen(field) - 1] = 0;
+      orderCols[i] = colFindColumn(t, field);
+    }
+    order.cols = orderCols;
+    order.descs = descs;
+    sortColOrder = &order;
+    STAGE(STAGE_FILTER);
+    qsort(rows, nRows, sizeof(uint32_t), compareColRows);
+    STAT(sorted, nRows);
+    TRACE_ROWS(STAGE_SORT, nRows, nRows);
+    TRACE_MEM(STAGE_SORT, capRows * sizeof(uint32_t));
+    STAGE(STAGE_SORT);
+    long limit = top;
+    size_t i;
+    for (i = 0; i < nRows && top != 0; i++) {
+      if (fp != NULL)
+        colCSVRow(ctx, t, rows[i], vSelect, cols, fp);
+      else if (into != NULL) {
+        if (!colIntoRow(ctx, t, rows[i], vSelect, cols, into)) continue;
+      }
+      else
+        colShowRow(ctx, table, t, rows[i], vSelect, cols);
+      n++;
+      top--;
+    }
+    traceEmit(replied, limit, i, n);
+    RedisModule_Free(rows);
+  }
+
+  if (fp != NULL) fclose(fp);
+  RedisModule_Free(cg.groups);
+  colScanFree(&scan);
+  RedisModule_CloseKey(key);
+  return n;
+}
+
+/* Apply the assignments of update statement to the qualifying rows, the
+ * number of rows updated is returned */
+size_t colUpdate(RedisModuleCtx *ctx, Table *table, Vector *vWhere, char **fields, RedisModuleString **values, size_t n, const char **err) {
+  RedisModuleKey *key;
+  ColTable *t = openColTable(ctx, table, REDISMODULE_READ|REDISMODULE_WRITE, &key);
+  int cols[n + 1];
+  for (size_t i = 0; t != NULL && i < n; i++) {
+    cols[i] = colFindColumn(t, fields[i]);
+    if (cols[i] < 0) *err = "unknown column";
+    else if (cols[i] == t->keyCol) *err = "primary key cannot be updated";
+  }
   size_t affected = 0;
-  for (size_t i = 0; i < nKeys; i++) {
-    RedisModuleString *key = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(keys, i));
-    const char *s = RedisModule_StringToChar(key);
-    if (!regexec(r, s, 1, NULL, 0)) {
-      if (vWhere == NULL || whereRecord(ctx, key, vWhere)) {
-        if (strlen(csvFile) > 0)
-          intoCSV(ctx, key, vSelect, csvFile);
-        else if (strlen(intoKey) > 0)
-          intoRecord(ctx, key, vSelect, intoKey);
+  if (t != NULL && *err == NULL) {
+    ColScan scan;
+    colScanInit(&scan, t, vWhere, 0);
+    while (colScanNext(&scan) > 0) {
+      for (size_t i = 0; i < scan.nSel; i++)
+        for (size_t j = 0; j < n; j++)
+          colSetValue(t, scan.sel[i], cols[j], RedisModule_StringToChar(values[j]));
+      affected += scan.nSel;
+    }
+    colScanFree(&scan);
+  }
+  RedisModule_CloseKey(key);
+  return affected;
+}
+
+/* Delete the qualifying rows. The rows are scanned from the last one, so the
+ * row taking the place of a deleted row is already scanned. */
+size_t colDelete(RedisModuleCtx *ctx, Table *table, Vector *vWhere) {
+  RedisModuleKey *key;
+  ColTable *t = openColTable(ctx, table, REDISMODULE_READ|REDISMODULE_WRITE, &key);
+  size_t affected = 0;
+  if (t != NULL) {
+    ColScan scan;
+    colScanInit(&scan, t, vWhere, 1);
+    while (colScanNext(&scan) > 0) {
+      for (size_t i = scan.nSel; i > 0; i--)
+        colDeleteRow(t, scan.sel[i - 1]);
+      affected += scan.nSel;
+    }
+    colScanFree(&scan);
+  }
+  RedisModule_CloseKey(key);
+  return affected;
+}
+
+/* Persistence of the column store. RDB keeps the columns one after another,
+ * AOF rewrite emits dbx.restore commands of up to COLUMN_AOF_ROWS rows. The
+ * version 1 adds the dictionary encoded columns. */
+#define COLUMN_ENCODING_VERSION 1
+#define COLUMN_AOF_ROWS 64
+
+void colRdbSave(RedisModuleIO *rdb, void *value) {
+  ColTable *t = value;
+  RedisModule_SaveUnsigned(rdb, t->nCol);
+  for (size_t c = 0; c < t->nCol; c++) {
+    RedisModule_SaveStringBuffer(rdb, t->cols[c].name, strlen(t->cols[c].name));
+    RedisModule_SaveUnsigned(rdb, t->cols[c].type);
+  }
+  RedisModule_SaveSigned(rdb, t->keyCol);
+  RedisModule_SaveSigned(rdb, t->nextId);
+  RedisModule_SaveUnsigned(rdb, t->nRow);
+  for (size_t r = 0; r < t->nRow; r++)
+    RedisModule_SaveSigned(rdb, t->ids[r]);
+  for (size_t c = 0; c < t->nCol; c++) {
+    Column *col = &t->cols[c];
+    if (col->type == COL_DICT) {
+      RedisModule_SaveUnsigned(rdb, col->nDict);
+      for (size_t k = 0; k < col->nDict; k++)
+        RedisModule_SaveStringBuffer(rdb, col->entries[k], strlen(col->entries[k]));
+    }
+    for (size_t r = 0; r < t->nRow; r++) {
+      RedisModule_SaveUnsigned(rdb, col->nulls[r]);
+      if (col->nulls[r]) continue;
+      if (col->type == COL_INT) RedisModule_SaveSigned(rdb, col->ints[r]);
+      else if (col->type == COL_DICT) RedisModule_SaveUnsigned(rdb, col->codes[r]);
+      else RedisModule_SaveStringBuffer(rdb, col->strs[r], strlen(col->strs[r]));
+    }
+  }
+}
+
+/* Load a string buffer as a terminated string */
+char *loadCString(RedisModuleIO *rdb) {
+  size_t len;
+  char *buf = RedisModule_LoadStringBuffer(rdb, &len);
+  char *s = RedisModule_Alloc(len + 1);
+  memcpy(s, buf, len);
+  s[len] = 0;
+  RedisModule_Free(buf);
+  return s;
+}
+
+void *colRdbLoad(RedisModuleIO *rdb, int encver) {
+  if (encver > COLUMN_ENCODING_VERSION) {
+    RedisModule_LogIOError(rdb, "warning", "unknown encoding version %d of columnar table", encver);
+    return NULL;
+  }
+  ColTable *t = RedisModule_Calloc(1, sizeof(ColTable));
+  t->nCol = RedisModule_LoadUnsigned(rdb);
+  t->cols = RedisModule_Calloc(t->nCol + 1, sizeof(Column));
+  for (size_t c = 0; c < t->nCol; c++) {
+    t->cols[c].name = loadCString(rdb);
+    t->cols[c].type = RedisModule_LoadUnsigned(rdb);
+  }
+  t->keyCol = RedisModule_LoadSigned(rdb);
+  t->nextId = RedisModule_LoadSigned(rdb);
+  t->nRow = t->cap = RedisModule_LoadUnsigned(rdb);
+  t->index = RedisModule_CreateDict(NULL);
+  t->ids = RedisModule_Alloc((t->cap + 1) * sizeof(long long));
+  for (size_t r = 0; r < t->nRow; r++)
+    t->ids[r] = RedisModule_LoadSigned(rdb);
+  for (size_t c = 0; c < t->nCol; c++) {
+    Column *col = &t->cols[c];
+    col->nulls = RedisModule_Alloc(t->cap + 1);
+    if (col->type == COL_INT)
+      col->ints = RedisModule_Calloc(t->cap + 1, sizeof(long long));
+    else if (col->type == COL_DICT) {
+      col->codes = RedisModule_Calloc(t->cap + 1, sizeof(uint16_t));
+      col->dict = RedisModule_CreateDict(NULL);
+      col->nDict = col->capDict = RedisModule_LoadUnsigned(rdb);
+      col->entries = RedisModule_Alloc((col->capDict + 1) * sizeof(char*));
+      for (size_t k = 0; k < col->nDict; k++) {
+        col->entries[k] = loadCString(rdb);
+        RedisModule_DictSetC(col->dict, col->entries[k], strlen(col->entries[k]), (void*)(intptr_t)(k + 1));
+      }
+    }
+    else
+      col->strs = RedisModule_Calloc(t->cap + 1, sizeof(char*));
+    for (size_t r = 0; r < t->nRow; r++) {
+      col->nulls[r] = RedisModule_LoadUnsigned(rdb);
+      if (col->nulls[r]) continue;
+      if (col->type == COL_INT) col->ints[r] = RedisModule_LoadSigned(rdb);
+      else if (col->type == COL_DICT) col->codes[r] = RedisModule_LoadUnsigned(rdb);
+      else col->strs[r] = loadCString(rdb);
+    }
+  }
+  for (size_t r = 0; r < t->nRow; r++)
+    colIndexRow(t, r);
+  return t;
+}
+
+/* dbx.restore <key> <columns> <key column> <next id> [<id> <value>...]...
+ * A value is prefixed by '=', an empty argument is a missing value. The
+ * names of the columns are joined by commas into RedisModule_Alloc memory. */
+char *colColumnList(ColTable *t) {
+  size_t len = 0;
+  for (size_t c = 0; c < t->nCol; c++) len += strlen(t->cols[c].name) + 1;
+  char *columns = RedisModule_Calloc(len + 1, 1);
+  for (size_t c = 0; c < t->nCol; c++) {
+    if (c > 0) strcat(columns, ",");
+    strcat(columns, t->cols[c].name);
+  }
+  return columns;
+}
+
+/* The id and values arguments of dbx.restore for n rows, their number is
+ * returned */
+size_t colRestoreArgs(RedisModuleCtx *ctx, ColTable *t, const size_t *rows, size_t n, RedisModuleString **argv) {
+  char buf[32];
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++) {
+    argv[k++] = RedisModule_CreateStringFromLongLong(ctx, t->ids[rows[i]]);
+    for (size_t c = 0; c < t->nCol; c++) {
+      const char *v = colGetValue(t, rows[i], c, buf);
+      argv[k++] = v? RedisModule_CreateStringPrintf(ctx, "=%s", v): RedisModule_CreateString(ctx, "", 0);
+    }
+  }
+  return k;
+}
+
+void colAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+  ColTable *t = value;
+  char *columns = colColumnList(t);
+  const char *keyCol = t->keyCol >= 0? t->cols[t->keyCol].name: "";
+
+  // the strings of the arguments need a context outside of a command
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(NULL);
+  RedisModuleString *argv[COLUMN_AOF_ROWS * (t->nCol + 1)];
+  size_t rows[COLUMN_AOF_ROWS];
+  size_t row = 0;
+  do {
+    size_t n = 0;
+    for (; row < t->nRow && n < COLUMN_AOF_ROWS; row++) rows[n++] = row;
+    n = colRestoreArgs(ctx, t, rows, n, argv);
+    RedisModule_EmitAOF(aof, "dbx.restore", "scclv", key, columns, keyCol, t->nextId, argv, n);
+    for (size_t i = 0; i < n; i++)
+      RedisModule_FreeString(ctx, argv[i]);
+  } while (row < t->nRow);
+  RedisModule_FreeThreadSafeContext(ctx);
+  RedisModule_Free(columns);
+}
+
+/* Propagate rows of the column store of a table as dbx.restore calls, which
+ * replace the rows of the same primary key. The csv import replicates its
+ * rows this way, the file it reads may not be on a replica. */
+void colReplicateRows(RedisModuleCtx *ctx, Table *table, ColTable *t, const size_t *rows, size_t n) {
+  RedisModuleString *key = RedisModule_CreateStringPrintf(ctx, COLUMN_PREFIX "%s", table->name);
+  char *columns = colColumnList(t);
+  const char *keyCol = t->keyCol >= 0? t->cols[t->keyCol].name: "";
+  RedisModuleString *argv[COLUMN_AOF_ROWS * (t->nCol + 1)];
+  for (size_t i = 0; i < n; i += COLUMN_AOF_ROWS) {
+    size_t k = colRestoreArgs(ctx, t, rows + i, n - i < COLUMN_AOF_ROWS? n - i: COLUMN_AOF_ROWS, argv);
+    RedisModule_Replicate(ctx, "dbx.restore", "scclv", key, columns, keyCol, t->nextId, argv, k);
+    for (size_t j = 0; j < k; j++)
+      RedisModule_FreeString(ctx, argv[j]);
+  }
+  RedisModule_Free(columns);
+  RedisModule_FreeString(ctx, key);
+}
+
+size_t colMemUsage(const void *value) {
+  const ColTable *t = value;
+  size_t size = sizeof(ColTable) + t->nCol * sizeof(Column) + t->cap * sizeof(long long);
+  for (size_t c = 0; c < t->nCol; c++) {
+    const Column *col = &t->cols[c];
+    size += strlen(col->name) + 1 + t->cap;
+    if (col->type == COL_INT)
+      size += t->cap * sizeof(long long);
+    else if (col->type == COL_DICT) {
+      size += t->cap * sizeof(uint16_t) + col->capDict * sizeof(char*);
+      for (size_t k = 0; k < col->nDict; k++)
+        size += 2 * (strlen(col->entries[k]) + 1) + 2 * sizeof(void*);
+    }
+    else {
+      size += t->cap * sizeof(char*);
+      for (size_t r = 0; r < t->nRow; r++)
+        if (col->strs[r]) size += strlen(col->strs[r]) + 1;
+    }
+  }
+  // a rax node per key of the index, roughly
+  if (t->keyCol >= 0) size += t->nRow * (2 * sizeof(void*) + 8);
+  return size;
+}
+
+void colDigest(RedisModuleDigest *md, void *value) {
+  ColTable *t = value;
+  char buf[32];
+  for (size_t r = 0; r < t->nRow; r++) {
+    RedisModule_DigestAddLongLong(md, t->ids[r]);
+    for (size_t c = 0; c < t->nCol; c++) {
+      const char *v = colGetValue(t, r, c, buf);
+      if (v) RedisModule_DigestAddStringBuffer(md, (unsigned char*)v, strlen(v));
+      else RedisModule_DigestAddLongLong(md, 0);
+    }
+    RedisModule_DigestEndSequence(md);
+  }
+}
+
+/* Create temporary set for sorting */
+size_t buildSetByPattern(RedisModuleCtx *ctx, Table *t, regex_t *r, char *setName, Vector *vWhere) {
+  RedisModule_Call(ctx, "DEL", "c", setName);
+  size_t affected = 0;
+  KeyScan ks;
+  RedisModuleString *key;
+  keyScanInit(ctx, &ks, t, r);
+  while ((key = keyScanNext(ctx, &ks)) != NULL) {
+    if (vWhere == NULL || whereRecord(ctx, key, vWhere)) {
+      RedisModule_Call(ctx, "SADD", "cs", setName, key);
+      affected++;
+    }
+    RedisModule_FreeString(ctx, key);
+  }
+  keyScanFree(&ks);
+  return affected;
+}
+
+/* Order of the values of order by across the nodes of a cluster select, as a
+ * columnar table orders them: integers by value, other values as text */
+int compareOrderValues(const char *x, size_t lx, const char *y, size_t ly) {
+  char bx[24], by[24];
+  long long a, b;
+  if (lx < sizeof(bx) && ly < sizeof(by)) {
+    memcpy(bx, x, lx);
+    bx[lx] = 0;
+    memcpy(by, y, ly);
+    by[ly] = 0;
+    if (parseInt64(bx, &a) && parseInt64(by, &b)) return (a > b) - (a < b);
+  }
+  int cmp = memcmp(x, y, lx < ly? lx: ly);
+  return cmp != 0? cmp: (lx > ly) - (lx < ly);
+}
+
+/* The rows of a node of a cluster select sorted in module memory, since the
+ * temporary set of SORT may hash to the slot of another node. Missing values
+ * come first, in the order the coordinator merges the nodes by. */
+typedef struct SortedKey {
+  RedisModuleString *key;
+  RedisModuleString *values[];  // of the fields of order by
+} SortedKey;
+
+typedef struct KeyOrder {
+  size_t n;
+  int *descs;
+} KeyOrder;
+
+static KeyOrder *sortKeyOrder;
+
+int compareSortedKeys(const void *x, const void *y) {
+  SortedKey *a = *(SortedKey**)x, *b = *(SortedKey**)y;
+  for (size_t i = 0; i < sortKeyOrder->n; i++) {
+    int cmp;
+    if (a->values[i] == NULL || b->values[i] == NULL)
+      cmp = (a->values[i] != NULL) - (b->values[i] != NULL);
+    else {
+      size_t la, lb;
+      const char *sa = RedisModule_StringPtrLen(a->values[i], &la);
+      const char *sb = RedisModule_StringPtrLen(b->values[i], &lb);
+      cmp = compareOrderValues(sa, la, sb, lb);
+    }
+    if (cmp != 0) return sortKeyOrder->descs[i]? -cmp: cmp;
+  }
+  return 0;
+}
+
+/* Reply the rows matching the where clause sorted by the fields of order by,
+ * up to top rows. The number of rows replied is returned. */
+size_t sortRecords(RedisModuleCtx *ctx, Table *t, regex_t *r, Vector *vSelect, Vector *vWhere, Vector *vOrder, long *top) {
+  size_t nOrder = Vector_Size(vOrder);
+  char *fields[nOrder + 1];
+  int descs[nOrder + 1];
+  for (size_t i = 0; i < nOrder; i++) {
+    fields[i] = VectorGetString(vOrder, i);
+    size_t len = strlen(fields[i]);
+    descs[i] = len > 0 && fields[i][len - 1] == '-';
+    if (descs[i]) fields[i][len - 1] = 0;
+  }
+
+  size_t nRow = 0, cap = 0;
+  SortedKey **rows = NULL;
+  KeyScan ks;
+  RedisModuleString *key;
+  keyScanInit(ctx, &ks, t, r);
+  while ((key = keyScanNext(ctx, &ks)) != NULL) {
+    if (!whereRecord(ctx, key, vWhere)) {
+      RedisModule_FreeString(ctx, key);
+      continue;
+    }
+    if (nRow == cap) {
+      cap = cap? 2 * cap: 1024;
+      rows = RedisModule_Realloc(rows, cap * sizeof(SortedKey*));
+    }
+    SortedKey *row = RedisModule_Alloc(sizeof(SortedKey) + nOrder * sizeof(RedisModuleString*));
+    row->key = key;
+    RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+    for (size_t i = 0; i < nOrder; i++) {
+      row->values[i] = NULL;
+      RedisModule_HashGet(hkey, REDISMODULE_HASH_CFIELDS, fields[i], &row->values[i], NULL);
+    }
+    RedisModule_CloseKey(hkey);
+    rows[nRow++] = row;
+  }
+  keyScanFree(&ks);
+  STAGE(STAGE_FILTER);
+
+  KeyOrder order = {nOrder, descs};
+  sortKeyOrder = &order;
+  qsort(rows, nRow, sizeof(SortedKey*), compareSortedKeys);
+  STAT(sorted, nRow);
+  TRACE_ROWS(STAGE_SORT, nRow, nRow);
+  TRACE_MEM(STAGE_SORT, cap * sizeof(SortedKey*) + nRow * (sizeof(SortedKey) + nOrder * sizeof(RedisModuleString*)));
+  STAGE(STAGE_SORT);
+
+  long limit = *top;
+  size_t n = 0, i;
+  for (i = 0; i < nRow && *top != 0; i++) {
+    showRecord(ctx, rows[i]->key, vSelect);
+    n++;
+    (*top)--;
+  }
+  traceEmit(1, limit, i, n);
+  for (i = 0; i < nRow; i++) {
+    for (size_t f = 0; f < nOrder; f++)
+      if (rows[i]->values[f]) RedisModule_FreeString(ctx, rows[i]->values[f]);
+    RedisModule_FreeString(ctx, rows[i]->key);
+    RedisModule_Free(rows[i]);
+  }
+  RedisModule_Free(rows);
+  return n;
+}
+
+/* The fields of order by missing from the select list are appended to it,
+ * for a node of a cluster select to reply the values the coordinator merges
+ * the rows by. The coordinator strips them from the rows. Their number is
+ * returned. */
+size_t selectOrderFields(Arena *a, Vector *vSelect, Vector *vOrder) {
+  size_t nSelect = Vector_Size(vSelect), added = 0;
+  for (size_t i = 0; i < nSelect; i++)
+    if (strcmp(VectorGetString(vSelect, i), "*") == 0) return 0;
+  for (size_t i = 0; i < Vector_Size(vOrder); i++) {
+    char *field = VectorGetString(vOrder, i);
+    size_t len = strlen(field);
+    if (len > 0 && field[len - 1] == '-') len--;
+    int found = 0;
+    for (size_t j = 0; j < Vector_Size(vSelect) && !found; j++) {
+      char *s = VectorGetString(vSelect, j);
+      found = strlen(s) == len && memcmp(s, field, len) == 0;
+    }
+    if (found) continue;
+    char *copy = arenaAlloc(a, len + 1);
+    memcpy(copy, field, len);
+    copy[len] = 0;
+    Vector_Push(vSelect, copy);
+    added++;
+  }
+  return added;
+}
+
+/* Scan the rows of a table matching the where clause, until fn returns 0 */
+typedef int (*ScanFunc)(RedisModuleCtx *ctx, RedisModuleString *key, void *privdata);
+
+void scanTable(RedisModuleCtx *ctx, Table *t, regex_t *r, Vector *vWhere, ScanFunc fn, void *privdata) {
+  int more = 1;
+  KeyScan ks;
+  RedisModuleString *key;
+  keyScanInit(ctx, &ks, t, r);
+  while (more && (key = keyScanNext(ctx, &ks)) != NULL) {
+    if (whereRecord(ctx, key, vWhere))
+      more = fn(ctx, key, privdata);
+    RedisModule_FreeString(ctx, key);
+  }
+  keyScanFree(&ks);
+}
+
+/* The assignments of update statement, for updateRow */
+typedef struct UpdateSet {
+  char **fields;
+  RedisModuleString **values;
+  size_t n;
+} UpdateSet;
+
+int updateRow(RedisModuleCtx *ctx, RedisModuleString *key, void *privdata) {
+  UpdateSet *set = privdata;
+  return updateRecord(ctx, key, set->fields, set->values, set->n);
+}
+
+int deleteRow(RedisModuleCtx *ctx, RedisModuleString *key, void *privdata) {
+  deleteRecord(ctx, key);
+  return 1;
+}
+
+/* Write the rows of a table matching the where clause by fn, which returns
+ * the number of rows it wrote. The keys are filtered and written by batch,
+ * so a stage is lapped once per batch. The number of rows written is
+ * returned. */
+size_t writeTable(RedisModuleCtx *ctx, Table *t, regex_t *r, Vector *vWhere, ScanFunc fn, void *privdata) {
+  RedisModuleString **keys = RedisModule_Alloc(BATCH_SIZE * sizeof(RedisModuleString*));
+  char match[BATCH_SIZE];
+  size_t n = 0, written = 0;
+  KeyScan ks;
+  RedisModuleString *key;
+  keyScanInit(ctx, &ks, t, r);
+  do {
+    key = keyScanNext(ctx, &ks);
+    if (key != NULL) keys[n++] = key;
+    if (key != NULL && n < BATCH_SIZE) continue;
+    STAGE(STAGE_SCAN);
+    for (size_t i = 0; i < n; i++)
+      match[i] = vWhere == NULL || whereRecord(ctx, keys[i], vWhere);
+    STAGE(STAGE_FILTER);
+    for (size_t i = 0; i < n; i++) {
+      if (match[i]) written += fn(ctx, keys[i], privdata);
+      RedisModule_FreeString(ctx, keys[i]);
+    }
+    STAGE(STAGE_WRITE);
+    n = 0;
+  } while (key != NULL);
+  keyScanFree(&ks);
+  RedisModule_Free(keys);
+  return written;
+}
+
+/* Join of two tables on the equality of a field of each, i.e.
+ * select ... from a join b on a.x = b.y where ...
+ * If the field of a side is its primary key, the rows of the other side look
+ * it up directly. Otherwise the rows of the smaller side are put into a hash
+ * table by their join value, and the rows of the other side probe it. */
+typedef struct JoinSide {
+  Table table;
+  regex_t regex;
+  char *field;       // the join field
+  Vector *vWhere;    // the conditions on the side, without the table name
+} JoinSide;
+
+typedef struct JoinKey {
+  struct JoinKey *next;
+  size_t len;
+  char key[];
+} JoinKey;
+
+typedef struct JoinEntry {
+  uint64_t hash;
+  char *value;
+  size_t vlen;
+  JoinKey *keys;     // rows having the value
+} JoinEntry;
+
+typedef struct Join {
+  JoinSide sides[2];
+  Vector *vSelect;
+  long top;
+  size_t n;          // joined rows
+  int inner;         // the side probing or looking up
+  Arena arena;
+  JoinEntry **slots; // open addressing by linear probing
+  size_t cap, count;
+} Join;
+
+/* The side of a qualified field "table.field", field is set after the dot */
+int joinSideOf(Join *j, char *item, char **field) {
+  char *dot = strchr(item, '.');
+  if (dot == NULL) return -1;
+  for (int s = 0; s < 2; s++) {
+    if (strlen(j->sides[s].table.name) == (size_t)(dot - item) &&
+        strncmp(item, j->sides[s].table.name, dot - item) == 0) {
+      *field = dot + 1;
+      return s;
+    }
+  }
+  return -1;
+}
+
+JoinEntry *joinFind(Join *j, const char *value, size_t vlen, uint64_t hash, int create) {
+  if (j->cap > 0) {
+    for (size_t i = hash & (j->cap - 1); j->slots[i] != NULL; i = (i + 1) & (j->cap - 1)) {
+      JoinEntry *e = j->slots[i];
+      if (e->hash == hash && e->vlen == vlen && memcmp(e->value, value, vlen) == 0) return e;
+    }
+  }
+  if (!create) return NULL;
+
+  if (2 * (j->count + 1) > j->cap) {
+    size_t cap = j->cap? 2 * j->cap: 1024;
+    JoinEntry **slots = RedisModule_Calloc(cap, sizeof(JoinEntry*));
+    for (size_t i = 0; i < j->cap; i++) {
+      JoinEntry *e = j->slots[i];
+      if (e == NULL) continue;
+      size_t k = e->hash & (cap - 1);
+      while (slots[k] != NULL) k = (k + 1) & (cap - 1);
+      slots[k] = e;
+    }
+    RedisModule_Free(j->slots);
+    j->slots = slots;
+    j->cap = cap;
+  }
+
+  JoinEntry *e = arenaAlloc(&j->arena, sizeof(JoinEntry));
+  e->hash = hash;
+  e->vlen = vlen;
+  e->value = arenaAlloc(&j->arena, vlen + 1);
+  memcpy(e->value, value, vlen);
+  e->keys = NULL;
+  size_t i = hash & (j->cap - 1);
+  while (j->slots[i] != NULL) i = (i + 1) & (j->cap - 1);
+  j->slots[i] = e;
+  j->count++;
+  return e;
+}
+
+/* The join value of a row, NULL if the row has no such field */
+RedisModuleString *joinValue(RedisModuleCtx *ctx, RedisModuleString *key, char *field) {
+  RedisModuleString *value = NULL;
+  RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+  if (RedisModule_KeyType(hkey) == REDISMODULE_KEYTYPE_HASH)
+    RedisModule_HashGet(hkey, REDISMODULE_HASH_CFIELDS, field, &value, NULL);
+  RedisModule_CloseKey(hkey);
+  return value;
+}
+
+/* Reply a joined row in the same form as showRecord, the fields of "*" are
+ * named by their table */
+void replyJoinedRow(RedisModuleCtx *ctx, Join *j, RedisModuleString **keys) {
+  replyArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  size_t n = 0;
+  for (size_t i = 0; i < Vector_Size(j->vSelect); i++) {
+    char *item = VectorGetString(j->vSelect, i);
+    if (strcmp(item, "*") == 0) {
+      for (int s = 0; s < 2; s++) {
+        RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGETALL", "s", keys[s]);
+        size_t tf = RedisModule_CallReplyLength(tags);
+        for (size_t t = 0; t + 1 < tf; t += 2) {
+          size_t len;
+          const char *f = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(tags, t), &len);
+          RedisModuleString *label = RedisModule_CreateStringPrintf(ctx, "%s.%.*s", j->sides[s].table.name, (int)len, f);
+          replyString(ctx, label);
+          RedisModule_FreeString(ctx, label);
+          replyCallReply(ctx, RedisModule_CallReplyArrayElement(tags, t + 1));
+          n += 2;
+        }
+        RedisModule_FreeCallReply(tags);
+      }
+      continue;
+    }
+
+    char *field;
+    int s = joinSideOf(j, item, &field);
+    replySimpleString(ctx, item);
+    if (strcmp(field, "rowid()") == 0)
+      replyString(ctx, keys[s]);
+    else {
+      RedisModuleString *value = joinValue(ctx, keys[s], field);
+      if (value) {
+        replyString(ctx, value);
+        RedisModule_FreeString(ctx, value);
+      }
+      else
+        replyNull(ctx);
+    }
+    n += 2;
+  }
+  replySetArrayLength(ctx, n);
+}
+
+/* Put a row of the smaller side into the hash table */
+int joinBuildRow(RedisModuleCtx *ctx, RedisModuleString *key, void *privdata) {
+  Join *j = privdata;
+  RedisModuleString *value = joinValue(ctx, key, j->sides[1 - j->inner].field);
+  if (value == NULL) return 1;
+  size_t vlen, klen;
+  const char *v = RedisModule_StringPtrLen(value, &vlen);
+  const char *k = RedisModule_StringPtrLen(key, &klen);
+  JoinEntry *e = joinFind(j, v, vlen, hashBytes(v, vlen), 1);
+  JoinKey *jk = arenaAlloc(&j->arena, sizeof(JoinKey) + klen);
+  jk->len = klen;
+  memcpy(jk->key, k, klen);
+  jk->next = e->keys;
+  e->keys = jk;
+  RedisModule_FreeString(ctx, value);
+  return 1;
+}
+
+/* Probe the hash table by a row of the other side */
+int joinProbeRow(RedisModuleCtx *ctx, RedisModuleString *key, void *privdata) {
+  Join *j = privdata;
+  RedisModuleString *value = joinValue(ctx, key, j->sides[j->inner].field);
+  if (value == NULL) return 1;
+  size_t vlen;
+  const char *v = RedisModule_StringPtrLen(value, &vlen);
+  JoinEntry *e = joinFind(j, v, vlen, hashBytes(v, vlen), 0);
+  RedisModule_FreeString(ctx, value);
+  if (e == NULL) return 1;
+
+  RedisModuleString *keys[2];
+  keys[j->inner] = key;
+  for (JoinKey *jk = e->keys; jk != NULL && j->top != 0; jk = jk->next) {
+    keys[1 - j->inner] = RedisModule_CreateString(ctx, jk->key, jk->len);
+    replyJoinedRow(ctx, j, keys);
+    RedisModule_FreeString(ctx, keys[1 - j->inner]);
+    j->n++;
+    j->top--;
+  }
+  return j->top != 0;
+}
+
+/* Look up the row of the other side by its primary key */
+int joinLookupRow(RedisModuleCtx *ctx, RedisModuleString *key, void *privdata) {
+  Join *j = privdata;
+  JoinSide *other = &j->sides[1 - j->inner];
+  RedisModuleString *value = joinValue(ctx, key, j->sides[j->inner].field);
+  if (value == NULL) return 1;
+  RedisModuleString *pkey = rowKey(ctx, &other->table, RedisModule_StringToChar(value));
+  RedisModule_FreeString(ctx, value);
+
+  RedisModuleKey *hkey = RedisModule_OpenKey(ctx, pkey, REDISMODULE_READ);
+  int exists = RedisModule_KeyType(hkey) == REDISMODULE_KEYTYPE_HASH;
+  RedisModule_CloseKey(hkey);
+  if (exists && whereRecord(ctx, pkey, other->vWhere)) {
+    RedisModuleString *keys[2];
+    keys[j->inner] = key;
+    keys[1 - j->inner] = pkey;
+    replyJoinedRow(ctx, j, keys);
+    j->n++;
+    j->top--;
+  }
+  RedisModule_FreeString(ctx, pkey);
+  return j->top != 0;
+}
+
+int joinStatement(RedisModuleCtx *ctx, const char *left, const char *right, char *stmOn, Vector *vSelect, Vector *vWhere, long top) {
+  Join j;
+  memset(&j, 0, sizeof(Join));
+  j.vSelect = vSelect;
+  j.top = top;
+  loadTable(ctx, left, &j.sides[0].table);
+  loadTable(ctx, right, &j.sides[1].table);
+  const char *err = NULL;
+  if (strcmp(left, right) == 0)
+    err = "a table cannot be joined with itself";
+  else if (j.sides[0].table.columnar || j.sides[1].table.columnar)
+    err = "a columnar table cannot be joined";
+
+  // on a.x = b.y
+  char *eq = strchr(stmOn, '=');
+  char *fields[2] = {NULL, NULL};
+  if (err == NULL && eq != NULL) {
+    *eq = 0;
+    char *f;
+    int s = joinSideOf(&j, stmOn, &f);
+    if (s >= 0) fields[s] = f;
+    s = joinSideOf(&j, eq + 1, &f);
+    if (s >= 0) fields[s] = f;
+  }
+  if (err == NULL && (fields[0] == NULL || fields[1] == NULL))
+    err = "on <table>.<field> = <table>.<field> is expected";
+
+  // the fields must be qualified by their table
+  for (size_t i = 0; err == NULL && i < Vector_Size(vSelect); i++) {
+    char *item = VectorGetString(vSelect, i), *f;
+    if (strcmp(item, "*") != 0 && joinSideOf(&j, item, &f) < 0)
+      err = "fields of join must be qualified by their table";
+  }
+  j.sides[0].vWhere = NewVector(void *, 4);
+  j.sides[1].vWhere = NewVector(void *, 4);
+  for (size_t i = 0; err == NULL && i + 2 < Vector_Size(vWhere); i += 3) {
+    char *f;
+    // the alternatives of or would have to be split by table too
+    if (whereOp(vWhere, i + 1) == WHERE_OR) {
+      err = "or is not supported in the where clause of a join";
+      break;
+    }
+    int s = joinSideOf(&j, VectorGetString(vWhere, i), &f);
+    if (s < 0) {
+      err = "fields of join must be qualified by their table";
+      break;
+    }
+    void *op, *value;
+    Vector_Get(vWhere, i + 1, &op);
+    Vector_Get(vWhere, i + 2, &value);
+    Vector_Push(j.sides[s].vWhere, f);
+    Vector_Push(j.sides[s].vWhere, op);
+    Vector_Push(j.sides[s].vWhere, value);
+  }
+
+  int compiled = 0;
+  if (err == NULL) {
+    if (regexCompile(ctx, &j.sides[0].regex, j.sides[0].table.pattern)) err = "";
+    else if (regexCompile(ctx, &j.sides[1].regex, j.sides[1].table.pattern)) {
+      regfree(&j.sides[0].regex);
+      err = "";
+    }
+    else compiled = 1;
+  }
+  if (err != NULL) {
+    Vector_Free(j.sides[0].vWhere);
+    Vector_Free(j.sides[1].vWhere);
+    if (strlen(err) > 0) replyError(ctx, err);
+    return REDISMODULE_ERR;
+  }
+  j.sides[0].field = fields[0];
+  j.sides[1].field = fields[1];
+
+  replyArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  if (top != 0) {
+    // A join on the primary key of a side looks it up, the other side scans
+    int lookup = -1;
+    for (int s = 1; s >= 0 && lookup < 0; s--)
+      if (strlen(j.sides[s].table.key) > 0 && strcmp(j.sides[s].table.key, j.sides[s].field) == 0)
+        lookup = s;
+    if (lookup >= 0) {
+      TRACE_PATH("join by primary key");
+      j.inner = 1 - lookup;
+      scanTable(ctx, &j.sides[j.inner].table, &j.sides[j.inner].regex, j.sides[j.inner].vWhere, joinLookupRow, &j);
+    }
+    else {
+      // The side known to be smaller builds the hash table, otherwise the
+      // right side
+      int build = 1;
+      if (j.sides[0].table.counted && j.sides[1].table.counted &&
+          j.sides[0].table.rows < j.sides[1].table.rows)
+        build = 0;
+      TRACE_PATH("hash join");
+      j.inner = 1 - build;
+      scanTable(ctx, &j.sides[build].table, &j.sides[build].regex, j.sides[build].vWhere, joinBuildRow, &j);
+      TRACE_MEM(STAGE_SCAN, j.arena.total + j.cap * sizeof(JoinEntry*));
+      STAGE(STAGE_SCAN);
+      if (j.count > 0)
+        scanTable(ctx, &j.sides[j.inner].table, &j.sides[j.inner].regex, j.sides[j.inner].vWhere, joinProbeRow, &j);
+    }
+  }
+  replySetArrayLength(ctx, j.n);
+  STAT(returned, j.n);
+
+  if (compiled) {
+    regfree(&j.sides[0].regex);
+    regfree(&j.sides[1].regex);
+  }
+  arenaFree(&j.arena);
+  RedisModule_Free(j.slots);
+  Vector_Free(j.sides[0].vWhere);
+  Vector_Free(j.sides[1].vWhere);
+  return REDISMODULE_OK;
+}
+
+/* The clauses a cluster select merges the results of the nodes by, kept by
+ * the run of the statement on the coordinator */
+typedef struct ClusterPlan {
+  char select[1024];
+  char group[1024];
+  char order[1024];
+  long top;
+} ClusterPlan;
+
+static ClusterPlan *clusterPlan;
+
+/* Parse and execute the select statement after the select keyword. The rows
+ * are copied to insertInto if it is called by insert ... select. The
+ * statement only defines the view if view is given. */
+int selectStatement(RedisModuleCtx *ctx, char *sp, IntoTarget *insertInto, View *view) {
+  // Table
+  long top = -1;
+  RedisModuleString *fromKeys;
+  char intoKey[128] = "";
+  char csvFile[128] = "";
+
+  int step = 0;
+  char *temp = RedisModule_PoolAlloc(ctx, strlen(sp) + 1);
+  char stmSelect[1024] = "";
+  char stmWhere[1024] = "";
+  int between = 0;
+  char stmOrder[1024] = "";
+  char stmGroup[1024] = "";
+  char joinTable[128] = "";
+  char stmOn[1024] = "";
+
+  char *token = strtok(sp, " ");
+  while (token != NULL) {
+    // A quoted string with spaces is joined back into its token
+    token = joinQuoted(token, temp);
+    switch(step) {
+      case 0:
+        if (strcmp("top", token) == 0) {
+          step = -2;
+          break;
+        }
+        step = -1;
+      case -1:
+        if (strlen(token) > 512) {
+          replyError(ctx, "select arguments are too long");
+          return REDISMODULE_ERR;
+        }
+        strcat(stmSelect, token);
+        step = -3;
+        break;
+      case -2:
+        top = atol(token);
+        step = -1;
+        break;
+      case -3:
+        if (strcmp("into", token) == 0) {
+          if (insertInto != NULL) {
+            replyError(ctx, "into clause is not allowed in insert statement");
+            return REDISMODULE_ERR;
+          }
+          step = -4;
+        }
+        else if (strcmp("from", token) == 0)
+          step = -6;
+        else {
+          if (strlen(stmSelect) + strlen(token) > 512) {
+            replyError(ctx, "select arguments are too long");
+            return REDISMODULE_ERR;
+          }
+          strcat(stmSelect, token);
+        }
+        break;
+      case -4:
+        // parse into clause, new keys are named by row id
+        if (strcmp("csv", token) == 0)
+          step = -45;
+        else {
+          if (strlen(token) >= sizeof(intoKey)) {
+            replyError(ctx, "into table name is too long");
+            return REDISMODULE_ERR;
+          }
+          strcpy(intoKey, token);
+          step = -5;
+        }
+        break;
+      case -45:
+        // the quotes stay around the name in a statement of a single argument
+        token = trim(trim(token, '"'), '\'');
+        if (strlen(token) >= sizeof(csvFile)) {
+          replyError(ctx, "csv file name is too long");
+          return REDISMODULE_ERR;
+        }
+        strcpy(csvFile, token);
+        step = -5;
+        break;
+      case -5:
+        if (strcmp("from", token) == 0)
+          step = -6;
+        else {
+          replyError(ctx, "from keyword is expected");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case -6:
+        // parse from clause
+        fromKeys = RMUtil_CreateFormattedString(ctx, token);
+        step = 7;
+        break;
+      case 7:
+        if (strcmp("join", token) == 0)
+          step = -16;
+        else if (strcmp("where", token) == 0)
+          step = -8;
+        else if (strcmp("group", token) == 0)
+          step = -13;
+        else if (strcmp("order", token) == 0)
+          step = -10;
+        break;
+      case -8:
+      case 9:
+        // parse where clause
+        if (strcmp("group", token) == 0)
+          step = -13;
+        else if (strcmp("order", token) == 0)
+          step = -10;
+        else {
+          if (strlen(stmWhere) + strlen(token) > 512) {
+            replyError(ctx, "where arguments are too long");
+            return REDISMODULE_ERR;
+          }
+          if (whereAppend(stmWhere, token, &between)) step = 9;
+        }
+        break;
+      case -10:
+        if (strcmp("by", token) == 0)
+          step = -11;
+        else {
+          replyError(ctx, "missing 'by' after order");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case -11:
+      case 12:
+        // parse order clause
+        if (strlen(stmOrder) + strlen(token) > 512) {
+          replyError(ctx, "order arguments are too long");
+          return REDISMODULE_ERR;
+        }
+        if (strcmp("desc", token) == 0)
+          strcat(stmOrder, "-");
         else
-          showRecord(ctx, key, vSelect);
-        affected++;
-        (*top)--;
+        if (strcmp("asc", token) != 0)
+          strcat(stmOrder, token);
+        step = 12;
+        break;
+      case -13:
+        if (strcmp("by", token) == 0)
+          step = -14;
+        else {
+          replyError(ctx, "missing 'by' after group");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case -14:
+      case 15:
+        // parse group by clause
+        if (strcmp("order", token) == 0)
+          step = -10;
+        else {
+          if (strlen(stmGroup) + strlen(token) > 512) {
+            replyError(ctx, "group arguments are too long");
+            return REDISMODULE_ERR;
+          }
+          strcat(stmGroup, token);
+          step = 15;
+        }
+        break;
+      case -16:
+        if (strlen(token) >= sizeof(joinTable)) {
+          replyError(ctx, "join table name is too long");
+          return REDISMODULE_ERR;
+        }
+        strcpy(joinTable, token);
+        step = -17;
+        break;
+      case -17:
+        if (strcmp("on", token) == 0)
+          step = -18;
+        else {
+          replyError(ctx, "missing 'on' after join table");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case -18:
+      case 19:
+        // parse on clause
+        if (strcmp("where", token) == 0)
+          step = -8;
+        else if (strcmp("group", token) == 0)
+          step = -13;
+        else if (strcmp("order", token) == 0)
+          step = -10;
+        else {
+          if (strlen(stmOn) + strlen(token) > 512) {
+            replyError(ctx, "on arguments are too long");
+            return REDISMODULE_ERR;
+          }
+          strcat(stmOn, token);
+          step = 19;
+        }
+        break;
+    }
+    token = strtok(NULL, " ");
+  }
+
+  if (step <= 0) {
+    replyError(ctx, "parse error");
+    return REDISMODULE_ERR;
+  }
+
+  // A node of a cluster select replies partial results, which can only be
+  // merged into a reply
+  if (partialReply && (strlen(intoKey) > 0 || strlen(csvFile) > 0 || strlen(joinTable) > 0)) {
+    replyError(ctx, "cluster select supports neither into, csv nor join");
+    return REDISMODULE_ERR;
+  }
+  if (clusterPlan != NULL) {
+    strcpy(clusterPlan->select, stmSelect);
+    strcpy(clusterPlan->group, stmGroup);
+    strcpy(clusterPlan->order, stmOrder);
+    clusterPlan->top = top;
+  }
+
+  // A view keeps its own copy of the clauses, which its items point to
+  if (view != NULL) {
+    view->select = RedisModule_Strdup(stmSelect);
+    view->where = RedisModule_Strdup(stmWhere);
+    view->group = RedisModule_Strdup(stmGroup);
+  }
+  // The temporaries of the statement are released when the command returns
+  Arena qa = {NULL, 0, ctx};
+  Vector *vSelect = splitStringByChar(&qa, view? view->select: stmSelect, ",");
+  Vector *vWhere = view? splitWhereString(&view->arena, view->where): splitWhereString(&qa, stmWhere);
+  Vector *vOrder = splitStringByChar(&qa, stmOrder, ",");
+  Vector *vGroup = splitStringByChar(&qa, view? view->group: stmGroup, ",");
+  if (vWhere == NULL) {
+    RedisModule_FreeString(ctx, fromKeys);
+    replyError(ctx, "where clause cannot be parsed");
+    return REDISMODULE_ERR;
+  }
+
+  // The rows of two tables joined on a field of each
+  if (strlen(joinTable) > 0) {
+    int rc = REDISMODULE_ERR;
+    STAGE(STAGE_PARSE);
+    if (insertInto != NULL || view != NULL || strlen(intoKey) > 0 || strlen(csvFile) > 0 ||
+        Vector_Size(vOrder) > 0 || Vector_Size(vGroup) > 0)
+      replyError(ctx, "join supports neither into, order by nor group by");
+    else
+      rc = joinStatement(ctx, RedisModule_StringToChar(fromKeys), joinTable, stmOn, vSelect, vWhere, top);
+    RedisModule_FreeString(ctx, fromKeys);
+    return rc;
+  }
+
+  // A view replies its groups, they are built by a scan when it is read the
+  // first time
+  View *fromView = view == NULL && insertInto == NULL? findView(ctx, RedisModule_StringToChar(fromKeys)): NULL;
+  if (fromView != NULL && partialReply) {
+    RedisModule_FreeString(ctx, fromKeys);
+    replyError(ctx, "cluster select cannot read a view");
+    return REDISMODULE_ERR;
+  }
+  if (fromView != NULL) {
+    int plain = Vector_Size(vSelect) == 1 && strcmp(VectorGetString(vSelect, 0), "*") == 0 &&
+      Vector_Size(vWhere) == 0 && Vector_Size(vGroup) == 0 && Vector_Size(vOrder) == 0 &&
+      strlen(intoKey) == 0 && strlen(csvFile) == 0;
+    if (plain) {
+      STAGE(STAGE_PARSE);
+      TRACE_PATH("view");
+      if (!fromView->built) viewBuild(ctx, fromView);
+      STAGE(STAGE_SCAN);
+      long limit = fromView->agg->limit;
+      if (top >= 0) fromView->agg->limit = top;
+      replyArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+      size_t n = replyAggregation(ctx, fromView->agg);
+      replySetArrayLength(ctx, n);
+      STAT(returned, n);
+      fromView->agg->limit = limit;
+    }
+    else
+      replyError(ctx, "only select [top n] * from a view is supported");
+    RedisModule_FreeString(ctx, fromKeys);
+    return plain? REDISMODULE_OK: REDISMODULE_ERR;
+  }
+
+  // The fields of insert ... select are mapped to the selected fields by position
+  if (insertInto != NULL && insertInto->vField != NULL) {
+    int match = Vector_Size(vSelect) == Vector_Size(insertInto->vField);
+    for (size_t i = 0; match && i < Vector_Size(vSelect); i++)
+      if (strcmp(VectorGetString(vSelect, i), "*") == 0) match = 0;
+    if (!match) {
+      replyError(ctx, "Number of fields does not match");
+      return REDISMODULE_ERR;
+    }
+  }
+
+  // Aggregate functions fold the rows into a row per group, the order and
+  // top clauses apply to the groups rather than the scanned rows
+  const char *err;
+  Aggregation *agg = parseAggregation(ctx, vSelect, vGroup, vOrder, top, &err);
+  if (agg != NULL && (insertInto != NULL || strlen(intoKey) > 0 || strlen(csvFile) > 0))
+    err = "aggregate functions cannot be written into a table or csv";
+  if (err != NULL) {
+    freeAggregation(ctx, agg);
+    replyError(ctx, err);
+    return REDISMODULE_ERR;
+  }
+  if (agg != NULL) top = -1;
+  // the order and top of the groups apply once the groups of all the nodes
+  // are merged
+  if (agg != NULL && partialReply) {
+    agg->nOrder = 0;
+    agg->limit = -1;
+  }
+  if (agg == NULL && partialReply)
+    selectOrderFields(&qa, vSelect, vOrder);
+
+  if (view != NULL) {
+    // only the shares of count, sum and avg can be taken back from a group
+    err = agg == NULL? "a view must be an aggregate query": NULL;
+    for (size_t f = 0; agg != NULL && f < agg->nFunc; f++)
+      if (agg->funcs[f].func > AGG_AVG) err = "only count, sum and avg can be maintained in a view";
+    if (err == NULL) {
+      loadTable(ctx, RedisModule_StringToChar(fromKeys), &view->table);
+      if (view->table.columnar) err = "a view cannot be defined on a columnar table";
+      else if (regexCompile(ctx, &view->regex, view->table.pattern)) err = "";
+    }
+    if (err != NULL) {
+      freeAggregation(ctx, agg);
+      if (strlen(err) > 0) replyError(ctx, err);
+    }
+    else {
+      agg->budget = SIZE_MAX;
+      view->agg = agg;
+      view->vWhere = vWhere;
+    }
+    RedisModule_FreeString(ctx, fromKeys);
+    return err == NULL? REDISMODULE_OK: REDISMODULE_ERR;
+  }
+
+  /* Convert key to regex, a defined table owns the keys of its prefix */
+  const char *pat = RedisModule_StringToChar(fromKeys);
+  Table table;
+  loadTable(ctx, pat, &table);
+  regex_t regex;
+  if (regexCompile(ctx, &regex, table.pattern)) {
+    freeAggregation(ctx, agg);
+    return REDISMODULE_ERR;
+  }
+
+  RedisModuleString *pkey = table.columnar? NULL: primaryKeyLookup(ctx, &table, vWhere);
+  Vector *pkeys = table.columnar || pkey? NULL: primaryKeyValues(&qa, table.key, vWhere);
+
+  // The destination of into clause, its row ids are reserved in blocks
+  IntoTarget target;
+  IntoTarget *into = insertInto;
+  if (strlen(intoKey) > 0) {
+    initIntoTarget(ctx, &target, intoKey, NULL, 0, 0);
+    into = &target;
+  }
+  if (into != NULL && into->table.columnar) {
+    RedisModule_FreeString(ctx, fromKeys);
+    if (pkey) RedisModule_FreeString(ctx, pkey);
+    freeAggregation(ctx, agg);
+    regfree(&regex);
+    replyError(ctx, "rows cannot be copied into a columnar table");
+    return REDISMODULE_ERR;
+  }
+
+  /* Print result in array format, or count with first and last key */
+  if (into == NULL || !into->compact)
+    replyArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  TRACE_MEM(STAGE_PARSE, qa.total);
+  STAGE(STAGE_PARSE);
+
+  if (table.columnar) {
+    // The rows of a columnar table are filtered on its column vectors
+    TRACE_PATH("columnar scan");
+    size_t n = colSelect(ctx, &table, vSelect, vWhere, vOrder, agg, top, into, csvFile);
+    endReply(ctx, into, agg, n);
+  }
+  else if (pkey != NULL) {
+    // Direct access by primary key, a single row needs neither scan nor sort
+    TRACE_PATH("primary key");
+    TRACE_ROWS(STAGE_PROBE, 1, 1);
+    size_t n = 0;
+    if (top != 0 && processRecord(ctx, pkey, vSelect, vWhere, agg, into, csvFile)) n++;
+    traceEmit(agg == NULL && into == NULL && strlen(csvFile) == 0, top, n, n);
+    endReply(ctx, into, agg, n);
+    RedisModule_FreeString(ctx, pkey);
+  }
+  else if (pkeys != NULL && (agg != NULL || Vector_Size(vOrder) == 0)) {
+    // The union of the rows accessed by primary key, in the order of the values
+    TRACE_PATH("primary key union");
+    size_t n = 0, nKey = Vector_Size(pkeys);
+    TRACE_ROWS(STAGE_PROBE, nKey, nKey);
+    for (size_t i = 0; i < nKey && (agg != NULL || top < 0 || (long)n < top); i++) {
+      RedisModuleString *key = rowKey(ctx, &table, VectorGetString(pkeys, i));
+      if (processRecord(ctx, key, vSelect, vWhere, agg, into, csvFile)) n++;
+      RedisModule_FreeString(ctx, key);
+    }
+    traceEmit(agg == NULL && into == NULL && strlen(csvFile) == 0, top, n, n);
+    endReply(ctx, into, agg, n);
+  }
+  else if (agg == NULL && Vector_Size(vOrder) > 0 && partialReply) {
+    TRACE_PATH("scan and sort in memory");
+    size_t n = sortRecords(ctx, &table, &regex, vSelect, vWhere, vOrder, &top);
+    endReply(ctx, into, agg, n);
+  }
+  else if (agg == NULL && Vector_Size(vOrder) > 0) {
+    // temporary set name
+    char setName[32];
+    sprintf(setName, "__db_tempset_%i", rn++);
+
+    RedisModuleCallReply *rep;
+
+    TRACE_PATH("scan and sort");
+    size_t nSet = buildSetByPattern(ctx, &table, &regex, setName, vWhere);
+    STAGE(STAGE_FILTER);
+    if (nSet > 0) {
+      char *field;
+      int nSortField = Vector_Size(vOrder);
+      int cap = 3 * nSortField + 2;
+
+      RedisModuleString *param[cap];
+      param[0] = RedisModule_CreateString(ctx, setName, strlen(setName));
+
+      for(int sf = 0; sf < nSortField; sf++) {
+        Vector_Get(vOrder, sf, &field);
+        if (field[strlen(field)-1] == '-') {
+          field[strlen(field)-1] = 0;
+          param[3+sf*3] = RedisModule_CreateString(ctx, "desc", 4);
+        }
+        else
+          param[3+sf*3] = RedisModule_CreateString(ctx, "asc", 3);
+        param[1+sf*3] = RedisModule_CreateString(ctx, "by", 2);
+        param[2+sf*3] = RedisModule_CreateStringPrintf(ctx, "*->%s", field, 3 + strlen(field));
+      }
+      param[cap-1] = RedisModule_CreateString(ctx, "alpha", 5);
+      rep = RedisModule_Call(ctx, "SORT", "v", &param, cap);
+      STAT(sorted, RedisModule_CallReplyLength(rep));
+      TRACE_ROWS(STAGE_SORT, nSet, RedisModule_CallReplyLength(rep));
+      STAGE(STAGE_SORT);
+
+      for(int i = 0; i < cap; i++)
+        RedisModule_FreeString(ctx, param[i]);
+
+      size_t n = processRecords(ctx, rep, &regex, vSelect, NULL, agg, &top, into, csvFile);
+
+      RedisModule_FreeCallReply(rep);
+      endReply(ctx, into, agg, n);
+    }
+    else
+      endReply(ctx, into, agg, 0);
+
+    // Remove the temporary set before leave
+    RedisModule_Call(ctx, "DEL", "c", setName);
+  }
+  else {
+    size_t n = 0;
+    Batch *batch = newBatch(&qa, vSelect, vWhere, agg);
+    KeyScan ks;
+    RedisModuleString *key;
+
+    /* The keys of the table are processed by batch */
+    TRACE_PATH("scan");
+    keyScanInit(ctx, &ks, &table, &regex);
+    while (top != 0 && (key = keyScanNext(ctx, &ks)) != NULL) {
+      batch->keys[batch->n++] = key;
+      if (batch->n == BATCH_SIZE)
+        n += batchRun(ctx, batch, vSelect, agg, &top, into, csvFile);
+    }
+    keyScanFree(&ks);
+    if (batch->n > 0)
+      n += batchRun(ctx, batch, vSelect, agg, &top, into, csvFile);
+
+    endReply(ctx, into, agg, n);
+  }
+
+  RedisModule_FreeString(ctx, fromKeys);
+  freeAggregation(ctx, agg);
+  regfree(&regex);
+
+  return REDISMODULE_OK;
+}
+
+void freeView(RedisModuleCtx *ctx, View *view) {
+  if (view->rows) {
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(view->rows, "^", NULL, 0);
+    void *share;
+    while (RedisModule_DictNextC(iter, NULL, &share) != NULL) RedisModule_Free(share);
+    RedisModule_DictIteratorStop(iter);
+    RedisModule_FreeDict(ctx, view->rows);
+  }
+  if (view->agg) {
+    freeAggregation(ctx, view->agg);
+    regfree(&view->regex);
+  }
+  arenaFree(&view->arena);
+  RedisModule_Free(view->query);
+  RedisModule_Free(view->select);
+  RedisModule_Free(view->where);
+  RedisModule_Free(view->group);
+  RedisModule_Free(view);
+}
+
+/* Parse the query of a view and add it to the loaded views. The errors are
+ * replied and NULL is returned. */
+View *defineView(RedisModuleCtx *ctx, const char *name, const char *query, size_t len) {
+  View *view = RedisModule_Calloc(1, sizeof(View));
+  strcpy(view->name, name);
+  view->query = RedisModule_Alloc(len + 1);
+  memcpy(view->query, query, len);
+  view->query[len] = 0;
+
+  char *sp = RedisModule_PoolAlloc(ctx, len + 1);
+  strcpy(sp, view->query);
+  if (selectStatement(ctx, sp, NULL, view) != REDISMODULE_OK) {
+    freeView(ctx, view);
+    return NULL;
+  }
+  view->rows = RedisModule_CreateDict(NULL);
+  view->next = views;
+  views = view;
+  return view;
+}
+
+/* Find a view by name, its definition is loaded from __dbx_view:<name> if it
+ * is not loaded yet. The groups are not built until the view is read. */
+View *findView(RedisModuleCtx *ctx, const char *name) {
+  View *prev = NULL;
+  for (View *view = views; view != NULL; prev = view, view = view->next) {
+    if (strcmp(view->name, name) != 0) continue;
+    // the definition may be gone, e.g. by flushall
+    RedisModuleString *def = RedisModule_CreateStringPrintf(ctx, VIEW_PREFIX "%s", name);
+    RedisModuleKey *dkey = RedisModule_OpenKey(ctx, def, REDISMODULE_READ);
+    int exists = RedisModule_KeyType(dkey) == REDISMODULE_KEYTYPE_HASH;
+    RedisModule_CloseKey(dkey);
+    RedisModule_FreeString(ctx, def);
+    if (exists) return view;
+    if (prev) prev->next = view->next;
+    else views = view->next;
+    freeView(ctx, view);
+    return NULL;
+  }
+
+  if (strlen(name) >= sizeof(views->name)) return NULL;
+  RedisModuleString *def = RedisModule_CreateStringPrintf(ctx, VIEW_PREFIX "%s", name);
+  RedisModuleCallReply *rep = RedisModule_Call(ctx, "HGET", "sc", def, "query");
+  RedisModule_FreeString(ctx, def);
+  if (RedisModule_CallReplyType(rep) != REDISMODULE_REPLY_STRING) {
+    RedisModule_FreeCallReply(rep);
+    return NULL;
+  }
+  size_t len;
+  const char *query = RedisModule_CallReplyStringPtr(rep, &len);
+  View *view = defineView(ctx, name, query, len);
+  RedisModule_FreeCallReply(rep);
+  return view;
+}
+
+/* create view <name> as select ... group by ... */
+int createView(RedisModuleCtx *ctx, char *sp) {
+  char *save;
+  char *name = strtok_r(sp, " ", &save);
+  char *as = strtok_r(NULL, " ", &save);
+  char *query = strtok_r(NULL, "", &save);
+  if (name == NULL || as == NULL || strcmp(as, "as") != 0 || query == NULL || strncmp(query, "select ", 7) != 0) {
+    RedisModule_ReplyWithError(ctx, "create view <name> as select ... is expected");
+    return REDISMODULE_ERR;
+  }
+  if (strlen(name) >= sizeof(views->name)) {
+    RedisModule_ReplyWithError(ctx, "view name is too long");
+    return REDISMODULE_ERR;
+  }
+  query += 6;
+
+  RedisModuleString *def = RedisModule_CreateStringPrintf(ctx, VIEW_PREFIX "%s", name);
+  RedisModuleCallReply *rep = RedisModule_Call(ctx, "EXISTS", "s", def);
+  long long exists = RedisModule_CallReplyInteger(rep);
+  RedisModule_FreeCallReply(rep);
+  if (exists || findView(ctx, name) != NULL) {
+    RedisModule_ReplyWithError(ctx, "view already exists");
+    return REDISMODULE_ERR;
+  }
+
+  View *view = defineView(ctx, name, query, strlen(query));
+  if (view == NULL) return REDISMODULE_ERR;
+  viewBuild(ctx, view);
+
+  // The definition is written with replication, the replicas build the groups
+  // when the view is read
+  rep = RedisModule_Call(ctx, "HSET", "!scc", def, "query", view->query);
+  RedisModule_FreeCallReply(rep);
+  RedisModule_FreeString(ctx, def);
+
+  RedisModule_ReplyWithSimpleString(ctx, "OK");
+  return REDISMODULE_OK;
+}
+
+/* Keyspace events of the rows changed by any command */
+int onKeyspaceEvent(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key) {
+  REDISMODULE_NOT_USED(type);
+  REDISMODULE_NOT_USED(event);
+  if (views != NULL) viewsRowChanged(ctx, key);
+  return REDISMODULE_OK;
+}
+
+int SelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModule_AutoMemory(ctx);
+
+  if (argc < 2)
+    return RedisModule_WrongArity(ctx);
+
+  // Process the arguments
+  size_t plen;
+  char s[1024] = "";
+  for (int i=1; i<argc; i++) {
+    if (strlen(s) > 0) strcat(s, " ");
+    const char *temp = RedisModule_StringPtrLen(argv[i], &plen);
+    if (strlen(s) + plen > 1024) {
+        replyError(ctx, "arguments are too long");
+        return REDISMODULE_ERR;
+    }
+
+    if (argc > 2) { // argc > 2 means the arguments are not in quoted. i.e. "..."
+      char *p = (char*)temp;
+      while (*p++) *p = *p == 32? 7: *p; // Convert all spaces in tabs, then convert back during parsing
+    }
+
+    if (strcmp("like", temp) == 0)
+      strcat(s, "~");
+    else
+      strcat(s, temp);
+  }
+
+  char *sp = s;
+  if (strncmp("select", sp, 6) == 0) sp += 6;
+
+  return selectStatement(ctx, sp, NULL, NULL);
+}
+
+/* Cluster scatter-gather. dbx.cluster select ... runs the statement on this
+ * node and sends it to every other master by the cluster bus. A node replies
+ * its rows, or the states of its groups, and the coordinator merges them:
+ * the groups by their states, the rows sorted by each node by merging the
+ * sorted lists. The client is blocked until all the masters answer. */
+#define CLUSTER_MSG_QUERY  1
+#define CLUSTER_MSG_RESULT 2
+#define CLUSTER_TIMEOUT    5000
+
+/* A reply of a node, decoded from the cluster bus */
+typedef struct NodeReply {
+  int type;          // REDISMODULE_REPLY_*
+  long long ll;
+  const char *s;
+  size_t len;
+  size_t n;
+  struct NodeReply *elems;
+} NodeReply;
+
+typedef struct Gather {
+  uint64_t id;
+  RedisModuleBlockedClient *bc;
+  ClusterPlan plan;
+  Arena arena;       // the replies of the nodes
+  size_t nPart, pending;
+  NodeReply *parts;  // the first is the reply of this node
+  char error[256];   // the first error replied by a node
+  struct Gather *next;
+} Gather;
+
+static Gather *gathers;  // waiting for the other masters
+static uint64_t gatherId;
+
+void freeGather(Gather *g) {
+  if (g == NULL) return;
+  arenaFree(&g->arena);
+  RedisModule_Free(g->parts);
+  RedisModule_Free(g);
+}
+
+/* Decode a reply, the strings point into the encoded data */
+int decodeReply(Arena *a, PartialReader *r, NodeReply *o) {
+  int8_t type;
+  uint32_t n;
+  memset(o, 0, sizeof(NodeReply));
+  partialGet(r, &type, sizeof(type));
+  o->type = type;
+  switch (type) {
+    case REDISMODULE_REPLY_STRING:
+    case REDISMODULE_REPLY_ERROR:
+      partialGet(r, &n, sizeof(n));
+      if (!r->ok || (size_t)(r->end - r->p) < n) return 0;
+      o->s = r->p;
+      o->len = n;
+      r->p += n;
+      break;
+    case REDISMODULE_REPLY_INTEGER:
+      partialGet(r, &o->ll, sizeof(o->ll));
+      break;
+    case REDISMODULE_REPLY_ARRAY:
+      // an element takes a byte at least
+      partialGet(r, &n, sizeof(n));
+      if (!r->ok || (size_t)(r->end - r->p) < n) return 0;
+      o->n = n;
+      o->elems = arenaAlloc(a, (n + 1) * sizeof(NodeReply));
+      for (uint32_t i = 0; i < n && r->ok; i++)
+        decodeReply(a, r, &o->elems[i]);
+      break;
+  }
+  return r->ok;
+}
+
+/* Add the encoded reply of a node */
+void gatherPart(Gather *g, const char *data, size_t len) {
+  char *copy = arenaAlloc(&g->arena, len);
+  memcpy(copy, data, len);
+  PartialReader r = {copy, copy + len, 1};
+  NodeReply *part = &g->parts[g->nPart++];
+  const char *err = NULL;
+  size_t elen = 0;
+  if (!decodeReply(&g->arena, &r, part)) {
+    part->type = REDISMODULE_REPLY_NULL;
+    err = "malformed reply of a node";
+    elen = strlen(err);
+  }
+  else if (part->type == REDISMODULE_REPLY_ERROR) {
+    err = part->s;
+    elen = part->len < sizeof(g->error) - 1? part->len: sizeof(g->error) - 1;
+  }
+  if (err != NULL && g->error[0] == 0) {
+    memcpy(g->error, err, elen);
+    g->error[elen] = 0;
+  }
+}
+
+void replyNodeReply(RedisModuleCtx *ctx, NodeReply *o) {
+  switch (o->type) {
+    case REDISMODULE_REPLY_STRING: RedisModule_ReplyWithStringBuffer(ctx, o->s, o->len); break;
+    case REDISMODULE_REPLY_INTEGER: RedisModule_ReplyWithLongLong(ctx, o->ll); break;
+    case REDISMODULE_REPLY_ARRAY:
+      RedisModule_ReplyWithArray(ctx, o->n);
+      for (size_t i = 0; i < o->n; i++) replyNodeReply(ctx, &o->elems[i]);
+      break;
+    default: RedisModule_ReplyWithNull(ctx);
+  }
+}
+
+/* The value of a field in a row replied as field and value pairs */
+NodeReply *nodeRowValue(NodeReply *row, const char *field) {
+  for (size_t i = 0; i + 1 < row->n; i += 2) {
+    NodeReply *f = &row->elems[i];
+    if (f->len == strlen(field) && memcmp(f->s, field, f->len) == 0)
+      return row->elems[i + 1].type == REDISMODULE_REPLY_STRING? &row->elems[i + 1]: NULL;
+  }
+  return NULL;
+}
+
+/* Compare rows by compareOrderValues, missing values first */
+int compareNodeRows(NodeReply *x, NodeReply *y, char **fields, int *descs, size_t nOrder) {
+  for (size_t i = 0; i < nOrder; i++) {
+    NodeReply *vx = nodeRowValue(x, fields[i]), *vy = nodeRowValue(y, fields[i]);
+    int cmp;
+    if (vx == NULL || vy == NULL)
+      cmp = (vx != NULL) - (vy != NULL);
+    else
+      cmp = compareOrderValues(vx->s, vx->len, vy->s, vy->len);
+    if (cmp != 0) return descs[i]? -cmp: cmp;
+  }
+  return 0;
+}
+
+/* Reply the rows of all the nodes, merging the sorted lists of the nodes up
+ * to top rows. The last nExtra fields of the rows are the ones of order by
+ * the select list lacks, they are not replied. The number of rows replied is
+ * returned. */
+size_t mergeNodeRows(RedisModuleCtx *ctx, Gather *g, Vector *vOrder, long top, size_t nExtra) {
+  size_t nOrder = Vector_Size(vOrder);
+  char *fields[nOrder + 1];
+  int descs[nOrder + 1];
+  for (size_t i = 0; i < nOrder; i++) {
+    fields[i] = VectorGetString(vOrder, i);
+    size_t len = strlen(fields[i]);
+    descs[i] = len > 0 && fields[i][len - 1] == '-';
+    if (descs[i]) fields[i][len - 1] = 0;
+  }
+
+  size_t next[g->nPart + 1], n = 0;
+  memset(next, 0, sizeof(next));
+  while (top < 0 || n < (size_t)top) {
+    NodeReply *best = NULL;
+    size_t from = 0;
+    for (size_t p = 0; p < g->nPart; p++) {
+      NodeReply *part = &g->parts[p];
+      if (part->type != REDISMODULE_REPLY_ARRAY || next[p] >= part->n) continue;
+      NodeReply *row = &part->elems[next[p]];
+      if (best == NULL || compareNodeRows(row, best, fields, descs, nOrder) < 0) {
+        best = row;
+        from = p;
+      }
+    }
+    if (best == NULL) break;
+    if (nExtra > 0 && best->type == REDISMODULE_REPLY_ARRAY && best->n >= 2 * nExtra) {
+      RedisModule_ReplyWithArray(ctx, best->n - 2 * nExtra);
+      for (size_t i = 0; i < best->n - 2 * nExtra; i++) replyNodeReply(ctx, &best->elems[i]);
+    }
+    else
+      replyNodeReply(ctx, best);
+    next[from]++;
+    n++;
+  }
+  return n;
+}
+
+/* Reply the result merged from the replies of all the nodes */
+int replyGather(RedisModuleCtx *ctx, Gather *g) {
+  if (g->error[0] != 0)
+    return RedisModule_ReplyWithError(ctx, g->error);
+
+  Arena qa = {NULL, 0, ctx};
+  Vector *vSelect = splitStringByChar(&qa, g->plan.select, ",");
+  Vector *vGroup = splitStringByChar(&qa, g->plan.group, ",");
+  Vector *vOrder = splitStringByChar(&qa, g->plan.order, ",");
+  const char *err;
+  Aggregation *agg = parseAggregation(ctx, vSelect, vGroup, vOrder, g->plan.top, &err);
+  if (err != NULL)
+    return RedisModule_ReplyWithError(ctx, err);
+
+  // The groups of all the nodes are merged before any of them is replied
+  for (size_t p = 0; agg != NULL && p < g->nPart; p++) {
+    NodeReply *part = &g->parts[p];
+    for (size_t i = 0; part->type == REDISMODULE_REPLY_ARRAY && i < part->n; i++) {
+      NodeReply *e = &part->elems[i];
+      if (e->type != REDISMODULE_REPLY_STRING || !mergePartialGroup(agg, e->s, e->len)) {
+        freeAggregation(ctx, agg);
+        return RedisModule_ReplyWithError(ctx, "malformed group of a node");
+      }
+    }
+  }
+
+  // The reply may come after the command returned, it is counted to it all
+  // the same
+  StmtStats *saved = curStats;
+  curStats = &stats[STAT_CLUSTER];
+  size_t n;
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  if (agg != NULL) {
+    n = replyAggregation(ctx, agg);
+    freeAggregation(ctx, agg);
+  }
+  else
+    n = mergeNodeRows(ctx, g, vOrder, g->plan.top, selectOrderFields(&qa, vSelect, vOrder));
+  RedisModule_ReplySetArrayLength(ctx, n);
+  STAT(returned, n);
+  curStats = saved;
+  return REDISMODULE_OK;
+}
+
+int ClusterReply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  return replyGather(ctx, RedisModule_GetBlockedClientPrivateData(ctx));
+}
+
+int ClusterTimeout(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModuleBlockedClient *bc = RedisModule_GetBlockedClientHandle(ctx);
+  for (Gather **pg = &gathers; *pg != NULL; pg = &(*pg)->next) {
+    if ((*pg)->bc != bc) continue;
+    Gather *g = *pg;
+    *pg = g->next;
+    freeGather(g);
+    break;
+  }
+  return RedisModule_ReplyWithError(ctx, "cluster select timed out");
+}
+
+void ClusterFree(RedisModuleCtx *ctx, void *privdata) {
+  freeGather(privdata);
+}
+
+int statCommand(RedisModuleCtx *ctx, int type, RedisModuleCmdFunc fn, RedisModuleString **argv, int argc);
+
+/* Run the statement of the coordinator on this node and send back its
+ * partial result */
+void onClusterQuery(RedisModuleCtx *ctx, const char *sender_id, uint8_t type, const unsigned char *payload, uint32_t len) {
+  PartialReader r = {(const char*)payload, (const char*)payload + len, 1};
+  uint64_t id;
+  uint32_t argc;
+  partialGet(&r, &id, sizeof(id));
+  partialGet(&r, &argc, sizeof(argc));
+  if (!r.ok || argc > len) return;
+
+  // The arguments follow the command name, as the command would take them
+  RedisModuleString **argv = RedisModule_Calloc(argc + 1, sizeof(RedisModuleString*));
+  size_t n = 0;
+  argv[n++] = RedisModule_CreateString(ctx, "dbx.select", 10);
+  while (n <= argc && r.ok) {
+    uint32_t alen;
+    partialGet(&r, &alen, sizeof(alen));
+    if (!r.ok || (size_t)(r.end - r.p) < alen) break;
+    argv[n++] = RedisModule_CreateString(ctx, r.p, alen);
+    r.p += alen;
+  }
+
+  PartialBuf b = {NULL, 0, 0};
+  partialPut(&b, &id, sizeof(id));
+  if (n == argc + 1 && argc > 0) {
+    // The statement runs here rather than by RedisModule_Call, which would
+    // refuse it for the slot of its first argument
+    ReplyCapture capture;
+    memset(&capture, 0, sizeof(capture));
+    partialReply = 1;
+    replyCapture = &capture;
+    statCommand(ctx, STAT_SELECT, SelectCommand, argv, n);
+    replyCapture = NULL;
+    partialReply = 0;
+    if (capture.buf.len > 0) partialPut(&b, capture.buf.p, capture.buf.len);
+    else encodeError(&b, "select failed on a node");
+    RedisModule_Free(capture.buf.p);
+  }
+  else
+    encodeError(&b, "malformed query of the coordinator");
+
+  char target[REDISMODULE_NODE_ID_LEN];
+  memcpy(target, sender_id, REDISMODULE_NODE_ID_LEN);
+  RedisModule_SendClusterMessage(ctx, target, CLUSTER_MSG_RESULT, (unsigned char*)b.p, b.len);
+  for (size_t i = 0; i < n; i++)
+    RedisModule_FreeString(ctx, argv[i]);
+  RedisModule_Free(argv);
+  RedisModule_Free(b.p);
+}
+
+/* Collect the partial result of a node, the client is unblocked by the last
+ * one. The results of a timed out select are dropped. */
+void onClusterResult(RedisModuleCtx *ctx, const char *sender_id, uint8_t type, const unsigned char *payload, uint32_t len) {
+  uint64_t id;
+  if (len < sizeof(id)) return;
+  memcpy(&id, payload, sizeof(id));
+  for (Gather **pg = &gathers; *pg != NULL; pg = &(*pg)->next) {
+    Gather *g = *pg;
+    if (g->id != id) continue;
+    gatherPart(g, (const char*)payload + sizeof(id), len - sizeof(id));
+    if (--g->pending == 0) {
+      *pg = g->next;
+      RedisModule_UnblockClient(g->bc, g);
+    }
+    return;
+  }
+}
+
+int ClusterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModule_AutoMemory(ctx);
+
+  if (argc < 2)
+    return RedisModule_WrongArity(ctx);
+  if (strncmp(RedisModule_StringToChar(argv[1]), "select", 6) != 0) {
+    RedisModule_ReplyWithError(ctx, "only select can run on the cluster");
+    return REDISMODULE_ERR;
+  }
+  int flags = RedisModule_GetContextFlags(ctx);
+  if (flags & (REDISMODULE_CTX_FLAGS_LUA | REDISMODULE_CTX_FLAGS_MULTI)) {
+    RedisModule_ReplyWithError(ctx, "cluster select cannot run in a transaction or a script");
+    return REDISMODULE_ERR;
+  }
+
+  // The other masters which hold the rest of the keyspace
+  size_t nNode = 0, nTarget = 0;
+  char **nodes = flags & REDISMODULE_CTX_FLAGS_CLUSTER? RedisModule_GetClusterNodesList(ctx, &nNode): NULL;
+  char *targets[nNode + 1];
+  for (size_t i = 0; i < nNode; i++) {
+    int nflags = 0;
+    if (RedisModule_GetClusterNodeInfo(ctx, nodes[i], NULL, NULL, NULL, &nflags) != REDISMODULE_OK ||
+        (nflags & REDISMODULE_NODE_MYSELF) || !(nflags & REDISMODULE_NODE_MASTER)) continue;
+    if (nflags & (REDISMODULE_NODE_PFAIL | REDISMODULE_NODE_FAIL)) {
+      RedisModule_FreeClusterNodesList(nodes);
+      RedisModule_ReplyWithError(ctx, "a master of the cluster is failing");
+      return REDISMODULE_ERR;
+    }
+    targets[nTarget++] = nodes[i];
+  }
+
+  // The query is encoded before this node runs it, as the arguments are
+  // changed by the parsing
+  Gather *g = RedisModule_Calloc(1, sizeof(Gather));
+  g->parts = RedisModule_Calloc(nTarget + 1, sizeof(NodeReply));
+  g->id = ++gatherId;
+  PartialBuf query = {NULL, 0, 0};
+  uint32_t nArg = argc - 1;
+  partialPut(&query, &g->id, sizeof(g->id));
+  partialPut(&query, &nArg, sizeof(nArg));
+  for (int i = 1; i < argc; i++) {
+    size_t len;
+    const char *arg = RedisModule_StringPtrLen(argv[i], &len);
+    uint32_t len32 = len;
+    partialPut(&query, &len32, sizeof(len32));
+    partialPut(&query, arg, len32);
+  }
+
+  // This node first, its run checks the statement and keeps the clauses the
+  // results are merged by
+  ReplyCapture local;
+  memset(&local, 0, sizeof(local));
+  clusterPlan = &g->plan;
+  partialReply = 1;
+  replyCapture = &local;
+  SelectCommand(ctx, argv, argc);
+  replyCapture = NULL;
+  partialReply = 0;
+  clusterPlan = NULL;
+  if (local.buf.len == 0) encodeError(&local.buf, "select failed");
+  gatherPart(g, local.buf.p, local.buf.len);
+  RedisModule_Free(local.buf.p);
+
+  int rc = g->error[0] == 0? REDISMODULE_OK: REDISMODULE_ERR;
+  if (rc == REDISMODULE_ERR || nTarget == 0) {
+    replyGather(ctx, g);
+    freeGather(g);
+  }
+  else {
+    g->bc = RedisModule_BlockClient(ctx, ClusterReply, ClusterTimeout, ClusterFree, CLUSTER_TIMEOUT);
+    g->pending = nTarget;
+    g->next = gathers;
+    gathers = g;
+    for (size_t i = 0; i < nTarget; i++) {
+      if (RedisModule_SendClusterMessage(ctx, targets[i], CLUSTER_MSG_QUERY, (unsigned char*)query.p, query.len) == REDISMODULE_OK)
+        continue;
+      PartialBuf b = {NULL, 0, 0};
+      partialPut(&b, &g->id, sizeof(g->id));
+      encodeError(&b, "a master of the cluster is unreachable");
+      onClusterResult(ctx, NULL, CLUSTER_MSG_RESULT, (unsigned char*)b.p, b.len);
+      RedisModule_Free(b.p);
+    }
+  }
+  RedisModule_Free(query.p);
+  if (nodes) RedisModule_FreeClusterNodesList(nodes);
+  return rc;
+}
+
+/* Check that a row of insert statement can be written, before any row of the
+ * statement is, so that a statement failing writes nothing. The keys of the
+ * rows checked so far are kept in seen. The error is returned, or NULL. */
+const char *checkRow(RedisModuleCtx *ctx, Table *table, ColTable *t, char **fields, char **values, size_t n, int upsert, RedisModuleDict *seen) {
+  const char *pk = NULL;
+  for (size_t i = 0; i < n; i++) {
+    if (t != NULL && colFindColumn(t, fields[i]) < 0) return "unknown column";
+    if (strcmp(fields[i], table->key) == 0 && strlen(values[i]) > 0) pk = values[i];
+  }
+  if (strlen(table->key) == 0) return NULL;
+  if (pk == NULL) return "primary key value is expected";
+  if (!upsert && RedisModule_DictSetC(seen, (void*)pk, strlen(pk), NULL) != REDISMODULE_OK)
+    return "duplicate key";
+  if (t != NULL) return !upsert && colLookup(t, pk) >= 0? "duplicate key": NULL;
+
+  RedisModuleString *key = rowKey(ctx, table, pk);
+  RedisModuleKey *hkey = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+  int type = RedisModule_KeyType(hkey);
+  RedisModule_CloseKey(hkey);
+  RedisModule_FreeString(ctx, key);
+  return type != REDISMODULE_KEYTYPE_EMPTY && (!upsert || type != REDISMODULE_KEYTYPE_HASH)? "duplicate key": NULL;
+}
+
+/* Write a row of insert statement into a hash or into the column store if
+ * the table is columnar. The key of the row is returned, or NULL with err
+ * set. */
+RedisModuleString *insertRow(RedisModuleCtx *ctx, Table *table, ColTable *t, RowIdBlock *ids, char **fields, char **values, size_t n, int upsert, int *created, const char **err) {
+  if (t != NULL)
+    return colInsertRow(ctx, table, t, fields, values, n, upsert, created, err);
+
+  RedisModuleString *key = newRowKey(ctx, table, ids, fields, values, n);
+  if (key == NULL)
+    *err = "primary key value is expected";
+  else if (writeRow(ctx, key, fields, values, n, upsert, created) == REDISMODULE_ERR) {
+    *err = "duplicate key";
+    RedisModule_FreeString(ctx, key);
+    key = NULL;
+  }
+  return key;
+}
+
+int InsertCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModule_AutoMemory(ctx);
+
+  if (argc < 2)
+    return RedisModule_WrongArity(ctx);
+
+  // Table
+  char intoKey[128] = "";
+  RedisModuleString *fromCSV = NULL;
+  int upsert = 0;
+
+  // Process the arguments. The statement is not limited in length since a
+  // values clause may carry many rows, so it is allocated from the pool.
+  size_t plen;
+  size_t slen = 0;
+  for (int i=1; i<argc; i++) {
+    RedisModule_StringPtrLen(argv[i], &plen);
+    slen += plen + 1;
+  }
+  char *s = RedisModule_PoolAlloc(ctx, slen + 1);
+  char *temp = RedisModule_PoolAlloc(ctx, slen + 1);
+  char *end = s;
+  *s = 0;
+  for (int i=1; i<argc; i++) {
+    if (end > s) *end++ = ' ';
+    const char *arg = RedisModule_StringPtrLen(argv[i], &plen);
+
+    if (argc > 2) { // argc > 2 means the arguments are not in quoted. i.e. "..."
+      char *p = (char*)arg;
+      while (*p++) *p = *p == 32? 7: *p; // Convert all spaces in tabs, then convert back during parsing
+    }
+    memcpy(end, arg, plen);
+    end += plen;
+    *end = 0;
+  }
+
+  char *sp = s;
+  if (strncmp("insert", sp, 6) == 0) sp += 6;
+
+  int step = 0;
+  char *stmField = RedisModule_PoolAlloc(ctx, slen + 1);
+  *stmField = 0;
+  size_t nRow = 0;
+  Vector *vValue = NewVector(void *, 16);
+
+  char *token = strtok(sp, " ");
+  while (token != NULL) {
+    if (token[0] == 39) {
+      strcpy(temp, &token[1]);
+      strcat(temp, " ");
+      strcat(temp, strtok(NULL, "'"));
+      strcpy(token, temp);
+    }
+    switch(step) {
+      case 0:
+        if (strcmp("into", token) == 0)
+          step = -1;
+        else {
+            RedisModule_ReplyWithError(ctx, "into keyword is expected");
+            return REDISMODULE_ERR;
+        }
+        break;
+      case -1:
+        // parse into clause, new keys are named by row id or primary key
+        if (strlen(token) >= sizeof(intoKey)) {
+          RedisModule_ReplyWithError(ctx, "into table name is too long");
+          return REDISMODULE_ERR;
+        }
+        strcpy(intoKey, token);
+        step = -2;
+        break;
+      case -2:
+        if (token[0] == '(') {
+          strcpy(stmField, &token[1]);
+          if (token[strlen(token) - 1] == ')') {
+            stmField[strlen(stmField) - 1] = 0;
+            step = -4;
+          }
+          else
+            step = -3;
+        }
+        else if (strcmp("values", token) == 0)
+          step = -5;
+        else if (strcmp("from", token) == 0)
+          step = -7;
+        else if (strcmp("select", token) == 0)
+          step = -12;
+        else {
+            RedisModule_ReplyWithError(ctx, "values keyword is expected");
+            return REDISMODULE_ERR;
+        }
+        break;
+      case -3:
+        if (token[strlen(token) - 1] == ')') {
+          token[strlen(token) - 1] = 0;
+          step = -4;
+        }
+        strcat(stmField, token);
+        break;
+      case -4:
+        if (strcmp("values", token) == 0)
+          step = -5;
+        else if (strcmp("from", token) == 0)
+          step = -7;
+        else if (strcmp("select", token) == 0)
+          step = -12;
+        else {
+            RedisModule_ReplyWithError(ctx, "values, from or select keyword is expected");
+            return REDISMODULE_ERR;
+        }
+        break;
+      case -7:
+        token = trim(token, '"');
+        fromCSV = RedisModule_CreateString(ctx, token, strlen(token));
+        step = 8;
+        break;
+      case 8:
+        if (strcmp("on", token) == 0) {
+          step = -9;
+          break;
+        }
+      case 11:
+        RedisModule_ReplyWithError(ctx, "The end of statement is expected");
+        return REDISMODULE_ERR;
+        break;
+      case -9:
+        if (strcmp("duplicate", token) == 0)
+          step = -10;
+        else {
+          RedisModule_ReplyWithError(ctx, "duplicate keyword is expected");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case -10:
+        // "on duplicate key update" is accepted as well
+        if (strcmp("update", token) == 0) {
+          upsert = 1;
+          step = 11;
+        }
+        else if (strcmp("key", token) != 0) {
+          RedisModule_ReplyWithError(ctx, "update keyword is expected");
+          return REDISMODULE_ERR;
+        }
+        break;
+    }
+    if (step == -5) {
+      // The tuples of values clause are parsed in a single pass, then the
+      // tokens after the last tuple are parsed as usual
+      const char *err;
+      char *rest = token + strlen(token);
+      if (rest < end) rest++;
+      rest = parseValues(rest, vValue, &nRow, &err);
+      if (rest == NULL) {
+        Vector_Free(vValue);
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_ERR;
       }
+      step = 8;
+      token = strtok(rest, " ");
+      continue;
     }
-    RedisModule_FreeString(ctx, key);
-    if (*top == 0) return affected;
+    if (step == -12) {
+      // insert ... select copies the selected rows by the select statement
+      Vector_Free(vValue);
+      char *rest = token + strlen(token);
+      if (rest < end) rest++;
+      upsert = stripUpsertClause(rest);
+
+      IntoTarget target;
+      Vector *vField = strlen(stmField) > 0? splitStringByChar(NULL, stmField, ","): NULL;
+      initIntoTarget(ctx, &target, intoKey, vField, upsert, 1);
+      TRACE_PATH("insert select");
+      int rc = selectStatement(ctx, rest, &target, NULL);
+      if (vField) Vector_Free(vField);
+      return rc;
+    }
+    token = strtok(NULL, " ");
   }
-  return affected;
-}
 
-/* Create temporary set for sorting */
-size_t buildSetByPattern(RedisModuleCtx *ctx, regex_t *r, char *setName, Vector *vWhere) {
-  RedisModule_Call(ctx, "DEL", "c", setName);
-  RedisModuleString *scursor = RedisModule_CreateStringFromLongLong(ctx, 0);
-  long long lcursor;
-  size_t affected = 0;
-  do {
-    RedisModuleCallReply *rep = RedisModule_Call(ctx, "SCAN", "s", scursor);
+  if (step < 7) {
+    Vector_Free(vValue);
+    RedisModule_ReplyWithError(ctx, "parse error");
+    return REDISMODULE_ERR;
+  }
 
-    /* Get the current cursor. */
-    scursor = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(rep, 0));
-    RedisModule_StringToLongLong(scursor, &lcursor);
+  Vector *vField = splitStringByChar(NULL, stmField, ",");
 
-    /* Filter by pattern matching. */
-    RedisModuleCallReply *keys = RedisModule_CallReplyArrayElement(rep, 1);
-    size_t nKeys = RedisModule_CallReplyLength(keys);
-    for (size_t i = 0; i < nKeys; i++) {
-      RedisModuleString *key = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(keys, i));
-      const char *s = RedisModule_StringToChar(key);
-      if (!regexec(r, s, 1, NULL, 0)) {
-        if (vWhere == NULL || whereRecord(ctx, key, vWhere)) {
-          RedisModule_Call(ctx, "SADD", "cs", setName, key);
-          affected++;
+  Table table;
+  loadTable(ctx, intoKey, &table);
+  STAGE(STAGE_PARSE);
+  TRACE_PATH(fromCSV != NULL? "csv import": "values");
+
+  // The rows of a columnar table go to its column store
+  RedisModuleKey *ckey = NULL;
+  ColTable *ct = NULL;
+  if (table.columnar) {
+    ct = openColTable(ctx, &table, REDISMODULE_READ|REDISMODULE_WRITE, &ckey);
+    if (ct == NULL) {
+      RedisModule_CloseKey(ckey);
+      Vector_Free(vField);
+      Vector_Free(vValue);
+      RedisModule_ReplyWithError(ctx, "the column store of the table is not available");
+      return REDISMODULE_ERR;
+    }
+  }
+
+  // All the row ids of values clause are reserved at once
+  int rc = REDISMODULE_OK;
+  long long added = 0;
+  RowIdBlock ids;
+  initRowIds(&ids, intoKey, fromCSV != NULL? ROWID_BLOCK: nRow);
+
+  if (fromCSV != NULL) {
+    const char *filename = RedisModule_StringToChar(fromCSV);
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+      if (ct != NULL) RedisModule_CloseKey(ckey);
+      Vector_Free(vField);
+      Vector_Free(vValue);
+      RedisModule_ReplyWithError(ctx, "File does not exist");
+      return REDISMODULE_ERR;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    char *split[CSV_MAX_VALUES];
+    size_t n = 0;
+    // the rows written into a column store, which are replicated
+    size_t *written = NULL;
+    size_t nWritten = 0, capWritten = 0;
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+
+    while(csvReadLine(fp, &line, &cap) != NULL) {
+      size_t nSplit = csvSplit(line, split, CSV_MAX_VALUES);
+      if (Vector_Size(vField) == 0) {
+        // The header names the fields, they outlive the line
+        char *header = RedisModule_PoolAlloc(ctx, cap);
+        header[0] = 0;
+        for (size_t i=0; i<nSplit; i++) {
+          if (i > 0) strcat(header, ",");
+          strcat(header, split[i]);
         }
+        if (vField) Vector_Free(vField);
+        vField = splitStringByChar(NULL, header, ",");
+        continue;
       }
-      RedisModule_FreeString(ctx, key);
+
+      size_t nField = Vector_Size(vField);
+      if (nSplit < nField) {
+        // the import stops, the rows before stay written
+        RedisModule_ReplyWithError(ctx, "Number of values does not match");
+        n++;
+        rc = REDISMODULE_ERR;
+        break;
+      }
+      char *fields[nField];
+      char **values = split;
+      for (size_t i=0; i<nField; i++)
+        fields[i] = VectorGetString(vField, i);
+
+      int created = 0;
+      const char *err;
+      RedisModuleString *key = insertRow(ctx, &table, ct, &ids, fields, values, nField, upsert, &created, &err);
+      if (key == NULL)
+        RedisModule_ReplyWithError(ctx, err);
+      else
+        RedisModule_ReplyWithString(ctx, key);
+      long row = key != NULL && ct != NULL? colWrittenRow(ct, created, fields, values, nField): -1;
+      if (row >= 0) {
+        if (nWritten == capWritten) {
+          capWritten = capWritten? 2 * capWritten: 1024;
+          written = RedisModule_Realloc(written, capWritten * sizeof(size_t));
+        }
+        written[nWritten++] = row;
+      }
+      added += created;
+      n++;
+      if (key) RedisModule_FreeString(ctx, key);
+    }
+    fclose(fp);
+    RedisModule_Free(line);
+    RedisModule_ReplySetArrayLength(ctx, n);
+    updateRowCount(ctx, &table, added);
+    if (nWritten > 0) colReplicateRows(ctx, &table, ct, written, nWritten);
+    RedisModule_Free(written);
+  }
+  else {
+    size_t nField = Vector_Size(vField);
+    if (nField == 0 || nField * nRow != Vector_Size(vValue)) {
+      Vector_Free(vField);
+      Vector_Free(vValue);
+      RedisModule_ReplyWithError(ctx, "Number of values does not match");
+      return REDISMODULE_ERR;
     }
 
-    RedisModule_FreeCallReply(keys);
-    RedisModule_FreeCallReply(rep);
-  } while (lcursor);
+    char *fields[nField];
+    char *values[nField];
+    for (size_t i=0; i<nField; i++)
+      fields[i] = VectorGetString(vField, i);
 
-  return affected;
+    // The rows are all checked first, a failing row fails the statement
+    RedisModuleDict *seen = RedisModule_CreateDict(NULL);
+    for (size_t r=0; r<nRow; r++) {
+      for (size_t i=0; i<nField; i++)
+        values[i] = VectorGetString(vValue, r * nField + i);
+      const char *err = checkRow(ctx, &table, ct, fields, values, nField, upsert, seen);
+      if (err == NULL) continue;
+      RedisModule_FreeDict(NULL, seen);
+      if (ct != NULL) RedisModule_CloseKey(ckey);
+      char msg[64];
+      sprintf(msg, "%s at row %zu", err, r + 1);
+      Vector_Free(vField);
+      Vector_Free(vValue);
+      RedisModule_ReplyWithError(ctx, msg);
+      return REDISMODULE_ERR;
+    }
+    RedisModule_FreeDict(NULL, seen);
+
+    RedisModuleString *key = NULL;
+    RedisModuleString *first = NULL;
+    for (size_t r=0; r<nRow; r++) {
+      for (size_t i=0; i<nField; i++)
+        values[i] = VectorGetString(vValue, r * nField + i);
+
+      int created = 0;
+      const char *err;
+      if (key != NULL && key != first) RedisModule_FreeString(ctx, key);
+      key = insertRow(ctx, &table, ct, &ids, fields, values, nField, upsert, &created, &err);
+      if (key == NULL) {
+        updateRowCount(ctx, &table, added);
+        if (ct != NULL) {
+          RedisModule_CloseKey(ckey);
+          if (r > 0) RedisModule_ReplicateVerbatim(ctx);
+        }
+        char msg[64];
+        sprintf(msg, "%s at row %zu", err, r + 1);
+        Vector_Free(vField);
+        Vector_Free(vValue);
+        RedisModule_ReplyWithError(ctx, msg);
+        return REDISMODULE_ERR;
+      }
+      added += created;
+      if (r == 0) first = key;
+    }
+    updateRowCount(ctx, &table, added);
+
+    // A single row is replied by its key, multiple rows by count, first and last key
+    if (nRow == 1) {
+      RedisModule_ReplyWithArray(ctx, 1);
+      RedisModule_ReplyWithString(ctx, key);
+    }
+    else {
+      RedisModule_ReplyWithArray(ctx, 3);
+      RedisModule_ReplyWithLongLong(ctx, nRow);
+      RedisModule_ReplyWithString(ctx, first);
+      RedisModule_ReplyWithString(ctx, key);
+      RedisModule_FreeString(ctx, first);
+    }
+    RedisModule_FreeString(ctx, key);
+  }
+  if (vField) Vector_Free(vField);
+  if (vValue) Vector_Free(vValue);
+
+  // The writes of the column store are not commands, the statement is
+  // replicated instead, or the rows of the csv import
+  if (ct != NULL) {
+    RedisModule_CloseKey(ckey);
+    if (fromCSV == NULL) RedisModule_ReplicateVerbatim(ctx);
+  }
+
+  return rc;
 }
 
-int SelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+int DeleteCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_AutoMemory(ctx);
 
   if (argc < 2)
     return RedisModule_WrongArity(ctx);
 
   // Table
-  long top = -1;
   RedisModuleString *fromKeys;
-  char intoKey[32] = "";
-  char csvFile[128] = "";
 
   // Process the arguments
   size_t plen;
@@ -364,134 +6223,204 @@ int SelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
       char *p = (char*)temp;
       while (*p++) *p = *p == 32? 7: *p; // Convert all spaces in tabs, then convert back during parsing
     }
-
-    if (strcmp("like", temp) == 0)
-      strcat(s, "~");
-    else
-      strcat(s, temp);
+    strcat(s, temp);
   }
 
   char *sp = s;
-  if (strncmp("select", sp, 6) == 0) sp += 6;
+  if (strncmp("delete", sp, 6) == 0) sp += 6;
 
   int step = 0;
   char temp[1024] = "";
-  char stmSelect[1024] = "";
   char stmWhere[1024] = "";
-  char stmOrder[1024] = "";
+  int between = 0;
 
   char *token = strtok(sp, " ");
   while (token != NULL) {
-    // If it is beginning in single quote, find the end quote in the following tokens
-    if (token[0] == 39) {
-      strcpy(temp, &token[1]);
-      strcat(temp, " ");
-      strcat(temp, strtok(NULL, "'"));
-      strcpy(token, temp);
-    }
+    // A quoted string with spaces is joined back into its token
+    token = joinQuoted(token, temp);
     switch(step) {
       case 0:
-        if (strcmp("top", token) == 0) {
-          step = -2;
-          break;
-        }
-        step = -1;
-      case -1:
-        if (strlen(token) > 512) {
-          RedisModule_ReplyWithError(ctx, "select arguments are too long");
-          return REDISMODULE_ERR;
-        }
-        strcat(stmSelect, token);
-        step = -3;
-        break;
-      case -2:
-        top = atol(token);
-        step = -1;
-        break;
-      case -3:
-        if (strcmp("into", token) == 0)
-          step = -4;
-        else if (strcmp("from", token) == 0)
-          step = -6;
+        if (strcmp("from", token) == 0)
+          step = -1;
         else {
-          if (strlen(stmSelect) + strlen(token) > 512) {
-            RedisModule_ReplyWithError(ctx, "select arguments are too long");
+            RedisModule_ReplyWithError(ctx, "from keyword is expected");
             return REDISMODULE_ERR;
-          }
-          strcat(stmSelect, token);
         }
         break;
-      case -4:
-        // parse into clause, assume time+rand always is new key
-        if (strcmp("csv", token) == 0)
-          step = -45;
+      case -1:
+        // parse from clause
+        fromKeys = RMUtil_CreateFormattedString(ctx, token);
+        step = 2;
+        break;
+      case 2:
+        if (strcmp("where", token) == 0)
+          step = -3;
         else {
-          strcpy(intoKey, token);
-          step = -5;
+          RedisModule_ReplyWithError(ctx, "where statement is expected");
+          return REDISMODULE_ERR;
         }
         break;
-      case -45:
-        strcpy(csvFile, token);
-        step = -5;
-        break;
-      case -5:
-        if (strcmp("from", token) == 0)
-          step = -6;
-        else {
-          RedisModule_ReplyWithError(ctx, "from keyword is expected");
+      case -3:
+      case 4:
+        // parse where clause
+        if (strlen(stmWhere) + strlen(token) > 512) {
+          RedisModule_ReplyWithError(ctx, "where arguments are too long");
           return REDISMODULE_ERR;
         }
+        if (whereAppend(stmWhere, token, &between)) step = 4;
         break;
-      case -6:
-        // parse from clause
+    }
+    token = strtok(NULL, " ");
+  }
+
+  if (step <= 0) {
+    RedisModule_ReplyWithError(ctx, "parse error");
+    return REDISMODULE_ERR;
+  }
+
+  Arena qa = {NULL, 0, ctx};
+  Vector *vWhere = splitWhereString(&qa, stmWhere);
+  if (vWhere == NULL) {
+    RedisModule_FreeString(ctx, fromKeys);
+    RedisModule_ReplyWithError(ctx, "where clause cannot be parsed");
+    return REDISMODULE_ERR;
+  }
+
+  /* Convert key to regex, a defined table owns the keys of its prefix */
+  const char *pat = RedisModule_StringToChar(fromKeys);
+  Table table;
+  loadTable(ctx, pat, &table);
+  regex_t regex;
+  if (regexCompile(ctx, &regex, table.pattern)) return REDISMODULE_ERR;
+
+  RedisModuleString *pkey = table.columnar? NULL: primaryKeyLookup(ctx, &table, vWhere);
+  Vector *pkeys = table.columnar || pkey? NULL: primaryKeyValues(&qa, table.key, vWhere);
+  STAGE(STAGE_PARSE);
+
+  size_t affected = 0;
+  if (table.columnar) {
+    TRACE_PATH("columnar scan");
+    affected = colDelete(ctx, &table, vWhere);
+    if (affected > 0) RedisModule_ReplicateVerbatim(ctx);
+  }
+  else if (pkey != NULL) {
+    TRACE_PATH("primary key");
+    TRACE_ROWS(STAGE_PROBE, 1, 1);
+    if (whereRecord(ctx, pkey, vWhere)) {
+      deleteRecord(ctx, pkey);
+      affected++;
+    }
+    RedisModule_FreeString(ctx, pkey);
+  }
+  else if (pkeys != NULL) {
+    TRACE_PATH("primary key union");
+    TRACE_ROWS(STAGE_PROBE, Vector_Size(pkeys), Vector_Size(pkeys));
+    for (int i = 0; i < Vector_Size(pkeys); i++) {
+      RedisModuleString *key = rowKey(ctx, &table, VectorGetString(pkeys, i));
+      if (whereRecord(ctx, key, vWhere)) {
+        deleteRecord(ctx, key);
+        affected++;
+      }
+      RedisModule_FreeString(ctx, key);
+    }
+  }
+  else {
+    TRACE_PATH("scan");
+    affected = writeTable(ctx, &table, &regex, vWhere, deleteRow, NULL);
+  }
+
+  updateRowCount(ctx, &table, -(long long)affected);
+
+  RedisModule_ReplyWithLongLong(ctx, affected);
+  RedisModule_FreeString(ctx, fromKeys);
+  regfree(&regex);
+
+  return REDISMODULE_OK;
+}
+
+int UpdateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModule_AutoMemory(ctx);
+
+  if (argc < 2)
+    return RedisModule_WrongArity(ctx);
+
+  // Table
+  RedisModuleString *fromKeys;
+
+  // Process the arguments
+  size_t plen;
+  char s[1024] = "";
+  for (int i=1; i<argc; i++) {
+    if (strlen(s) > 0) strcat(s, " ");
+    const char *temp = RedisModule_StringPtrLen(argv[i], &plen);
+    if (strlen(s) + plen > 1024) {
+        RedisModule_ReplyWithError(ctx, "arguments are too long");
+        return REDISMODULE_ERR;
+    }
+
+    if (argc > 2) { // argc > 2 means the arguments are not in quoted. i.e. "..."
+      char *p = (char*)temp;
+      while (*p++) *p = *p == 32? 7: *p; // Convert all spaces in tabs, then convert back during parsing
+    }
+
+    if (strcmp("like", temp) == 0)
+      strcat(s, "~");
+    else
+      strcat(s, temp);
+  }
+
+  char *sp = s;
+  if (strncmp("update", sp, 6) == 0) sp += 6;
+
+  int step = 0;
+  char temp[1024] = "";
+  char stmSet[1024] = "";
+  char stmWhere[1024] = "";
+  int between = 0;
+
+  char *p;
+  char *token = strtok(sp, " ");
+  while (token != NULL) {
+    // A quoted string with spaces is joined back into its token
+    token = joinQuoted(token, temp);
+    switch(step) {
+      case 0:
+        // parse table name
         fromKeys = RMUtil_CreateFormattedString(ctx, token);
-        step = 7;
-        break;
-      case 7:
-        if (strcmp("where", token) == 0)
-          step = -8;
-        else if (strcmp("order", token) == 0)
-          step = -10;
+        step = -1;
         break;
-      case -8:
-      case 9:
-        // parse where clause
-        if (strcmp("order", token) == 0)
-          step = -10;
-        else if (strcmp("and", token) == 0)
-          strcat(stmWhere, "&&");
+      case -1:
+        if (strcmp("set", token) == 0)
+          step = -2;
         else {
-          if (strlen(stmWhere) + strlen(token) > 512) {
-            RedisModule_ReplyWithError(ctx, "where arguments are too long");
-            return REDISMODULE_ERR;
-          }
-          char *p = token;
-          while (*p++) *p = *p == 7? 32: *p;
-          strcat(stmWhere, token);
-          step = 9;
+          RedisModule_ReplyWithError(ctx, "set keyword is expected");
+          return REDISMODULE_ERR;
         }
         break;
-      case -10:
-        if (strcmp("by", token) == 0)
-          step = -11;
+      case -2:
+      case 3:
+        // parse set clause
+        if (step == 3 && strcmp("where", token) == 0)
+          step = -4;
         else {
-          RedisModule_ReplyWithError(ctx, "missing 'by' after order");
-          return REDISMODULE_ERR;
+          if (strlen(stmSet) + strlen(token) > 512) {
+            RedisModule_ReplyWithError(ctx, "set arguments are too long");
+            return REDISMODULE_ERR;
+          }
+          p = token;
+          while (*p++) *p = *p == 7? 32: *p;
+          strcat(stmSet, token);
+          step = 3;
         }
         break;
-      case -11:
-      case 12:
-        // parse order clause
-        if (strlen(stmOrder) + strlen(token) > 512) {
-          RedisModule_ReplyWithError(ctx, "order arguments are too long");
+      case -4:
+      case 5:
+        // parse where clause
+        if (strlen(stmWhere) + strlen(token) > 512) {
+          RedisModule_ReplyWithError(ctx, "where arguments are too long");
           return REDISMODULE_ERR;
         }
-        if (strcmp("desc", token) == 0)
-          strcat(stmOrder, "-");
-        else
-        if (strcmp("asc", token) != 0)
-          strcat(stmOrder, token);
-        step = 12;
+        if (whereAppend(stmWhere, token, &between)) step = 5;
         break;
     }
     token = strtok(NULL, " ");
@@ -502,102 +6431,115 @@ int SelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return REDISMODULE_ERR;
   }
 
-  Vector *vSelect = splitStringByChar(stmSelect, ",");
-  Vector *vWhere = splitWhereString(stmWhere);
-  Vector *vOrder = splitStringByChar(stmOrder, ",");
+  // Split the assignments at the commas outside of quotes into field and
+  // value, the values are shared by all rows
+  Arena qa = {NULL, 0, ctx};
+  size_t cap = 1;
+  for (p = stmSet; *p; p++) cap += *p == ',';
+  Vector *vSet = arenaVector(&qa, cap);
+  for (char *item = stmSet, *next; item != NULL; item = next) {
+    next = cutUnquoted(item, ',');
+    if (*item) Vector_Push(vSet, item);
+  }
+  size_t nSet = Vector_Size(vSet);
+  char *fields[nSet];
+  RedisModuleString *values[nSet];
+  for (size_t i = 0; i < nSet; i++) {
+    char *field = VectorGetString(vSet, i);
+    char *value = strchr(field, '=');
+    if (value == NULL || value == field) {
+      RedisModule_ReplyWithError(ctx, "assignment is expected in set clause");
+      return REDISMODULE_ERR;
+    }
+    *value++ = 0;
+    value = trim(trim(value, '"'), '\'');
+    fields[i] = field;
+    values[i] = RedisModule_CreateString(ctx, value, strlen(value));
+  }
+
+  Vector *vWhere = splitWhereString(&qa, stmWhere);
+  if (vWhere == NULL) {
+    for (size_t i = 0; i < nSet; i++)
+      RedisModule_FreeString(ctx, values[i]);
+    RedisModule_FreeString(ctx, fromKeys);
+    RedisModule_ReplyWithError(ctx, "where clause cannot be parsed");
+    return REDISMODULE_ERR;
+  }
 
-   /* Convert key to regex */
+  /* Convert key to regex, a defined table owns the keys of its prefix */
   const char *pat = RedisModule_StringToChar(fromKeys);
+  Table table;
+  loadTable(ctx, pat, &table);
+  for (size_t i = 0; table.key[0] && i < nSet; i++)
+    if (strcmp(fields[i], table.key) == 0) {
+      for (size_t j = 0; j < nSet; j++)
+        RedisModule_FreeString(ctx, values[j]);
+      RedisModule_ReplyWithError(ctx, "primary key cannot be updated");
+      return REDISMODULE_ERR;
+    }
   regex_t regex;
-  if (regexCompile(ctx, &regex, pat)) return REDISMODULE_ERR;
-
-  /* Print result in array format */
-  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  if (regexCompile(ctx, &regex, table.pattern)) return REDISMODULE_ERR;
 
-  if (Vector_Size(vOrder) > 0) {
-    // temporary set name
-    char setName[32];
-    sprintf(setName, "__db_tempset_%i", rn++);
-
-    RedisModuleCallReply *rep;
-
-    if (buildSetByPattern(ctx, &regex, setName, vWhere) > 0) {
-      char *field;
-      int nSortField = Vector_Size(vOrder);
-      int cap = 3 * nSortField + 2;
-
-      RedisModuleString *param[cap];
-      param[0] = RedisModule_CreateString(ctx, setName, strlen(setName));
-
-      for(int sf = 0; sf < nSortField; sf++) {
-        Vector_Get(vOrder, sf, &field);
-        if (field[strlen(field)-1] == '-') {
-          field[strlen(field)-1] = 0;
-          param[3+sf*3] = RedisModule_CreateString(ctx, "desc", 4);
-        }
-        else
-          param[3+sf*3] = RedisModule_CreateString(ctx, "asc", 3);
-        param[1+sf*3] = RedisModule_CreateString(ctx, "by", 2);
-        param[2+sf*3] = RedisModule_CreateStringPrintf(ctx, "*->%s", field, 3 + strlen(field));
-      }
-      param[cap-1] = RedisModule_CreateString(ctx, "alpha", 5);
-      rep = RedisModule_Call(ctx, "SORT", "v", &param, cap);
-
-      for(int i = 0; i < cap; i++)
-        RedisModule_FreeString(ctx, param[i]);
-
-      size_t n = processRecords(ctx, rep, &regex, vSelect, NULL, &top, intoKey, csvFile);
+  RedisModuleString *pkey = table.columnar? NULL: primaryKeyLookup(ctx, &table, vWhere);
+  Vector *pkeys = table.columnar || pkey? NULL: primaryKeyValues(&qa, table.key, vWhere);
+  STAGE(STAGE_PARSE);
 
-      RedisModule_FreeCallReply(rep);
-      RedisModule_ReplySetArrayLength(ctx, n);
+  size_t affected = 0;
+  if (table.columnar) {
+    TRACE_PATH("columnar scan");
+    const char *err = NULL;
+    affected = colUpdate(ctx, &table, vWhere, fields, values, nSet, &err);
+    if (err != NULL) {
+      for (size_t i = 0; i < nSet; i++)
+        RedisModule_FreeString(ctx, values[i]);
+      regfree(&regex);
+      RedisModule_ReplyWithError(ctx, err);
+      return REDISMODULE_ERR;
+    }
+  }
+  else if (pkey != NULL) {
+    TRACE_PATH("primary key");
+    TRACE_ROWS(STAGE_PROBE, 1, 1);
+    if (whereRecord(ctx, pkey, vWhere))
+      affected += updateRecord(ctx, pkey, fields, values, nSet);
+    RedisModule_FreeString(ctx, pkey);
+  }
+  else if (pkeys != NULL) {
+    TRACE_PATH("primary key union");
+    TRACE_ROWS(STAGE_PROBE, Vector_Size(pkeys), Vector_Size(pkeys));
+    for (int i = 0; i < Vector_Size(pkeys); i++) {
+      RedisModuleString *key = rowKey(ctx, &table, VectorGetString(pkeys, i));
+      if (whereRecord(ctx, key, vWhere))
+        affected += updateRecord(ctx, key, fields, values, nSet);
+      RedisModule_FreeString(ctx, key);
     }
-    else
-      RedisModule_ReplySetArrayLength(ctx, 0);
-
-    // Remove the temporary set before leave
-    RedisModule_Call(ctx, "DEL", "c", setName);
   }
   else {
-    RedisModuleString *scursor = RedisModule_CreateStringFromLongLong(ctx, 0);
-    long long lcursor;
-    size_t n = 0;
-    do {
-      RedisModuleCallReply *rep = RedisModule_Call(ctx, "SCAN", "s", scursor);
-
-      /* Get the current cursor. */
-      scursor = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(rep, 0));
-      RedisModule_StringToLongLong(scursor, &lcursor);
-
-      /* Filter by pattern matching. */
-      RedisModuleCallReply *rkeys = RedisModule_CallReplyArrayElement(rep, 1);
-      n += processRecords(ctx, rkeys, &regex, vSelect, vWhere, &top, intoKey, csvFile);
-
-      RedisModule_FreeCallReply(rkeys);
-      RedisModule_FreeCallReply(rep);
-      if (top == 0) break;
-    } while (lcursor);
-
-    RedisModule_ReplySetArrayLength(ctx, n);
-    RedisModule_FreeString(ctx, scursor);
+    TRACE_PATH("scan");
+    UpdateSet set = {fields, values, nSet};
+    affected = writeTable(ctx, &table, &regex, vWhere, updateRow, &set);
   }
 
+  // The column store is replicated by the statement, the hashes by their writes
+  if (table.columnar && affected > 0) RedisModule_ReplicateVerbatim(ctx);
+
+  RedisModule_ReplyWithLongLong(ctx, affected);
   RedisModule_FreeString(ctx, fromKeys);
-  Vector_Free(vSelect);
-  Vector_Free(vWhere);
-  Vector_Free(vOrder);
+  for (size_t i = 0; i < nSet; i++)
+    RedisModule_FreeString(ctx, values[i]);
+  regfree(&regex);
 
   return REDISMODULE_OK;
 }
 
-int InsertCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+int CreateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_AutoMemory(ctx);
 
   if (argc < 2)
     return RedisModule_WrongArity(ctx);
 
   // Table
-  char intoKey[128] = "";
-  RedisModuleString *fromCSV = NULL;
+  char tableName[128] = "";
 
   // Process the arguments
   size_t plen;
@@ -609,327 +6551,1243 @@ int InsertCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         RedisModule_ReplyWithError(ctx, "arguments are too long");
         return REDISMODULE_ERR;
     }
-
-    if (argc > 2) { // argc > 2 means the arguments are not in quoted. i.e. "..."
-      char *p = (char*)temp;
-      while (*p++) *p = *p == 32? 7: *p; // Convert all spaces in tabs, then convert back during parsing
-    }
     strcat(s, temp);
   }
 
   char *sp = s;
-  if (strncmp("insert", sp, 6) == 0) sp += 6;
+  if (strncmp("create", sp, 6) == 0) sp += 6;
+  if (strncmp(" view ", sp, 6) == 0) return createView(ctx, sp + 6);
 
   int step = 0;
-  char temp[1024] = "";
-  char stmField[1024] = "";
-  char stmValue[1024] = "";
+  int columnar = 0;
+  long long buckets = 0;
+  char stmColumn[1024] = "";
 
-  char *p;
   char *token = strtok(sp, " ");
   while (token != NULL) {
-    if (token[0] == 39) {
-      strcpy(temp, &token[1]);
-      strcat(temp, " ");
-      strcat(temp, strtok(NULL, "'"));
-      strcpy(token, temp);
-    }
     switch(step) {
       case 0:
-        if (strcmp("into", token) == 0)
+        if (strcmp("table", token) == 0)
           step = -1;
         else {
-            RedisModule_ReplyWithError(ctx, "into keyword is expected");
-            return REDISMODULE_ERR;
+          RedisModule_ReplyWithError(ctx, "table keyword is expected");
+          return REDISMODULE_ERR;
         }
         break;
       case -1:
-        // parse into clause, assume time+rand always is new key
-        strcpy(intoKey, token);
+        if (strlen(token) >= sizeof(tableName)) {
+          RedisModule_ReplyWithError(ctx, "table name is too long");
+          return REDISMODULE_ERR;
+        }
+        strcpy(tableName, token);
         step = -2;
         break;
       case -2:
-        if (token[0] == '(') {
-          strcpy(stmField, &token[1]);
-          if (token[strlen(token) - 1] == ')') {
-            stmField[strlen(stmField) - 1] = 0;
-            step = -4;
-          }
-          else
-            step = -3;
-        }
-        else if (strcmp("values", token) == 0)
-          step = -5;
-        else if (strcmp("from", token) == 0)
-          step = -7;
-        else {
-            RedisModule_ReplyWithError(ctx, "values keyword is expected");
-            return REDISMODULE_ERR;
-        }
-        break;
-      case -3:
-        if (token[strlen(token) - 1] == ')') {
-          token[strlen(token) - 1] = 0;
-          strcat(stmField, token);
-          step = -4;
-        }
+      case 3:
+        // parse column definitions, the words of each definition are kept
+        if (strlen(stmColumn) > 0) strcat(stmColumn, " ");
+        strcat(stmColumn, token);
+        if (token[strlen(token) - 1] == ')') step = 4;
+        else step = 3;
         break;
-      case -4:
-        if (strcmp("values", token) == 0)
+      case 4:
+        // the storage of the rows, "using columnar" keeps them in a column store
+        if (strcmp("using", token) == 0) {
           step = -5;
-        else if (strcmp("from", token) == 0)
+          break;
+        }
+      case 6:
+        // "buckets <n>" tags the row keys to n cluster slots
+        if (strcmp("buckets", token) == 0) {
           step = -7;
-        else {
-            RedisModule_ReplyWithError(ctx, "values or from keyword is expected");
-            return REDISMODULE_ERR;
+          break;
         }
-        break;
+      case 8:
+        RedisModule_ReplyWithError(ctx, "The end of statement is expected");
+        return REDISMODULE_ERR;
       case -5:
-      case -6:
-        p = token;
-        while (*p++) *p = *p == 7? 32: *p;
-        if (token[0] == '(') {
-          strcpy(stmValue, &token[1]);
-          if (token[strlen(token) - 1] == ')') {
-            stmValue[strlen(stmValue) - 1] = 0;
-            step = 8;
-          }
-          else
-            step = -6;
-        }
-        else if (token[strlen(token) - 1] == ')') {
-          token[strlen(token) - 1] = 0;
-          strcat(stmValue, token);
-          step = 8;
+        if (strcmp("columnar", token) != 0) {
+          RedisModule_ReplyWithError(ctx, "unknown table storage");
+          return REDISMODULE_ERR;
         }
-        else
-          strcat(stmValue, token);
+        columnar = 1;
+        step = 6;
         break;
       case -7:
-        fromCSV = RedisModule_CreateString(ctx, token, strlen(token));
+        if (!parseInt64(token, &buckets) || buckets < 1 || buckets > MAX_BUCKETS) {
+          RedisModule_ReplyWithError(ctx, "the number of buckets must be 1 to 16384");
+          return REDISMODULE_ERR;
+        }
         step = 8;
         break;
-      case 8:
-        RedisModule_ReplyWithError(ctx, "The end of statement is expected");
-        return REDISMODULE_ERR;
-        break;
     }
     token = strtok(NULL, " ");
   }
 
-  if (step < 7) {
-    RedisModule_ReplyWithError(ctx, "parse error");
+  if ((step != 4 && step != 6 && step != 8) || stmColumn[0] != '(') {
+    RedisModule_ReplyWithError(ctx, "parse error");
+    return REDISMODULE_ERR;
+  }
+  if (columnar && buckets > 0) {
+    RedisModule_ReplyWithError(ctx, "a columnar table is a single key, it has no buckets");
+    return REDISMODULE_ERR;
+  }
+  stmColumn[strlen(stmColumn) - 1] = 0;
+
+  // Each definition is "<column> [key]", "primary key" is accepted as well
+  char columns[1024] = "";
+  char key[128] = "";
+  Vector *vColumn = splitStringByChar(NULL, &stmColumn[1], ",");
+  for (size_t i = 0; i < Vector_Size(vColumn); i++) {
+    char *save;
+    char *words[4];
+    int nWord = 0;
+    for (char *w = strtok_r(VectorGetString(vColumn, i), " ", &save); w != NULL; w = strtok_r(NULL, " ", &save))
+      if (nWord < 4) words[nWord++] = w;
+
+    if (nWord == 0 || strlen(words[0]) >= sizeof(key)) {
+      Vector_Free(vColumn);
+      RedisModule_ReplyWithError(ctx, "column name is expected");
+      return REDISMODULE_ERR;
+    }
+    char *column = words[0];
+    if ((nWord == 2 && strcmp(words[1], "key") == 0) ||
+        (nWord == 3 && strcmp(words[1], "primary") == 0 && strcmp(words[2], "key") == 0)) {
+      if (strlen(key) > 0) {
+        Vector_Free(vColumn);
+        RedisModule_ReplyWithError(ctx, "multiple primary keys are defined");
+        return REDISMODULE_ERR;
+      }
+      strcpy(key, column);
+    }
+    else if (nWord > 1) {
+      Vector_Free(vColumn);
+      RedisModule_ReplyWithError(ctx, "unknown column attribute");
+      return REDISMODULE_ERR;
+    }
+    if (strlen(columns) > 0) strcat(columns, ",");
+    strcat(columns, column);
+  }
+  Vector_Free(vColumn);
+
+  RedisModuleString *catalog = RedisModule_CreateStringPrintf(ctx, CATALOG_PREFIX "%s", tableName);
+  RedisModuleCallReply *rep = RedisModule_Call(ctx, "HEXISTS", "sc", catalog, "columns");
+  long long exists = RedisModule_CallReplyInteger(rep);
+  RedisModule_FreeCallReply(rep);
+  if (exists) {
+    RedisModule_ReplyWithError(ctx, "table already exists");
+    return REDISMODULE_ERR;
+  }
+
+  // The rows already in the key space of the table start its row count, a
+  // columnar table starts empty
+  char glob[160];
+  if (buckets == 1) sprintf(glob, "{%s}:*", tableName);
+  else if (buckets > 1) sprintf(glob, "{%s:*}:*", tableName);
+  else sprintf(glob, "%s:*", tableName);
+  RedisModuleString *args[10];
+  int nArg = 0;
+  args[nArg++] = RedisModule_CreateString(ctx, "columns", 7);
+  args[nArg++] = RedisModule_CreateString(ctx, columns, strlen(columns));
+  args[nArg++] = RedisModule_CreateString(ctx, "rows", 4);
+  args[nArg++] = RedisModule_CreateStringFromLongLong(ctx, columnar? 0: countRows(ctx, glob));
+  if (strlen(key) > 0) {
+    args[nArg++] = RedisModule_CreateString(ctx, "key", 3);
+    args[nArg++] = RedisModule_CreateString(ctx, key, strlen(key));
+  }
+  if (columnar) {
+    args[nArg++] = RedisModule_CreateString(ctx, "storage", 7);
+    args[nArg++] = RedisModule_CreateString(ctx, "columnar", 8);
+  }
+  if (buckets > 0) {
+    args[nArg++] = RedisModule_CreateString(ctx, "buckets", 7);
+    args[nArg++] = RedisModule_CreateStringFromLongLong(ctx, buckets);
+  }
+
+  // The catalog is written with replication so that it reaches AOF and replicas
+  rep = RedisModule_Call(ctx, "HMSET", "!sv", catalog, args, nArg);
+  RedisModule_FreeCallReply(rep);
+  for (int i = 0; i < nArg; i++)
+    RedisModule_FreeString(ctx, args[i]);
+  RedisModule_FreeString(ctx, catalog);
+
+  RedisModule_ReplyWithSimpleString(ctx, "OK");
+  return REDISMODULE_OK;
+}
+
+/* dbx.restore <key> <columns> <key column> <next id> [<id> <value>...]...
+ * appends rows to a column store as written by its AOF rewrite, or replaces
+ * the rows of the same primary key. A value is prefixed by '=', an empty
+ * argument is a missing value. */
+int RestoreCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModule_AutoMemory(ctx);
+
+  if (argc < 5)
+    return RedisModule_WrongArity(ctx);
+
+  long long nextId;
+  if (RedisModule_StringToLongLong(argv[4], &nextId) == REDISMODULE_ERR) {
+    RedisModule_ReplyWithError(ctx, "invalid next row id");
+    return REDISMODULE_ERR;
+  }
+
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ|REDISMODULE_WRITE);
+  int type = RedisModule_KeyType(key);
+  if (type != REDISMODULE_KEYTYPE_EMPTY && RedisModule_ModuleTypeGetType(key) != ColumnType) {
+    RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+    return REDISMODULE_ERR;
+  }
+  ColTable *t;
+  if (type == REDISMODULE_KEYTYPE_EMPTY) {
+    const char *keyCol = RedisModule_StringToChar(argv[3]);
+    t = colCreate(RedisModule_StringToChar(argv[2]), strlen(keyCol) > 0? keyCol: NULL);
+    RedisModule_ModuleTypeSetValue(key, ColumnType, t);
+  }
+  else
+    t = RedisModule_ModuleTypeGetValue(key);
+
+  size_t width = t->nCol + 1;
+  if ((argc - 5) % width != 0) {
+    RedisModule_ReplyWithError(ctx, "Number of values does not match");
+    return REDISMODULE_ERR;
+  }
+  for (int i = 5; i < argc; i += width) {
+    long long id;
+    if (RedisModule_StringToLongLong(argv[i], &id) == REDISMODULE_ERR) {
+      RedisModule_ReplyWithError(ctx, "invalid row id");
+      return REDISMODULE_ERR;
+    }
+    // the row of the same primary key is replaced
+    long row = -1;
+    if (t->keyCol >= 0) {
+      size_t len;
+      const char *v = RedisModule_StringPtrLen(argv[i + 1 + t->keyCol], &len);
+      if (len > 0) row = colLookup(t, v + 1);
+    }
+    int created = row < 0;
+    if (created) row = colAppendRow(t);
+    t->ids[row] = id;
+    for (size_t c = 0; c < t->nCol; c++) {
+      size_t len;
+      const char *v = RedisModule_StringPtrLen(argv[i + 1 + c], &len);
+      if (len > 0) colSetValue(t, row, c, v + 1);
+      else if (!created) colSetValue(t, row, c, NULL);
+    }
+    if (created) colIndexRow(t, row);
+  }
+  if (nextId > t->nextId) t->nextId = nextId;
+
+  RedisModule_ReplicateVerbatim(ctx);
+  RedisModule_ReplyWithSimpleString(ctx, "OK");
+  return REDISMODULE_OK;
+}
+
+/* Bucket of a latency, the latencies under 4us have a bucket each, then each
+ * power of two is split in 4 */
+int latencyBucket(long long us) {
+  if (us < 4) return us < 0? 0: us;
+  int msb = 63 - __builtin_clzll(us);
+  int b = (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+  return b < LATENCY_BUCKETS? b: LATENCY_BUCKETS - 1;
+}
+
+/* The highest latency of a bucket */
+long long latencyBucketMax(int b) {
+  if (b < 4) return b;
+  int shift = b / 4 - 1;
+  return ((4LL + b % 4 + 1) << shift) - 1;
+}
+
+/* The latency under which the fraction p of the calls completed */
+long long latencyPercentile(StmtStats *s, double p) {
+  long long rank = (long long)(p * s->calls + 0.999999), seen = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += s->latency[b];
+    if (seen >= rank && seen > 0) {
+      long long us = latencyBucketMax(b);
+      return us < s->maxUsec? us: s->maxUsec;
+    }
+  }
+  return 0;
+}
+
+static const char *statNames[STAT_TYPES] = {"select", "insert", "update", "delete", "create", "cluster"};
+
+/* Slow log. The statements taking slowlogUsec or more are kept in a ring of
+ * the last SLOWLOG_LEN, with their text stripped of literals, access path,
+ * stage timings and row counts. A negative threshold turns it off. */
+#define SLOWLOG_LEN  128
+#define SLOWLOG_TEXT 256
+
+typedef struct SlowEntry {
+  long long id;
+  long long time;  // unix time the statement ended
+  long long usec;
+  int type;
+  const char *path;
+  long long stages[STAGES];
+  long long scanned, returned;
+  char text[SLOWLOG_TEXT];
+} SlowEntry;
+
+static SlowEntry slowlog[SLOWLOG_LEN];
+static long long slowlogId;     // the id of the next entry
+static long long slowlogFirst;  // the first id since reset
+static long long slowlogUsec = 10000;
+
+/* State of the normalization of a statement, carried across its arguments */
+typedef struct NormState {
+  int literal;  // the next word is a literal, after an operator or like
+  int values;   // 1 after values keyword, 2 within a tuple
+  int item;     // the current item of the tuple is replaced already
+  int join;     // within on clause, which compares fields
+} NormState;
+
+/* Append an argument of the statement to its normalized text, the literals
+ * are replaced by '?': quoted strings, numbers, the word after a comparison
+ * operator or like, and the items of the tuples of values clause. */
+size_t normalizeText(const char *s, size_t len, char *out, size_t n, size_t cap, NormState *st) {
+  #define NORM_PUT(c) do { if (n + 1 < cap) out[n++] = (c); } while (0)
+  size_t i = 0;
+  while (i < len) {
+    char c = s[i];
+    if (c == ' ' || c == 7) {
+      if (n > 0 && out[n-1] != ' ' && st->values != 2) NORM_PUT(' ');
+      i++;
+    }
+    else if (st->values == 2) {
+      if (c == '\'' || c == '"') {
+        char *q = memchr(s + i + 1, c, len - i - 1);
+        i = q? q - s: len - 1;
+      }
+      if (c == ',' || c == ')') {
+        NORM_PUT(c);
+        st->item = 0;
+        if (c == ')') st->values = 1;
+      }
+      else if (!st->item) {
+        NORM_PUT('?');
+        st->item = 1;
+      }
+      i++;
+    }
+    else if (c == '\'' || c == '"') {
+      char *q = memchr(s + i + 1, c, len - i - 1);
+      i = q? q - s + 1: len;
+      NORM_PUT('?');
+      st->literal = 0;
+    }
+    else if (strchr("=<>!~", c)) {
+      while (i < len && strchr("=<>!~", s[i])) NORM_PUT(s[i++]);
+      st->literal = !st->join;
+    }
+    else if (isalnum((unsigned char)c) || c == '_' || c == '.' ||
+             (c == '-' && i + 1 < len && isdigit((unsigned char)s[i+1]))) {
+      size_t start = i++;
+      while (i < len && (isalnum((unsigned char)s[i]) || strchr("_.-+:", s[i]))) i++;
+      if (st->literal || isdigit((unsigned char)c) || c == '-' || c == '.')
+        NORM_PUT('?');
+      else
+        for (size_t k = start; k < i; k++) NORM_PUT(s[k]);
+      st->literal = i - start == 4 && strncasecmp(s + start, "like", 4) == 0;
+      st->values = i - start == 6 && strncasecmp(s + start, "values", 6) == 0;
+      if (i - start == 2 && strncasecmp(s + start, "on", 2) == 0) st->join = 1;
+      if (i - start == 5 && strncasecmp(s + start, "where", 5) == 0) st->join = 0;
+    }
+    else {
+      if (c == '(' && st->values == 1) {
+        st->values = 2;
+        st->item = 0;
+      }
+      NORM_PUT(c);
+      i++;
+    }
+  }
+  #undef NORM_PUT
+  return n;
+}
+
+/* The text of a statement from its arguments, without its literals */
+void normalizeStatement(int type, RedisModuleString **argv, int argc, char *out, size_t cap) {
+  NormState st = {0, 0, 0, 0};
+  size_t n = 0;
+  for (int i = 1; i < argc; i++) {
+    size_t len;
+    const char *arg = RedisModule_StringPtrLen(argv[i], &len);
+    while (len > 0 && (*arg == ' ' || *arg == 7)) arg++, len--;
+    if (i == 1 && strncmp(arg, statNames[type], strlen(statNames[type])) != 0)
+      n = normalizeText(statNames[type], strlen(statNames[type]), out, n, cap, &st);
+    if (n > 0 && out[n-1] != ' ' && st.values != 2) n = normalizeText(" ", 1, out, n, cap, &st);
+    n = normalizeText(arg, len, out, n, cap, &st);
+  }
+  while (n > 0 && out[n-1] == ' ') n--;
+  out[n] = 0;
+  if (n + 1 >= cap) strcpy(&out[cap - 4], "...");
+}
+
+void slowlogAdd(int type, RedisModuleString **argv, int argc, long long usec, StmtTrace *trace, long long scanned, long long returned) {
+  SlowEntry *e = &slowlog[slowlogId % SLOWLOG_LEN];
+  e->id = slowlogId++;
+  e->time = time(NULL);
+  e->usec = usec;
+  e->type = type;
+  e->path = trace->path? trace->path: "";
+  memcpy(e->stages, trace->stages, sizeof(e->stages));
+  e->scanned = scanned;
+  e->returned = returned;
+  normalizeStatement(type, argv, argc, e->text, sizeof(e->text));
+}
+
+/* The trace of the next statement, set by explain analyze */
+static StmtTrace *explainTrace;
+
+/* Run a command, its work and latency counted to the statement type */
+int statCommand(RedisModuleCtx *ctx, int type, RedisModuleCmdFunc fn, RedisModuleString **argv, int argc) {
+  StmtStats *saved = curStats;
+  StmtTrace *savedTrace = curTrace, trace;
+  StmtStats *s = curStats = &stats[type];
+  long long scanned = s->scanned, returned = s->returned;
+  long long start = monotonicUs();
+  curTrace = NULL;
+  if (explainTrace != NULL) {
+    curTrace = explainTrace;
+    explainTrace = NULL;
+  }
+  else if (slowlogUsec >= 0) {
+    memset(&trace, 0, sizeof(trace));
+    curTrace = &trace;
+  }
+  if (curTrace != NULL) curTrace->lap = start;
+
+  int rc = fn(ctx, argv, argc);
+  long long us = monotonicUs() - start;
+  s->calls++;
+  if (rc == REDISMODULE_ERR) s->errors++;
+  s->usec += us;
+  if (us > s->maxUsec) s->maxUsec = us;
+  s->latency[latencyBucket(us)]++;
+
+  // the time after the last stage went to the reply or to the writes
+  if (curTrace != NULL) {
+    stageLap(type == STAT_SELECT || type == STAT_CLUSTER? STAGE_SINK: STAGE_WRITE);
+    if (slowlogUsec >= 0 && us >= slowlogUsec)
+      slowlogAdd(type, argv, argc, us, curTrace, s->scanned - scanned, s->returned - returned);
+  }
+  curTrace = savedTrace;
+  curStats = saved;
+  return rc;
+}
+
+#define STAT_COMMAND(cmd, type) \
+  int cmd##Stat(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) { \
+    return statCommand(ctx, type, cmd, argv, argc); \
+  }
+STAT_COMMAND(SelectCommand, STAT_SELECT)
+STAT_COMMAND(InsertCommand, STAT_INSERT)
+STAT_COMMAND(UpdateCommand, STAT_UPDATE)
+STAT_COMMAND(DeleteCommand, STAT_DELETE)
+STAT_COMMAND(CreateCommand, STAT_CREATE)
+STAT_COMMAND(ClusterCommand, STAT_CLUSTER)
+
+void replyStats(RedisModuleCtx *ctx, const char *name, StmtStats *s) {
+  RedisModule_ReplyWithArray(ctx, 36);
+  RedisModule_ReplyWithSimpleString(ctx, "statement");
+  RedisModule_ReplyWithSimpleString(ctx, name);
+  RedisModule_ReplyWithSimpleString(ctx, "calls");
+  RedisModule_ReplyWithLongLong(ctx, s->calls);
+  RedisModule_ReplyWithSimpleString(ctx, "errors");
+  RedisModule_ReplyWithLongLong(ctx, s->errors);
+  RedisModule_ReplyWithSimpleString(ctx, "usec");
+  RedisModule_ReplyWithLongLong(ctx, s->usec);
+  RedisModule_ReplyWithSimpleString(ctx, "usec_per_call");
+  RedisModule_ReplyWithDouble(ctx, s->calls? (double)s->usec / s->calls: 0);
+  RedisModule_ReplyWithSimpleString(ctx, "p50");
+  RedisModule_ReplyWithLongLong(ctx, latencyPercentile(s, 0.5));
+  RedisModule_ReplyWithSimpleString(ctx, "p99");
+  RedisModule_ReplyWithLongLong(ctx, latencyPercentile(s, 0.99));
+  RedisModule_ReplyWithSimpleString(ctx, "p999");
+  RedisModule_ReplyWithLongLong(ctx, latencyPercentile(s, 0.999));
+  RedisModule_ReplyWithSimpleString(ctx, "max");
+  RedisModule_ReplyWithLongLong(ctx, s->maxUsec);
+  RedisModule_ReplyWithSimpleString(ctx, "keys_scanned");
+  RedisModule_ReplyWithLongLong(ctx, s->scanned);
+  RedisModule_ReplyWithSimpleString(ctx, "keys_matched");
+  RedisModule_ReplyWithLongLong(ctx, s->matched);
+  RedisModule_ReplyWithSimpleString(ctx, "fields_fetched");
+  RedisModule_ReplyWithLongLong(ctx, s->fetched);
+  RedisModule_ReplyWithSimpleString(ctx, "rows_returned");
+  RedisModule_ReplyWithLongLong(ctx, s->returned);
+  RedisModule_ReplyWithSimpleString(ctx, "rows_sorted");
+  RedisModule_ReplyWithLongLong(ctx, s->sorted);
+  RedisModule_ReplyWithSimpleString(ctx, "bytes_exported");
+  RedisModule_ReplyWithLongLong(ctx, s->exported);
+
+  // the histogram is replied as [highest latency, calls] of the used buckets
+  RedisModule_ReplyWithSimpleString(ctx, "latency");
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  size_t n = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    if (s->latency[b] == 0) continue;
+    RedisModule_ReplyWithArray(ctx, 2);
+    RedisModule_ReplyWithLongLong(ctx, latencyBucketMax(b));
+    RedisModule_ReplyWithLongLong(ctx, s->latency[b]);
+    n++;
+  }
+  RedisModule_ReplySetArrayLength(ctx, n);
+}
+
+/* Split the arguments of a short admin command into words, whether they come
+ * as separate arguments or as one, without its leading name. The number of
+ * words is returned, or -1 if they are too long. */
+int commandWords(RedisModuleString **argv, int argc, const char *name, char *buf, size_t cap, char **words, int max) {
+  size_t n = 0;
+  for (int i = 1; i < argc; i++) {
+    size_t len;
+    const char *arg = RedisModule_StringPtrLen(argv[i], &len);
+    if (n + len + 2 > cap) return -1;
+    if (n > 0) buf[n++] = ' ';
+    memcpy(&buf[n], arg, len);
+    n += len;
+  }
+  buf[n] = 0;
+  int nWord = 0;
+  for (char *token = strtok(buf, " "); token != NULL; token = strtok(NULL, " ")) {
+    if (nWord == 0 && token == buf && strcmp(token, name) == 0) continue;
+    if (nWord == max) return -1;
+    words[nWord++] = token;
+  }
+  return nWord;
+}
+
+/* dbx stats [reset] replies the statistics of each statement type, or clears
+ * them */
+int StatsCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  char buf[64], *words[1];
+  int nWord = commandWords(argv, argc, "stats", buf, sizeof(buf), words, 1);
+  if (nWord < 0 || (nWord == 1 && strcmp(words[0], "reset") != 0)) {
+    RedisModule_ReplyWithError(ctx, "unknown stats option");
     return REDISMODULE_ERR;
   }
 
-  Vector *vField = splitStringByChar(stmField, ",");
-  Vector *vValue = splitStringByChar(stmValue, ",");
+  if (nWord == 1) {
+    memset(stats, 0, sizeof(stats));
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+  RedisModule_ReplyWithArray(ctx, STAT_TYPES);
+  for (int t = 0; t < STAT_TYPES; t++)
+    replyStats(ctx, statNames[t], &stats[t]);
+  return REDISMODULE_OK;
+}
 
-  if (fromCSV != NULL) {
-    const char *filename = RedisModule_StringToChar(fromCSV);
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
-      RedisModule_ReplyWithError(ctx, "File does not exist");
-      return REDISMODULE_ERR;
-    }
-    char line[1024];
-    char *value, *field;
-    size_t n = 0;
-    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+void replySlowEntry(RedisModuleCtx *ctx, SlowEntry *e) {
+  RedisModule_ReplyWithArray(ctx, 18);
+  RedisModule_ReplyWithSimpleString(ctx, "id");
+  RedisModule_ReplyWithLongLong(ctx, e->id);
+  RedisModule_ReplyWithSimpleString(ctx, "time");
+  RedisModule_ReplyWithLongLong(ctx, e->time);
+  RedisModule_ReplyWithSimpleString(ctx, "usec");
+  RedisModule_ReplyWithLongLong(ctx, e->usec);
+  RedisModule_ReplyWithSimpleString(ctx, "statement");
+  RedisModule_ReplyWithStringBuffer(ctx, e->text, strlen(e->text));
+  RedisModule_ReplyWithSimpleString(ctx, "path");
+  RedisModule_ReplyWithSimpleString(ctx, e->path);
+  RedisModule_ReplyWithSimpleString(ctx, "rows_scanned");
+  RedisModule_ReplyWithLongLong(ctx, e->scanned);
+  RedisModule_ReplyWithSimpleString(ctx, "rows_returned");
+  RedisModule_ReplyWithLongLong(ctx, e->returned);
+  RedisModule_ReplyWithSimpleString(ctx, "type");
+  RedisModule_ReplyWithSimpleString(ctx, statNames[e->type]);
 
-    while(fgets(line, 1024, fp) != NULL) {
-      if (line[strlen(line)-1] == 10) line[strlen(line)-1] = 0;
-      if (line[strlen(line)-1] == 13) line[strlen(line)-1] = 0;
+  // the stages which took any time, in microseconds
+  RedisModule_ReplyWithSimpleString(ctx, "stages");
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  size_t n = 0;
+  for (int st = 0; st < STAGES; st++) {
+    if (e->stages[st] == 0) continue;
+    RedisModule_ReplyWithSimpleString(ctx, stageNames[st]);
+    RedisModule_ReplyWithLongLong(ctx, e->stages[st]);
+    n += 2;
+  }
+  RedisModule_ReplySetArrayLength(ctx, n);
+}
 
-      value = strtok(line, ",");
-      if (Vector_Size(vField) == 0) {
-        while (value != NULL) {
-          if (strlen(stmField) > 0) strcat(stmField, ",");
-          strcat(stmField, trim(value, '"'));
-          value = strtok(NULL, ",");
-        }
-        if (vField) Vector_Free(vField);
-        vField = splitStringByChar(stmField, ",");
-        continue;
-      }
+/* dbx slowlog get [n] | len | reset | threshold [usec] */
+int SlowlogCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  char buf[64], *words[2];
+  int nWord = commandWords(argv, argc, "slowlog", buf, sizeof(buf), words, 2);
+  long long first = slowlogId - SLOWLOG_LEN > slowlogFirst? slowlogId - SLOWLOG_LEN: slowlogFirst;
+  long long arg = 10;
+  if (nWord == 2 && !parseInt64(words[1], &arg)) nWord = -1;
 
-      RedisModuleString *key = RedisModule_CreateStringPrintf(ctx, "%s:%u-%i", intoKey, (unsigned)time(NULL), rn++);
-      for (size_t i=0; i<Vector_Size(vField); i++) {
-        if (value == NULL) {
-          RedisModule_ReplyWithError(ctx, "Number of values does not match");
-          return REDISMODULE_ERR;
-        }
-        Vector_Get(vField, i, &field);
-        RedisModuleCallReply *rep = RedisModule_Call(ctx, "HSET", "scc", key, field, trim(value, '"'));
-        RedisModule_FreeCallReply(rep);
-        value = strtok(NULL, ",");
-      }
-      n++;
-      RedisModule_ReplyWithString(ctx, key);
-      RedisModule_FreeString(ctx, key);
-    }
-    fclose(fp);
-    RedisModule_ReplySetArrayLength(ctx, n);
+  if (nWord >= 1 && strcmp(words[0], "get") == 0 && arg >= 0) {
+    // the newest entries first
+    long long n = slowlogId - first < arg? slowlogId - first: arg;
+    RedisModule_ReplyWithArray(ctx, n);
+    for (long long id = slowlogId - 1; id >= slowlogId - n; id--)
+      replySlowEntry(ctx, &slowlog[id % SLOWLOG_LEN]);
+    return REDISMODULE_OK;
   }
-  else {
-    if (Vector_Size(vField) != Vector_Size(vValue)) {
-      RedisModule_ReplyWithError(ctx, "Number of values does not match");
-      return REDISMODULE_ERR;
-    }
+  if (nWord == 1 && strcmp(words[0], "len") == 0)
+    return RedisModule_ReplyWithLongLong(ctx, slowlogId - first);
+  if (nWord == 1 && strcmp(words[0], "reset") == 0) {
+    slowlogFirst = slowlogId;
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+  if (nWord == 1 && strcmp(words[0], "threshold") == 0)
+    return RedisModule_ReplyWithLongLong(ctx, slowlogUsec);
+  if (nWord == 2 && strcmp(words[0], "threshold") == 0) {
+    slowlogUsec = arg;
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+  RedisModule_ReplyWithError(ctx, "slowlog get [n], len, reset or threshold [usec] is expected");
+  return REDISMODULE_ERR;
+}
 
-    char *field, *value;
-    size_t n = 0;
-    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+/* dbx explain analyze select ... runs the select and replies, instead of its
+ * rows, the operators the rows went through: the rows in and out of each,
+ * the microseconds spent in it and the most memory it held. */
+int ExplainCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModule_AutoMemory(ctx);
 
-    RedisModuleString *key = RMUtil_CreateFormattedString(ctx, "%s:%u-%i", intoKey, (unsigned)time(NULL), rn++);
-    for (size_t i=0; i<Vector_Size(vField); i++) {
-      Vector_Get(vField, i, &field);
-      Vector_Get(vValue, i, &value);
-      RedisModuleCallReply *rep = RedisModule_Call(ctx, "HSET", "scc", key, field, trim(value, '"'));
-      RedisModule_FreeCallReply(rep);
+  // The words explain and analyze may share an argument with the statement
+  int i = 1, first = 1, analyze = 0;
+  const char *p = NULL, *end = NULL;
+  while (i < argc && !analyze) {
+    if (p == NULL) {
+      size_t len;
+      p = RedisModule_StringPtrLen(argv[i], &len);
+      end = p + len;
     }
-    n++;
-    RedisModule_ReplyWithString(ctx, key);
-    RedisModule_FreeString(ctx, key);
-    RedisModule_ReplySetArrayLength(ctx, n);
+    while (p < end && *p == ' ') p++;
+    if (p == end) {
+      p = NULL;
+      i++;
+      continue;
+    }
+    const char *q = p;
+    while (q < end && *q != ' ') q++;
+    if (first && q - p == 7 && strncmp(p, "explain", 7) == 0) first = 0;
+    else if (q - p == 7 && strncmp(p, "analyze", 7) == 0) analyze = 1;
+    else break;
+    p = q;
   }
-  if (vField) Vector_Free(vField);
-  if (vValue) Vector_Free(vValue);
+  while (p != NULL && p < end && *p == ' ') p++;
+  if (p == end && i < argc) {
+    p = NULL;
+    i++;
+  }
+  if (!analyze || i >= argc) {
+    RedisModule_ReplyWithError(ctx, "explain analyze select ... is expected");
+    return REDISMODULE_ERR;
+  }
+  if (p == NULL) {
+    size_t len;
+    p = RedisModule_StringPtrLen(argv[i], &len);
+    end = p + len;
+  }
+  if (end - p < 6 || strncmp(p, "select", 6) != 0) {
+    RedisModule_ReplyWithError(ctx, "only select statement can be explained");
+    return REDISMODULE_ERR;
+  }
+
+  // The statement runs as dbx.select, its reply is dropped
+  int n = argc - i + 1;
+  RedisModuleString *args[n];
+  args[0] = RedisModule_CreateString(ctx, "dbx.select", 10);
+  args[1] = RedisModule_CreateString(ctx, p, end - p);
+  for (int k = 2; k < n; k++) args[k] = argv[i + k - 1];
+  StmtTrace trace;
+  memset(&trace, 0, sizeof(trace));
+  ReplyCapture capture;
+  memset(&capture, 0, sizeof(capture));
+  explainTrace = &trace;
+  replyCapture = &capture;
+  long long start = monotonicUs();
+  statCommand(ctx, STAT_SELECT, SelectCommand, args, n);
+  long long us = monotonicUs() - start;
+  replyCapture = NULL;
+  explainTrace = NULL;
+  if (capture.buf.len == 0) {
+    RedisModule_Free(capture.buf.p);
+    RedisModule_ReplyWithError(ctx, "the statement could not run");
+    return REDISMODULE_ERR;
+  }
+  if (capture.buf.p[0] == REDISMODULE_REPLY_ERROR) {
+    uint32_t len;
+    memcpy(&len, capture.buf.p + 1, sizeof(len));
+    char err[len + 1];
+    memcpy(err, capture.buf.p + 1 + sizeof(len), len);
+    err[len] = 0;
+    RedisModule_Free(capture.buf.p);
+    RedisModule_ReplyWithError(ctx, err);
+    return REDISMODULE_ERR;
+  }
+  RedisModule_Free(capture.buf.p);
 
+  size_t mem = 0;
+  for (int st = 0; st < STAGES; st++) mem += trace.mem[st];
+  RedisModule_ReplyWithArray(ctx, 10);
+  RedisModule_ReplyWithSimpleString(ctx, "path");
+  RedisModule_ReplyWithSimpleString(ctx, trace.path? trace.path: "");
+  RedisModule_ReplyWithSimpleString(ctx, "usec");
+  RedisModule_ReplyWithLongLong(ctx, us);
+  RedisModule_ReplyWithSimpleString(ctx, "rows");
+  RedisModule_ReplyWithLongLong(ctx, trace.rowsOut[STAGE_SINK]);
+  RedisModule_ReplyWithSimpleString(ctx, "memory");
+  RedisModule_ReplyWithLongLong(ctx, mem);
+  RedisModule_ReplyWithSimpleString(ctx, "operators");
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  size_t nOp = 0;
+  for (int st = 0; st < STAGES; st++) {
+    if (trace.stages[st] == 0 && trace.rowsIn[st] == 0 && trace.rowsOut[st] == 0 && trace.mem[st] == 0)
+      continue;
+    RedisModule_ReplyWithArray(ctx, 10);
+    RedisModule_ReplyWithSimpleString(ctx, "operator");
+    RedisModule_ReplyWithSimpleString(ctx, stageNames[st]);
+    RedisModule_ReplyWithSimpleString(ctx, "rows_in");
+    RedisModule_ReplyWithLongLong(ctx, trace.rowsIn[st]);
+    RedisModule_ReplyWithSimpleString(ctx, "rows_out");
+    RedisModule_ReplyWithLongLong(ctx, trace.rowsOut[st]);
+    RedisModule_ReplyWithSimpleString(ctx, "usec");
+    RedisModule_ReplyWithLongLong(ctx, trace.stages[st]);
+    RedisModule_ReplyWithSimpleString(ctx, "memory");
+    RedisModule_ReplyWithLongLong(ctx, trace.mem[st]);
+    nOp++;
+  }
+  RedisModule_ReplySetArrayLength(ctx, nOp);
   return REDISMODULE_OK;
 }
 
-int DeleteCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  RedisModule_AutoMemory(ctx);
+/* Column statistics for the planner. dbx analyze samples up to
+ * ANALYZE_SAMPLE rows of a table, by a reservoir over the keys of its scan
+ * or over the rows of its column store, and keeps for each column the
+ * fraction of rows missing it, an estimate of its distinct values, its most
+ * common values with their frequencies, the bounds of an equi-depth histogram
+ * of its other values and their average width. The values are ordered as the
+ * where clause compares them. The statistics of a table are a module value
+ * at __dbx_stats:<name>, so they are kept by RDB, and a periodic refresh
+ * analyzes again the tables which changed. */
+#define STATS_PREFIX "__dbx_stats:"
+#define STATS_ENCODING_VERSION 0
+#define ANALYZE_SAMPLE  30000
+#define ANALYZE_MCV     10
+#define ANALYZE_BUCKETS 100
+#define ANALYZE_CHANGE  10    // percent of the rows changed for a refresh
 
-  if (argc < 2)
-    return RedisModule_WrongArity(ctx);
+typedef struct ColStats {
+  char *name;
+  double nullFrac;    // fraction of the rows without a value
+  double distinct;    // estimated number of distinct values
+  double width;       // average length of a value
+  size_t nMcv, nBound;
+  char **mcv;         // most common values, the most frequent first
+  double *mcvFreq;    // fraction of the rows having each of them
+  char **bounds;      // histogram of the values which are not in mcv
+} ColStats;
 
-  // Table
-  RedisModuleString *fromKeys;
+typedef struct TableStats {
+  long long rows;     // rows of the table when analyzed
+  long long sampled;
+  long long time;
+  size_t nCol;
+  ColStats *cols;
+} TableStats;
 
-  // Process the arguments
-  size_t plen;
-  char s[1024] = "";
-  for (int i=1; i<argc; i++) {
-    if (strlen(s) > 0) strcat(s, " ");
-    const char *temp = RedisModule_StringPtrLen(argv[i], &plen);
-    if (strlen(s) + plen > 1024) {
-        RedisModule_ReplyWithError(ctx, "arguments are too long");
-        return REDISMODULE_ERR;
+static RedisModuleType *StatsType;
+static struct RMUtilTimer *analyzeTimer;
+static long long analyzeInterval;   // seconds between refreshes, 0 if off
+
+void statsFree(void *value) {
+  TableStats *s = value;
+  for (size_t c = 0; c < s->nCol; c++) {
+    ColStats *cs = &s->cols[c];
+    for (size_t i = 0; i < cs->nMcv; i++) RedisModule_Free(cs->mcv[i]);
+    for (size_t i = 0; i < cs->nBound; i++) RedisModule_Free(cs->bounds[i]);
+    RedisModule_Free(cs->mcv);
+    RedisModule_Free(cs->mcvFreq);
+    RedisModule_Free(cs->bounds);
+    RedisModule_Free(cs->name);
+  }
+  RedisModule_Free(s->cols);
+  RedisModule_Free(s);
+}
+
+void statsRdbSave(RedisModuleIO *rdb, void *value) {
+  TableStats *s = value;
+  RedisModule_SaveSigned(rdb, s->rows);
+  RedisModule_SaveSigned(rdb, s->sampled);
+  RedisModule_SaveSigned(rdb, s->time);
+  RedisModule_SaveUnsigned(rdb, s->nCol);
+  for (size_t c = 0; c < s->nCol; c++) {
+    ColStats *cs = &s->cols[c];
+    RedisModule_SaveStringBuffer(rdb, cs->name, strlen(cs->name));
+    RedisModule_SaveDouble(rdb, cs->nullFrac);
+    RedisModule_SaveDouble(rdb, cs->distinct);
+    RedisModule_SaveDouble(rdb, cs->width);
+    RedisModule_SaveUnsigned(rdb, cs->nMcv);
+    for (size_t i = 0; i < cs->nMcv; i++) {
+      RedisModule_SaveStringBuffer(rdb, cs->mcv[i], strlen(cs->mcv[i]));
+      RedisModule_SaveDouble(rdb, cs->mcvFreq[i]);
     }
+    RedisModule_SaveUnsigned(rdb, cs->nBound);
+    for (size_t i = 0; i < cs->nBound; i++)
+      RedisModule_SaveStringBuffer(rdb, cs->bounds[i], strlen(cs->bounds[i]));
+  }
+}
 
-    if (argc > 2) { // argc > 2 means the arguments are not in quoted. i.e. "..."
-      char *p = (char*)temp;
-      while (*p++) *p = *p == 32? 7: *p; // Convert all spaces in tabs, then convert back during parsing
+void *statsRdbLoad(RedisModuleIO *rdb, int encver) {
+  if (encver > STATS_ENCODING_VERSION) {
+    RedisModule_LogIOError(rdb, "warning", "unknown encoding version %d of table statistics", encver);
+    return NULL;
+  }
+  TableStats *s = RedisModule_Calloc(1, sizeof(TableStats));
+  s->rows = RedisModule_LoadSigned(rdb);
+  s->sampled = RedisModule_LoadSigned(rdb);
+  s->time = RedisModule_LoadSigned(rdb);
+  s->nCol = RedisModule_LoadUnsigned(rdb);
+  s->cols = RedisModule_Calloc(s->nCol + 1, sizeof(ColStats));
+  for (size_t c = 0; c < s->nCol; c++) {
+    ColStats *cs = &s->cols[c];
+    cs->name = loadCString(rdb);
+    cs->nullFrac = RedisModule_LoadDouble(rdb);
+    cs->distinct = RedisModule_LoadDouble(rdb);
+    cs->width = RedisModule_LoadDouble(rdb);
+    cs->nMcv = RedisModule_LoadUnsigned(rdb);
+    cs->mcv = RedisModule_Alloc((cs->nMcv + 1) * sizeof(char*));
+    cs->mcvFreq = RedisModule_Alloc((cs->nMcv + 1) * sizeof(double));
+    for (size_t i = 0; i < cs->nMcv; i++) {
+      cs->mcv[i] = loadCString(rdb);
+      cs->mcvFreq[i] = RedisModule_LoadDouble(rdb);
     }
-    strcat(s, temp);
+    cs->nBound = RedisModule_LoadUnsigned(rdb);
+    cs->bounds = RedisModule_Alloc((cs->nBound + 1) * sizeof(char*));
+    for (size_t i = 0; i < cs->nBound; i++)
+      cs->bounds[i] = loadCString(rdb);
   }
+  return s;
+}
 
-  char *sp = s;
-  if (strncmp("delete", sp, 6) == 0) sp += 6;
+/* The statistics derive from rows which may come after them in the rewritten
+ * file, so none are written: after a restart from AOF the tables are analyzed
+ * again by dbx analyze or the refresh. */
+void statsAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+}
 
-  int step = 0;
-  char temp[1024] = "";
-  char stmWhere[1024] = "";
+size_t statsMemUsage(const void *value) {
+  const TableStats *s = value;
+  size_t size = sizeof(TableStats) + s->nCol * sizeof(ColStats);
+  for (size_t c = 0; c < s->nCol; c++) {
+    const ColStats *cs = &s->cols[c];
+    size += strlen(cs->name) + 1 + cs->nMcv * (sizeof(char*) + sizeof(double)) + cs->nBound * sizeof(char*);
+    for (size_t i = 0; i < cs->nMcv; i++) size += strlen(cs->mcv[i]) + 1;
+    for (size_t i = 0; i < cs->nBound; i++) size += strlen(cs->bounds[i]) + 1;
+  }
+  return size;
+}
 
-  char *token = strtok(sp, " ");
-  while (token != NULL) {
-    // If it is beginning in single quote, find the end quote in the following tokens
-    if (token[0] == 39) {
-      strcpy(temp, &token[1]);
-      strcat(temp, " ");
-      strcat(temp, strtok(NULL, "'"));
-      strcpy(token, temp);
+/* The sampled rows by column, a NULL value is missing in its row. The
+ * columns are added as they are found in the rows. */
+typedef struct SampleColumn {
+  const char *name;
+  const char **values;
+} SampleColumn;
+
+typedef struct Sample {
+  Arena arena;
+  size_t nRow, nCol, capCol;
+  SampleColumn *cols;
+  RedisModuleDict *index;   // column name to index + 1
+} Sample;
+
+SampleColumn *sampleColumn(Sample *s, const char *name, size_t len) {
+  size_t c = (size_t)RedisModule_DictGetC(s->index, (void*)name, len, NULL);
+  if (c > 0) return &s->cols[c - 1];
+  if (s->nCol == s->capCol) {
+    s->capCol = s->capCol? 2 * s->capCol: 16;
+    s->cols = RedisModule_Realloc(s->cols, s->capCol * sizeof(SampleColumn));
+  }
+  SampleColumn *col = &s->cols[s->nCol++];
+  col->name = arenaStrndup(&s->arena, name, len);
+  col->values = arenaCalloc(&s->arena, s->nRow + 1, sizeof(char*));
+  RedisModule_DictSetC(s->index, (void*)name, len, (void*)s->nCol);
+  return col;
+}
+
+/* A random index of [0, n) for the reservoir */
+long long sampleRandom(long long n) {
+  return (((long long)rand() << 31) ^ rand()) % n;
+}
+
+/* Sample the rows of the column store, the number of rows is returned */
+long long sampleColRows(RedisModuleCtx *ctx, Table *table, Sample *s) {
+  RedisModuleKey *key;
+  ColTable *t = openColTable(ctx, table, REDISMODULE_READ, &key);
+  if (t == NULL) {
+    RedisModule_CloseKey(key);
+    return 0;
+  }
+  s->nRow = t->nRow < ANALYZE_SAMPLE? t->nRow: ANALYZE_SAMPLE;
+  size_t *rows = RedisModule_Alloc((s->nRow + 1) * sizeof(size_t));
+  for (size_t r = 0; r < t->nRow; r++) {
+    if (r < s->nRow) rows[r] = r;
+    else {
+      long long i = sampleRandom(r + 1);
+      if (i < (long long)s->nRow) rows[i] = r;
     }
-    switch(step) {
-      case 0:
-        if (strcmp("from", token) == 0)
-          step = -1;
-        else {
-            RedisModule_ReplyWithError(ctx, "from keyword is expected");
-            return REDISMODULE_ERR;
-        }
-        break;
-      case -1:
-        // parse from clause
-        fromKeys = RMUtil_CreateFormattedString(ctx, token);
-        step = 2;
-        break;
-      case 2:
-        if (strcmp("where", token) == 0)
-          step = -3;
-        else {
-          RedisModule_ReplyWithError(ctx, "where statement is expected");
-          return REDISMODULE_ERR;
-        }
-        break;
-      case -3:
-      case 4:
-        // parse where clause
-        if (strlen(stmWhere) + strlen(token) > 512) {
-          RedisModule_ReplyWithError(ctx, "where arguments are too long");
-          return REDISMODULE_ERR;
-        }
-        if (strcmp("and", token) == 0)
-          strcat(stmWhere, "&&");
-        else {
-          char *p = token;
-          while (*p++) *p = *p == 7? 32: *p;
-          strcat(stmWhere, token);
-          step = 4;
-        }
-        break;
+  }
+  char buf[32];
+  for (size_t c = 0; c < t->nCol; c++) {
+    SampleColumn *col = sampleColumn(s, t->cols[c].name, strlen(t->cols[c].name));
+    for (size_t i = 0; i < s->nRow; i++) {
+      const char *v = colGetValue(t, rows[i], c, buf);
+      if (v) col->values[i] = arenaStrndup(&s->arena, v, strlen(v));
     }
-    token = strtok(NULL, " ");
   }
+  long long n = t->nRow;
+  RedisModule_Free(rows);
+  RedisModule_CloseKey(key);
+  return n;
+}
 
-  if (step <= 0) {
-    RedisModule_ReplyWithError(ctx, "parse error");
-    return REDISMODULE_ERR;
+/* Sample the rows of a table of hashes by a reservoir of the keys of its
+ * scan, the number of rows is returned. The columns of a defined table come
+ * first, so a column without any value is known too. */
+long long sampleHashRows(RedisModuleCtx *ctx, Table *table, Sample *s) {
+  regex_t regex;
+  if (regcomp(&regex, table->pattern, REG_EXTENDED | REG_NOSUB | REG_NEWLINE)) return 0;
+  RedisModuleString **keys = RedisModule_Alloc(ANALYZE_SAMPLE * sizeof(RedisModuleString*));
+  RedisModuleString *key;
+  long long n = 0;
+  KeyScan ks;
+  keyScanInit(ctx, &ks, table, &regex);
+  while ((key = keyScanNext(ctx, &ks)) != NULL) {
+    long long i = n < ANALYZE_SAMPLE? n: sampleRandom(n + 1);
+    n++;
+    if (i >= ANALYZE_SAMPLE) {
+      RedisModule_FreeString(ctx, key);
+      continue;
+    }
+    if (i < (long long)s->nRow) RedisModule_FreeString(ctx, keys[i]);
+    else s->nRow++;
+    keys[i] = key;
   }
+  keyScanFree(&ks);
+  regfree(&regex);
 
-  Vector *vWhere = splitWhereString(stmWhere);
+  RedisModuleString *catalog = RedisModule_CreateStringPrintf(ctx, CATALOG_PREFIX "%s", table->name);
+  RedisModuleCallReply *rep = RedisModule_Call(ctx, "HGET", "sc", catalog, "columns");
+  size_t len;
+  const char *columns = RedisModule_CallReplyStringPtr(rep, &len);
+  for (size_t i = 0, j = 0; columns != NULL && j <= len; j++) {
+    if (j < len && columns[j] != ',') continue;
+    if (j > i) sampleColumn(s, &columns[i], j - i);
+    i = j + 1;
+  }
+  RedisModule_FreeCallReply(rep);
+  RedisModule_FreeString(ctx, catalog);
 
-  /* Convert key to regex */
-  const char *pat = RedisModule_StringToChar(fromKeys);
-  regex_t regex;
-  if (regexCompile(ctx, &regex, pat)) return REDISMODULE_ERR;
+  for (size_t r = 0; r < s->nRow; r++) {
+    RedisModuleCallReply *tags = RedisModule_Call(ctx, "HGETALL", "s", keys[r]);
+    size_t tf = RedisModule_CallReplyLength(tags);
+    for (size_t j = 0; j + 1 < tf; j += 2) {
+      size_t flen, vlen;
+      const char *f = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(tags, j), &flen);
+      const char *v = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(tags, j + 1), &vlen);
+      sampleColumn(s, f, flen)->values[r] = arenaStrndup(&s->arena, v, vlen);
+    }
+    RedisModule_FreeCallReply(tags);
+    RedisModule_FreeString(ctx, keys[r]);
+  }
+  RedisModule_Free(keys);
+  return n;
+}
+
+/* The values of a sample equal to each other */
+typedef struct ValueRun {
+  const char *value;
+  size_t count;
+  int mcv;
+} ValueRun;
+
+/* The order of the histogram: the integers by value as whereCompare orders
+ * them, before the other values by text */
+int compareStrings(const void *a, const void *b) {
+  const char *x = *(const char**)a, *y = *(const char**)b;
+  long long lx, ly;
+  int ix = parseInt64(x, &lx), iy = parseInt64(y, &ly);
+  if (ix && iy) return (lx > ly) - (lx < ly);
+  if (ix != iy) return iy - ix;
+  return strcmp(x, y);
+}
+
+/* The most frequent first, then by value */
+int compareRunCounts(const void *a, const void *b) {
+  const ValueRun *x = *(const ValueRun**)a, *y = *(const ValueRun**)b;
+  if (x->count != y->count) return x->count < y->count? 1: -1;
+  return strcmp(x->value, y->value);
+}
+
+/* The statistics of a column from its sample of nRow out of rows */
+void columnStats(ColStats *cs, SampleColumn *col, size_t nRow, long long rows, Arena *a) {
+  const char **v = arenaAlloc(a, (nRow + 1) * sizeof(char*));
+  size_t n = 0, width = 0;
+  for (size_t r = 0; r < nRow; r++)
+    if (col->values[r]) {
+      v[n++] = col->values[r];
+      width += strlen(col->values[r]);
+    }
+  cs->name = RedisModule_Strdup(col->name);
+  cs->nullFrac = nRow? (double)(nRow - n) / nRow: 0;
+  cs->width = n? (double)width / n: 0;
+  cs->mcv = RedisModule_Alloc((ANALYZE_MCV + 1) * sizeof(char*));
+  cs->mcvFreq = RedisModule_Alloc((ANALYZE_MCV + 1) * sizeof(double));
+  cs->bounds = RedisModule_Alloc((ANALYZE_BUCKETS + 2) * sizeof(char*));
+  if (n == 0) return;
+
+  qsort(v, n, sizeof(char*), compareStrings);
+  ValueRun *runs = arenaAlloc(a, n * sizeof(ValueRun));
+  ValueRun **byCount = arenaAlloc(a, n * sizeof(ValueRun*));
+  size_t d = 0, f1 = 0;
+  for (size_t i = 0, j; i < n; i = j) {
+    for (j = i + 1; j < n && strcmp(v[j], v[i]) == 0; j++);
+    runs[d] = (ValueRun){v[i], j - i, 0};
+    byCount[d] = &runs[d];
+    if (j - i == 1) f1++;
+    d++;
+  }
+
+  // The distinct values of a part of the table are scaled by the estimator
+  // Duj1 of Haas and Stokes, n * d / (n - f1 + f1 * n / N), f1 being the
+  // values seen once and N the rows having a value
+  int whole = (long long)nRow >= rows;
+  double total = rows * (1 - cs->nullFrac);
+  cs->distinct = d;
+  if (!whole && total > n) {
+    double e = n * (double)d / (n - f1 + f1 * (double)n / total);
+    cs->distinct = e < d? d: e > total? total: e;
+  }
+
+  // The values more frequent than 1.25 times the average, and by more than
+  // four standard errors of a count so that a uniform column has none. All
+  // of them if they are few and all were seen.
+  qsort(byCount, d, sizeof(ValueRun*), compareRunCounts);
+  int all = d <= ANALYZE_MCV && (whole || f1 == 0);
+  double avg = (double)n / d;
+  size_t m = n;
+  for (size_t k = 0; k < d && cs->nMcv < ANALYZE_MCV; k++) {
+    ValueRun *run = byCount[k];
+    if (!all && (run->count < 2 || run->count < 1.25 * avg || run->count - avg < 4 * sqrt(avg))) break;
+    run->mcv = 1;
+    cs->mcv[cs->nMcv] = RedisModule_Strdup(run->value);
+    cs->mcvFreq[cs->nMcv++] = (double)run->count / nRow;
+    m -= run->count;
+  }
 
+  // The bounds split the m other values into buckets of as many values
+  if (d - cs->nMcv < 2) return;
+  size_t nb = m - 1 < ANALYZE_BUCKETS? m - 1: ANALYZE_BUCKETS;
+  size_t k = 0, seen = 0;
+  for (size_t b = 0; b <= nb; b++) {
+    size_t rank = b * (m - 1) / nb;
+    while (runs[k].mcv || seen + runs[k].count <= rank) {
+      if (!runs[k].mcv) seen += runs[k].count;
+      k++;
+    }
+    cs->bounds[cs->nBound++] = RedisModule_Strdup(runs[k].value);
+  }
+}
+
+TableStats *analyzeTable(RedisModuleCtx *ctx, Table *table) {
+  Sample s;
+  memset(&s, 0, sizeof(s));
+  s.index = RedisModule_CreateDict(NULL);
+  TableStats *ts = RedisModule_Calloc(1, sizeof(TableStats));
+  ts->rows = table->columnar? sampleColRows(ctx, table, &s): sampleHashRows(ctx, table, &s);
+  ts->sampled = s.nRow;
+  ts->time = time(NULL);
+  ts->nCol = s.nCol;
+  ts->cols = RedisModule_Calloc(s.nCol + 1, sizeof(ColStats));
+  for (size_t c = 0; c < s.nCol; c++)
+    columnStats(&ts->cols[c], &s.cols[c], s.nRow, ts->rows, &s.arena);
+  RedisModule_FreeDict(NULL, s.index);
+  RedisModule_Free(s.cols);
+  arenaFree(&s.arena);
+  return ts;
+}
+
+/* The statistics of a table, NULL if it is not analyzed. The key is closed
+ * by the caller. */
+TableStats *openStats(RedisModuleCtx *ctx, const char *name, int mode, RedisModuleKey **key) {
+  RedisModuleString *s = RedisModule_CreateStringPrintf(ctx, STATS_PREFIX "%s", name);
+  *key = RedisModule_OpenKey(ctx, s, mode);
+  RedisModule_FreeString(ctx, s);
+  if (RedisModule_KeyType(*key) == REDISMODULE_KEYTYPE_MODULE && RedisModule_ModuleTypeGetType(*key) == StatsType)
+    return RedisModule_ModuleTypeGetValue(*key);
+  return NULL;
+}
+
+void storeStats(RedisModuleCtx *ctx, const char *name, TableStats *ts) {
+  RedisModuleKey *key;
+  openStats(ctx, name, REDISMODULE_WRITE, &key);
+  RedisModule_ModuleTypeSetValue(key, StatsType, ts);
+  RedisModule_CloseKey(key);
+}
+
+/* The rows of a table known without a scan, -1 if they are not counted */
+long long knownRows(RedisModuleCtx *ctx, Table *table) {
+  if (!table->columnar) return table->counted? table->rows: -1;
+  RedisModuleKey *key;
+  ColTable *t = openColTable(ctx, table, REDISMODULE_READ, &key);
+  long long rows = t? (long long)t->nRow: 0;
+  RedisModule_CloseKey(key);
+  return rows;
+}
+
+/* Analyze again the tables whose rows changed by more than ANALYZE_CHANGE
+ * percent since their statistics, or which are not counted. The number of
+ * tables analyzed is returned. */
+long long analyzeStale(RedisModuleCtx *ctx) {
+  // the names first, the statistics are replaced as they go
+  Vector *names = NewVector(char *, 8);
   RedisModuleString *scursor = RedisModule_CreateStringFromLongLong(ctx, 0);
-  long long lcursor;
-  size_t affected = 0;
+  long long lcursor, n = 0;
   do {
-    RedisModuleCallReply *rep = RedisModule_Call(ctx, "SCAN", "s", scursor);
-
-    /* Get the current cursor. */
+    RedisModuleCallReply *rep = RedisModule_Call(ctx, "SCAN", "scccl", scursor, "MATCH", STATS_PREFIX "*", "COUNT", 1000LL);
+    RedisModule_FreeString(ctx, scursor);
     scursor = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(rep, 0));
     RedisModule_StringToLongLong(scursor, &lcursor);
-
-    /* Filter by pattern matching. */
     RedisModuleCallReply *keys = RedisModule_CallReplyArrayElement(rep, 1);
-    size_t nKeys = RedisModule_CallReplyLength(keys);
-    for (size_t i = 0; i < nKeys; i++) {
-      RedisModuleString *key = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(keys, i));
-      const char *s = RedisModule_StringToChar(key);
-      if (!regexec(&regex, s, 1, NULL, 0)) {
-        if (vWhere == NULL || whereRecord(ctx, key, vWhere)) {
-          RedisModule_Call(ctx, "DEL", "s", key);
-          affected++;
-        }
-      }
-      RedisModule_FreeString(ctx, key);
+    for (size_t i = 0; i < RedisModule_CallReplyLength(keys); i++) {
+      size_t len;
+      const char *k = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(keys, i), &len);
+      size_t skip = strlen(STATS_PREFIX);
+      char *name = RedisModule_Alloc(len - skip + 1);
+      memcpy(name, k + skip, len - skip);
+      name[len - skip] = 0;
+      Vector_Push(names, name);
     }
-
     RedisModule_FreeCallReply(rep);
   } while (lcursor);
-
   RedisModule_FreeString(ctx, scursor);
 
-  RedisModule_ReplyWithLongLong(ctx, affected);
-  RedisModule_FreeString(ctx, fromKeys);
-  Vector_Free(vWhere);
+  for (int i = 0; i < Vector_Size(names); i++) {
+    char *name = VectorGetString(names, i);
+    Table table;
+    RedisModuleKey *key;
+    loadTable(ctx, name, &table);
+    TableStats *old = openStats(ctx, name, REDISMODULE_READ, &key);
+    long long rows = knownRows(ctx, &table);
+    int stale = old != NULL && strlen(table.name) > 0 &&
+      (rows < 0 || llabs(rows - old->rows) * 100 > old->rows * ANALYZE_CHANGE);
+    RedisModule_CloseKey(key);
+    if (stale) {
+      storeStats(ctx, name, analyzeTable(ctx, &table));
+      RedisModule_Replicate(ctx, "dbx.analyze", "c", name);
+      n++;
+    }
+    RedisModule_Free(name);
+  }
+  Vector_Free(names);
+  return n;
+}
+
+/* The refresh runs on the timer thread under the lock of Redis, on a master
+ * only since the analyze is replicated */
+void analyzeTick(RedisModuleCtx *ctx, void *privdata) {
+  RedisModule_ThreadSafeContextLock(ctx);
+  if (analyzeInterval > 0 && !(RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_SLAVE))
+    analyzeStale(ctx);
+  RedisModule_ThreadSafeContextUnlock(ctx);
+}
+
+/* The timer is started by the first interval and lives on, since it cannot
+ * be stopped while its tick waits for the lock held here. A new interval
+ * counts from the next tick, the refresh is off at 0. */
+void analyzeSetInterval(long long seconds) {
+  struct timespec interval = {seconds, 0};
+  if (seconds > 0 && analyzeTimer == NULL)
+    analyzeTimer = RMUtil_NewPeriodicTimer(analyzeTick, NULL, NULL, interval);
+  else if (seconds > 0)
+    RMUtilTimer_SetInterval(analyzeTimer, interval);
+  analyzeInterval = seconds;
+}
+
+void replyTableStats(RedisModuleCtx *ctx, const char *name, TableStats *ts) {
+  RedisModule_ReplyWithArray(ctx, 10);
+  RedisModule_ReplyWithSimpleString(ctx, "table");
+  RedisModule_ReplyWithStringBuffer(ctx, name, strlen(name));
+  RedisModule_ReplyWithSimpleString(ctx, "rows");
+  RedisModule_ReplyWithLongLong(ctx, ts->rows);
+  RedisModule_ReplyWithSimpleString(ctx, "sampled");
+  RedisModule_ReplyWithLongLong(ctx, ts->sampled);
+  RedisModule_ReplyWithSimpleString(ctx, "time");
+  RedisModule_ReplyWithLongLong(ctx, ts->time);
+  RedisModule_ReplyWithSimpleString(ctx, "columns");
+  RedisModule_ReplyWithArray(ctx, ts->nCol);
+  for (size_t c = 0; c < ts->nCol; c++) {
+    ColStats *cs = &ts->cols[c];
+    RedisModule_ReplyWithArray(ctx, 12);
+    RedisModule_ReplyWithSimpleString(ctx, "column");
+    RedisModule_ReplyWithStringBuffer(ctx, cs->name, strlen(cs->name));
+    RedisModule_ReplyWithSimpleString(ctx, "null_frac");
+    RedisModule_ReplyWithDouble(ctx, cs->nullFrac);
+    RedisModule_ReplyWithSimpleString(ctx, "distinct");
+    RedisModule_ReplyWithLongLong(ctx, (long long)(cs->distinct + 0.5));
+    RedisModule_ReplyWithSimpleString(ctx, "avg_width");
+    RedisModule_ReplyWithDouble(ctx, cs->width);
+    RedisModule_ReplyWithSimpleString(ctx, "mcv");
+    RedisModule_ReplyWithArray(ctx, 2 * cs->nMcv);
+    for (size_t i = 0; i < cs->nMcv; i++) {
+      RedisModule_ReplyWithStringBuffer(ctx, cs->mcv[i], strlen(cs->mcv[i]));
+      RedisModule_ReplyWithDouble(ctx, cs->mcvFreq[i]);
+    }
+    RedisModule_ReplyWithSimpleString(ctx, "histogram");
+    RedisModule_ReplyWithArray(ctx, cs->nBound);
+    for (size_t i = 0; i < cs->nBound; i++)
+      RedisModule_ReplyWithStringBuffer(ctx, cs->bounds[i], strlen(cs->bounds[i]));
+  }
+}
+
+/* dbx analyze <table> | show <table> | refresh [seconds], or without
+ * argument the tables changed since their statistics */
+int AnalyzeCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  char buf[320], *words[2];
+  int nWord = commandWords(argv, argc, "analyze", buf, sizeof(buf), words, 2);
+  long long seconds = 0;
+
+  if (nWord == 0)
+    return RedisModule_ReplyWithLongLong(ctx, analyzeStale(ctx));
+  if (nWord >= 1 && strcmp(words[0], "refresh") == 0) {
+    if (nWord == 1)
+      return RedisModule_ReplyWithLongLong(ctx, analyzeInterval);
+    if (!parseInt64(words[1], &seconds) || seconds < 0) {
+      RedisModule_ReplyWithError(ctx, "invalid refresh interval");
+      return REDISMODULE_ERR;
+    }
+    analyzeSetInterval(seconds);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
 
+  Table table;
+  int show = nWord > 0 && strcmp(words[0], "show") == 0;
+  const char *name = nWord == 2 && show? words[1]: nWord == 1 && !show? words[0]: NULL;
+  if (name != NULL) loadTable(ctx, name, &table);
+  if (name == NULL || strlen(table.name) == 0) {
+    RedisModule_ReplyWithError(ctx, "dbx analyze <table> is expected");
+    return REDISMODULE_ERR;
+  }
+  if (nWord == 2) {
+    RedisModuleKey *key;
+    TableStats *ts = openStats(ctx, name, REDISMODULE_READ, &key);
+    if (ts == NULL) RedisModule_ReplyWithNull(ctx);
+    else replyTableStats(ctx, name, ts);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+  }
+  TableStats *ts = analyzeTable(ctx, &table);
+  storeStats(ctx, name, ts);
+  RedisModule_ReplicateVerbatim(ctx);
+  replyTableStats(ctx, name, ts);
   return REDISMODULE_OK;
 }
 
@@ -940,11 +7798,23 @@ int ExecCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   const char *arg = RedisModule_StringToChar(argv[1]);
 
   if (strncmp(arg, "select", 6) == 0)
-    return SelectCommand(ctx, argv, argc);
+    return SelectCommandStat(ctx, argv, argc);
   else if (strncmp(arg, "insert", 6) == 0)
-    return InsertCommand(ctx, argv, argc);
+    return InsertCommandStat(ctx, argv, argc);
   else if (strncmp(arg, "delete", 6) == 0)
-    return DeleteCommand(ctx, argv, argc);
+    return DeleteCommandStat(ctx, argv, argc);
+  else if (strncmp(arg, "update", 6) == 0)
+    return UpdateCommandStat(ctx, argv, argc);
+  else if (strncmp(arg, "create", 6) == 0)
+    return CreateCommandStat(ctx, argv, argc);
+  else if (strncmp(arg, "stats", 5) == 0)
+    return StatsCommand(ctx, argv, argc);
+  else if (strncmp(arg, "slowlog", 7) == 0)
+    return SlowlogCommand(ctx, argv, argc);
+  else if (strncmp(arg, "explain", 7) == 0)
+    return ExplainCommand(ctx, argv, argc);
+  else if (strncmp(arg, "analyze", 7) == 0)
+    return AnalyzeCommand(ctx, argv, argc);
   else {
     RedisModule_ReplyWithError(ctx, "parse error");
     return REDISMODULE_ERR;
@@ -959,16 +7829,77 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx) {
   if (RedisModule_Init(ctx, "dbx", 1, REDISMODULE_APIVER_1) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
+  // Register the native table type and choose its filter kernels
+  intFilterInit();
+  foldInit();
+  RedisModuleTypeMethods tm = {
+    .version = REDISMODULE_TYPE_METHOD_VERSION,
+    .rdb_load = colRdbLoad,
+    .rdb_save = colRdbSave,
+    .aof_rewrite = colAofRewrite,
+    .mem_usage = colMemUsage,
+    .digest = colDigest,
+    .free = colFree
+  };
+  ColumnType = RedisModule_CreateDataType(ctx, "dbxcolumn", COLUMN_ENCODING_VERSION, &tm);
+  if (ColumnType == NULL)
+    return REDISMODULE_ERR;
+
+  // The statistics of the analyzed tables
+  RedisModuleTypeMethods sm = {
+    .version = REDISMODULE_TYPE_METHOD_VERSION,
+    .rdb_load = statsRdbLoad,
+    .rdb_save = statsRdbSave,
+    .aof_rewrite = statsAofRewrite,
+    .mem_usage = statsMemUsage,
+    .free = statsFree
+  };
+  StatsType = RedisModule_CreateDataType(ctx, "dbx-stats", STATS_ENCODING_VERSION, &sm);
+  if (StatsType == NULL)
+    return REDISMODULE_ERR;
+
   // Register the command
-  if (RedisModule_CreateCommand(ctx, "dbx.select", SelectCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
+  if (RedisModule_CreateCommand(ctx, "dbx.select", SelectCommandStat, "readonly", 1, 1, 1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "dbx.insert", InsertCommandStat, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "dbx.delete", DeleteCommandStat, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "dbx.update", UpdateCommandStat, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "dbx.create", CreateCommandStat, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "dbx.restore", RestoreCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  // The select over all the masters of a cluster, its arguments have no key
+  if (RedisModule_CreateCommand(ctx, "dbx.cluster", ClusterCommandStat, "readonly", 0, 0, 0) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+  RedisModule_RegisterClusterMessageReceiver(ctx, CLUSTER_MSG_QUERY, onClusterQuery);
+  RedisModule_RegisterClusterMessageReceiver(ctx, CLUSTER_MSG_RESULT, onClusterResult);
+
+  if (RedisModule_CreateCommand(ctx, "dbx.stats", StatsCommand, "readonly", 0, 0, 0) == REDISMODULE_ERR)
+    return REDISMODULE_ERR;
+
+  if (RedisModule_CreateCommand(ctx, "dbx.slowlog", SlowlogCommand, "readonly", 0, 0, 0) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
-  if (RedisModule_CreateCommand(ctx, "dbx.insert", InsertCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+  // The select explained may write into a table or a csv file
+  if (RedisModule_CreateCommand(ctx, "dbx.explain", ExplainCommand, "write deny-oom", 0, 0, 0) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
-  if (RedisModule_CreateCommand(ctx, "dbx.delete", DeleteCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+  if (RedisModule_CreateCommand(ctx, "dbx.analyze", AnalyzeCommand, "write deny-oom", 0, 0, 0) == REDISMODULE_ERR)
     return REDISMODULE_ERR;
 
+  // Rows changed by other commands are applied to the views
+  RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_HASH |
+    REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED, onKeyspaceEvent);
+
   // Register the command
   if (RedisModule_CreateCommand(ctx, "dbx", ExecCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
     return REDISMODULE_ERR;